@@ -60,9 +60,9 @@ public:
      * We will first analytically integrate our means, and Jacobians
      * Then we perform numerical integration for our measurement covariance
      */
-    void feed_IMU(double t_0, double t_1, Eigen::Matrix<double,3,1> w_m_0, Eigen::Matrix<double,3,1> a_m_0,
-                  Eigen::Matrix<double,3,1> w_m_1 = Eigen::Matrix<double,3,1>::Zero(),
-                  Eigen::Matrix<double,3,1> a_m_1 = Eigen::Matrix<double,3,1>::Zero()) {
+    void feed_IMU(double t_0, double t_1, const Eigen::Matrix<double,3,1>& w_m_0, const Eigen::Matrix<double,3,1>& a_m_0,
+                  const Eigen::Matrix<double,3,1>& w_m_1 = Eigen::Matrix<double,3,1>::Zero(),
+                  const Eigen::Matrix<double,3,1>& a_m_1 = Eigen::Matrix<double,3,1>::Zero()) override {
 
 
         // Get time difference
@@ -147,8 +147,8 @@ public:
         Eigen::Matrix<double,3,3> Beta_arg = (delta_t * eye3 + f_3 * w_x + f_4 * w_x_2);
 
         // Matrices that will multiply the a_hat in the update expressions
-        Eigen::MatrixXd H_al = R_tau12k * alpha_arg;
-        Eigen::MatrixXd H_be = R_tau12k * Beta_arg;
+        Eigen::Matrix<double,3,3> H_al = R_tau12k * alpha_arg;
+        Eigen::Matrix<double,3,3> H_be = R_tau12k * Beta_arg;
 
         // Update the measurement means
         alpha_tau += beta_tau * delta_t + H_al * a_hat;
@@ -173,9 +173,9 @@ public:
         H_b -= H_be;
 
         // Derivatives of R_tau12k wrt bias_w entries
-        Eigen::MatrixXd d_R_bw_1 = -R_tau12k * skew_x(J_q * e_1);
-        Eigen::MatrixXd d_R_bw_2 = -R_tau12k * skew_x(J_q * e_2);
-        Eigen::MatrixXd d_R_bw_3 = -R_tau12k * skew_x(J_q * e_3);
+        Eigen::Matrix<double,3,3> d_R_bw_1 = -R_tau12k * skew_x(J_q * e_1);
+        Eigen::Matrix<double,3,3> d_R_bw_2 = -R_tau12k * skew_x(J_q * e_2);
+        Eigen::Matrix<double,3,3> d_R_bw_3 = -R_tau12k * skew_x(J_q * e_3);
 
         // Now compute the gyro bias Jacobian terms
         double df_1_dbw_1;
@@ -271,79 +271,35 @@ public:
 
 
         //Compute covariance (in this implementation, we use RK4)
-        //k1-------------------------------------------------------------------------------------------------
+        //Our state and noise Jacobians are sparse, so we only build their non-zero blocks (see compute_P_dot())
+        Eigen::Matrix<double,15,15> P_dot_k1, P_dot_k2, P_dot_k3, P_dot_k4;
+        Eigen::Matrix<double,15,15> P_k;
 
-        // Build state Jacobian
-        Eigen::Matrix<double, 15, 15> F_k1 = Eigen::Matrix<double, 15, 15>::Zero();
-        F_k1.block(0, 0, 3, 3) = -w_x;
-        F_k1.block(0, 3, 3, 3) = -eye3;
-        F_k1.block(6, 0, 3, 3) = -R_k2tau.transpose() * a_x;
-        F_k1.block(6, 9, 3, 3) = -R_k2tau.transpose();
-        F_k1.block(12, 6, 3, 3) = eye3;
-
-        // Build noise Jacobian
-        Eigen::Matrix<double, 15, 12> G_k1 = Eigen::Matrix<double, 15, 12>::Zero();
-        G_k1.block(0, 0, 3, 3) = -eye3;
-        G_k1.block(3, 3, 3, 3) = eye3;
-        G_k1.block(6, 6, 3, 3) = -R_k2tau.transpose();
-        G_k1.block(9, 9, 3, 3) = eye3;
+        //k1-------------------------------------------------------------------------------------------------
 
         // Get covariance derivative
-        Eigen::Matrix<double, 15, 15> P_dot_k1 = F_k1 * P_meas + P_meas * F_k1.transpose() + G_k1 * Q_c * G_k1.transpose();
-
+        Eigen::Matrix<double,3,3> R_k2tau_T = R_k2tau.transpose();
+        compute_P_dot(w_x, R_k2tau_T, a_x, P_meas, P_dot_k1);
 
         //k2-------------------------------------------------------------------------------------------------
 
-        // Build state Jacobian
-        Eigen::Matrix<double, 15, 15> F_k2 = Eigen::Matrix<double, 15, 15>::Zero();
-        F_k2.block(0, 0, 3, 3) = -w_x;
-        F_k2.block(0, 3, 3, 3) = -eye3;
-        F_k2.block(6, 0, 3, 3) = -R_mid.transpose() * a_x;
-        F_k2.block(6, 9, 3, 3) = -R_mid.transpose();
-        F_k2.block(12, 6, 3, 3) = eye3;
-
-        // Build noise Jacobian
-        Eigen::Matrix<double, 15, 12> G_k2 = Eigen::Matrix<double, 15, 12>::Zero();
-        G_k2.block(0, 0, 3, 3) = -eye3;
-        G_k2.block(3, 3, 3, 3) = eye3;
-        G_k2.block(6, 6, 3, 3) = -R_mid.transpose();
-        G_k2.block(9, 9, 3, 3) = eye3;
-
         // Get covariance derivative
-        Eigen::Matrix<double, 15, 15> P_k2 = P_meas + P_dot_k1 * delta_t / 2.0;
-        Eigen::Matrix<double, 15, 15> P_dot_k2 = F_k2 * P_k2 + P_k2 * F_k2.transpose() + G_k2 * Q_c * G_k2.transpose();
+        Eigen::Matrix<double,3,3> R_mid_T = R_mid.transpose();
+        P_k = P_meas + P_dot_k1 * (delta_t / 2.0);
+        compute_P_dot(w_x, R_mid_T, a_x, P_k, P_dot_k2);
 
         //k3-------------------------------------------------------------------------------------------------
 
         // Our state and noise Jacobians are the same as k2
         // Since k2 and k3 correspond to the same estimates for the midpoint
-        Eigen::Matrix<double, 15, 15> F_k3 = F_k2;
-        Eigen::Matrix<double, 15, 12> G_k3 = G_k2;
-
-        // Get covariance derivative
-        Eigen::Matrix<double, 15, 15> P_k3 = P_meas + P_dot_k2 * delta_t / 2.0;
-        Eigen::Matrix<double, 15, 15> P_dot_k3 = F_k3 * P_k3 + P_k3 * F_k3.transpose() + G_k3 * Q_c * G_k3.transpose();
+        P_k = P_meas + P_dot_k2 * (delta_t / 2.0);
+        compute_P_dot(w_x, R_mid_T, a_x, P_k, P_dot_k3);
 
         //k4-------------------------------------------------------------------------------------------------
 
-        // Build state Jacobian
-        Eigen::Matrix<double, 15, 15> F_k4 = Eigen::Matrix<double, 15, 15>::Zero();
-        F_k4.block(0, 0, 3, 3) = -w_x;
-        F_k4.block(0, 3, 3, 3) = -eye3;
-        F_k4.block(6, 0, 3, 3) = -R_k2tau1.transpose() * a_x;
-        F_k4.block(6, 9, 3, 3) = -R_k2tau1.transpose();
-        F_k4.block(12, 6, 3, 3) = eye3;
-
-        // Build noise Jacobian
-        Eigen::Matrix<double, 15, 12> G_k4 = Eigen::Matrix<double, 15, 12>::Zero();
-        G_k4.block(0, 0, 3, 3) = -eye3;
-        G_k4.block(3, 3, 3, 3) = eye3;
-        G_k4.block(6, 6, 3, 3) = -R_k2tau1.transpose();
-        G_k4.block(9, 9, 3, 3) = eye3;
-
         // Get covariance derivative
-        Eigen::Matrix<double, 15, 15> P_k4 = P_meas + P_dot_k3 * delta_t;
-        Eigen::Matrix<double, 15, 15> P_dot_k4 = F_k4 * P_k4 + P_k4 * F_k4.transpose() + G_k4 * Q_c * G_k4.transpose();
+        P_k = P_meas + P_dot_k3 * delta_t;
+        compute_P_dot(w_x, R_tau12k, a_x, P_k, P_dot_k4);
 
 
         //done-------------------------------------------------------------------------------------------------
@@ -362,6 +318,44 @@ public:
     }
 
 
+protected:
+
+
+    /**
+     * @brief Computes the covariance derivative of our preintegration, P_dot = F*P + P*F^T + G*Q_c*G^T
+     *
+     * Our state Jacobian F only has five non-zero 3x3 blocks, and our noise Jacobian G is block diagonal.
+     * Thus instead of the full 15x15 and 15x12 products we only multiply the blocks that are non-zero.
+     * Since P is symmetric, we also have that P*F^T = (F*P)^T.
+     *
+     * @param w_x Skew of the bias corrected angular velocity
+     * @param R_T Rotation from the current local frame to the start of the interval (R_k2tau^T)
+     * @param a_x Skew of the bias corrected linear acceleration
+     * @param P Current covariance
+     * @param P_dot Covariance derivative
+     */
+    void compute_P_dot(const Eigen::Matrix<double,3,3>& w_x, const Eigen::Matrix<double,3,3>& R_T,
+                       const Eigen::Matrix<double,3,3>& a_x, const Eigen::Matrix<double,15,15>& P,
+                       Eigen::Matrix<double,15,15>& P_dot) const {
+
+        // F*P, with F(0,0) = -w_x, F(0,3) = -I, F(6,0) = -R^T*a_x, F(6,9) = -R^T, F(12,6) = I
+        Eigen::Matrix<double,15,15> FP = Eigen::Matrix<double,15,15>::Zero();
+        FP.block<3,15>(0,0).noalias() = -w_x * P.block<3,15>(0,0);
+        FP.block<3,15>(0,0) -= P.block<3,15>(3,0);
+        FP.block<3,15>(6,0).noalias() = -(R_T * a_x) * P.block<3,15>(0,0);
+        FP.block<3,15>(6,0).noalias() -= R_T * P.block<3,15>(9,0);
+        FP.block<3,15>(12,0) = P.block<3,15>(6,0);
+
+        // G*Q_c*G^T, with G(0,0) = -I, G(3,3) = I, G(6,6) = -R^T, G(9,9) = I
+        P_dot = FP + FP.transpose();
+        P_dot.block<3,3>(0,0) += Q_c.block<3,3>(0,0);
+        P_dot.block<3,3>(3,3) += Q_c.block<3,3>(3,3);
+        P_dot.block<3,3>(6,6).noalias() += R_T * Q_c.block<3,3>(6,6) * R_T.transpose();
+        P_dot.block<3,3>(9,9) += Q_c.block<3,3>(9,9);
+
+    }
+
+
 };
 
 
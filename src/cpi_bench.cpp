@@ -0,0 +1,528 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Eigen>
+
+#include "cpi/CpiBase.h"
+#include "cpi/CpiV1.h"
+#include "utils/colors.h"
+#include "utils/quat_ops.h"
+
+
+/**
+ * @brief Dense CPI preintegration, as CpiV1 was before its fixed-size sparse kernels.
+ *
+ * This is only used as the reference of this benchmark, so we can check that CpiV1 still computes the same thing.
+ */
+class CpiV1Dense: public CpiBase {
+
+public:
+
+    /// Default constructor (see CpiV1)
+    CpiV1Dense(double sigma_w, double sigma_wb, double sigma_a, double sigma_ab, bool imu_avg_= false):
+            CpiBase(sigma_w, sigma_wb, sigma_a, sigma_ab, imu_avg_){}
+
+    /**
+     * @brief Our precompound function for Model 1 using dense matrices everywhere
+     */
+    void feed_IMU(double t_0, double t_1, const Eigen::Matrix<double,3,1>& w_m_0, const Eigen::Matrix<double,3,1>& a_m_0,
+                  const Eigen::Matrix<double,3,1>& w_m_1 = Eigen::Matrix<double,3,1>::Zero(),
+                  const Eigen::Matrix<double,3,1>& a_m_1 = Eigen::Matrix<double,3,1>::Zero()) override {
+
+
+        // Get time difference
+        double delta_t = t_1-t_0;
+        DT += delta_t;
+
+        //If no time has passed do nothing
+        if (delta_t == 0){
+            return;
+        }
+
+        // Get estimated imu readings
+        Eigen::Matrix<double,3,1> w_hat = w_m_0 - b_w_lin;
+        Eigen::Matrix<double,3,1> a_hat = a_m_0 - b_a_lin;
+
+        // If averaging, average
+        if (imu_avg){
+            w_hat += w_m_1- b_w_lin;
+            w_hat = 0.5*w_hat;
+            a_hat += a_m_1- b_a_lin;
+            a_hat = .5*a_hat;
+        }
+
+        // Get angle change w*dt
+        Eigen::Matrix<double,3,1> w_hatdt = w_hat * delta_t;
+
+        // Get entries of w_hat
+        double w_1 = w_hat(0, 0);
+        double w_2 = w_hat(1, 0);
+        double w_3 = w_hat(2, 0);
+
+        // Get magnitude of w and wdt
+        double mag_w = w_hat.norm();
+        double w_dt = mag_w * delta_t;
+
+        // Threshold to determine if equations will be unstable
+        bool small_w = (mag_w < 0.008726646);
+
+        // Get some of the variables used in the preintegration equations
+        double dt_2 = pow(delta_t,2);
+        double cos_wt = cos(w_dt);
+        double sin_wt = sin(w_dt);
+
+        Eigen::Matrix<double,3,3> w_x = skew_x(w_hat);
+        Eigen::Matrix<double,3,3> a_x = skew_x(a_hat);
+        Eigen::Matrix<double,3,3> w_tx = skew_x(w_hatdt);
+        Eigen::Matrix<double,3,3> w_x_2 = w_x * w_x;
+
+
+        //==========================================================================
+        // MEASUREMENT MEANS
+        //==========================================================================
+
+        // Get relative rotation
+        Eigen::Matrix<double,3,3> R_tau2tau1 = small_w?  eye3 - delta_t * w_x + (pow(delta_t, 2) / 2) * w_x_2:
+                                               eye3 - (sin_wt / mag_w) * w_x + ((1.0 - cos_wt) / (pow(mag_w, 2.0))) * w_x_2;
+
+        // Updated rotation and its transpose
+        Eigen::Matrix<double,3,3> R_k2tau1 = R_tau2tau1*R_k2tau;
+        Eigen::Matrix<double,3,3> R_tau12k = R_k2tau1.transpose();
+
+        //Intermediate variables for evaluating the measurement/bias Jacobian update
+        double f_1;
+        double f_2;
+        double f_3;
+        double f_4;
+
+        if (small_w) {
+            f_1 = -(pow(delta_t, 3) / 3);
+            f_2 = (pow(delta_t, 4) / 8);
+            f_3 = -(pow(delta_t, 2) / 2);
+            f_4 = (pow(delta_t, 3) / 6);
+        } else {
+            f_1 = (w_dt * cos_wt - sin_wt) / (pow(mag_w, 3));
+            f_2 = (pow(w_dt, 2) - 2 * cos_wt - 2 * w_dt * sin_wt + 2) / (2 * pow(mag_w, 4));
+            f_3 = -(1 - cos_wt) / pow(mag_w, 2);
+            f_4 = (w_dt - sin_wt) / pow(mag_w, 3);
+        }
+
+        // Compute the main part of our analytical means
+        Eigen::Matrix<double,3,3> alpha_arg = ((dt_2 / 2.0) * eye3 + f_1 * w_x + f_2 * w_x_2);
+        Eigen::Matrix<double,3,3> Beta_arg = (delta_t * eye3 + f_3 * w_x + f_4 * w_x_2);
+
+        // Matrices that will multiply the a_hat in the update expressions
+        Eigen::MatrixXd H_al = R_tau12k * alpha_arg;
+        Eigen::MatrixXd H_be = R_tau12k * Beta_arg;
+
+        // Update the measurement means
+        alpha_tau += beta_tau * delta_t + H_al * a_hat;
+        beta_tau += H_be * a_hat;
+
+
+        //==========================================================================
+        // BIAS JACOBIANS (ANALYTICAL)
+        //==========================================================================
+
+        // Get right Jacobian
+        Eigen::Matrix<double,3,3> J_r_tau1 = small_w? eye3 - .5 * w_tx + (1.0 / 6.0) * w_tx * w_tx:
+                                             eye3 - ((1 - cos_wt) / (pow((w_dt), 2.0))) * w_tx +
+                                             ((w_dt - sin_wt) / (pow(w_dt, 3.0))) * w_tx * w_tx;
+
+        // Update orientation in respect to gyro bias Jacobians
+        J_q = R_tau2tau1 * J_q + J_r_tau1 * delta_t;
+
+        // Update alpha and beta in respect to accel bias Jacobians
+        H_a -= H_al;
+        H_a += delta_t*H_b;
+        H_b -= H_be;
+
+        // Derivatives of R_tau12k wrt bias_w entries
+        Eigen::MatrixXd d_R_bw_1 = -R_tau12k * skew_x(J_q * e_1);
+        Eigen::MatrixXd d_R_bw_2 = -R_tau12k * skew_x(J_q * e_2);
+        Eigen::MatrixXd d_R_bw_3 = -R_tau12k * skew_x(J_q * e_3);
+
+        // Now compute the gyro bias Jacobian terms
+        double df_1_dbw_1;
+        double df_1_dbw_2;
+        double df_1_dbw_3;
+
+        double df_2_dbw_1;
+        double df_2_dbw_2;
+        double df_2_dbw_3;
+
+        double df_3_dbw_1;
+        double df_3_dbw_2;
+        double df_3_dbw_3;
+
+        double df_4_dbw_1;
+        double df_4_dbw_2;
+        double df_4_dbw_3;
+
+        if (small_w) {
+            double df_1_dw_mag = -(pow(delta_t, 5) / 15);
+            df_1_dbw_1 = w_1 * df_1_dw_mag;
+            df_1_dbw_2 = w_2 * df_1_dw_mag;
+            df_1_dbw_3 = w_3 * df_1_dw_mag;
+
+            double df_2_dw_mag = (pow(delta_t, 6) / 72);
+            df_2_dbw_1 = w_1 * df_2_dw_mag;
+            df_2_dbw_2 = w_2 * df_2_dw_mag;
+            df_2_dbw_3 = w_3 * df_2_dw_mag;
+
+            double df_3_dw_mag = -(pow(delta_t, 4) / 12);
+            df_3_dbw_1 = w_1 * df_3_dw_mag;
+            df_3_dbw_2 = w_2 * df_3_dw_mag;
+            df_3_dbw_3 = w_3 * df_3_dw_mag;
+
+            double df_4_dw_mag = (pow(delta_t, 5) / 60);
+            df_4_dbw_1 = w_1 * df_4_dw_mag;
+            df_4_dbw_2 = w_2 * df_4_dw_mag;
+            df_4_dbw_3 = w_3 * df_4_dw_mag;
+        }
+        else {
+            double df_1_dw_mag = (pow(w_dt, 2) * sin_wt - 3 * sin_wt + 3 * w_dt * cos_wt) / pow(mag_w, 5);
+            df_1_dbw_1 = w_1 * df_1_dw_mag;
+            df_1_dbw_2 = w_2 * df_1_dw_mag;
+            df_1_dbw_3 = w_3 * df_1_dw_mag;
+
+
+            double df_2_dw_mag = (pow(w_dt, 2) - 4 * cos_wt - 4 * w_dt * sin_wt + pow(w_dt, 2) * cos_wt + 4) / (pow(mag_w, 6));
+            df_2_dbw_1 = w_1 * df_2_dw_mag;
+            df_2_dbw_2 = w_2 * df_2_dw_mag;
+            df_2_dbw_3 = w_3 * df_2_dw_mag;
+
+            double df_3_dw_mag = (2 * (cos_wt - 1) + w_dt * sin_wt) / (pow(mag_w, 4));
+            df_3_dbw_1 = w_1 * df_3_dw_mag;
+            df_3_dbw_2 = w_2 * df_3_dw_mag;
+            df_3_dbw_3 = w_3 * df_3_dw_mag;
+
+            double df_4_dw_mag = (2 * w_dt + w_dt * cos_wt - 3 * sin_wt) / (pow(mag_w, 5));
+            df_4_dbw_1 = w_1 * df_4_dw_mag;
+            df_4_dbw_2 = w_2 * df_4_dw_mag;
+            df_4_dbw_3 = w_3 * df_4_dw_mag;
+        }
+
+        // Update alpha and beta gyro bias Jacobians
+        J_a += J_b * delta_t;
+        J_a.block(0, 0, 3, 1) += (d_R_bw_1 * alpha_arg + R_tau12k * (df_1_dbw_1 * w_x - f_1 * e_1x +
+                                                                     df_2_dbw_1 * w_x_2 -
+                                                                     f_2 * (e_1x * w_x + w_x * e_1x))) * a_hat;
+        J_a.block(0, 1, 3, 1) += (d_R_bw_2 * alpha_arg + R_tau12k * (df_1_dbw_2 * w_x - f_1 * e_2x +
+                                                                     df_2_dbw_2 * w_x_2 -
+                                                                     f_2 * (e_2x * w_x + w_x * e_2x))) * a_hat;
+        J_a.block(0, 2, 3, 1) += (d_R_bw_3 * alpha_arg + R_tau12k * (df_1_dbw_3 * w_x - f_1 * e_3x +
+                                                                     df_2_dbw_3 * w_x_2 -
+                                                                     f_2 * (e_3x * w_x + w_x * e_3x))) * a_hat;
+        J_b.block(0, 0, 3, 1) += (d_R_bw_1 * Beta_arg + R_tau12k * (df_3_dbw_1 * w_x - f_3 * e_1x +
+                                                                    df_4_dbw_1 * w_x_2 -
+                                                                    f_4 * (e_1x * w_x + w_x * e_1x))) * a_hat;
+        J_b.block(0, 1, 3, 1) += (d_R_bw_2 * Beta_arg + R_tau12k * (df_3_dbw_2 * w_x - f_3 * e_2x +
+                                                                    df_4_dbw_2 * w_x_2 -
+                                                                    f_4 * (e_2x * w_x + w_x * e_2x))) * a_hat;
+        J_b.block(0, 2, 3, 1) += (d_R_bw_3 * Beta_arg + R_tau12k * (df_3_dbw_3 * w_x - f_3 * e_3x +
+                                                                    df_4_dbw_3 * w_x_2 -
+                                                                    f_4 * (e_3x * w_x + w_x * e_3x))) * a_hat;
+
+
+        //==========================================================================
+        // MEASUREMENT COVARIANCE
+        //==========================================================================
+
+        // Going to need orientation at intermediate time i.e. at .5*dt;
+        Eigen::Matrix<double,3,3> R_mid = small_w?  eye3 - .5*delta_t * w_x + (pow(.5*delta_t, 2) / 2) * w_x_2:
+                                          eye3 - (sin(mag_w*.5*delta_t) / mag_w) * w_x + ((1.0 - cos(mag_w*.5*delta_t)) / (pow(mag_w, 2.0))) * w_x_2;
+        R_mid = R_mid*R_k2tau;
+
+
+        //Compute covariance (in this implementation, we use RK4)
+        //k1-------------------------------------------------------------------------------------------------
+
+        // Build state Jacobian
+        Eigen::Matrix<double, 15, 15> F_k1 = Eigen::Matrix<double, 15, 15>::Zero();
+        F_k1.block(0, 0, 3, 3) = -w_x;
+        F_k1.block(0, 3, 3, 3) = -eye3;
+        F_k1.block(6, 0, 3, 3) = -R_k2tau.transpose() * a_x;
+        F_k1.block(6, 9, 3, 3) = -R_k2tau.transpose();
+        F_k1.block(12, 6, 3, 3) = eye3;
+
+        // Build noise Jacobian
+        Eigen::Matrix<double, 15, 12> G_k1 = Eigen::Matrix<double, 15, 12>::Zero();
+        G_k1.block(0, 0, 3, 3) = -eye3;
+        G_k1.block(3, 3, 3, 3) = eye3;
+        G_k1.block(6, 6, 3, 3) = -R_k2tau.transpose();
+        G_k1.block(9, 9, 3, 3) = eye3;
+
+        // Get covariance derivative
+        Eigen::Matrix<double, 15, 15> P_dot_k1 = F_k1 * P_meas + P_meas * F_k1.transpose() + G_k1 * Q_c * G_k1.transpose();
+
+
+        //k2-------------------------------------------------------------------------------------------------
+
+        // Build state Jacobian
+        Eigen::Matrix<double, 15, 15> F_k2 = Eigen::Matrix<double, 15, 15>::Zero();
+        F_k2.block(0, 0, 3, 3) = -w_x;
+        F_k2.block(0, 3, 3, 3) = -eye3;
+        F_k2.block(6, 0, 3, 3) = -R_mid.transpose() * a_x;
+        F_k2.block(6, 9, 3, 3) = -R_mid.transpose();
+        F_k2.block(12, 6, 3, 3) = eye3;
+
+        // Build noise Jacobian
+        Eigen::Matrix<double, 15, 12> G_k2 = Eigen::Matrix<double, 15, 12>::Zero();
+        G_k2.block(0, 0, 3, 3) = -eye3;
+        G_k2.block(3, 3, 3, 3) = eye3;
+        G_k2.block(6, 6, 3, 3) = -R_mid.transpose();
+        G_k2.block(9, 9, 3, 3) = eye3;
+
+        // Get covariance derivative
+        Eigen::Matrix<double, 15, 15> P_k2 = P_meas + P_dot_k1 * delta_t / 2.0;
+        Eigen::Matrix<double, 15, 15> P_dot_k2 = F_k2 * P_k2 + P_k2 * F_k2.transpose() + G_k2 * Q_c * G_k2.transpose();
+
+        //k3-------------------------------------------------------------------------------------------------
+
+        // Our state and noise Jacobians are the same as k2
+        // Since k2 and k3 correspond to the same estimates for the midpoint
+        Eigen::Matrix<double, 15, 15> F_k3 = F_k2;
+        Eigen::Matrix<double, 15, 12> G_k3 = G_k2;
+
+        // Get covariance derivative
+        Eigen::Matrix<double, 15, 15> P_k3 = P_meas + P_dot_k2 * delta_t / 2.0;
+        Eigen::Matrix<double, 15, 15> P_dot_k3 = F_k3 * P_k3 + P_k3 * F_k3.transpose() + G_k3 * Q_c * G_k3.transpose();
+
+        //k4-------------------------------------------------------------------------------------------------
+
+        // Build state Jacobian
+        Eigen::Matrix<double, 15, 15> F_k4 = Eigen::Matrix<double, 15, 15>::Zero();
+        F_k4.block(0, 0, 3, 3) = -w_x;
+        F_k4.block(0, 3, 3, 3) = -eye3;
+        F_k4.block(6, 0, 3, 3) = -R_k2tau1.transpose() * a_x;
+        F_k4.block(6, 9, 3, 3) = -R_k2tau1.transpose();
+        F_k4.block(12, 6, 3, 3) = eye3;
+
+        // Build noise Jacobian
+        Eigen::Matrix<double, 15, 12> G_k4 = Eigen::Matrix<double, 15, 12>::Zero();
+        G_k4.block(0, 0, 3, 3) = -eye3;
+        G_k4.block(3, 3, 3, 3) = eye3;
+        G_k4.block(6, 6, 3, 3) = -R_k2tau1.transpose();
+        G_k4.block(9, 9, 3, 3) = eye3;
+
+        // Get covariance derivative
+        Eigen::Matrix<double, 15, 15> P_k4 = P_meas + P_dot_k3 * delta_t;
+        Eigen::Matrix<double, 15, 15> P_dot_k4 = F_k4 * P_k4 + P_k4 * F_k4.transpose() + G_k4 * Q_c * G_k4.transpose();
+
+
+        //done-------------------------------------------------------------------------------------------------
+
+        // Collect covariance solution
+        // Ensure it is positive definite
+        P_meas += (delta_t / 6.0) * (P_dot_k1 + 2.0 * P_dot_k2 + 2.0 * P_dot_k3 + P_dot_k4);
+        P_meas = 0.5 * (P_meas + P_meas.transpose());
+
+        // Update rotation mean
+        // Note we had to wait to do this, since we use the old orientation in our covariance calculation
+        R_k2tau = R_k2tau1;
+        q_k2tau = rot_2_quat(R_k2tau);
+
+
+    }
+
+};
+
+
+/// Prints the usage of this program
+static void print_usage(const char *name) {
+    printf("usage: %s [options]\n", name);
+    printf("    --duration <double>  seconds of imu data we preintegrate (default: 120)\n");
+    printf("    --imu_rate <double>  rate of the imu (default: 400)\n");
+    printf("    --cam_rate <double>  rate of the intervals we preintegrate over (default: 20)\n");
+    printf("    --repeat <int>       number of times we time each kernel, the fastest is reported (default: 5)\n");
+    printf("    --seed <int>         seed of the random inputs (default: 0)\n");
+    printf("    --tol <double>       largest relative error to the dense version before we fail (default: 1e-12)\n");
+}
+
+
+/**
+ * @brief Preintegrates each interval of our imu readings (the same way the Propagator does)
+ * @param times Time of each imu reading
+ * @param wm Angular velocity of each imu reading
+ * @param am Linear acceleration of each imu reading
+ * @param intervals Index of the first and last imu reading of each interval
+ * @param bg_lin Gyroscope bias we linearize at
+ * @param ba_lin Accelerometer bias we linearize at
+ * @param results Preintegration of each interval
+ */
+template<typename CPI>
+static void preintegrate(const std::vector<double> &times, const std::vector<Eigen::Vector3d> &wm, const std::vector<Eigen::Vector3d> &am,
+                         const std::vector<std::pair<size_t,size_t>> &intervals, const Eigen::Vector3d &bg_lin,
+                         const Eigen::Vector3d &ba_lin, std::vector<CPI> &results) {
+    results.clear();
+    for(const auto &interval : intervals) {
+        CPI integration(1.6968e-04, 1.9393e-05, 2.0000e-3, 3.0000e-03, true);
+        integration.setLinearizationPoints(bg_lin, ba_lin);
+        for(size_t i=interval.first; i<interval.second; i++) {
+            integration.feed_IMU(times.at(i), times.at(i+1), wm.at(i), am.at(i), wm.at(i+1), am.at(i+1));
+        }
+        results.push_back(integration);
+    }
+}
+
+
+/// Largest difference between two matrices, relative to the largest entry of the reference
+template<typename Derived1, typename Derived2>
+static double relative_error(const Eigen::MatrixBase<Derived1> &value, const Eigen::MatrixBase<Derived2> &reference) {
+    double scale = std::max(reference.cwiseAbs().maxCoeff(), 1e-300);
+    return (value-reference).cwiseAbs().maxCoeff()/scale;
+}
+
+
+int main(int argc, char** argv)
+{
+
+    // Our benchmark settings
+    double duration = 120.0;
+    double imu_rate = 400.0;
+    double cam_rate = 20.0;
+    int repeat = 5;
+    int seed = 0;
+    double tol = 1e-12;
+
+    // Parse our command line options
+    for(int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if(i+1 >= argc) {
+            printf(RED "missing value for %s\n" RESET, arg.c_str());
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+        std::string value = argv[++i];
+        if(arg == "--duration") duration = std::stod(value);
+        else if(arg == "--imu_rate") imu_rate = std::stod(value);
+        else if(arg == "--cam_rate") cam_rate = std::stod(value);
+        else if(arg == "--repeat") repeat = std::max(1, std::stoi(value));
+        else if(arg == "--seed") seed = std::stoi(value);
+        else if(arg == "--tol") tol = std::stod(value);
+        else {
+            printf(RED "unknown option %s\n" RESET, arg.c_str());
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    if(duration <= 0 || imu_rate <= 0 || cam_rate <= 0 || cam_rate > imu_rate) {
+        printf(RED "duration and rates need to be positive, and the camera slower than the imu\n" RESET);
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Synthetic imu readings of a body that is still for the first tenth (so we hit the small angle cases), and then moves smoothly
+    // Each reading also has white noise on it, like a real imu
+    std::mt19937 gen(seed);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::uniform_real_distribution<double> phase(0.0, 2.0*M_PI);
+    Eigen::Vector3d phase_w(phase(gen), phase(gen), phase(gen));
+    Eigen::Vector3d phase_a(phase(gen), phase(gen), phase(gen));
+    size_t num_imu = (size_t)(duration*imu_rate)+1;
+    std::vector<double> times(num_imu);
+    std::vector<Eigen::Vector3d> wm(num_imu), am(num_imu);
+    for(size_t i=0; i<num_imu; i++) {
+        double t = (double)i/imu_rate;
+        double scale = (t < 0.1*duration)? 0.0 : 1.0;
+        times.at(i) = 1e9+t;
+        for(int k=0; k<3; k++) {
+            wm.at(i)(k) = scale*0.8*std::sin(0.7*(k+1)*t+phase_w(k)) + 1e-3*noise(gen);
+            am.at(i)(k) = scale*2.0*std::sin(0.5*(k+1)*t+phase_a(k)) + 2e-2*noise(gen);
+        }
+        am.at(i)(2) += 9.81;
+    }
+
+    // Split our readings into the intervals between camera times
+    std::vector<std::pair<size_t,size_t>> intervals;
+    size_t stride = std::max((size_t)1, (size_t)std::round(imu_rate/cam_rate));
+    for(size_t i=0; i+stride<num_imu; i+=stride) {
+        intervals.push_back({i,i+stride});
+    }
+    size_t num_samples = intervals.size()*stride;
+    Eigen::Vector3d bg_lin(1e-3, -2e-3, 5e-4);
+    Eigen::Vector3d ba_lin(2e-2, 1e-2, -3e-2);
+
+    // Time both versions, each over all the intervals
+    std::vector<CpiV1Dense> results_dense;
+    std::vector<CpiV1> results_sparse;
+    double time_dense = INFINITY;
+    double time_sparse = INFINITY;
+    for(int r=0; r<repeat; r++) {
+        auto rT1 = std::chrono::steady_clock::now();
+        preintegrate(times, wm, am, intervals, bg_lin, ba_lin, results_dense);
+        auto rT2 = std::chrono::steady_clock::now();
+        preintegrate(times, wm, am, intervals, bg_lin, ba_lin, results_sparse);
+        auto rT3 = std::chrono::steady_clock::now();
+        time_dense = std::min(time_dense, std::chrono::duration_cast<std::chrono::duration<double>>(rT2-rT1).count());
+        time_sparse = std::min(time_sparse, std::chrono::duration_cast<std::chrono::duration<double>>(rT3-rT2).count());
+    }
+
+    // Largest relative error of each output over all intervals
+    std::vector<std::string> names = {"alpha_tau", "beta_tau", "q_k2tau", "J_q", "J_a", "J_b", "H_a", "H_b", "P_meas"};
+    std::vector<double> errors(names.size(), 0.0);
+    for(size_t i=0; i<intervals.size(); i++) {
+        const CpiV1 &value = results_sparse.at(i);
+        const CpiV1Dense &reference = results_dense.at(i);
+        std::vector<double> error_i = {
+            relative_error(value.alpha_tau, reference.alpha_tau), relative_error(value.beta_tau, reference.beta_tau),
+            relative_error(value.q_k2tau, reference.q_k2tau), relative_error(value.J_q, reference.J_q),
+            relative_error(value.J_a, reference.J_a), relative_error(value.J_b, reference.J_b),
+            relative_error(value.H_a, reference.H_a), relative_error(value.H_b, reference.H_b),
+            relative_error(value.P_meas, reference.P_meas)
+        };
+        for(size_t k=0; k<names.size(); k++) {
+            errors.at(k) = std::max(errors.at(k), error_i.at(k));
+        }
+    }
+
+    // Print a summary, and fail if our kernel does not match the dense version
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "CPI preintegration (%d intervals of %d readings)\n", (int)intervals.size(), (int)stride);
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "%-10s %12s %12s\n" RESET, "kernel", "samples/s", "sec");
+    printf(REDPURPLE "%-10s %12.3e %12.4f\n" RESET, "dense", (double)num_samples/time_dense, time_dense);
+    printf(REDPURPLE "%-10s %12.3e %12.4f\n" RESET, "CpiV1", (double)num_samples/time_sparse, time_sparse);
+    printf(REDPURPLE "speedup: %.2fx\n\n" RESET, time_dense/std::max(time_sparse,1e-12));
+    printf(REDPURPLE "%-10s %12s\n" RESET, "output", "rel_error");
+    bool success = true;
+    for(size_t k=0; k<names.size(); k++) {
+        bool valid = (errors.at(k) <= tol);
+        success = success && valid;
+        printf("%s%-10s %12.2e\n" RESET, valid? REDPURPLE : RED, names.at(k).c_str(), errors.at(k));
+    }
+    if(!success) {
+        printf(RED "[BENCH]: CpiV1 does not match the dense preintegration (tol = %.2e)\n" RESET, tol);
+        return EXIT_FAILURE;
+    }
+
+    // Done!
+    return EXIT_SUCCESS;
+
+}
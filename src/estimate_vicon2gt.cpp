@@ -19,22 +19,113 @@
 
 
 #include <cmath>
+#include <future>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <unistd.h>
 #include <Eigen/Eigen>
+#include <boost/filesystem.hpp>
 
 #include <ros/ros.h>
-#include <rosbag/bag.h>
-#include <rosbag/view.h>
-#include <sensor_msgs/Imu.h>
-#include <nav_msgs/Odometry.h>
-#include <geometry_msgs/PoseStamped.h>
-#include <geometry_msgs/TransformStamped.h>
 
 #include "meas/Propagator.h"
 #include "meas/Interpolator.h"
+#include "meas/MeasCache.h"
 #include "solver/ViconGraphSolver.h"
+#include "solver/ViconGraphVisualizer.h"
+#include "utils/load_rosbag.h"
+#include "utils/parse_ros.h"
+#include "utils/profiler.h"
+
+
+/**
+ * @brief Everything we need to estimate a single body (an IMU rigidly attached to a vicon marker body)
+ *
+ * By default we only have one body, whose parameters are in our private namespace.
+ * Otherwise each name in the "bodies" parameter is a sub-namespace, whose parameters default to the ones of the private namespace.
+ */
+struct BODYJOB {
+
+    /// Name of this body (empty if we only have a single body)
+    std::string name;
+
+    /// Node handle of this body's namespace (its parameters and publishers)
+    ros::NodeHandle nh;
+
+    /// Topics we will load for this body
+    BAGTOPICS topics;
+
+    /// Where we will save the result, and cache the measurements of this body
+    std::string path_states, path_info, path_cache;
+
+    /// If we should always use the manual vicon sigmas
+    bool use_manual_sigmas = false;
+
+    /// If we should use the gravity direction of the first body instead of estimating our own (i.e. same vicon frame)
+    bool share_gravity = false;
+
+    /// Our IMU noise values
+    double sigma_w = 1.6968e-04;
+    double sigma_a = 2.0000e-3;
+    double sigma_wb = 1.9393e-05;
+    double sigma_ab = 3.0000e-03;
+
+    /// If we should store the IMU history in single precision (for long high rate bags)
+    bool imu_compact = false;
+
+    /// Vicon sigmas (used if we don't have odometry messages)
+    std::vector<double> viconsigmas = {1e-4,1e-4,1e-4,1e-5,1e-5,1e-5};
+
+    /// Options of the solver
+    SolverOptions options;
+
+    /// Measurements and the solver of this body
+    MeasCache cache;
+    std::shared_ptr<Propagator> propagator;
+    std::shared_ptr<Interpolator> interpolator;
+    std::vector<double> timestamp_cameras;
+    std::shared_ptr<ViconGraphSolver> solver;
+
+};
+
+
+/**
+ * @brief Loads the parameters of a body from its namespace
+ * @param nh Namespace we will load from
+ * @param defaults Body whose parameters we use for any that are not set
+ * @return Body with its parameters
+ */
+BODYJOB load_body(ros::NodeHandle &nh, const BODYJOB &defaults) {
+    BODYJOB body = defaults;
+    body.nh = nh;
+    nh.param<std::string>("topic_imu", body.topics.topic_imu, defaults.topics.topic_imu);
+    nh.param<std::string>("topic_cam", body.topics.topic_cam, defaults.topics.topic_cam);
+    nh.param<std::string>("topic_vicon", body.topics.topic_vicon, defaults.topics.topic_vicon);
+    nh.param<std::string>("stats_path_states", body.path_states, defaults.path_states);
+    nh.param<std::string>("stats_path_info", body.path_info, defaults.path_info);
+    nh.param<std::string>("path_cache", body.path_cache, defaults.path_cache);
+    nh.param<bool>("use_manual_sigmas", body.use_manual_sigmas, defaults.use_manual_sigmas);
+    nh.param<bool>("share_gravity", body.share_gravity, defaults.share_gravity);
+    nh.param<double>("gyroscope_noise_density", body.sigma_w, defaults.sigma_w);
+    nh.param<double>("accelerometer_noise_density", body.sigma_a, defaults.sigma_a);
+    nh.param<double>("gyroscope_random_walk", body.sigma_wb, defaults.sigma_wb);
+    nh.param<double>("accelerometer_random_walk", body.sigma_ab, defaults.sigma_ab);
+    nh.param<bool>("imu_compact", body.imu_compact, defaults.imu_compact);
+    nh.param<std::vector<double>>("vicon_sigmas", body.viconsigmas, defaults.viconsigmas);
+    body.options = load_solver_options(nh, defaults.options);
+    return body;
+}
+
+
+/**
+ * @brief Inserts the name of a body in front of the file name of a path (e.g. /a/gt_states.csv to /a/<name>_gt_states.csv)
+ */
+std::string path_for_body(const std::string &path, const std::string &name) {
+    boost::filesystem::path p(path);
+    return (p.parent_path()/(name+"_"+p.filename().string())).string();
+}
+
 
 
 int main(int argc, char** argv)
@@ -45,25 +136,25 @@ int main(int argc, char** argv)
     ros::NodeHandle nh("~");
 
     // Load the imu, camera, and vicon topics
-    std::string topic_imu, topic_cam, topic_vicon;
-    nh.param<std::string>("topic_imu", topic_imu, "/imu0");
-    nh.param<std::string>("topic_cam", topic_cam, "/cam0/image_raw");
-    nh.param<std::string>("topic_vicon", topic_vicon, "/vicon/ironsides/odom");
+    BODYJOB body_default;
+    nh.param<std::string>("topic_imu", body_default.topics.topic_imu, "/imu0");
+    nh.param<std::string>("topic_cam", body_default.topics.topic_cam, "/cam0/image_raw");
+    nh.param<std::string>("topic_vicon", body_default.topics.topic_vicon, "/vicon/ironsides/odom");
 
     // Load the bag path
-    bool save2file, use_manual_sigmas;
-    std::string path_to_bag, path_states, path_info;
+    bool save2file;
+    std::string path_to_bag;
     nh.param<std::string>("path_bag", path_to_bag, "bagfile.bag");
-    nh.param<std::string>("stats_path_states", path_states, "gt_states.csv");
-    nh.param<std::string>("stats_path_info", path_info, "vicon2gt_info.txt");
+    nh.param<std::string>("stats_path_states", body_default.path_states, "gt_states.csv");
+    nh.param<std::string>("stats_path_info", body_default.path_info, "vicon2gt_info.txt");
     nh.param<bool>("save2file", save2file, false);
-    nh.param<bool>("use_manual_sigmas", use_manual_sigmas, false);
+    nh.param<bool>("use_manual_sigmas", body_default.use_manual_sigmas, false);
     ROS_INFO("rosbag information...");
     ROS_INFO("    - bag path: %s", path_to_bag.c_str());
-    ROS_INFO("    - state path: %s", path_states.c_str());
-    ROS_INFO("    - info path: %s", path_info.c_str());
+    ROS_INFO("    - state path: %s", body_default.path_states.c_str());
+    ROS_INFO("    - info path: %s", body_default.path_info.c_str());
     ROS_INFO("    - save to file: %d", (int)save2file);
-    ROS_INFO("    - use manual sigmas: %d", (int)use_manual_sigmas);
+    ROS_INFO("    - use manual sigmas: %d", (int)body_default.use_manual_sigmas);
 
     // Get our start location and how much of the bag we want to play
     // Make the bag duration < 0 to just process to the end of the bag
@@ -71,185 +162,216 @@ int main(int argc, char** argv)
     nh.param<double>("bag_start", bag_start, 0);
     nh.param<double>("bag_durr", bag_durr, -1);
 
-
-    //===================================================================================
-    //===================================================================================
-    //===================================================================================
-
-
-    // Load rosbag here, and find messages we can play
-    rosbag::Bag bag;
-    bag.open(path_to_bag, rosbag::bagmode::Read);
-
-    // We should load the bag as a view
-    // Here we go from beginning of the bag to the end of the bag
-    rosbag::View view_full;
-    rosbag::View view;
-
-    // Start a few seconds in from the full view time
-    // If we have a negative duration then use the full bag length
-    view_full.addQuery(bag);
-    ros::Time time_init = view_full.getBeginTime();
-    time_init += ros::Duration(bag_start);
-    ros::Time time_finish = (bag_durr < 0)? view_full.getEndTime() : time_init + ros::Duration(bag_durr);
-    ROS_INFO("loading rosbag into memory...");
-    ROS_INFO("    - time start = %.6f", time_init.toSec());
-    ROS_INFO("    - time end   = %.6f", time_finish.toSec());
-    ROS_INFO("    - duration   = %.2f (secs)", time_finish.toSec()-time_init.toSec());
-    view.addQuery(bag, time_init, time_finish);
-
-    // Check to make sure we have data to play
-    if (view.size() == 0) {
-        ROS_ERROR("No messages to play on specified topics.  Exiting.");
-        ROS_ERROR("IMU TOPIC: %s",topic_imu.c_str());
-        ROS_ERROR("CAM TOPIC: %s",topic_cam.c_str());
-        ROS_ERROR("VIC TOPIC: %s",topic_vicon.c_str());
-        ros::shutdown();
-        return EXIT_FAILURE;
-    }
-
-
-    //===================================================================================
-    //===================================================================================
-    //===================================================================================
+    // If we should cache the parsed measurements (so future runs do not need to re-read the bag)
+    bool use_cache;
+    nh.param<bool>("use_cache", use_cache, false);
+    nh.param<std::string>("path_cache", body_default.path_cache, path_to_bag+".vicon2gt_cache");
+    ROS_INFO("    - use cache: %d", (int)use_cache);
+    ROS_INFO("    - cache path: %s", body_default.path_cache.c_str());
+
+    // If we should profile each stage, and where to save the timeline to (will not save if empty)
+    bool profile;
+    std::string path_profile;
+    nh.param<bool>("profile", profile, false);
+    nh.param<std::string>("path_profile", path_profile, "");
+    ROS_INFO("    - profile: %d", (int)profile);
+    ROS_INFO("    - profile path: %s", path_profile.c_str());
+    Profiler::set_enabled(profile);
 
     // Our IMU noise values
-    double sigma_w,sigma_wb,sigma_a,sigma_ab;
-    nh.param<double>("gyroscope_noise_density", sigma_w, 1.6968e-04);
-    nh.param<double>("accelerometer_noise_density", sigma_a, 2.0000e-3);
-    nh.param<double>("gyroscope_random_walk", sigma_wb, 1.9393e-05);
-    nh.param<double>("accelerometer_random_walk", sigma_ab, 3.0000e-03);
+    nh.param<double>("gyroscope_noise_density", body_default.sigma_w, body_default.sigma_w);
+    nh.param<double>("accelerometer_noise_density", body_default.sigma_a, body_default.sigma_a);
+    nh.param<double>("gyroscope_random_walk", body_default.sigma_wb, body_default.sigma_wb);
+    nh.param<double>("accelerometer_random_walk", body_default.sigma_ab, body_default.sigma_ab);
+    nh.param<bool>("imu_compact", body_default.imu_compact, body_default.imu_compact);
 
     // Vicon sigmas (used if we don't have odometry messages)
-    Eigen::Matrix<double,3,3> R_q = Eigen::Matrix<double,3,3>::Zero();
-    Eigen::Matrix<double,3,3> R_p = Eigen::Matrix<double,3,3>::Zero();
-    std::vector<double> viconsigmas;
-    std::vector<double> viconsigmas_default = {1e-4,1e-4,1e-4,1e-5,1e-5,1e-5};
-    nh.param<std::vector<double>>("vicon_sigmas", viconsigmas, viconsigmas_default);
-    R_q(0,0) = std::pow(viconsigmas.at(0),2);
-    R_q(1,1) = std::pow(viconsigmas.at(1),2);
-    R_q(2,2) = std::pow(viconsigmas.at(2),2);
-    R_p(0,0) = std::pow(viconsigmas.at(3),2);
-    R_p(1,1) = std::pow(viconsigmas.at(4),2);
-    R_p(2,2) = std::pow(viconsigmas.at(5),2);
+    nh.param<std::vector<double>>("vicon_sigmas", body_default.viconsigmas, body_default.viconsigmas);
+    body_default.options = load_solver_options(nh);
+    body_default.nh = nh;
+
+    // Multiple bodies recorded in the same bag, each is a namespace with its own topics and output paths
+    // These all are loaded from the bag at once, and then solved at the same time
+    // Bodies in the same vicon frame can use the gravity direction estimated by the first body
+    std::vector<std::string> names;
+    nh.param<std::vector<std::string>>("bodies", names, std::vector<std::string>());
+    nh.param<bool>("share_gravity", body_default.share_gravity, false);
+    std::vector<BODYJOB> bodies;
+    for(const std::string &name : names) {
+        BODYJOB defaults = body_default;
+        defaults.name = name;
+        defaults.path_states = path_for_body(body_default.path_states, name);
+        defaults.path_info = path_for_body(body_default.path_info, name);
+        defaults.path_cache = body_default.path_cache+"."+name;
+        ros::NodeHandle nh_body(nh, name);
+        bodies.push_back(load_body(nh_body, defaults));
+        ROS_INFO("body %s...", name.c_str());
+        ROS_INFO("    - imu topic: %s", bodies.back().topics.topic_imu.c_str());
+        ROS_INFO("    - cam topic: %s", bodies.back().topics.topic_cam.c_str());
+        ROS_INFO("    - vicon topic: %s", bodies.back().topics.topic_vicon.c_str());
+        ROS_INFO("    - state path: %s", bodies.back().path_states.c_str());
+        ROS_INFO("    - info path: %s", bodies.back().path_info.c_str());
+        ROS_INFO("    - share gravity: %d", (int)(bodies.size() > 1 && bodies.back().share_gravity));
+    }
+    if(bodies.empty()) {
+        bodies.push_back(body_default);
+    }
 
 
     //===================================================================================
     //===================================================================================
     //===================================================================================
 
-    // Our data storage objects
-    std::shared_ptr<Propagator> propagator = std::make_shared<Propagator>(sigma_w,sigma_wb,sigma_a,sigma_ab);
-    std::shared_ptr<Interpolator> interpolator = std::make_shared<Interpolator>();
-    std::vector<double> timestamp_cameras;
-
-    // Counts on how many measurements we have
-    int ct_imu = 0;
-    int ct_cam = 0;
-    int ct_vic = 0;
-
-    // Step through the rosbag
-    for (const rosbag::MessageInstance& m : view) {
-
-        // If ros is wants us to stop, break out
-        if (!ros::ok())
-            break;
-
-        // Handle IMU messages
-        sensor_msgs::Imu::ConstPtr s0 = m.instantiate<sensor_msgs::Imu>();
-        if (s0 != nullptr && m.getTopic() == topic_imu) {
-            Eigen::Matrix<double,3,1> wm, am;
-            wm << s0->angular_velocity.x, s0->angular_velocity.y, s0->angular_velocity.z;
-            am << s0->linear_acceleration.x, s0->linear_acceleration.y, s0->linear_acceleration.z;
-            propagator->feed_imu(s0->header.stamp.toSec(),wm,am);
-            ct_imu++;
+    // Try to load each body from our cache
+    // Its key includes the bag size and modification time so we know if it has changed
+    std::vector<size_t> pending;
+    for(size_t b=0; b<bodies.size(); b++) {
+        BODYJOB &body = bodies.at(b);
+        std::string cache_key = MeasCache::make_key(path_to_bag, body.topics.topic_imu, body.topics.topic_cam,
+                                                    body.topics.topic_vicon, bag_start, bag_durr);
+        if(use_cache && body.cache.load(body.path_cache, cache_key)) {
+            ROS_INFO("loaded measurements from cache %s...", body.path_cache.c_str());
+            continue;
         }
-
-        // Handle CAMEREA messages
-        if (m.getTopic() == topic_cam) {
-            timestamp_cameras.push_back(m.getTime().toSec());
-            ct_cam++;
+        if(use_cache) {
+            ROS_INFO("no valid cache found at %s, will load from the rosbag...", body.path_cache.c_str());
         }
+        pending.push_back(b);
+    }
 
-        // Handle VICON messages
-        nav_msgs::Odometry::ConstPtr s2 = m.instantiate<nav_msgs::Odometry>();
-        if (s2 != nullptr && m.getTopic() == topic_vicon) {
-            // load orientation and position of the vicon
-            Eigen::Matrix<double,4,1> q;
-            Eigen::Matrix<double,3,1> p;
-            q << s2->pose.pose.orientation.x,s2->pose.pose.orientation.y,s2->pose.pose.orientation.z,s2->pose.pose.orientation.w;
-            p << s2->pose.pose.position.x,s2->pose.pose.position.y,s2->pose.pose.position.z;
-            // load the covariance of the pose (order=x,y,z,rx,ry,rz) stored row-major
-            Eigen::Matrix<double,6,6> pose_cov;
-            for(size_t c=0;c<6;c++) {
-                for(size_t r=0;r<6;r++) {
-                    pose_cov(r,c) = s2->pose.covariance[6*c+r];
-                }
-            }
-            // Overwrite if using manual sigmas
-            if(use_manual_sigmas) {
-                pose_cov = Eigen::Matrix<double,6,6>::Zero();
-                pose_cov.block(3,3,3,3) = R_q;
-                pose_cov.block(0,0,3,3) = R_p;
+    // Load all bodies that were not cached from the rosbag at once
+    if(!pending.empty()) {
+        std::vector<BAGTOPICS> topics;
+        for(size_t b : pending) {
+            topics.push_back(bodies.at(b).topics);
+        }
+        std::vector<MeasCache> caches;
+        if(!load_rosbag(path_to_bag, topics, bag_start, bag_durr, caches)) {
+            ros::shutdown();
+            return EXIT_FAILURE;
+        }
+        for(size_t i=0; i<pending.size(); i++) {
+            BODYJOB &body = bodies.at(pending.at(i));
+            body.cache = std::move(caches.at(i));
+            if(use_cache && ros::ok()) {
+                std::string cache_key = MeasCache::make_key(path_to_bag, body.topics.topic_imu, body.topics.topic_cam,
+                                                            body.topics.topic_vicon, bag_start, bag_durr);
+                bool saved = body.cache.save(body.path_cache, cache_key);
+                if(saved) ROS_INFO("saved measurements to cache %s...", body.path_cache.c_str());
+                else ROS_WARN("unable to save the cache to %s", body.path_cache.c_str());
             }
-            //Eigen::Map<Eigen::Matrix<double,6,6,Eigen::RowMajor>> pose_cov(s2->pose.covariance.begin(),36,1);
-            // feed it!
-            interpolator->feed_pose(s2->header.stamp.toSec(),q,p,pose_cov.block(3,3,3,3),pose_cov.block(0,0,3,3));
-            ct_vic++;
         }
+    }
 
-        // Handle VICON messages
-        geometry_msgs::TransformStamped::ConstPtr s3 = m.instantiate<geometry_msgs::TransformStamped>();
-        if (s3 != nullptr && m.getTopic() == topic_vicon) {
-            // load orientation and position of the vicon
-            Eigen::Matrix<double,4,1> q;
-            Eigen::Matrix<double,3,1> p;
-            q << s3->transform.rotation.x,s3->transform.rotation.y,s3->transform.rotation.z,s3->transform.rotation.w;
-            p << s3->transform.translation.x,s3->transform.translation.y,s3->transform.translation.z;
-            // feed it!
-            interpolator->feed_pose(s3->header.stamp.toSec(),q,p,R_q,R_p);
-            ct_vic++;
-        }
 
-        // Handle VICON messages
-        geometry_msgs::PoseStamped::ConstPtr s4 = m.instantiate<geometry_msgs::PoseStamped>();
-        if (s4 != nullptr && m.getTopic() == topic_vicon) {
-            // load orientation and position of the vicon
-            Eigen::Matrix<double,4,1> q;
-            Eigen::Matrix<double,3,1> p;
-            q << s4->pose.orientation.x,s4->pose.orientation.y,s4->pose.orientation.z,s4->pose.orientation.w;
-            p << s4->pose.position.x,s4->pose.position.y,s4->pose.position.z;
-            // feed it!
-            interpolator->feed_pose(s4->header.stamp.toSec(),q,p,R_q,R_p);
-            ct_vic++;
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Each body gets an even share of the cores, since they will be solved at the same time
+    int num_threads = std::max(1, (int)std::thread::hardware_concurrency()/(int)bodies.size());
+    for(BODYJOB &body : bodies) {
+
+        // Vicon sigmas (used if we don't have odometry messages)
+        Eigen::Matrix<double,3,3> R_q = Eigen::Matrix<double,3,3>::Zero();
+        Eigen::Matrix<double,3,3> R_p = Eigen::Matrix<double,3,3>::Zero();
+        R_q(0,0) = std::pow(body.viconsigmas.at(0),2);
+        R_q(1,1) = std::pow(body.viconsigmas.at(1),2);
+        R_q(2,2) = std::pow(body.viconsigmas.at(2),2);
+        R_p(0,0) = std::pow(body.viconsigmas.at(3),2);
+        R_p(1,1) = std::pow(body.viconsigmas.at(4),2);
+        R_p(2,2) = std::pow(body.viconsigmas.at(5),2);
+
+        // Our data storage objects
+        body.propagator = std::make_shared<Propagator>(body.sigma_w,body.sigma_wb,body.sigma_a,body.sigma_ab,body.imu_compact);
+        body.interpolator = std::make_shared<Interpolator>();
+        body.timestamp_cameras = body.cache.cam_times;
+
+        // Feed our IMU and VICON measurements
+        body.cache.feed(*body.propagator, *body.interpolator, R_q, R_p, body.use_manual_sigmas);
+
+        // Counts on how many measurements we have
+        int ct_imu = (int)body.cache.imu_times.size();
+        int ct_cam = (int)body.cache.cam_times.size();
+        int ct_vic = (int)body.cache.vicon_times.size();
+
+        // Print out how many we have loaded
+        ROS_INFO("done loading the rosbag%s%s...", body.name.empty()? "" : " for ", body.name.c_str());
+        ROS_INFO("    - number imu   = %d",ct_imu);
+        ROS_INFO("    - number cam   = %d",ct_cam);
+        ROS_INFO("    - number vicon = %d",ct_vic);
+
+        // Check to make sure we have data to optimize
+        if (ct_imu == 0 || ct_cam == 0 || ct_vic == 0) {
+            ROS_ERROR("Not enough data to optimize with!");
+            ros::shutdown();
+            return EXIT_FAILURE;
         }
 
+        // We no longer need the raw measurements
+        if(body.options.num_threads <= 0)
+            body.options.num_threads = num_threads;
+        body.cache = MeasCache();
 
     }
 
-    // Print out how many we have loaded
-    ROS_INFO("done loading the rosbag...");
-    ROS_INFO("    - number imu   = %d",ct_imu);
-    ROS_INFO("    - number cam   = %d",ct_cam);
-    ROS_INFO("    - number vicon = %d",ct_vic);
+    // Setup our ROS publishers (before solving so subscribers have time to connect)
+    std::vector<std::shared_ptr<ViconGraphVisualizer>> visualizers;
+    for(BODYJOB &body : bodies) {
+        visualizers.push_back(std::make_shared<ViconGraphVisualizer>(body.nh));
+    }
 
-    // Check to make sure we have data to optimize
-    if (ct_imu == 0 || ct_cam == 0 || ct_vic == 0) {
-        ROS_ERROR("Not enough data to optimize with!");
+    // Solve all bodies at the same time
+    // Bodies that share gravity need to wait for the first body, and are then solved with its gravity direction fixed
+    auto solve_bodies = [&](bool followers) {
+        std::vector<std::future<void>> solves;
+        for(size_t b=0; b<bodies.size(); b++) {
+            BODYJOB &body = bodies.at(b);
+            if(followers != (b > 0 && body.share_gravity))
+                continue;
+            if(followers) {
+                double toff;
+                Eigen::Matrix3d R_BtoI;
+                Eigen::Vector3d p_BinI;
+                bodies.at(0).solver->get_calibration(toff, R_BtoI, p_BinI, body.options.init_R_GtoV);
+                body.options.estimate_gravity = false;
+            }
+            body.solver = std::make_shared<ViconGraphSolver>(body.options,body.propagator,body.interpolator,body.timestamp_cameras);
+            body.solver->set_cancel_callback([]() { return !ros::ok(); });
+            solves.push_back(std::async(std::launch::async, [&body]() {
+                body.solver->build_and_solve();
+            }));
+        }
+        for(auto &solve : solves) {
+            solve.get();
+        }
+    };
+    // If any body can not be solved (the solver has already said why), then we stop
+    try {
+        solve_bodies(false);
+        solve_bodies(true);
+    } catch (const std::exception &) {
         ros::shutdown();
         return EXIT_FAILURE;
     }
 
-    // Create the graph problem, and solve it
-    ViconGraphSolver solver(nh,propagator,interpolator,timestamp_cameras);
-    solver.build_and_solve();
-
-    // Visualize onto ROS
-    solver.visualize();
+    // Save to file all the information while we visualize onto ROS
+    std::vector<std::future<void>> writings;
+    for(size_t b=0; b<bodies.size(); b++) {
+        if(save2file) {
+            writings.push_back(bodies.at(b).solver->write_to_file_async(bodies.at(b).path_states,bodies.at(b).path_info));
+        }
+        visualizers.at(b)->visualize(*bodies.at(b).solver);
+    }
+    for(auto &writing : writings) {
+        writing.get();
+    }
 
-    // Finally, save to file all the information
-    if(save2file) {
-        solver.write_to_file(path_states,path_info);
+    // Report where our time went
+    if(profile) {
+        Profiler::print_summary();
+        if(!path_profile.empty())
+            Profiler::write_trace(path_profile);
     }
 
     // Done!
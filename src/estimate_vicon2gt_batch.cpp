@@ -0,0 +1,465 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <Eigen/Eigen>
+#include <boost/filesystem.hpp>
+
+#include <ros/ros.h>
+
+#include "meas/Propagator.h"
+#include "meas/Interpolator.h"
+#include "meas/MeasCache.h"
+#include "solver/ViconGraphSolver.h"
+#include "utils/load_rosbag.h"
+#include "utils/parse_ros.h"
+#include "utils/profiler.h"
+
+
+/// Rough number of bytes each state needs in the graph and optimizer (factors, linearization, and elimination)
+static const double BYTES_PER_STATE = 32.0*1024.0;
+
+/// Rough number of bytes each IMU and vicon measurement needs once loaded
+static const double BYTES_PER_IMU = 3.0*64.0;
+static const double BYTES_PER_VICON = 1024.0;
+
+
+/**
+ * @brief A single bag we will process in our batch
+ */
+struct BAGJOB {
+
+    /// Line of the manifest this job is from
+    int line = 0;
+
+    /// Rosbag settings (see estimate_vicon2gt)
+    std::string path_bag, topic_imu, topic_cam, topic_vicon;
+    double bag_start = 0.0;
+    double bag_durr = -1.0;
+
+    /// Output file locations
+    std::string path_states, path_info;
+
+    /// Measurement cache settings
+    bool use_cache = false;
+    std::string path_cache;
+
+    /// IMU noise (see Propagator)
+    double sigma_w, sigma_wb, sigma_a, sigma_ab;
+
+    /// Vicon noise settings
+    bool use_manual_sigmas = false;
+    Eigen::Matrix<double,3,3> R_q, R_p;
+
+    /// Options for the solver of this bag
+    SolverOptions options;
+
+    /// Size of the bag from its index, and our estimated peak memory usage
+    size_t num_imu = 0, num_cam = 0, num_vicon = 0;
+    double duration = 0.0;
+    double memory_mb = 0.0;
+
+    /// State of this job, and how long each stage took (sec)
+    bool success = false;
+    std::string status = "not run";
+    double time_wait = 0.0;
+    double time_load = 0.0;
+    double time_solve = 0.0;
+    double time_write = 0.0;
+
+};
+
+
+/**
+ * @brief Parses a line of the manifest into a job.
+ *
+ * Each line is a list of `key=value` entries, which override the defaults loaded from the node handler.
+ * A entry without a `=` is treated as the path of the bag.
+ * Supported keys are: path_bag, topic_imu, topic_cam, topic_vicon, bag_start, bag_durr, stats_path_states, stats_path_info,
+ * use_cache, path_cache, use_manual_sigmas, gyroscope_noise_density, accelerometer_noise_density, gyroscope_random_walk,
+ * accelerometer_random_walk, toff_imu_to_vicon, vicon_max_dt, num_loop_relin, chunk_size, keyframe_dt, warm_start_states,
+ * warm_start_info.
+ *
+ * @param line Line of the manifest (without comments)
+ * @param job Job which has its defaults already set
+ * @param error Reason the line could not be parsed
+ * @return False if the line has an unknown key or invalid value
+ */
+bool parse_manifest_line(const std::string &line, BAGJOB &job, std::string &error) {
+    std::istringstream ss(line);
+    std::string token;
+    while(ss >> token) {
+        size_t pos = token.find('=');
+        std::string key = (pos == std::string::npos)? "path_bag" : token.substr(0, pos);
+        std::string value = (pos == std::string::npos)? token : token.substr(pos+1);
+        try {
+            if(key == "path_bag") job.path_bag = value;
+            else if(key == "topic_imu") job.topic_imu = value;
+            else if(key == "topic_cam") job.topic_cam = value;
+            else if(key == "topic_vicon") job.topic_vicon = value;
+            else if(key == "bag_start") job.bag_start = std::stod(value);
+            else if(key == "bag_durr") job.bag_durr = std::stod(value);
+            else if(key == "stats_path_states") job.path_states = value;
+            else if(key == "stats_path_info") job.path_info = value;
+            else if(key == "use_cache") job.use_cache = (value == "true" || value == "1");
+            else if(key == "path_cache") job.path_cache = value;
+            else if(key == "use_manual_sigmas") job.use_manual_sigmas = (value == "true" || value == "1");
+            else if(key == "gyroscope_noise_density") job.sigma_w = std::stod(value);
+            else if(key == "accelerometer_noise_density") job.sigma_a = std::stod(value);
+            else if(key == "gyroscope_random_walk") job.sigma_wb = std::stod(value);
+            else if(key == "accelerometer_random_walk") job.sigma_ab = std::stod(value);
+            else if(key == "toff_imu_to_vicon") job.options.init_toff_imu_to_vicon = std::stod(value);
+            else if(key == "vicon_max_dt") job.options.vicon_max_dt = std::stod(value);
+            else if(key == "num_loop_relin") job.options.num_loop_relin = std::stoi(value);
+            else if(key == "chunk_size") job.options.chunk_size = std::stoi(value);
+            else if(key == "keyframe_dt") job.options.keyframe_dt = std::stod(value);
+            else if(key == "warm_start_states") job.options.warm_start_states = value;
+            else if(key == "warm_start_info") job.options.warm_start_info = value;
+            else {
+                error = "unknown key " + key;
+                return false;
+            }
+        } catch (const std::exception &) {
+            error = "invalid value for " + key + " (" + value + ")";
+            return false;
+        }
+    }
+    if(job.path_bag.empty()) {
+        error = "no bag path";
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Loads, solves, and saves a single bag
+ * @param job Job we will process, will have its timings and status filled
+ */
+void process_job(BAGJOB &job) {
+
+    // Each job is shown on the timeline of the worker that processed it
+    ProfileScope scope("process_job");
+
+    // Load the measurements from the cache or rosbag
+    // If the bag can not be read (e.g. it is corrupt, or we run out of memory), only this job fails
+    auto rT1 = std::chrono::high_resolution_clock::now();
+    std::shared_ptr<Propagator> propagator;
+    std::shared_ptr<Interpolator> interpolator;
+    std::vector<double> timestamp_cameras;
+    try {
+        std::string cache_key = MeasCache::make_key(job.path_bag, job.topic_imu, job.topic_cam, job.topic_vicon, job.bag_start, job.bag_durr);
+        MeasCache cache;
+        bool has_cache = job.use_cache && cache.load(job.path_cache, cache_key);
+        if(!has_cache) {
+            if(!load_rosbag(job.path_bag, job.topic_imu, job.topic_cam, job.topic_vicon, job.bag_start, job.bag_durr, cache)) {
+                job.status = "unable to load messages on topics";
+                return;
+            }
+            if(job.use_cache && ros::ok() && !cache.save(job.path_cache, cache_key)) {
+                ROS_WARN("unable to save the cache to %s", job.path_cache.c_str());
+            }
+        }
+        if(!ros::ok()) {
+            job.status = "cancelled";
+            return;
+        }
+        if(cache.imu_times.empty() || cache.cam_times.empty() || cache.vicon_times.empty()) {
+            job.status = "not enough data";
+            return;
+        }
+
+        // Our data storage objects
+        propagator = std::make_shared<Propagator>(job.sigma_w, job.sigma_wb, job.sigma_a, job.sigma_ab);
+        interpolator = std::make_shared<Interpolator>();
+        cache.feed(*propagator, *interpolator, job.R_q, job.R_p, job.use_manual_sigmas);
+        timestamp_cameras = cache.cam_times;
+    } catch (const std::exception &e) {
+        job.time_load = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now()-rT1).count();
+        job.status = std::string("failed: ")+e.what();
+        return;
+    }
+    auto rT2 = std::chrono::high_resolution_clock::now();
+    job.time_load = std::chrono::duration_cast<std::chrono::duration<double>>(rT2-rT1).count();
+
+    // Create the graph problem, and solve it
+    // If this bag can not be solved (e.g. invalid options or no camera times in the imu range), only this job fails
+    try {
+        ViconGraphSolver solver(job.options, propagator, interpolator, timestamp_cameras);
+        solver.set_cancel_callback([]() { return !ros::ok(); });
+        solver.build_and_solve();
+        if(!ros::ok()) {
+            job.status = "cancelled";
+            return;
+        }
+        auto rT3 = std::chrono::high_resolution_clock::now();
+        job.time_solve = std::chrono::duration_cast<std::chrono::duration<double>>(rT3-rT2).count();
+
+        // Finally, save to file all the information
+        solver.write_to_file(job.path_states, job.path_info);
+        auto rT4 = std::chrono::high_resolution_clock::now();
+        job.time_write = std::chrono::duration_cast<std::chrono::duration<double>>(rT4-rT3).count();
+    } catch (const std::exception &e) {
+        job.time_solve = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now()-rT2).count();
+        job.status = std::string("failed: ")+e.what();
+        return;
+    }
+
+    // Done!
+    job.success = true;
+    job.status = "success";
+
+}
+
+
+int main(int argc, char** argv)
+{
+
+    // Start up
+    ros::init(argc, argv, "estimate_vicon2gt_batch");
+    ros::NodeHandle nh("~");
+
+    // Batch settings
+    int num_workers;
+    double memory_budget_mb;
+    std::string path_manifest, path_timings;
+    nh.param<std::string>("path_manifest", path_manifest, "manifest.txt");
+    nh.param<std::string>("path_timings", path_timings, "vicon2gt_batch_timings.txt");
+    nh.param<int>("batch_num_workers", num_workers, 2);
+    nh.param<double>("batch_memory_mb", memory_budget_mb, 0.0);
+    num_workers = std::max(1, num_workers);
+    ROS_INFO("batch information...");
+    ROS_INFO("    - manifest path: %s", path_manifest.c_str());
+    ROS_INFO("    - timings path: %s", path_timings.c_str());
+    ROS_INFO("    - number workers: %d", num_workers);
+    ROS_INFO("    - memory budget: %.1f MB (zero is unlimited)", memory_budget_mb);
+
+    // If we should profile each stage, and where to save the timeline to (will not save if empty)
+    bool profile;
+    std::string path_profile;
+    nh.param<bool>("profile", profile, false);
+    nh.param<std::string>("path_profile", path_profile, "");
+    ROS_INFO("    - profile: %d", (int)profile);
+    ROS_INFO("    - profile path: %s", path_profile.c_str());
+    Profiler::set_enabled(profile);
+
+    // Default settings of each job, these are the same parameters as estimate_vicon2gt
+    BAGJOB job_default;
+    nh.param<std::string>("topic_imu", job_default.topic_imu, "/imu0");
+    nh.param<std::string>("topic_cam", job_default.topic_cam, "/cam0/image_raw");
+    nh.param<std::string>("topic_vicon", job_default.topic_vicon, "/vicon/ironsides/odom");
+    nh.param<double>("bag_start", job_default.bag_start, 0);
+    nh.param<double>("bag_durr", job_default.bag_durr, -1);
+    nh.param<bool>("use_cache", job_default.use_cache, false);
+    nh.param<bool>("use_manual_sigmas", job_default.use_manual_sigmas, false);
+    nh.param<double>("gyroscope_noise_density", job_default.sigma_w, 1.6968e-04);
+    nh.param<double>("accelerometer_noise_density", job_default.sigma_a, 2.0000e-3);
+    nh.param<double>("gyroscope_random_walk", job_default.sigma_wb, 1.9393e-05);
+    nh.param<double>("accelerometer_random_walk", job_default.sigma_ab, 3.0000e-03);
+    std::vector<double> viconsigmas;
+    std::vector<double> viconsigmas_default = {1e-4,1e-4,1e-4,1e-5,1e-5,1e-5};
+    nh.param<std::vector<double>>("vicon_sigmas", viconsigmas, viconsigmas_default);
+    job_default.R_q = Eigen::Matrix<double,3,3>::Zero();
+    job_default.R_p = Eigen::Matrix<double,3,3>::Zero();
+    job_default.R_q(0,0) = std::pow(viconsigmas.at(0),2);
+    job_default.R_q(1,1) = std::pow(viconsigmas.at(1),2);
+    job_default.R_q(2,2) = std::pow(viconsigmas.at(2),2);
+    job_default.R_p(0,0) = std::pow(viconsigmas.at(3),2);
+    job_default.R_p(1,1) = std::pow(viconsigmas.at(4),2);
+    job_default.R_p(2,2) = std::pow(viconsigmas.at(5),2);
+    job_default.options = load_solver_options(nh);
+
+    // If the number of solver threads is not set, then split our cores between the workers
+    if(job_default.options.num_threads <= 0) {
+        job_default.options.num_threads = std::max(1, (int)std::thread::hardware_concurrency()/num_workers);
+    }
+
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Load our manifest, each line is a bag
+    std::ifstream file(path_manifest);
+    if(!file.is_open()) {
+        ROS_ERROR("unable to open the manifest %s", path_manifest.c_str());
+        return EXIT_FAILURE;
+    }
+    std::vector<BAGJOB> jobs;
+    std::string line;
+    int line_num = 0;
+    while(std::getline(file, line)) {
+        line_num++;
+        line = line.substr(0, line.find('#'));
+        if(line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        BAGJOB job = job_default;
+        job.line = line_num;
+        std::string error;
+        if(!parse_manifest_line(line, job, error)) {
+            ROS_ERROR("manifest line %d: %s", line_num, error.c_str());
+            return EXIT_FAILURE;
+        }
+        // Default outputs are next to the bag, so each bag gets its own
+        std::string path_base = (boost::filesystem::path(job.path_bag).parent_path() / boost::filesystem::path(job.path_bag).stem()).string();
+        if(job.path_states.empty()) job.path_states = path_base + "_gt_states.csv";
+        if(job.path_info.empty()) job.path_info = path_base + "_vicon2gt_info.txt";
+        if(job.path_cache.empty()) job.path_cache = job.path_bag + ".vicon2gt_cache";
+        jobs.push_back(job);
+    }
+    file.close();
+    ROS_INFO("loaded %d bags from the manifest", (int)jobs.size());
+
+    // Get the size of each bag from its index, and estimate how much memory it will need
+    // If we are chunking, then only a chunk per solver thread is in memory at once
+    std::vector<size_t> pending;
+    for(size_t i=0; i<jobs.size(); i++) {
+        BAGJOB &job = jobs.at(i);
+        if(!get_rosbag_info(job.path_bag, job.topic_imu, job.topic_cam, job.topic_vicon, job.bag_start, job.bag_durr,
+                            job.num_imu, job.num_cam, job.num_vicon, job.duration)) {
+            job.status = "unable to open bag";
+            continue;
+        }
+        double num_states = (double)job.num_cam;
+        if(job.options.chunk_size > 0) {
+            num_states = std::min(num_states, (double)job.options.chunk_size*job.options.num_threads);
+        }
+        job.memory_mb = (BYTES_PER_STATE*num_states + BYTES_PER_IMU*job.num_imu + BYTES_PER_VICON*job.num_vicon)/(1024.0*1024.0);
+        pending.push_back(i);
+        ROS_INFO("    - %s: %.1f sec, %d cam, %d imu, %d vicon, %.1f MB estimated", job.path_bag.c_str(), job.duration,
+                 (int)job.num_cam, (int)job.num_imu, (int)job.num_vicon, job.memory_mb);
+    }
+
+    // Longest bags are processed first, so the shorter ones can fill in around them at the end
+    std::stable_sort(pending.begin(), pending.end(), [&](size_t a, size_t b) {
+        return jobs.at(a).duration > jobs.at(b).duration;
+    });
+
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Each worker takes the first pending job which fits in our memory budget
+    // If nothing is running, then we always take the next job (even if it is over the budget by itself)
+    std::mutex mtx;
+    std::condition_variable cv;
+    double memory_in_use = 0.0;
+    int num_running = 0;
+    int num_done = 0;
+    auto time_start = std::chrono::high_resolution_clock::now();
+    auto worker = [&]() {
+        while(ros::ok()) {
+
+            // Wait until we have a job we can admit
+            std::unique_lock<std::mutex> lck(mtx);
+            auto rT0 = std::chrono::high_resolution_clock::now();
+            size_t idx = jobs.size();
+            while(ros::ok() && !pending.empty()) {
+                for(size_t k=0; k<pending.size(); k++) {
+                    double memory_mb = jobs.at(pending.at(k)).memory_mb;
+                    if(num_running == 0 || memory_budget_mb <= 0.0 || memory_in_use+memory_mb <= memory_budget_mb) {
+                        idx = pending.at(k);
+                        pending.erase(pending.begin()+k);
+                        break;
+                    }
+                }
+                if(idx < jobs.size())
+                    break;
+                cv.wait_for(lck, std::chrono::milliseconds(100));
+            }
+            if(idx >= jobs.size())
+                break;
+            BAGJOB &job = jobs.at(idx);
+            memory_in_use += job.memory_mb;
+            num_running++;
+            job.time_wait = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now()-rT0).count();
+            ROS_INFO("[BATCH]: starting %s (%.1f MB estimated, %.1f MB in use)", job.path_bag.c_str(), job.memory_mb, memory_in_use);
+            lck.unlock();
+
+            // Process it!
+            process_job(job);
+
+            // Release its memory so other jobs can start
+            lck.lock();
+            memory_in_use -= job.memory_mb;
+            num_running--;
+            num_done++;
+            ROS_INFO("[BATCH]: %s %s (load %.2f | solve %.2f | write %.2f sec) (%d of %d)", job.path_bag.c_str(), job.status.c_str(),
+                     job.time_load, job.time_solve, job.time_write, num_done, (int)jobs.size());
+            cv.notify_all();
+
+        }
+    };
+    std::vector<std::thread> threads;
+    for(int i=0; i<num_workers; i++) {
+        threads.emplace_back(worker);
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+    double time_total = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now()-time_start).count();
+
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Save the timings of every bag to file (in the order of the manifest)
+    boost::filesystem::path p1(path_timings);
+    if(!p1.parent_path().empty())
+        boost::filesystem::create_directories(p1.parent_path());
+    std::ofstream of_timings(path_timings, std::ofstream::out | std::ofstream::trunc);
+    if(!of_timings.is_open()) {
+        ROS_ERROR("unable to open the timings file %s", path_timings.c_str());
+        return EXIT_FAILURE;
+    }
+    of_timings << "# line path_bag status duration(s) num_cam memory_mb(est) wait(s) load(s) solve(s) write(s) total(s)" << std::endl;
+    int num_success = 0;
+    for(const BAGJOB &job : jobs) {
+        num_success += (int)job.success;
+        of_timings << std::fixed << std::setprecision(3) << job.line << " " << job.path_bag << " \"" << job.status << "\" "
+                   << job.duration << " " << job.num_cam << " " << job.memory_mb << " " << job.time_wait << " "
+                   << job.time_load << " " << job.time_solve << " " << job.time_write << " "
+                   << job.time_load+job.time_solve+job.time_write << std::endl;
+    }
+    of_timings << "# total wall time " << time_total << " sec" << std::endl;
+    of_timings.close();
+    ROS_INFO("\u001b[34m[BATCH]: %d of %d bags succeeded in %.2f sec\u001b[0m", num_success, (int)jobs.size(), time_total);
+
+    // Report where our time went (summed over all bags)
+    if(profile) {
+        Profiler::print_summary();
+        if(!path_profile.empty())
+            Profiler::write_trace(path_profile);
+    }
+
+    // Done!
+    return (num_success == (int)jobs.size())? EXIT_SUCCESS : EXIT_FAILURE;
+
+}
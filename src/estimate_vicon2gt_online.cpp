@@ -0,0 +1,322 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <boost/filesystem.hpp>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <topic_tools/shape_shifter.h>
+
+#include "meas/Propagator.h"
+#include "meas/Interpolator.h"
+#include "meas/MeasCache.h"
+#include "solver/StateWriter.h"
+#include "solver/ViconGraphSolver.h"
+#include "utils/load_rosbag.h"
+#include "utils/parse_ros.h"
+#include "utils/profiler.h"
+
+
+/**
+ * @brief Streams the measurements of a single body into our fixed-lag solve (see ViconGraphSolver::stream_update())
+ *
+ * Measurements are buffered as they arrive, and fed into the solver once we have a window of camera times that the imu and vicon cover.
+ * Each time states leave the lag of the solver, they are appended to the state file.
+ * Thus the states are written about a lag behind the recording, and we only ever hold the measurements within the lag.
+ */
+struct STREAMJOB {
+
+    /// Where we will save the result
+    std::string path_states, path_info;
+
+    /// Vicon sigmas (used if we don't have odometry messages, or always if we use manual sigmas)
+    Eigen::Matrix<double,3,3> R_q, R_p;
+    bool use_manual_sigmas = false;
+
+    /// How long we wait for all measurements of a time to arrive (sec)
+    double stream_delay = 2.0;
+
+    /// Measurements that have not been given to the solver yet
+    MeasCache cache;
+
+    /// Measurements and the solver
+    std::shared_ptr<Propagator> propagator;
+    std::shared_ptr<Interpolator> interpolator;
+    std::shared_ptr<ViconGraphSolver> solver;
+    SolverOptions options;
+
+    /// Newest imu and vicon time we have been given
+    double time_imu = -INFINITY;
+    double time_vicon = -INFINITY;
+
+    /// Number of states we have written
+    size_t num_written = 0;
+
+};
+
+
+/**
+ * @brief Gives our buffered measurements to the solver once we have a full window of camera times that they cover
+ * @param job Body we are estimating
+ * @param finished If we will not get any more measurements, thus all buffered camera times should be added
+ */
+void process_stream(STREAMJOB &job, bool finished) {
+
+    // Camera times (in the imu clock) that should have all of their imu and vicon by now
+    // Vicon times are moved into the imu clock with our initial time offset, the delay covers how much it can change
+    double time_ready = std::min(job.time_imu, job.time_vicon+job.options.init_toff_imu_to_vicon)-job.stream_delay;
+    if(finished)
+        time_ready = INFINITY;
+    std::vector<double> &cam_times = job.cache.cam_times;
+    if(!finished && (cam_times.empty() || time_ready < cam_times.front()+job.options.stream_window))
+        return;
+
+    // Feed our new measurements, and hand off all camera times that are ready
+    std::sort(cam_times.begin(), cam_times.end());
+    job.cache.feed(*job.propagator, *job.interpolator, job.R_q, job.R_p, job.use_manual_sigmas);
+    auto it = std::upper_bound(cam_times.begin(), cam_times.end(), time_ready);
+    std::vector<double> timestamps(cam_times.begin(), it);
+    std::vector<double> cam_waiting(it, cam_times.end());
+    job.cache = MeasCache();
+    job.cache.cam_times = cam_waiting;
+
+    // Update our solve, and write all states that are now final
+    // Vicon poses older than any factor still in the solve needs are then no longer needed
+    std::vector<StateWriter::STATEROW> rows;
+    job.solver->stream_update(timestamps, rows);
+    if(finished)
+        job.solver->stream_finish(rows);
+    if(!rows.empty() && !StateWriter::append_csv(job.path_states, rows))
+        ROS_ERROR("unable to write states to %s", job.path_states.c_str());
+    job.interpolator->clean_older_than(job.solver->stream_oldest_vicon());
+    job.num_written += rows.size();
+    ROS_INFO("added %d camera times, %d states written (%d camera times waiting)",
+             (int)timestamps.size(), (int)job.num_written, (int)cam_waiting.size());
+
+}
+
+
+
+int main(int argc, char** argv)
+{
+
+    // Start up
+    ros::init(argc, argv, "estimate_vicon2gt_online");
+    ros::NodeHandle nh("~");
+
+    // Load the imu, camera, and vicon topics
+    std::string topic_imu, topic_cam, topic_vicon;
+    nh.param<std::string>("topic_imu", topic_imu, "/imu0");
+    nh.param<std::string>("topic_cam", topic_cam, "/cam0/image_raw");
+    nh.param<std::string>("topic_vicon", topic_vicon, "/vicon/ironsides/odom");
+
+    // Load the bag path, if it is empty then we subscribe to the topics while they are recorded
+    STREAMJOB job;
+    std::string path_to_bag;
+    nh.param<std::string>("path_bag", path_to_bag, "");
+    nh.param<std::string>("stats_path_states", job.path_states, "gt_states.csv");
+    nh.param<std::string>("stats_path_info", job.path_info, "vicon2gt_info.txt");
+    nh.param<bool>("use_manual_sigmas", job.use_manual_sigmas, false);
+    nh.param<double>("stream_delay", job.stream_delay, job.stream_delay);
+    ROS_INFO("stream information...");
+    ROS_INFO("    - bag path: %s", path_to_bag.empty()? "(subscribing to topics)" : path_to_bag.c_str());
+    ROS_INFO("    - state path: %s", job.path_states.c_str());
+    ROS_INFO("    - info path: %s", job.path_info.c_str());
+    ROS_INFO("    - use manual sigmas: %d", (int)job.use_manual_sigmas);
+    ROS_INFO("    - stream delay: %.2f", job.stream_delay);
+
+    // Get our start location and how much of the bag we want to play
+    // Make the bag duration < 0 to just process to the end of the bag
+    double bag_start, bag_durr;
+    nh.param<double>("bag_start", bag_start, 0);
+    nh.param<double>("bag_durr", bag_durr, -1);
+
+    // If we should profile each stage, and where to save the timeline to (will not save if empty)
+    bool profile;
+    std::string path_profile;
+    nh.param<bool>("profile", profile, false);
+    nh.param<std::string>("path_profile", path_profile, "");
+    Profiler::set_enabled(profile);
+
+    // Our IMU noise values
+    double sigma_w, sigma_a, sigma_wb, sigma_ab;
+    bool imu_compact;
+    nh.param<double>("gyroscope_noise_density", sigma_w, 1.6968e-04);
+    nh.param<double>("accelerometer_noise_density", sigma_a, 2.0000e-3);
+    nh.param<double>("gyroscope_random_walk", sigma_wb, 1.9393e-05);
+    nh.param<double>("accelerometer_random_walk", sigma_ab, 3.0000e-03);
+    nh.param<bool>("imu_compact", imu_compact, false);
+
+    // Vicon sigmas (used if we don't have odometry messages)
+    std::vector<double> viconsigmas;
+    std::vector<double> viconsigmas_default = {1e-4,1e-4,1e-4,1e-5,1e-5,1e-5};
+    nh.param<std::vector<double>>("vicon_sigmas", viconsigmas, viconsigmas_default);
+    job.R_q = Eigen::Matrix<double,3,3>::Zero();
+    job.R_p = Eigen::Matrix<double,3,3>::Zero();
+    job.R_q(0,0) = std::pow(viconsigmas.at(0),2);
+    job.R_q(1,1) = std::pow(viconsigmas.at(1),2);
+    job.R_q(2,2) = std::pow(viconsigmas.at(2),2);
+    job.R_p(0,0) = std::pow(viconsigmas.at(3),2);
+    job.R_p(1,1) = std::pow(viconsigmas.at(4),2);
+    job.R_p(2,2) = std::pow(viconsigmas.at(5),2);
+
+    // Create our solver, note that we do not give it a cancel callback
+    // When we are stopped we still want to finish the states we have, which needs all of their imu factors
+    job.options = load_solver_options(nh);
+    if(job.options.num_threads <= 0)
+        job.options.num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    job.propagator = std::make_shared<Propagator>(sigma_w,sigma_wb,sigma_a,sigma_ab,imu_compact);
+    job.interpolator = std::make_shared<Interpolator>();
+    try {
+        job.solver = std::make_shared<ViconGraphSolver>(job.options,job.propagator,job.interpolator,std::vector<double>());
+    } catch (const std::exception &) {
+        ros::shutdown();
+        return EXIT_FAILURE;
+    }
+
+    // We append to our state file as states are finalized, so remove the result of any previous run
+    boost::filesystem::create_directories(boost::filesystem::path(job.path_states).parent_path());
+    boost::filesystem::create_directories(boost::filesystem::path(job.path_info).parent_path());
+    std::remove(job.path_states.c_str());
+    std::remove(job.path_info.c_str());
+
+
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Handlers of each type of measurement, which buffer them until we process the next window
+    MeasCache &cache = job.cache;
+    auto handle_imu = [&](const sensor_msgs::Imu &msg) {
+        Eigen::Matrix<double,3,1> wm, am;
+        wm << msg.angular_velocity.x, msg.angular_velocity.y, msg.angular_velocity.z;
+        am << msg.linear_acceleration.x, msg.linear_acceleration.y, msg.linear_acceleration.z;
+        cache.imu_times.push_back(msg.header.stamp.toSec());
+        cache.imu_wm.push_back(wm);
+        cache.imu_am.push_back(am);
+        job.time_imu = std::max(job.time_imu, msg.header.stamp.toSec());
+    };
+    auto handle_vicon = [&](double timestamp, const Eigen::Matrix<double,4,1> &q, const Eigen::Matrix<double,3,1> &p,
+                            const Eigen::Matrix<double,6,6> &pose_cov, bool has_cov) {
+        cache.vicon_times.push_back(timestamp);
+        cache.vicon_q.push_back(q);
+        cache.vicon_p.push_back(p);
+        cache.vicon_cov.push_back(pose_cov);
+        cache.vicon_has_cov.push_back((uint8_t)has_cov);
+        job.time_vicon = std::max(job.time_vicon, timestamp);
+    };
+
+    // Any failure of the solver (it has already said why) stops us
+    try {
+
+        // Read all of our topics from the bag in time order, as if they were arriving while recording
+        // Like the offline tool, camera times are the time each message was recorded at
+        if(!path_to_bag.empty()) {
+            rosbag::Bag bag;
+            bag.open(path_to_bag, rosbag::bagmode::Read);
+            rosbag::View view_full(bag);
+            ros::Time time_init = view_full.getBeginTime()+ros::Duration(bag_start);
+            ros::Time time_finish = (bag_durr < 0)? view_full.getEndTime() : time_init+ros::Duration(bag_durr);
+            rosbag::View view(bag, rosbag::TopicQuery(std::vector<std::string>{topic_imu, topic_cam, topic_vicon}), time_init, time_finish);
+            ROS_INFO("streaming %d messages from the rosbag...", (int)view.size());
+            for (const rosbag::MessageInstance& m : view) {
+                if (!ros::ok())
+                    break;
+                if (m.getTopic() == topic_cam) {
+                    cache.cam_times.push_back(m.getTime().toSec());
+                } else if (m.getTopic() == topic_imu) {
+                    sensor_msgs::Imu::ConstPtr s0 = m.instantiate<sensor_msgs::Imu>();
+                    if (s0 != nullptr)
+                        handle_imu(*s0);
+                } else {
+                    double timestamp;
+                    Eigen::Matrix<double,4,1> q;
+                    Eigen::Matrix<double,3,1> p;
+                    Eigen::Matrix<double,6,6> pose_cov = Eigen::Matrix<double,6,6>::Zero();
+                    bool has_cov = false;
+                    if (parse_vicon_message(m, timestamp, q, p, pose_cov, has_cov))
+                        handle_vicon(timestamp, q, p, pose_cov, has_cov);
+                }
+                process_stream(job, false);
+            }
+            bag.close();
+        }
+
+        // Else subscribe to the topics, camera times are the time we receive each message
+        // We do not need to decode the images or vicon messages until we know their type, so these are not typed
+        else {
+            ros::NodeHandle nh_topics;
+            ros::Subscriber sub_imu = nh_topics.subscribe<sensor_msgs::Imu>(topic_imu, 10000,
+                    [&](const sensor_msgs::Imu::ConstPtr &msg) { handle_imu(*msg); });
+            ros::Subscriber sub_cam = nh_topics.subscribe<topic_tools::ShapeShifter>(topic_cam, 100,
+                    [&](const topic_tools::ShapeShifter::ConstPtr &) { cache.cam_times.push_back(ros::Time::now().toSec()); });
+            ros::Subscriber sub_vicon = nh_topics.subscribe<topic_tools::ShapeShifter>(topic_vicon, 1000,
+                    [&](const topic_tools::ShapeShifter::ConstPtr &msg) {
+                double timestamp;
+                Eigen::Matrix<double,4,1> q;
+                Eigen::Matrix<double,3,1> p;
+                Eigen::Matrix<double,6,6> pose_cov = Eigen::Matrix<double,6,6>::Zero();
+                bool has_cov = false;
+                if (parse_vicon_message(*msg, timestamp, q, p, pose_cov, has_cov))
+                    handle_vicon(timestamp, q, p, pose_cov, has_cov);
+            });
+            ROS_INFO("waiting for measurements (stop the node to finish the solve)...");
+            ros::Rate rate(100);
+            while (ros::ok()) {
+                ros::spinOnce();
+                process_stream(job, false);
+                rate.sleep();
+            }
+        }
+
+        // We will not get any more measurements, so add the rest and write all states we have left
+        process_stream(job, true);
+        if(job.num_written == 0) {
+            ROS_ERROR("Not enough data to optimize with!");
+            return EXIT_FAILURE;
+        }
+        job.solver->write_info_to_file(job.path_info);
+
+    } catch (const rosbag::BagException &e) {
+        ROS_ERROR("unable to read the rosbag %s: %s", path_to_bag.c_str(), e.what());
+        return EXIT_FAILURE;
+    } catch (const std::exception &) {
+        return EXIT_FAILURE;
+    }
+    ROS_INFO("done, wrote %d states to %s", (int)job.num_written, job.path_states.c_str());
+
+    // Report where our time went
+    if(profile) {
+        Profiler::print_summary();
+        if(!path_profile.empty())
+            Profiler::write_trace(path_profile);
+    }
+
+    // Done!
+    return EXIT_SUCCESS;
+}
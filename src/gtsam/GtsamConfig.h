@@ -25,9 +25,9 @@
 /**
  * @brief Configuration object that informs the factors if they need to compute Jacobians.
  *
- * For some reason GTSAM doesn't seem to support "fixing" of variables, thus we would need to make a bunch of factors.
- * We instead will always add calibration factors to the graph (which might make it slower), but then just zero the Jacobians.
- * Zero'ing the Jacobians in respect to the calibration will allow them to remain the same (i.e. the factors are not a function of).
+ * GTSAM doesn't support "fixing" of variables, thus we have factor variants that hold the fixed calibration as constants.
+ * The solver uses these (MeasBased_ViconPoseFixedCalibFactor and ImuFactorCPIv1FixedGravity) so fixed calibration are not in the linear system.
+ * The full factors still zero the Jacobians in respect to calibration we do not estimate, in case they are connected to them.
  */
 struct GtsamConfig {
 
@@ -42,6 +42,9 @@ public:
     /// If we want to estimate the position between VICON and IMU
     bool estimate_vicon_imu_pos = true;
 
+    /// If we want to estimate the rotation from the gravity aligned frame to the VICON frame
+    bool estimate_gravity = true;
+
 };
 
 #endif //GTSAMCONFIG_H
\ No newline at end of file
@@ -27,6 +27,9 @@ using namespace gtsam;
 gtsam::Vector ImuFactorCPIv1::evaluateError(const JPLNavState& state_i, const JPLNavState& state_j, const RotationXY& rotxy,
                                             boost::optional<Matrix&> H1, boost::optional<Matrix&> H2, boost::optional<Matrix&> H3) const {
 
+    // Record how long we take to evaluate and linearize (only into the statistics as there is one of us per interval)
+    ProfileScope scope((H1 || H2 || H3)? "imu_factor_linearize" : "imu_factor_error", false);
+
     // Separate our variables from our states
     Vector4 q_GtoK = state_i.q();
     Vector4 q_GtoK1 = state_j.q();
@@ -203,8 +206,10 @@ gtsam::Vector ImuFactorCPIv1::evaluateError(const JPLNavState& state_i, const JP
                 << std::cos(rotxy.thetay())*std::cos(rotxy.thetax()), 0.0, -std::sin(rotxy.thetay())*std::cos(rotxy.thetax());
         // Derivative of beta, alpha, in respect to our two rotation angles
         Eigen::Matrix<double,15,2> Hg = Eigen::Matrix<double,15,2>::Zero();
-        Hg.block(6,0,3,2) = quat_2_Rot(q_GtoK)*deltatime*gravity_magnitude*H_thetaxy;
-        Hg.block(12,0,3,2) = 0.5*quat_2_Rot(q_GtoK)*std::pow(deltatime,2)*gravity_magnitude*H_thetaxy;
+        if(m_config->estimate_gravity) {
+            Hg.block(6,0,3,2) = quat_2_Rot(q_GtoK)*deltatime*gravity_magnitude*H_thetaxy;
+            Hg.block(12,0,3,2) = 0.5*quat_2_Rot(q_GtoK)*std::pow(deltatime,2)*gravity_magnitude*H_thetaxy;
+        }
         // Reconstruct the whole Jacobian
         *H3 = *OptionalJacobian<15,2>(Hg);
     }
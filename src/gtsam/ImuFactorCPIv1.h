@@ -20,11 +20,14 @@
 #ifndef GTSAM_IMUFACTORCPIv1_H
 #define GTSAM_IMUFACTORCPIv1_H
 
+#include <memory>
 #include <gtsam/base/debug.h>
 #include <gtsam/nonlinear/NonlinearFactor.h>
 
+#include "GtsamConfig.h"
 #include "JPLNavState.h"
 #include "RotationXY.h"
+#include "utils/profiler.h"
 #include "utils/quat_ops.h"
 
 
@@ -71,13 +74,15 @@ namespace gtsam {
         double deltatime; ///< time in seconds that this measurement is over
         double gravity_magnitude; ///< global gravity magnitude (should be the same for all measurements)
 
+        std::shared_ptr<GtsamConfig> m_config; ///< config file for if we should estimate gravity
+
     public:
 
         /// Construct from the two linking JPLNavStates, preingration measurement, and its covariance
         ImuFactorCPIv1(Key state_i, Key state_j, Key rotxy, Eigen::Matrix<double,15,15> covariance, double deltatime,
                        double grav_m, Vector3 alpha, Vector3 beta, Vector4 q_KtoK1, Bias3 ba_lin, Bias3 bg_lin,
                        Eigen::Matrix<double,3,3> J_q, Eigen::Matrix<double,3,3> J_beta, Eigen::Matrix<double,3,3> J_alpha,
-                       Eigen::Matrix<double,3,3> H_beta, Eigen::Matrix<double,3,3> H_alpha) :
+                       Eigen::Matrix<double,3,3> H_beta, Eigen::Matrix<double,3,3> H_alpha, std::shared_ptr<GtsamConfig> config) :
                 NoiseModelFactor3<JPLNavState, JPLNavState, RotationXY>(noiseModel::Gaussian::Covariance(covariance), state_i, state_j, rotxy) {
 
             // Measurement
@@ -95,6 +100,7 @@ namespace gtsam {
             // Static values
             this->deltatime = deltatime;
             this->gravity_magnitude = grav_m;
+            this->m_config = config;
 
         }
 
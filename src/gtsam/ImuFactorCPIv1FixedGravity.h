@@ -0,0 +1,85 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef GTSAM_IMUFACTORCPIv1FIXEDGRAVITY_H
+#define GTSAM_IMUFACTORCPIv1FIXEDGRAVITY_H
+
+#include <gtsam/nonlinear/NonlinearFactor.h>
+
+#include "ImuFactorCPIv1.h"
+#include "JPLNavState.h"
+#include "RotationXY.h"
+
+
+using namespace gtsam;
+
+
+
+namespace gtsam {
+
+    /**
+     * @brief Continuous Preintegration Factor Model 1 with a fixed rotation from vicon frame to gravity inertial frame
+     *
+     * The @ref ImuFactorCPIv1 is always connected to the gravity variable and zeros its Jacobian if we do not estimate it.
+     * This wraps that factor and evaluates it with a constant rotation, thus only the two states are keys of this factor.
+     */
+    class ImuFactorCPIv1FixedGravity : public NoiseModelFactor2<JPLNavState, JPLNavState> {
+    private:
+
+        boost::shared_ptr<ImuFactorCPIv1> m_factor; ///< full factor that we evaluate our error with
+        RotationXY m_rotxy; ///< fixed rotation from vicon frame to gravity inertial frame
+
+    public:
+
+        /// Construct from the full preintegration factor and the fixed gravity rotation
+        ImuFactorCPIv1FixedGravity(const boost::shared_ptr<ImuFactorCPIv1> &factor, const RotationXY &rotxy) :
+                NoiseModelFactor2<JPLNavState, JPLNavState>(factor->noiseModel(), factor->key1(), factor->key2()),
+                m_factor(factor), m_rotxy(rotxy) { }
+
+        /// Error function. Given the current states, calculate the measurement error/residual
+        gtsam::Vector evaluateError(const JPLNavState& state_i, const JPLNavState& state_j,
+                                    boost::optional<Matrix&> H1 = boost::none, boost::optional<Matrix&> H2 = boost::none) const {
+            return m_factor->evaluateError(state_i, state_j, m_rotxy, H1, H2, boost::none);
+        }
+
+        /// Print function for this factor
+        void print(const std::string& s, const KeyFormatter& keyFormatter = DefaultKeyFormatter) const {
+            std::cout << s << "ImuFactorCPIv1FixedGravity(" << keyFormatter(this->key1()) << "," << keyFormatter(this->key2()) << ")" << std::endl;
+            std::cout << "  measured: " << std::endl << *m_factor << std::endl;
+            std::cout << "  gravity: " << m_rotxy.thetax() << " " << m_rotxy.thetay() << std::endl;
+            this->noiseModel_->print("  noise model: ");
+        }
+
+        /// Define how two factors can be equal to each other
+        bool equals(const NonlinearFactor &expected, double tol = 1e-9) const {
+            // Cast the object
+            const auto *e =  dynamic_cast<const ImuFactorCPIv1FixedGravity*>(&expected);
+            if(e == nullptr) return false;
+            // Success, compare the wrapped factors and the fixed gravity
+            return NoiseModelFactor2<JPLNavState,JPLNavState>::equals(*e, tol)
+                   && m_factor->equals(*e->m_factor, tol)
+                   && m_rotxy.equals(e->m_rotxy, tol);
+        }
+
+    };
+
+
+} // namespace gtsam
+
+
+#endif /* GTSAM_IMUFACTORCPIv1FIXEDGRAVITY_H */
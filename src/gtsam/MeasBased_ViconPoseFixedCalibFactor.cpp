@@ -0,0 +1,62 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "MeasBased_ViconPoseFixedCalibFactor.h"
+
+
+using namespace std;
+using namespace gtsam;
+
+
+std::vector<Key> MeasBased_ViconPoseFixedCalibFactor::get_keys(Key kstate, Key kR_BtoI, Key kp_BinI, Key kt_off, const GtsamConfig &config) {
+    std::vector<Key> keys = {kstate};
+    if(config.estimate_vicon_imu_ori) keys.push_back(kR_BtoI);
+    if(config.estimate_vicon_imu_pos) keys.push_back(kp_BinI);
+    if(config.estimate_vicon_imu_toff) keys.push_back(kt_off);
+    return keys;
+}
+
+
+gtsam::Vector MeasBased_ViconPoseFixedCalibFactor::unwhitenedError(const Values& x, boost::optional<std::vector<Matrix>&> H) const {
+
+    // Get our state, and either the estimated or fixed calibration
+    size_t idx = 1;
+    const JPLNavState &state = x.at<JPLNavState>(keys().at(0));
+    JPLQuaternion q_BtoI = (m_config->estimate_vicon_imu_ori)? x.at<JPLQuaternion>(keys().at(idx++)) : m_q_BtoI;
+    Vector3 p_BinI = (m_config->estimate_vicon_imu_pos)? x.at<Vector3>(keys().at(idx++)) : m_p_BinI;
+    Vector1 t_off = (m_config->estimate_vicon_imu_toff)? x.at<Vector1>(keys().at(idx++)) : m_t_off;
+
+    // Only compute the error if we do not need Jacobians
+    if(!H) {
+        return m_factor.evaluateError(state, q_BtoI, p_BinI, t_off);
+    }
+
+    // Else get the Jacobians of only our keys (the fixed ones are never computed)
+    Matrix H1, H2, H3, H4;
+    gtsam::Vector error = m_factor.evaluateError(state, q_BtoI, p_BinI, t_off, H1,
+            (m_config->estimate_vicon_imu_ori)? boost::optional<Matrix&>(H2) : boost::none,
+            (m_config->estimate_vicon_imu_pos)? boost::optional<Matrix&>(H3) : boost::none,
+            (m_config->estimate_vicon_imu_toff)? boost::optional<Matrix&>(H4) : boost::none);
+    idx = 0;
+    (*H).at(idx++) = H1;
+    if(m_config->estimate_vicon_imu_ori) (*H).at(idx++) = H2;
+    if(m_config->estimate_vicon_imu_pos) (*H).at(idx++) = H3;
+    if(m_config->estimate_vicon_imu_toff) (*H).at(idx++) = H4;
+    return error;
+
+}
@@ -0,0 +1,110 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef GTSAM_VICONPOSEFIXEDCALIBFACTOR_H
+#define GTSAM_VICONPOSEFIXEDCALIBFACTOR_H
+
+#include <vector>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+
+#include "GtsamConfig.h"
+#include "JPLNavState.h"
+#include "JPLQuaternion.h"
+#include "MeasBased_ViconPoseTimeoffsetFactor.h"
+#include "meas/Interpolator.h"
+
+using namespace gtsam;
+
+namespace gtsam {
+
+    /**
+     * @brief Vicon pose factor with time offset, which is only connected to the calibration we estimate.
+     *
+     * The @ref MeasBased_ViconPoseTimeoffsetFactor is always connected to all calibration variables and zeros the Jacobians of fixed ones.
+     * This has the same error, but the fixed calibration are constants of the factor and not keys, thus they are not in the linear system at all.
+     * Our keys are the state followed by the estimated calibration in the order (R_BtoI, p_BinI, t_off).
+     */
+    class MeasBased_ViconPoseFixedCalibFactor : public NoiseModelFactor {
+    private:
+
+        MeasBased_ViconPoseTimeoffsetFactor m_factor; ///< full factor that we evaluate our error with
+        std::shared_ptr<GtsamConfig> m_config; ///< config file for which calibration we estimate
+
+        JPLQuaternion m_q_BtoI; ///< fixed rotation from vicon body to imu (if not estimated)
+        Vector3 m_p_BinI; ///< fixed position of vicon body in imu (if not estimated)
+        Vector1 m_t_off; ///< fixed time offset (if not estimated)
+
+        /// Get the keys of the state and the calibration we estimate
+        static std::vector<Key> get_keys(Key kstate, Key kR_BtoI, Key kp_BinI, Key kt_off, const GtsamConfig &config);
+
+    public:
+
+        /**
+         * @brief Construct from the JPLNavState, calibration, and time offset
+         * @param kstate Key of the state
+         * @param kR_BtoI Key of the rotation from vicon body to imu (only used if estimated)
+         * @param kp_BinI Key of the position of vicon body in imu (only used if estimated)
+         * @param kt_off Key of the time offset (only used if estimated)
+         * @param q_BtoI Rotation from vicon body to imu (only used if fixed)
+         * @param p_BinI Position of vicon body in imu (only used if fixed)
+         * @param t_off Time offset (only used if fixed)
+         * @param interpolator Interpolator that has vicon poses in it
+         * @param config Config for which calibration we estimate
+         */
+        MeasBased_ViconPoseFixedCalibFactor(Key kstate, Key kR_BtoI, Key kp_BinI, Key kt_off,
+                                            const JPLQuaternion &q_BtoI, const Vector3 &p_BinI, const Vector1 &t_off,
+                                            std::shared_ptr<const Interpolator> interpolator, std::shared_ptr<GtsamConfig> config) :
+                NoiseModelFactor(noiseModel::Robust::Create(
+                        noiseModel::mEstimator::Huber::Create(1.345),
+                        noiseModel::Gaussian::Covariance(Eigen::Matrix<double,6,6>::Identity())
+                        ), get_keys(kstate, kR_BtoI, kp_BinI, kt_off, *config)),
+                m_factor(kstate, kR_BtoI, kp_BinI, kt_off, interpolator, config),
+                m_config(config), m_q_BtoI(q_BtoI), m_p_BinI(p_BinI), m_t_off(t_off) { }
+
+        /// Error function. Given the current states, calculate the measurement error/residual
+        gtsam::Vector unwhitenedError(const Values& x, boost::optional<std::vector<Matrix>&> H = boost::none) const;
+
+        /// Print function for this factor
+        void print(const std::string& s, const KeyFormatter& keyFormatter = DefaultKeyFormatter) const {
+            std::cout << s << "ViconPoseFixedCalibFactor(";
+            for(size_t i=0; i<this->size(); i++) {
+                std::cout << ((i>0)? "," : "") << keyFormatter(this->keys().at(i));
+            }
+            std::cout << ")" << std::endl;
+            this->noiseModel_->print("  noise model: ");
+        }
+
+        /// Define how two factors can be equal to each other
+        bool equals(const NonlinearFactor &expected, double tol = 1e-9) const {
+            // Cast the object
+            const auto *e =  dynamic_cast<const MeasBased_ViconPoseFixedCalibFactor*>(&expected);
+            if(e == nullptr) return false;
+            // Success, compare base noise values and the fixed values
+            return NoiseModelFactor::equals(*e, tol)
+                   && m_q_BtoI.equals(e->m_q_BtoI, tol)
+                   && gtsam::equal(m_p_BinI, e->m_p_BinI, tol)
+                   && gtsam::equal(m_t_off, e->m_t_off, tol);
+        }
+
+    };
+
+
+} // namespace gtsam
+
+
+#endif /* GTSAM_VICONPOSEFIXEDCALIBFACTOR_H */
@@ -26,6 +26,9 @@ using namespace gtsam;
 gtsam::Vector MeasBased_ViconPoseTimeoffsetFactor::evaluateError(const JPLNavState& state, const JPLQuaternion& q_BtoI, const Vector3& p_BinI, const Vector1& t_off,
                                                                  boost::optional<Matrix&> H1, boost::optional<Matrix&> H2, boost::optional<Matrix&> H3, boost::optional<Matrix&> H4) const {
 
+    // Record how long we take to evaluate and linearize (only into the statistics as there is one of us per state)
+    ProfileScope scope((H1 || H2 || H3 || H4)? "vicon_factor_linearize" : "vicon_factor_error", false);
+
 
     //================================================================================
     //================================================================================
@@ -46,16 +49,34 @@ gtsam::Vector MeasBased_ViconPoseTimeoffsetFactor::evaluateError(const JPLNavSta
     //================================================================================
 
     // Get our interpolated pose at the node timestep
+    // If we have already interpolated at this time we can just use that result
+    double timestamp_inV = timestamp_inI-t_off(0);
     Eigen::Matrix<double,4,1> q_interp;
     Eigen::Matrix<double,3,1> p_interp;
-    Eigen::Matrix<double,6,6> R_interp;
     Eigen::Matrix<double,6,1> H_toff;
-    bool has_vicon = m_interpolator->get_pose_with_jacobian(timestamp_inI-t_off(0),q_interp,p_interp,R_interp, H_toff);
+    Eigen::Matrix<double,6,6> sqrt_inv_interp;
+    bool has_vicon;
+    {
+        std::lock_guard<std::mutex> lck(m_cache.mtx);
+        if(!m_cache.valid || m_cache.timestamp != timestamp_inV) {
+
+            // Get our interpolated pose
+            Eigen::Matrix<double,6,6> R_interp;
+            m_cache.has_vicon = m_interpolator->get_pose_with_jacobian(timestamp_inV,m_cache.q_interp,m_cache.p_interp,R_interp,m_cache.H_toff);
+
+            // Find the sqrt inverse to whittening
+            // This is because our measurement noise can change every iteration based on interpolation
+            m_cache.sqrt_inv_interp = compute_sqrt_inv(R_interp);
+            m_cache.timestamp = timestamp_inV;
+            m_cache.valid = true;
 
-    // Find the sqrt inverse to whittening
-    // This is because our measurement noise can change every iteration based on interpolation
-    Eigen::Matrix<double,6,6> sqrt_inv_interp = R_interp.llt().matrixL();
-    sqrt_inv_interp = sqrt_inv_interp.colPivHouseholderQr().solve(Eigen::Matrix<double,6,6>::Identity());
+        }
+        has_vicon = m_cache.has_vicon;
+        q_interp = m_cache.q_interp;
+        p_interp = m_cache.p_interp;
+        H_toff = m_cache.H_toff;
+        sqrt_inv_interp = m_cache.sqrt_inv_interp;
+    }
 
     // Our error vector [delta = (orientation, position)]
     Vector6 error;
@@ -146,6 +167,30 @@ gtsam::Vector MeasBased_ViconPoseTimeoffsetFactor::evaluateError(const JPLNavSta
 
 
 
+Eigen::Matrix<double,6,6> MeasBased_ViconPoseTimeoffsetFactor::compute_sqrt_inv(const Eigen::Matrix<double,6,6> &R_interp) {
 
+    // If the orientation and position are not correlated, then we can whiten each on its own
+    Eigen::Matrix<double,6,6> sqrt_inv_interp = Eigen::Matrix<double,6,6>::Zero();
+    if(R_interp.block(0,3,3,3).isZero(0) && R_interp.block(3,0,3,3).isZero(0)) {
+        Eigen::LLT<Eigen::Matrix<double,3,3>> llt_q(R_interp.block(0,0,3,3));
+        Eigen::LLT<Eigen::Matrix<double,3,3>> llt_p(R_interp.block(3,3,3,3));
+        if(llt_q.info() == Eigen::Success && llt_p.info() == Eigen::Success) {
+            sqrt_inv_interp.block(0,0,3,3) = llt_q.matrixL().solve(Eigen::Matrix<double,3,3>::Identity());
+            sqrt_inv_interp.block(3,3,3,3) = llt_p.matrixL().solve(Eigen::Matrix<double,3,3>::Identity());
+            return sqrt_inv_interp;
+        }
+    } else {
+        Eigen::LLT<Eigen::Matrix<double,6,6>> llt(R_interp);
+        if(llt.info() == Eigen::Success) {
+            sqrt_inv_interp = llt.matrixL().solve(Eigen::Matrix<double,6,6>::Identity());
+            return sqrt_inv_interp;
+        }
+    }
 
+    // Else our covariance is not positive definite, so invert it the same way we always have
+    // This handles the case that we do not have vicon (zero covariance) which will zero our error
+    sqrt_inv_interp = R_interp.llt().matrixL();
+    sqrt_inv_interp = sqrt_inv_interp.colPivHouseholderQr().solve(Eigen::Matrix<double,6,6>::Identity());
+    return sqrt_inv_interp;
 
+}
@@ -19,6 +19,7 @@
 #ifndef GTSAM_VICONPOSETIMEOFFSETFACTOR_H
 #define GTSAM_VICONPOSETIMEOFFSETFACTOR_H
 
+#include <mutex>
 #include <gtsam/base/debug.h>
 #include <gtsam/nonlinear/NonlinearFactor.h>
 #include <gtsam/base/numericalDerivative.h>
@@ -27,6 +28,7 @@
 #include "JPLNavState.h"
 #include "JPLQuaternion.h"
 #include "meas/Interpolator.h"
+#include "utils/profiler.h"
 #include "utils/quat_ops.h"
 
 using namespace gtsam;
@@ -41,14 +43,49 @@ namespace gtsam {
     class MeasBased_ViconPoseTimeoffsetFactor : public NoiseModelFactor4<JPLNavState, JPLQuaternion, Vector3, Vector1> {
     private:
 
-        std::shared_ptr<Interpolator> m_interpolator; ///< interpolator that has vicon poses in it
+        std::shared_ptr<const Interpolator> m_interpolator; ///< interpolator that has vicon poses in it (only queried, thus safe to share between threads)
         std::shared_ptr<GtsamConfig> m_config; ///< config file for if we should estimate calibration
 
+        /**
+         * @brief Interpolated vicon measurement and its whitening matrix at the last time we were evaluated.
+         *
+         * The interpolated measurement only depends on the vicon time we query at, which only changes if the time offset does.
+         * Thus during optimization we are often evaluated multiple times at the same vicon time (e.g. error and then linearize).
+         * The mutex is not copied, so each copy of the factor gets its own lock.
+         */
+        struct INTERPCACHE {
+            std::mutex mtx;
+            bool valid = false;
+            double timestamp = 0;
+            bool has_vicon = false;
+            Eigen::Matrix<double,4,1> q_interp;
+            Eigen::Matrix<double,3,1> p_interp;
+            Eigen::Matrix<double,6,1> H_toff;
+            Eigen::Matrix<double,6,6> sqrt_inv_interp;
+            INTERPCACHE() { }
+            INTERPCACHE(const INTERPCACHE &other) : valid(other.valid), timestamp(other.timestamp), has_vicon(other.has_vicon),
+                q_interp(other.q_interp), p_interp(other.p_interp), H_toff(other.H_toff), sqrt_inv_interp(other.sqrt_inv_interp) { }
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        };
+        mutable INTERPCACHE m_cache; ///< last interpolated measurement
+
+        /**
+         * @brief Computes the matrix that whitens an error with the given covariance (i.e. inverse of its lower Cholesky factor)
+         *
+         * If the covariance is block diagonal between orientation and position we whiten each 3x3 block on its own.
+         * Otherwise we factor the full 6x6, and in both cases invert using a triangular solve.
+         * If the covariance is not positive definite (e.g. zero if we have no vicon), this falls back to a full QR solve.
+         *
+         * @param R_interp Covariance of the measurement
+         * @return Lower triangular whitening matrix
+         */
+        static Eigen::Matrix<double,6,6> compute_sqrt_inv(const Eigen::Matrix<double,6,6> &R_interp);
+
     public:
 
         /// Construct from the JPLNavState, calibration, and time offset
         MeasBased_ViconPoseTimeoffsetFactor(Key kstate, Key kR_BtoI, Key kp_BinI, Key kt_off,
-                                            std::shared_ptr<Interpolator> interpolator, std::shared_ptr<GtsamConfig> config) :
+                                            std::shared_ptr<const Interpolator> interpolator, std::shared_ptr<GtsamConfig> config) :
                 NoiseModelFactor4<JPLNavState, JPLQuaternion, Vector3, Vector1>(noiseModel::Robust::Create(
                         noiseModel::mEstimator::Huber::Create(1.345),
                          noiseModel::Gaussian::Covariance(Eigen::Matrix<double,6,6>::Identity())
@@ -23,17 +23,16 @@
 void Interpolator::feed_pose(double timestamp, Eigen::Matrix<double,4,1> q, Eigen::Matrix<double,3,1> p,
                              Eigen::Matrix<double,3,3> R_q, Eigen::Matrix<double,3,3> R_p) {
 
-    // Create our imu data object
-    POSEDATA data;
-    data.timestamp = timestamp;
-    data.has_odom = false;
-    data.q = q;
-    data.p = p;
-    data.R_q = R_q;
-    data.R_p = R_p;
-
-    // Append it to our vector
-    pose_data.insert(data);
+    // Append it to our arrays
+    int idx = insert_pose(timestamp, q, p, R_q, R_p);
+
+    // If we are also storing odometry, then this pose has no velocity information
+    if(idx >= 0 && !pose_v.empty()) {
+        pose_v.insert(pose_v.begin()+idx, Eigen::Matrix<double,3,1>::Zero());
+        pose_w.insert(pose_w.begin()+idx, Eigen::Matrix<double,3,1>::Zero());
+        pose_R_v.insert(pose_R_v.begin()+idx, Eigen::Matrix<double,3,3>::Zero());
+        pose_R_w.insert(pose_R_w.begin()+idx, Eigen::Matrix<double,3,3>::Zero());
+    }
 
 }
 
@@ -43,119 +42,109 @@ void Interpolator::feed_odom(double timestamp, Eigen::Matrix<double,4,1> q, Eige
                              Eigen::Matrix<double,3,3> R_q, Eigen::Matrix<double,3,3> R_p,
                              Eigen::Matrix<double,3,3> R_v, Eigen::Matrix<double,3,3> R_w) {
 
-    // Create our imu data object
-    POSEDATA data;
-    data.timestamp = timestamp;
-    data.has_odom = true;
-    data.q = q;
-    data.p = p;
-    data.v = v;
-    data.w = w;
-    data.R_q = R_q;
-    data.R_p = R_p;
-    data.R_v = R_v;
-    data.R_w = R_w;
-
-    // Append it to our vector
-    pose_data.insert(data);
+    // Append the pose to our arrays
+    int idx = insert_pose(timestamp, q, p, R_q, R_p);
+    if(idx < 0)
+        return;
+
+    // If this is our first odometry, then allocate the velocity arrays
+    // All poses before this one did not have any velocity information
+    if(pose_v.empty()) {
+        pose_v.resize(pose_times.size()-1, Eigen::Matrix<double,3,1>::Zero());
+        pose_w.resize(pose_times.size()-1, Eigen::Matrix<double,3,1>::Zero());
+        pose_R_v.resize(pose_times.size()-1, Eigen::Matrix<double,3,3>::Zero());
+        pose_R_w.resize(pose_times.size()-1, Eigen::Matrix<double,3,3>::Zero());
+    }
+
+    // Append the velocities
+    pose_v.insert(pose_v.begin()+idx, v);
+    pose_w.insert(pose_w.begin()+idx, w);
+    pose_R_v.insert(pose_R_v.begin()+idx, R_v);
+    pose_R_w.insert(pose_R_w.begin()+idx, R_w);
 
 }
 
 bool Interpolator::get_pose(double timestamp, Eigen::Matrix<double,4,1>& q,
-                            Eigen::Matrix<double,3,1>& p, Eigen::Matrix<double,6,6>& R) {
+                            Eigen::Matrix<double,3,1>& p, Eigen::Matrix<double,6,6>& R) const {
 
-    // Find our bounds for the desired timestamp
-    POSEDATA pose_to_find;
-    pose_to_find.timestamp = timestamp;
-    auto bounds = pose_data.equal_range(pose_to_find);
+    // Same as the full interpolation, we just do not return the time offset Jacobian
+    Eigen::Matrix<double,6,1> H_toff;
+    return get_pose_with_jacobian(timestamp, q, p, R, H_toff);
 
-    // Best we can do at the beginning is just the first vicon pose
-    if(bounds.first==pose_data.begin()) {
-        // our pose
-        //POSEDATA poseEXACT = *bounds.first;
-        // mean values
-        q << 0, 0, 0, 1; //= poseEXACT.q;
-        p << 0, 0, 0; //= poseEXACT.p;
-        // meas covariance
-        R.setZero();
-        //R.block(0,0,3,3) = poseEXACT.R_q;
-        //R.block(3,3,3,3) = poseEXACT.R_p;
-        return false;
-    }
+}
 
-    // Return false if we do not have any bounding pose for this measurement (shouldn't happen)
-    if(bounds.first==pose_data.end() || bounds.second==pose_data.end()) {
-        // our pose
-        //POSEDATA poseEXACT = *(--bounds.first);
-        // mean values
-        q << 0, 0, 0, 1; //= poseEXACT.q;
-        p << 0, 0, 0; //= poseEXACT.p;
-        // meas covariance
-        R.setZero();
-        //R.block(0,0,3,3) = poseEXACT.R_q;
-        //R.block(3,3,3,3) = poseEXACT.R_p;
-        //ROS_ERROR("[INTERPOLATOR]: UNABLE TO FIND BOUNDING POSES, %d, %d",bounds.first==pose_data.end(),bounds.second==pose_data.end());
-        //ROS_ERROR("[INTERPOLATOR]: tmeas = %.9f | time0 = %.9f | time1 = %.9f", timestamp, time0, time1);
-        return false;
-    }
-    bounds.first--;
 
-    // If we found an exact one, just return that
-    if(bounds.first->timestamp==bounds.second->timestamp) {
-        // our pose
-        POSEDATA poseEXACT = *bounds.first;
+bool Interpolator::get_pose_with_jacobian(double timestamp, Eigen::Matrix<double,4,1>& q, Eigen::Matrix<double,3,1>& p,
+                                          Eigen::Matrix<double,6,6>& R, Eigen::Matrix<double,6,1>& H_toff) const {
+
+    // Record how long each call takes (only into the statistics as this is called for every vicon factor)
+    ProfileScope scope("get_pose_with_jacobian", false);
+
+    // Find our bounds for the desired timestamp
+    // Return false if we do not have any bounding pose for this measurement
+    size_t idx0, idx1;
+    if(!find_bounds(timestamp, idx0, idx1)) {
         // mean values
-        q = poseEXACT.q;
-        p = poseEXACT.p;
+        q << 0, 0, 0, 1;
+        p << 0, 0, 0;
         // meas covariance
         R.setZero();
-        R.block(0,0,3,3) = poseEXACT.R_q;
-        R.block(3,3,3,3) = poseEXACT.R_p;
-        return true;
+        H_toff.setZero();
+        //ROS_ERROR("[INTERPOLATOR]: UNABLE TO FIND BOUNDING POSES, tmeas = %.9f", timestamp);
+        return false;
     }
 
     // Else set our bounds as the bounds our binary search found
-    POSEDATA pose0 = *bounds.first;
-    POSEDATA pose1 = *bounds.second;
+    const double &time0 = pose_times.at(idx0);
+    const double &time1 = pose_times.at(idx1);
+    const Eigen::Matrix<double,3,1> &p0 = pose_p.at(idx0);
+    const Eigen::Matrix<double,3,1> &p1 = pose_p.at(idx1);
 
     // Our lamda time-distance fraction
-    double lambda = (timestamp-pose0.timestamp)/(pose1.timestamp-pose0.timestamp);
+    double lambda = (timestamp-time0)/(time1-time0);
 
     // Bounding SO(3) orientations
-    Eigen::Matrix<double,3,3> R_Gto0 = quat_2_Rot(pose0.q);
-    Eigen::Matrix<double,3,3> R_Gto1 = quat_2_Rot(pose1.q);
+    Eigen::Matrix<double,3,3> R_Gto0 = quat_2_Rot(pose_q.at(idx0));
+    Eigen::Matrix<double,3,3> R_Gto1 = quat_2_Rot(pose_q.at(idx1));
 
     // Now perform the interpolation
     Eigen::Matrix<double,3,3> R_0to1 = R_Gto1*R_Gto0.transpose();
-    Eigen::Matrix<double,3,3> R_0toi = exp_so3(lambda*log_so3(R_0to1));
+    Eigen::Matrix<double,3,1> w_0to1 = log_so3(R_0to1);
+    Eigen::Matrix<double,3,3> R_0toi = exp_so3(lambda*w_0to1);
     Eigen::Matrix<double,3,3> R_interp = R_0toi*R_Gto0;
-    Eigen::Matrix<double,3,1> p_interp = (1-lambda)*pose0.p + lambda*pose1.p;
+    Eigen::Matrix<double,3,1> p_interp = (1-lambda)*p0 + lambda*p1;
 
     // Calculate intermediate values for cov propagation equations
     // Equation (8)-(10) of Geneva2018ICRA async measurement paper
+    // NOTE: Jr(-lambda*log(R_0to1^T)) is the same as Jr(lambda*log(R_0to1)), so we only compute it once
+    // NOTE: the right Jacobian of the full rotation is used as is (it used to be inverted twice)
     Eigen::Matrix<double,3,3> eye33 = Eigen::Matrix<double,3,3>::Identity();
-    Eigen::Matrix<double,3,3> JR_r0i = Jr_so3(lambda*log_so3(R_0to1));
-    Eigen::Matrix<double,3,3> JRinv_r01 = Jr_so3(log_so3(R_0to1)).inverse();
-    JRinv_r01 = JRinv_r01.inverse().eval();
-    Eigen::Matrix<double,3,3> JRneg_r0i = Jr_so3(-lambda*log_so3(R_0to1.transpose()));
-    Eigen::Matrix<double,3,3> JRneginv_r01 = Jr_so3(log_so3(R_0to1.transpose())).inverse();
-    JRneginv_r01 = JRneginv_r01.inverse().eval();
+    Eigen::Matrix<double,3,3> JR_r0i = Jr_so3(lambda*w_0to1);
+    Eigen::Matrix<double,3,3> JR_r01 = Jr_so3(w_0to1);
 
     // Covariance propagation Jacobian
     // Equation (7) of Geneva2018ICRA async measurement paper
     Eigen::Matrix<double,6,12> Hu = Eigen::Matrix<double,6,12>::Zero();
-    Hu.block(0,0,3,3) = -R_0toi*(JR_r0i*lambda*JRinv_r01-eye33);
-    Hu.block(0,6,3,3) = R_0toi*(JRneg_r0i*lambda*JRinv_r01);
+    Hu.block(0,0,3,3) = -R_0toi*(JR_r0i*lambda*JR_r01-eye33);
+    Hu.block(0,6,3,3) = R_0toi*(JR_r0i*lambda*JR_r01);
     Hu.block(3,6,3,3) = (1-lambda)*eye33;
     Hu.block(3,9,3,3) = lambda*eye33;
 
     // Finally propagate the covariance!
-    Eigen::Matrix<double,12,12> R_12 = Eigen::Matrix<double,12,12>::Zero();
-    R_12.block(0,0,3,3) = pose0.R_q;
-    R_12.block(3,3,3,3) = pose0.R_p;
-    R_12.block(6,6,3,3) = pose1.R_q;
-    R_12.block(9,9,3,3) = pose1.R_p;
-    R = Hu*R_12*Hu.transpose();
+    // Our bounding pose noises are block diagonal, so we only need to add each block's contribution
+    const Eigen::Matrix<double,3,3>* R_blocks[4] = {&pose_R_q.at(idx0), &pose_R_p.at(idx0), &pose_R_q.at(idx1), &pose_R_p.at(idx1)};
+    R.setZero();
+    for(int k=0; k<4; k++) {
+        if(Hu.block(0,3*k,6,3).isZero(0))
+            continue;
+        R.noalias() += Hu.block(0,3*k,6,3)*(*R_blocks[k])*Hu.block(0,3*k,6,3).transpose();
+    }
+
+    // Jacobian in respect to our time offset
+    double H_lambda2toff = -1.0/(time1-time0);
+    H_toff.setZero();
+    H_toff.block(0,0,3,1) = -R_0toi*JR_r0i*w_0to1*H_lambda2toff;
+    H_toff.block(3,0,3,1) = (p1 - p0)*H_lambda2toff;
 
     // Done
     q = rot_2_quat(R_interp);
@@ -164,158 +153,180 @@ bool Interpolator::get_pose(double timestamp, Eigen::Matrix<double,4,1>& q,
 
 }
 
+bool Interpolator::get_bounds(double timestamp,
+                              double &time0, Eigen::Matrix<double,4,1>& q0, Eigen::Matrix<double,3,1>& p0, Eigen::Matrix<double,6,6>& R0,
+                              double &time1, Eigen::Matrix<double,4,1>& q1, Eigen::Matrix<double,3,1>& p1, Eigen::Matrix<double,6,6>& R1) const {
 
-bool Interpolator::get_pose_with_jacobian(double timestamp, Eigen::Matrix<double,4,1>& q, Eigen::Matrix<double,3,1>& p,
-                                          Eigen::Matrix<double,6,6>& R, Eigen::Matrix<double,6,1>& H_toff) {
 
     // Find our bounds for the desired timestamp
-    POSEDATA pose_to_find;
-    pose_to_find.timestamp = timestamp;
-    auto bounds = pose_data.equal_range(pose_to_find);
-
-    // Best we can do at the beginning is just the first vicon pose
-    if(bounds.first==pose_data.begin()) {
-        // our pose
-        //POSEDATA poseEXACT = *bounds.first;
-        // mean values
-        q << 0, 0, 0, 1; //= poseEXACT.q;
-        p << 0, 0, 0; //= poseEXACT.p;
-        // meas covariance
-        R.setZero();
-        //R.block(0,0,3,3) = poseEXACT.R_q;
-        //R.block(3,3,3,3) = poseEXACT.R_p;
+    // Return false if we do not have any bounding pose for this measurement (shouldn't happen)
+    size_t idx0, idx1;
+    if(!find_bounds(timestamp, idx0, idx1)) {
+        //ROS_ERROR("[INTERPOLATOR]: UNABLE TO FIND BOUNDING POSES, tmeas = %.9f", timestamp);
         return false;
     }
 
-    // Return false if we do not have any bounding pose for this measurement (shouldn't happen)
-    if(bounds.first==pose_data.end() || bounds.second==pose_data.end()) {
-        // our pose
-        //POSEDATA poseEXACT = *(--bounds.first);
-        // mean values
-        q << 0, 0, 0, 1; //= poseEXACT.q;
-        p << 0, 0, 0; //= poseEXACT.p;
-        // meas covariance
-        R.setZero();
-        //R.block(0,0,3,3) = poseEXACT.R_q;
-        //R.block(3,3,3,3) = poseEXACT.R_p;
-        //ROS_ERROR("[INTERPOLATOR]: UNABLE TO FIND BOUNDING POSES, %d, %d",bounds.first==pose_data.end(),bounds.second==pose_data.end());
-        //ROS_ERROR("[INTERPOLATOR]: tmeas = %.9f | time0 = %.9f | time1 = %.9f", timestamp, time0, time1);
-        return false;
+    // Pose 0
+    time0 = pose_times.at(idx0);
+    q0 = pose_q.at(idx0);
+    p0 = pose_p.at(idx0);
+    R0.setZero();
+    R0.block(0,0,3,3) = pose_R_q.at(idx0);
+    R0.block(3,3,3,3) = pose_R_p.at(idx0);
+
+    // Pose 1
+    time1 = pose_times.at(idx1);
+    q1 = pose_q.at(idx1);
+    p1 = pose_p.at(idx1);
+    R1.setZero();
+    R1.block(0,0,3,3) = pose_R_q.at(idx1);
+    R1.block(3,3,3,3) = pose_R_p.at(idx1);
+
+    return true;
+
+}
+
+
+void Interpolator::clean_older_than(double timestamp) {
+
+    // Find the first pose that we might need, and keep the one before it
+    size_t idx = find_index(timestamp);
+    if(idx < 2)
+        return;
+
+    // Remove all older poses (the velocities are only there if we have been fed odometry)
+    long num = (long)(idx-1);
+    pose_times.erase(pose_times.begin(), pose_times.begin()+num);
+    pose_q.erase(pose_q.begin(), pose_q.begin()+num);
+    pose_p.erase(pose_p.begin(), pose_p.begin()+num);
+    pose_R_q.erase(pose_R_q.begin(), pose_R_q.begin()+num);
+    pose_R_p.erase(pose_R_p.begin(), pose_R_p.begin()+num);
+    if(!pose_v.empty()) {
+        pose_v.erase(pose_v.begin(), pose_v.begin()+num);
+        pose_w.erase(pose_w.begin(), pose_w.begin()+num);
+        pose_R_v.erase(pose_R_v.begin(), pose_R_v.begin()+num);
+        pose_R_w.erase(pose_R_w.begin(), pose_R_w.begin()+num);
     }
-    bounds.first--;
 
-    // If we found an exact one, just return that
-    if(bounds.first->timestamp==bounds.second->timestamp) {
-        // our pose
-        POSEDATA poseEXACT = *bounds.first;
-        // mean values
-        q = poseEXACT.q;
-        p = poseEXACT.p;
-        // meas covariance
-        R.setZero();
-        R.block(0,0,3,3) = poseEXACT.R_q;
-        R.block(3,3,3,3) = poseEXACT.R_p;
-        return true;
+}
+
+
+std::vector<std::pair<double,double>> Interpolator::get_coverage(double max_dt) const {
+
+    // Loop through each pair of neighboring poses, and see if we can interpolate between them
+    // Neighboring pairs that we can interpolate between are merged into a single interval
+    std::vector<std::pair<double,double>> coverage;
+    bool valid_prev = !pose_times.empty() && is_valid_pose(0);
+    bool covered_prev = false;
+    for(size_t k=1; k<pose_times.size(); k++) {
+        bool valid = is_valid_pose(k);
+        bool covered = valid_prev && valid && (max_dt <= 0 || pose_times.at(k)-pose_times.at(k-1) <= max_dt);
+        if(covered && covered_prev)
+            coverage.back().second = pose_times.at(k);
+        else if(covered)
+            coverage.emplace_back(pose_times.at(k-1), pose_times.at(k));
+        valid_prev = valid;
+        covered_prev = covered;
     }
+    return coverage;
 
-    // Else set our bounds as the bounds our binary search found
-    POSEDATA pose0 = *bounds.first;
-    POSEDATA pose1 = *bounds.second;
+}
 
-    // Our lamda time-distance fraction
-    double lambda = (timestamp-pose0.timestamp)/(pose1.timestamp-pose0.timestamp);
 
-    // Bounding SO(3) orientations
-    Eigen::Matrix<double,3,3> R_Gto0 = quat_2_Rot(pose0.q);
-    Eigen::Matrix<double,3,3> R_Gto1 = quat_2_Rot(pose1.q);
+bool Interpolator::is_valid_pose(size_t idx) const {
 
-    // Now perform the interpolation
-    Eigen::Matrix<double,3,3> R_0to1 = R_Gto1*R_Gto0.transpose();
-    Eigen::Matrix<double,3,3> R_0toi = exp_so3(lambda*log_so3(R_0to1));
-    Eigen::Matrix<double,3,3> R_interp = R_0toi*R_Gto0;
-    Eigen::Matrix<double,3,1> p_interp = (1-lambda)*pose0.p + lambda*pose1.p;
+    // All values need to be finite
+    const Eigen::Matrix<double,3,3> &R_q = pose_R_q.at(idx);
+    const Eigen::Matrix<double,3,3> &R_p = pose_R_p.at(idx);
+    if(!pose_q.at(idx).allFinite() || !pose_p.at(idx).allFinite() || !R_q.allFinite() || !R_p.allFinite())
+        return false;
 
-    // Calculate intermediate values for cov propagation equations
-    // Equation (8)-(10) of Geneva2018ICRA async measurement paper
-    Eigen::Matrix<double,3,3> eye33 = Eigen::Matrix<double,3,3>::Identity();
-    Eigen::Matrix<double,3,3> JR_r0i = Jr_so3(lambda*log_so3(R_0to1));
-    Eigen::Matrix<double,3,3> JRinv_r01 = Jr_so3(log_so3(R_0to1)).inverse();
-    JRinv_r01 = JRinv_r01.inverse().eval();
-    Eigen::Matrix<double,3,3> JRneg_r0i = Jr_so3(-lambda*log_so3(R_0to1.transpose()));
-    Eigen::Matrix<double,3,3> JRneginv_r01 = Jr_so3(log_so3(R_0to1.transpose())).inverse();
-    JRneginv_r01 = JRneginv_r01.inverse().eval();
+    // Our covariance needs to be invertible for it to be used in a factor
+    Eigen::LLT<Eigen::Matrix<double,3,3>> llt_q(R_q);
+    Eigen::LLT<Eigen::Matrix<double,3,3>> llt_p(R_p);
+    return (llt_q.info() == Eigen::Success && llt_p.info() == Eigen::Success);
 
-    // Covariance propagation Jacobian
-    // Equation (7) of Geneva2018ICRA async measurement paper
-    Eigen::Matrix<double,6,12> Hu = Eigen::Matrix<double,6,12>::Zero();
-    Hu.block(0,0,3,3) = -R_0toi*(JR_r0i*lambda*JRinv_r01-eye33);
-    Hu.block(0,6,3,3) = R_0toi*(JRneg_r0i*lambda*JRinv_r01);
-    Hu.block(3,6,3,3) = (1-lambda)*eye33;
-    Hu.block(3,9,3,3) = lambda*eye33;
+}
 
-    // Finally propagate the covariance!
-    Eigen::Matrix<double,12,12> R_12 = Eigen::Matrix<double,12,12>::Zero();
-    R_12.block(0,0,3,3) = pose0.R_q;
-    R_12.block(3,3,3,3) = pose0.R_p;
-    R_12.block(6,6,3,3) = pose1.R_q;
-    R_12.block(9,9,3,3) = pose1.R_p;
-    R = Hu*R_12*Hu.transpose();
 
-    // Jacobian in respect to our time offset
-    double H_lambda2toff = -1.0/(pose1.timestamp-pose0.timestamp);
-    H_toff.setZero();
-    H_toff.block(0,0,3,1) = -R_0toi*JR_r0i*log_so3(R_0to1)*H_lambda2toff;
-    H_toff.block(3,0,3,1) = (pose1.p - pose0.p)*H_lambda2toff;
+int Interpolator::insert_pose(double timestamp, const Eigen::Matrix<double,4,1>& q, const Eigen::Matrix<double,3,1>& p,
+                              const Eigen::Matrix<double,3,3>& R_q, const Eigen::Matrix<double,3,3>& R_p) {
 
-    // Done
-    q = rot_2_quat(R_interp);
-    p = p_interp;
-    return true;
+    // Find where this pose should go (typically at the end since they arrive in order)
+    // We ignore any poses that we already have a measurement at
+    size_t idx = pose_times.size();
+    if(!pose_times.empty() && timestamp <= pose_times.back()) {
+        idx = (size_t)(std::lower_bound(pose_times.begin(), pose_times.end(), timestamp)-pose_times.begin());
+        if(pose_times.at(idx) == timestamp)
+            return -1;
+    }
 
+    // Append it to our arrays
+    pose_times.insert(pose_times.begin()+idx, timestamp);
+    pose_q.insert(pose_q.begin()+idx, q);
+    pose_p.insert(pose_p.begin()+idx, p);
+    pose_R_q.insert(pose_R_q.begin()+idx, R_q);
+    pose_R_p.insert(pose_R_p.begin()+idx, R_p);
+    return (int)idx;
 
+}
+
+
+size_t Interpolator::find_index(double timestamp) const {
+
+    // Return if we have no poses, or are outside of the range
+    size_t size = pose_times.size();
+    if(size == 0 || timestamp <= pose_times.front())
+        return 0;
+    if(timestamp > pose_times.back())
+        return size;
+
+    // Guess the location assuming that our poses are uniformly spaced
+    double fraction = (timestamp-pose_times.front())/(pose_times.back()-pose_times.front());
+    size_t guess = std::min((size_t)(fraction*(double)(size-1)), size-1);
+
+    // Gallop from our guess to find a range that contains the timestamp
+    // After this we should have pose_times[lo-1] < timestamp <= pose_times[hi]
+    size_t lo = guess;
+    size_t hi = guess;
+    size_t step = 1;
+    if(pose_times.at(guess) < timestamp) {
+        while(hi < size && pose_times.at(hi) < timestamp) {
+            lo = hi+1;
+            hi = std::min(guess+step, size);
+            step *= 2;
+        }
+    } else {
+        while(lo > 0 && pose_times.at(lo-1) >= timestamp) {
+            hi = lo-1;
+            lo = (guess > step)? guess-step : 0;
+            step *= 2;
+        }
+    }
+
+    // Finally binary search this small range
+    return (size_t)(std::lower_bound(pose_times.begin()+lo, pose_times.begin()+hi, timestamp)-pose_times.begin());
 
 }
 
-bool Interpolator::get_bounds(double timestamp,
-                              double &time0, Eigen::Matrix<double,4,1>& q0, Eigen::Matrix<double,3,1>& p0, Eigen::Matrix<double,6,6>& R0,
-                              double &time1, Eigen::Matrix<double,4,1>& q1, Eigen::Matrix<double,3,1>& p1, Eigen::Matrix<double,6,6>& R1) {
 
+bool Interpolator::find_bounds(double timestamp, size_t &idx0, size_t &idx1) const {
 
-    // Find our bounds for the desired timestamp
-    POSEDATA pose_to_find;
-    pose_to_find.timestamp = timestamp;
-    auto bounds = pose_data.equal_range(pose_to_find);
+    // Find the first pose that is not older than us (lower bound)
+    // And the first pose that is newer than us (upper bound)
+    size_t size = pose_times.size();
+    size_t idx_lower = find_index(timestamp);
+    size_t idx_upper = (idx_lower < size && pose_times.at(idx_lower) == timestamp)? idx_lower+1 : idx_lower;
 
+    // Best we can do at the beginning is just the first vicon pose
     // Return false if we do not have any bounding pose for this measurement (shouldn't happen)
-    if(bounds.first==pose_data.begin() || bounds.first==pose_data.end() || bounds.second==pose_data.end()) {
-        //ROS_ERROR("[INTERPOLATOR]: UNABLE TO FIND BOUNDING POSES, %d, %d",bounds.first==pose_data.end(),bounds.second==pose_data.end());
-        //ROS_ERROR("[INTERPOLATOR]: tmeas = %.9f | time0 = %.9f | time1 = %.9f", timestamp, time0, time1);
+    if(idx_lower == 0 || idx_lower >= size || idx_upper >= size) {
         return false;
     }
-    bounds.first--;
-
-    // Else set our bounds as the bounds our binary search found
-    POSEDATA pose0 = *bounds.first;
-    POSEDATA pose1 = *bounds.second;
-
-    // Pose 0
-    time0 = pose0.timestamp;
-    q0 = pose0.q;
-    p0 = pose0.p;
-    R0.setZero();
-    R0.block(0,0,3,3) = pose0.R_q;
-    R0.block(3,3,3,3) = pose0.R_p;
-
-    // Pose 1
-    time1 = pose1.timestamp;
-    q1 = pose1.q;
-    p1 = pose1.p;
-    R1.setZero();
-    R1.block(0,0,3,3) = pose1.R_q;
-    R1.block(3,3,3,3) = pose1.R_p;
 
+    // Older pose is right before the lower bound, newer is the upper bound
+    idx0 = idx_lower-1;
+    idx1 = idx_upper;
     return true;
 
 }
-
-
@@ -22,32 +22,36 @@
 
 #include <vector>
 #include <algorithm>
+#include <utility>
 #include <Eigen/Eigen>
-#include <ros/ros.h>
+#include <Eigen/StdVector>
 
 #include "cpi/CpiV1.h"
+#include "utils/profiler.h"
 #include "utils/quat_ops.h"
 
 
-struct POSEDATA {
-    double timestamp = -1;
-    bool has_odom = false;
-    // ori, pos, vel, ang
-    Eigen::Matrix<double,4,1> q;
-    Eigen::Matrix<double,3,1> p;
-    Eigen::Matrix<double,3,1> v;
-    Eigen::Matrix<double,3,1> w;
-    // noise covariances
-    Eigen::Matrix<double,3,3> R_q;
-    Eigen::Matrix<double,3,3> R_p;
-    Eigen::Matrix<double,3,3> R_v;
-    Eigen::Matrix<double,3,3> R_w;
-    // Comparison operator
-    bool operator< ( const POSEDATA& s ) const { return timestamp < s.timestamp; }
-    bool operator> ( const POSEDATA& s ) const { return timestamp > s.timestamp; }
+/**
+ * @brief Read-only view of the raw poses inside of the interpolator.
+ *
+ * All arrays are sorted by timestamp and have the same length.
+ * This references the interpolator storage directly, so it should not outlive it.
+ */
+struct POSEVIEW {
+    const std::vector<double> &timestamps;
+    const std::vector<Eigen::Matrix<double,4,1>,Eigen::aligned_allocator<Eigen::Matrix<double,4,1>>> &q;
+    const std::vector<Eigen::Matrix<double,3,1>> &p;
+    /// Number of poses we have
+    size_t size() const { return timestamps.size(); }
 };
 
 
+/**
+ * @brief Stores vicon poses sorted by time and interpolates them (with covariance) at any time between them.
+ *
+ * All queries are const and do not keep any state between calls, thus any number of threads can query at the same time.
+ * Poses should not be fed while other threads are querying.
+ */
 class Interpolator
 {
 
@@ -68,27 +72,88 @@ public:
 
     /// Given a timestamp, this will get the pose at that time
     /// If we don't have that pose in our vector, we will perform interpolation to get it
-    bool get_pose(double timestamp, Eigen::Matrix<double,4,1>& q, Eigen::Matrix<double,3,1>& p, Eigen::Matrix<double,6,6>& R);
+    bool get_pose(double timestamp, Eigen::Matrix<double,4,1>& q, Eigen::Matrix<double,3,1>& p, Eigen::Matrix<double,6,6>& R) const;
 
     /// Given a timestamp, this will get the pose at that time
     /// If we don't have that pose in our vector, we will perform interpolation to get it
-    bool get_pose_with_jacobian(double timestamp, Eigen::Matrix<double,4,1>& q, Eigen::Matrix<double,3,1>& p, Eigen::Matrix<double,6,6>& R, Eigen::Matrix<double,6,1>& H_toff);
+    bool get_pose_with_jacobian(double timestamp, Eigen::Matrix<double,4,1>& q, Eigen::Matrix<double,3,1>& p, Eigen::Matrix<double,6,6>& R, Eigen::Matrix<double,6,1>& H_toff) const;
 
     /// Given a timestamp, this will find the bounding poses for them
     bool get_bounds(double timestamp,
             double &time0, Eigen::Matrix<double,4,1>& q0, Eigen::Matrix<double,3,1>& p0, Eigen::Matrix<double,6,6>& R0,
-            double &time1, Eigen::Matrix<double,4,1>& q1, Eigen::Matrix<double,3,1>& p1, Eigen::Matrix<double,6,6>& R1);
+            double &time1, Eigen::Matrix<double,4,1>& q1, Eigen::Matrix<double,3,1>& p1, Eigen::Matrix<double,6,6>& R1) const;
+
+    /**
+     * @brief Finds the time intervals that we are able to interpolate valid poses in
+     *
+     * This is done in a single pass over our poses, so it is cheap to check if a time is covered afterwards.
+     * Each interval is open on both ends, the same as get_pose() which needs a pose on both sides of the queried time.
+     * We do not interpolate between two poses if either has a non-finite or non positive definite covariance (e.g. dropouts),
+     * or if they are more than the max dt apart.
+     *
+     * @param max_dt Largest time between two poses that we will interpolate between (sec), zero will not limit it
+     * @return Sorted and non-overlapping intervals (start, end) that have valid poses
+     */
+    std::vector<std::pair<double,double>> get_coverage(double max_dt) const;
+
+    /**
+     * @brief Removes poses that are no longer needed to interpolate from the given time.
+     *
+     * We keep the newest pose before the timestamp, since it is needed to interpolate right after it.
+     * This should not be called while other threads are interpolating.
+     *
+     * @param timestamp Oldest time we will want to interpolate at in the future
+     */
+    void clean_older_than(double timestamp);
 
     /// Get all raw poses (used only for viz)
-    std::set<POSEDATA,std::less<POSEDATA>> get_raw_poses() {
-        return pose_data;
+    POSEVIEW get_raw_poses() const {
+        return POSEVIEW{pose_times, pose_q, pose_p};
     }
 
 private:
 
-    // Our history of POSE messages (time, ori, pos, vel, ang)
+    /**
+     * @brief Inserts a new pose into our sorted arrays
+     * Poses with a timestamp that is already in our history are ignored.
+     * @return Index we have inserted at, or -1 if it was a duplicate
+     */
+    int insert_pose(double timestamp, const Eigen::Matrix<double,4,1>& q, const Eigen::Matrix<double,3,1>& p,
+                    const Eigen::Matrix<double,3,3>& R_q, const Eigen::Matrix<double,3,3>& R_p);
+
+    /**
+     * @brief Finds the index of the first pose that is not older than the given timestamp (i.e. std::lower_bound).
+     * Since our poses are typically uniform in time we first guess the location by interpolating the timestamp.
+     * We then gallop from this guess to bracket the true location, and finish with a binary search.
+     */
+    size_t find_index(double timestamp) const;
+
+    /**
+     * @brief Finds the two poses that bound the given timestamp
+     * @param timestamp Desired time we want to interpolate at
+     * @param idx0 Index of the older pose
+     * @param idx1 Index of the newer pose
+     * @return False if we do not have bounding poses
+     */
+    bool find_bounds(double timestamp, size_t &idx0, size_t &idx1) const;
+
+    /// Returns true if the pose at this index is finite and has a positive definite covariance
+    bool is_valid_pose(size_t idx) const;
+
+    // Our history of POSE messages stored as sorted arrays (time, ori, pos, and their noise)
     // Note that this is sorted by timestamps so we can binary search through it....
-    std::set<POSEDATA,std::less<POSEDATA>> pose_data;
+    std::vector<double> pose_times;
+    std::vector<Eigen::Matrix<double,4,1>,Eigen::aligned_allocator<Eigen::Matrix<double,4,1>>> pose_q;
+    std::vector<Eigen::Matrix<double,3,1>> pose_p;
+    std::vector<Eigen::Matrix<double,3,3>> pose_R_q;
+    std::vector<Eigen::Matrix<double,3,3>> pose_R_p;
+
+    // Velocities and their noises if we have been given ODOM measurements
+    // These are only allocated once the first odometry message is fed (zero for pose only measurements)
+    std::vector<Eigen::Matrix<double,3,1>> pose_v;
+    std::vector<Eigen::Matrix<double,3,1>> pose_w;
+    std::vector<Eigen::Matrix<double,3,3>> pose_R_v;
+    std::vector<Eigen::Matrix<double,3,3>> pose_R_w;
 
 };
 
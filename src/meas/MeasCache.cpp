@@ -0,0 +1,145 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "MeasCache.h"
+
+#include <sstream>
+#include <iomanip>
+#include <boost/filesystem.hpp>
+
+
+// Definition of our version (we take its address when writing)
+const uint32_t MeasCache::VERSION;
+
+// Magic string at the start of every cache file
+static const char CACHE_MAGIC[8] = {'V','2','G','T','M','E','A','S'};
+
+
+bool MeasCache::load(const std::string &path, const std::string &key) {
+
+    // Start timing
+    ProfileScope scope("cache_load");
+
+    // Open the file
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if(!file.is_open())
+        return false;
+
+    // Check that this is our file, and the version matches
+    char magic[8];
+    uint32_t version = 0;
+    if(!file.read(magic, sizeof(magic)) || !std::equal(magic, magic+sizeof(magic), CACHE_MAGIC))
+        return false;
+    if(!file.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != VERSION)
+        return false;
+
+    // Check that the key matches
+    std::vector<char> key_file;
+    if(!read_vector(file, key_file) || std::string(key_file.begin(), key_file.end()) != key)
+        return false;
+
+    // Finally read in all our measurements
+    bool success = read_vector(file, imu_times) && read_vector(file, imu_wm) && read_vector(file, imu_am)
+            && read_vector(file, cam_times)
+            && read_vector(file, vicon_times) && read_vector(file, vicon_q) && read_vector(file, vicon_p)
+            && read_vector(file, vicon_cov) && read_vector(file, vicon_has_cov);
+
+    // Ensure that all our vectors are the same size
+    success = success && imu_wm.size() == imu_times.size() && imu_am.size() == imu_times.size()
+            && vicon_q.size() == vicon_times.size() && vicon_p.size() == vicon_times.size()
+            && vicon_cov.size() == vicon_times.size() && vicon_has_cov.size() == vicon_times.size();
+
+    // If the file is corrupt, then do not leave any of it behind for the caller to append the bag onto
+    if(!success)
+        *this = MeasCache();
+    return success;
+
+}
+
+
+bool MeasCache::save(const std::string &path, const std::string &key) const {
+
+    // Start timing
+    ProfileScope scope("cache_save");
+
+    // Open the file
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+        return false;
+
+    // Header with our version and key
+    std::vector<char> key_file(key.begin(), key.end());
+    file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+    write_vector(file, key_file);
+
+    // Finally write all our measurements
+    write_vector(file, imu_times);
+    write_vector(file, imu_wm);
+    write_vector(file, imu_am);
+    write_vector(file, cam_times);
+    write_vector(file, vicon_times);
+    write_vector(file, vicon_q);
+    write_vector(file, vicon_p);
+    write_vector(file, vicon_cov);
+    write_vector(file, vicon_has_cov);
+    file.close();
+    return !file.fail();
+
+}
+
+
+
+std::string MeasCache::make_key(const std::string &path_bag, const std::string &topic_imu, const std::string &topic_cam,
+                                const std::string &topic_vicon, double bag_start, double bag_durr) {
+    std::stringstream key;
+    key << std::setprecision(20) << path_bag << "|" << topic_imu << "|" << topic_cam << "|" << topic_vicon << "|"
+        << bag_start << "|" << bag_durr;
+    if(boost::filesystem::exists(path_bag)) {
+        key << "|" << boost::filesystem::file_size(path_bag) << "|" << boost::filesystem::last_write_time(path_bag);
+    }
+    return key.str();
+}
+
+
+
+void MeasCache::feed(Propagator &propagator, Interpolator &interpolator, const Eigen::Matrix<double,3,3> &R_q,
+                     const Eigen::Matrix<double,3,3> &R_p, bool use_manual_sigmas) const {
+
+    // Start timing
+    ProfileScope scope("cache_feed");
+
+    // Feed our IMU measurements (we know how many there are, so allocate the history once)
+    propagator.reserve(imu_times.size());
+    for(size_t i=0; i<imu_times.size(); i++) {
+        propagator.feed_imu(imu_times.at(i),imu_wm.at(i),imu_am.at(i));
+    }
+
+    // Feed our VICON measurements
+    // If the message did not have a covariance, or we are using manual sigmas, we need to use the manual sigmas
+    for(size_t i=0; i<vicon_times.size(); i++) {
+        Eigen::Matrix<double,6,6> pose_cov = vicon_cov.at(i);
+        if(!vicon_has_cov.at(i) || use_manual_sigmas) {
+            pose_cov = Eigen::Matrix<double,6,6>::Zero();
+            pose_cov.block(3,3,3,3) = R_q;
+            pose_cov.block(0,0,3,3) = R_p;
+        }
+        interpolator.feed_pose(vicon_times.at(i),vicon_q.at(i),vicon_p.at(i),pose_cov.block(3,3,3,3),pose_cov.block(0,0,3,3));
+    }
+
+}
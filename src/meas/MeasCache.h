@@ -0,0 +1,160 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef MEASCACHE_H
+#define MEASCACHE_H
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <Eigen/Eigen>
+#include <Eigen/StdVector>
+
+#include "meas/Interpolator.h"
+#include "meas/Propagator.h"
+
+
+/**
+ * @brief Binary cache of the raw measurements we have loaded from a rosbag.
+ *
+ * Parsing a large rosbag can take minutes, so we save the raw measurements to a compact binary file.
+ * Each cache is stored with a key string (e.g. bag path, topics and time window) and a format version.
+ * When loading, if either of these do not match then the cache is treated as stale and not used.
+ *
+ * We save the measurements as they are in the bag, and not the noises that will be fed into the interpolator.
+ * Thus things like the vicon sigmas can be changed without invalidating the cache.
+ * Note that the file is written in the byte order of this machine.
+ */
+class MeasCache
+{
+
+public:
+
+    /// Version of the file format, increment this if the layout of the file changes
+    static const uint32_t VERSION = 1;
+
+    /// Default constructor
+    MeasCache() { }
+
+    /**
+     * @brief Try to load the cache from file
+     * @param path Path to the cache file
+     * @param key Key that the cache should have been saved with
+     * @return False if the file does not exist, or was saved with a different key or version
+     */
+    bool load(const std::string &path, const std::string &key);
+
+    /**
+     * @brief Saves the cache to file
+     * @param path Path to the cache file (will be overwritten)
+     * @param key Key that we will save with this cache
+     * @return False if we were unable to write the file
+     */
+    bool save(const std::string &path, const std::string &key) const;
+
+    /**
+     * @brief Creates the key a cache of a rosbag should have
+     * This includes the bag size and modification time (if it exists) so we know if it has changed.
+     * @param path_bag Path to the rosbag
+     * @param topic_imu IMU topic
+     * @param topic_cam Camera topic
+     * @param topic_vicon Vicon topic
+     * @param bag_start How many seconds into the bag we start
+     * @param bag_durr How far after the start we load (negative for the whole bag)
+     * @return Key of the cache
+     */
+    static std::string make_key(const std::string &path_bag, const std::string &topic_imu, const std::string &topic_cam,
+                                const std::string &topic_vicon, double bag_start, double bag_durr);
+
+    /**
+     * @brief Feeds all our measurements into the propagator and interpolator
+     *
+     * If the vicon message did not have a covariance, or we are using manual sigmas, we will use the manual sigmas.
+     *
+     * @param propagator Propagator we will feed the IMU measurements to
+     * @param interpolator Interpolator we will feed the vicon poses to
+     * @param R_q Manual vicon orientation covariance
+     * @param R_p Manual vicon position covariance
+     * @param use_manual_sigmas If we should always use the manual covariances
+     */
+    void feed(Propagator &propagator, Interpolator &interpolator, const Eigen::Matrix<double,3,3> &R_q,
+              const Eigen::Matrix<double,3,3> &R_p, bool use_manual_sigmas) const;
+
+    /// IMU measurements (time, angular, linear)
+    std::vector<double> imu_times;
+    std::vector<Eigen::Matrix<double,3,1>> imu_wm;
+    std::vector<Eigen::Matrix<double,3,1>> imu_am;
+
+    /// Camera timestamps
+    std::vector<double> cam_times;
+
+    /// Vicon measurements (time, ori, pos)
+    std::vector<double> vicon_times;
+    std::vector<Eigen::Matrix<double,4,1>,Eigen::aligned_allocator<Eigen::Matrix<double,4,1>>> vicon_q;
+    std::vector<Eigen::Matrix<double,3,1>> vicon_p;
+
+    /// Vicon covariance from the message (order=x,y,z,rx,ry,rz), only valid if the message had one (i.e. odometry)
+    std::vector<Eigen::Matrix<double,6,6>,Eigen::aligned_allocator<Eigen::Matrix<double,6,6>>> vicon_cov;
+    std::vector<uint8_t> vicon_has_cov;
+
+private:
+
+    /// Writes a vector to the file, as its length followed by its raw elements
+    template<typename T, typename A>
+    static void write_vector(std::ofstream &file, const std::vector<T,A> &vec) {
+        uint64_t size = vec.size();
+        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        if(size > 0)
+            file.write(reinterpret_cast<const char*>(vec.data()), (std::streamsize)(size*sizeof(T)));
+    }
+
+    /// Number of bytes left to read in the file, or negative if we can not tell
+    static std::streamoff bytes_left(std::ifstream &file) {
+        std::streampos pos = file.tellg();
+        if(pos < 0)
+            return -1;
+        file.seekg(0, std::ios::end);
+        std::streampos end = file.tellg();
+        file.seekg(pos);
+        if(end < 0 || !file)
+            return -1;
+        return (std::streamoff)(end-pos);
+    }
+
+    /// Reads a vector that was written with write_vector(), returns false if the file ended early or the length does not fit in it
+    template<typename T, typename A>
+    static bool read_vector(std::ifstream &file, std::vector<T,A> &vec) {
+        uint64_t size = 0;
+        if(!file.read(reinterpret_cast<char*>(&size), sizeof(size)))
+            return false;
+        // A corrupt length could be anything, so check it is in the rest of the file before we allocate it
+        std::streamoff left = bytes_left(file);
+        if(left < 0 || size > (uint64_t)left/sizeof(T))
+            return false;
+        vec.resize(size);
+        if(size > 0 && !file.read(reinterpret_cast<char*>(vec.data()), (std::streamsize)(size*sizeof(T))))
+            return false;
+        return true;
+    }
+
+};
+
+
+#endif /* MEASCACHE_H */
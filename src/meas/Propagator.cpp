@@ -27,34 +27,112 @@ void Propagator::feed_imu(double timestamp, Eigen::Matrix<double,3,1> wm, Eigen:
     data.wm = wm;
     data.am = am;
 
-    // Append it to our vector
-    imu_data.emplace_back(data);
+    // Append it to our history, adding a new chunk if the newest is full
+    if(imu_size == 0 || get_timestamp(imu_size-1) <= timestamp) {
+        size_t j = imu_start+imu_size;
+        if(j/CHUNK_SIZE >= imu_chunks.size())
+            add_chunk(timestamp);
+        IMUDATA overflow;
+        insert_into_chunk(imu_chunks.back(), j%CHUNK_SIZE, data, overflow);
+        imu_size++;
+        return;
+    }
+
+    // If it is out of order, then insert it so that our history remains sorted
+    // As all chunks but the newest are full, each chunk we insert into pushes its newest measurement into the next
+    size_t lo = 0;
+    size_t hi = imu_size;
+    while(lo < hi) {
+        size_t mid = lo+(hi-lo)/2;
+        if(timestamp < get_timestamp(mid)) hi = mid;
+        else lo = mid+1;
+    }
+    size_t j = imu_start+lo;
+    size_t c = j/CHUNK_SIZE;
+    size_t k = j%CHUNK_SIZE;
+    IMUDATA overflow;
+    while(insert_into_chunk(imu_chunks.at(c), k, data, overflow)) {
+        data = overflow;
+        c++;
+        k = 0;
+        if(c >= imu_chunks.size())
+            add_chunk(data.timestamp);
+    }
+    imu_size++;
+
+}
+
+
+void Propagator::add_chunk(double time_base) {
+
+    // Allocate the whole chunk at once (with room for one overflow measurement while inserting)
+    imu_chunks.emplace_back();
+    IMUCHUNK &chunk = imu_chunks.back();
+    chunk.time_base = time_base;
+    if(compact) chunk.data_compact.reserve(CHUNK_SIZE+1);
+    else chunk.data.reserve(CHUNK_SIZE+1);
 
 }
 
 
-bool Propagator::propagate(double time0, double time1, Eigen::Matrix<double,3,1> bg_lin, Eigen::Matrix<double,3,1> ba_lin, CpiV1& integration) {
+bool Propagator::insert_into_chunk(IMUCHUNK &chunk, size_t k, const IMUDATA &data, IMUDATA &overflow) {
 
+    // Full precision measurements are stored as is
+    if(!compact) {
+        chunk.data.insert(chunk.data.begin()+k, data);
+        if(chunk.data.size() <= CHUNK_SIZE)
+            return false;
+        overflow = chunk.data.back();
+        chunk.data.pop_back();
+        return true;
+    }
+
+    // Else store it relative to the time base of this chunk
+    chunk.data_compact.insert(chunk.data_compact.begin()+k, encode(chunk, data));
+    if(chunk.data_compact.size() <= CHUNK_SIZE)
+        return false;
+    overflow = decode(chunk, chunk.data_compact.back());
+    chunk.data_compact.pop_back();
+    return true;
+
+}
+
+
+bool Propagator::propagate(double time0, double time1, const Eigen::Matrix<double,3,1>& bg_lin, const Eigen::Matrix<double,3,1>& ba_lin, CpiV1& integration) {
+
+    // Record how long each call takes (only into the statistics as this is called for every interval)
+    ProfileScope scope("propagate", false);
 
     // First lets construct an IMU vector of measurements we need
-    std::vector<IMUDATA> prop_data;
+    // Each thread reuses its own buffer, so we do not allocate for every interval
+    static thread_local std::vector<IMUDATA> prop_data;
+    prop_data.clear();
 
     // Ensure we have some measurements in the first place!
-    if(imu_data.empty()) {
+    if(imu_size == 0) {
         printf(YELLOW "No IMU measurements to use!!\n" RESET);
         return false;
     }
 
+    // Find where our integration period starts in the history
+    // All measurements before the one right before time0 can not be used, so we skip them
+    size_t idx_start = find_index(time0);
+    idx_start = (idx_start > 0)? idx_start-1 : 0;
+
     // Loop through and find all the needed measurements to propagate with
     // Note we split measurements based on the given state time, and the update timestamp
-    for(size_t i=0; i<imu_data.size()-1; i++) {
+    // Each measurement is decoded from our history once, as we move forward in it
+    IMUDATA imu_next = get_data(idx_start);
+    for(size_t i=idx_start; i<imu_size-1; i++) {
+        IMUDATA imu_curr = imu_next;
+        imu_next = get_data(i+1);
 
         // START OF THE INTEGRATION PERIOD
         // If the next timestamp is greater then our current state time
         // And the current is not greater then it yet...
         // Then we should "split" our current IMU measurement
-        if(imu_data.at(i+1).timestamp > time0 && imu_data.at(i).timestamp < time0) {
-            IMUDATA data = Propagator::interpolate_data(imu_data.at(i),imu_data.at(i+1), time0);
+        if(imu_next.timestamp > time0 && imu_curr.timestamp < time0) {
+            IMUDATA data = Propagator::interpolate_data(imu_curr,imu_next, time0);
             prop_data.push_back(data);
             //printf("propagation #%d = CASE 1 = %.3f => %.3f\n", (int)i,data.timestamp-prop_data.at(0).timestamp,time0-prop_data.at(0).timestamp);
             continue;
@@ -63,9 +141,9 @@ bool Propagator::propagate(double time0, double time1, Eigen::Matrix<double,3,1>
         // MIDDLE OF INTEGRATION PERIOD
         // If our imu measurement is right in the middle of our propagation period
         // Then we should just append the whole measurement time to our propagation vector
-        if(imu_data.at(i).timestamp >= time0 && imu_data.at(i+1).timestamp <= time1) {
-            prop_data.push_back(imu_data.at(i));
-            //printf("propagation #%d = CASE 2 = %.3f\n",(int)i,imu_data.at(i).timestamp-prop_data.at(0).timestamp);
+        if(imu_curr.timestamp >= time0 && imu_next.timestamp <= time1) {
+            prop_data.push_back(imu_curr);
+            //printf("propagation #%d = CASE 2 = %.3f\n",(int)i,imu_curr.timestamp-prop_data.at(0).timestamp);
             continue;
         }
 
@@ -74,27 +152,27 @@ bool Propagator::propagate(double time0, double time1, Eigen::Matrix<double,3,1>
         // We should just "split" the NEXT IMU measurement to the update time,
         // NOTE: we add the current time, and then the time at the end of the interval (so we can get a dt)
         // NOTE: we also break out of this loop, as this is the last IMU measurement we need!
-        if(imu_data.at(i+1).timestamp > time1) {
+        if(imu_next.timestamp > time1) {
             // If we have a very low frequency IMU then, we could have only recorded the first integration (i.e. case 1) and nothing else
             // In this case, both the current IMU measurement and the next is greater than the desired intepolation, thus we should just cut the current at the desired time
             // Else, we have hit CASE2 and this IMU measurement is not past the desired propagation time, thus add the whole IMU reading
-            if(imu_data.at(i).timestamp > time1 && i == 0) {
+            if(imu_curr.timestamp > time1 && i == 0) {
                 // This case can happen if we don't have any imu data that has occured before the startup time
                 // This means that either we have dropped IMU data, or we have not gotten enough.
                 // In this case we can't propgate forward in time, so there is not that much we can do.
                 break;
-            } else if(imu_data.at(i).timestamp > time1) {
-                IMUDATA data = interpolate_data(imu_data.at(i-1), imu_data.at(i), time1);
+            } else if(imu_curr.timestamp > time1) {
+                IMUDATA data = interpolate_data(get_data(i-1), imu_curr, time1);
                 prop_data.push_back(data);
-                //printf("propagation #%d = CASE 3.1 = %.3f => %.3f\n", (int)i,imu_data.at(i).timestamp-prop_data.at(0).timestamp,imu_data.at(i).timestamp-time0);
+                //printf("propagation #%d = CASE 3.1 = %.3f => %.3f\n", (int)i,imu_curr.timestamp-prop_data.at(0).timestamp,imu_curr.timestamp-time0);
             } else {
-                prop_data.push_back(imu_data.at(i));
-                //printf("propagation #%d = CASE 3.2 = %.3f => %.3f\n", (int)i,imu_data.at(i).timestamp-prop_data.at(0).timestamp,imu_data.at(i).timestamp-time0);
+                prop_data.push_back(imu_curr);
+                //printf("propagation #%d = CASE 3.2 = %.3f => %.3f\n", (int)i,imu_curr.timestamp-prop_data.at(0).timestamp,imu_curr.timestamp-time0);
             }
             // If the added IMU message doesn't end exactly at the camera time
             // Then we need to add another one that is right at the ending time
             if(prop_data.at(prop_data.size()-1).timestamp != time1) {
-                IMUDATA data = interpolate_data(imu_data.at(i), imu_data.at(i+1), time1);
+                IMUDATA data = interpolate_data(imu_curr, imu_next, time1);
                 prop_data.push_back(data);
                 //printf("propagation #%d = CASE 3.3 = %.3f => %.3f\n", (int)i,data.timestamp-prop_data.at(0).timestamp,data.timestamp-time0);
             }
@@ -118,13 +196,18 @@ bool Propagator::propagate(double time0, double time1, Eigen::Matrix<double,3,1>
 
     // Loop through and ensure we do not have an zero dt values
     // This would cause the noise covariance to be Infinity
-    for (size_t i=0; i < prop_data.size()-1; i++) {
-        if (std::abs(prop_data.at(i+1).timestamp-prop_data.at(i).timestamp) < 1e-12) {
+    // We remove the older of the two readings, and compact the rest forward in place
+    size_t num_kept = 0;
+    for (size_t i=0; i < prop_data.size(); i++) {
+        if (i+1 < prop_data.size() && std::abs(prop_data.at(i+1).timestamp-prop_data.at(i).timestamp) < 1e-12) {
             printf(YELLOW "Zero DT between IMU reading %d and %d, removing it!\n" RESET, (int)i, (int)(i+1));
-            prop_data.erase(prop_data.begin()+i);
-            i--;
+            continue;
         }
+        if (num_kept != i)
+            prop_data.at(num_kept) = prop_data.at(i);
+        num_kept++;
     }
+    prop_data.resize(num_kept);
 
     // Check that we have at least one measurement to propagate with
     if(prop_data.size() < 2) {
@@ -168,30 +251,69 @@ bool Propagator::propagate(double time0, double time1, Eigen::Matrix<double,3,1>
 bool Propagator::has_bounding_imu(double timestamp) {
 
     // Ensure we have some measurements in the first place!
-    if (imu_data.empty()) {
+    if (imu_size == 0) {
         return false;
     }
 
-    // If we have a lower and upper bounding imu
-    bool has_lower = false;
-    bool has_upper = false;
+    // Since our history is sorted, we just need to check the oldest and newest
+    bool has_lower = (get_timestamp(0) <= timestamp);
+    bool has_upper = (get_timestamp(imu_size-1) >= timestamp);
 
-    // Loop through and find bounding IMU
-    for (size_t i = 0; i < imu_data.size(); i++) {
-        // Check if we have a lower bound
-        if (imu_data.at(i).timestamp <= timestamp) {
-            has_lower = true;
-        }
-        // Check if we have an upper bound
-        if (imu_data.at(i).timestamp >= timestamp) {
-            has_upper = true;
+    // Return if we found
+    return (has_lower && has_upper);
+
+}
+
+
+size_t Propagator::find_index(double timestamp) const {
+
+    // Our search range in the history
+    size_t size = imu_size;
+    size_t lo = 0;
+    size_t hi = size;
+
+    // Use our last lookup to narrow down the range
+    // If the hint is older than the timestamp, we gallop forward doubling our step each time
+    size_t hint = std::min(cursor.load(std::memory_order_relaxed), size);
+    if(hint == 0 || get_timestamp(hint-1) < timestamp) {
+        lo = hint;
+        size_t step = 1;
+        size_t bound = hint;
+        while(bound < size && get_timestamp(bound) < timestamp) {
+            lo = bound+1;
+            bound = hint+step;
+            step *= 2;
         }
-        // Break early
-        if(has_lower && has_upper)
-            break;
+        hi = std::min(bound, size);
+    } else {
+        hi = hint;
     }
 
-    // Return if we found
-    return (has_lower && has_upper);
+    // Finally binary search the remaining range
+    while(lo < hi) {
+        size_t mid = lo+(hi-lo)/2;
+        if(get_timestamp(mid) < timestamp) lo = mid+1;
+        else hi = mid;
+    }
+    cursor.store(lo, std::memory_order_relaxed);
+    return lo;
+
+}
+
+
+
+void Propagator::clean_older_than(double timestamp) {
+
+    // Find the first measurement that we might need, and keep the one before it
+    size_t idx = find_index(timestamp);
+    if(idx < 2)
+        return;
+
+    // Free all chunks that only have older measurements, the rest of the first chunk is skipped
+    size_t j = imu_start+(idx-1);
+    imu_chunks.erase(imu_chunks.begin(), imu_chunks.begin()+(long)(j/CHUNK_SIZE));
+    imu_start = j%CHUNK_SIZE;
+    imu_size -= idx-1;
+    cursor = 0;
 
 }
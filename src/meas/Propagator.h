@@ -21,13 +21,15 @@
 
 
 #include <vector>
+#include <atomic>
+#include <algorithm>
 #include <Eigen/Eigen>
-#include <ros/ros.h>
 
 #include "cpi/CpiBase.h"
 #include "cpi/CpiV1.h"
 #include "utils/quat_ops.h"
 #include "utils/colors.h"
+#include "utils/profiler.h"
 
 
 struct IMUDATA {
@@ -37,37 +39,106 @@ struct IMUDATA {
 };
 
 
+/**
+ * @brief IMU measurement stored in single precision, with its time relative to the time base of its chunk.
+ * This is half the size of IMUDATA, while the float precision is still well below the noise of any IMU.
+ */
+struct IMUCOMPACT {
+    float dt;
+    float wm[3];
+    float am[3];
+};
+
+
+/**
+ * @brief Fixed capacity chunk of our IMU history, which is allocated once and never grows past its capacity.
+ * Only one of the two arrays is used, depending on if the propagator is compact or not.
+ */
+struct IMUCHUNK {
+    double time_base = 0.0;
+    std::vector<IMUDATA> data;
+    std::vector<IMUCOMPACT> data_compact;
+};
+
+
+/**
+ * @brief Stores IMU measurements sorted by time and preintegrates them between any two times.
+ *
+ * Many threads can propagate at the same time, as each uses its own scratch buffer and the lookup hint is atomic.
+ * Measurements should not be fed or cleaned while other threads are propagating.
+ *
+ * The history is stored in fixed size chunks, so growing it never needs to copy the measurements we already have.
+ * If compact, each measurement is stored in single precision with its time relative to the first of its chunk (see @ref IMUCOMPACT).
+ * These are decoded back to double precision as they are used in propagate().
+ * Each chunk only spans a few seconds for typical IMU rates, thus the times decoded are within a microsecond.
+ */
 class Propagator
 {
 
 public:
 
-    /// Default constuctor
-    Propagator(double sigmaw, double sigmawb, double sigmaa, double sigmaab) {
+    /// Number of measurements in each chunk of our history
+    static const size_t CHUNK_SIZE = 1024;
+
+    /// Default constuctor, if compact we will store the measurements in single precision
+    Propagator(double sigmaw, double sigmawb, double sigmaa, double sigmaab, bool compact = false) : cursor(0) {
         this->sigma_w = sigmaw;
         this->sigma_wb = sigmawb;
         this->sigma_a = sigmaa;
         this->sigma_ab = sigmaab;
+        this->compact = compact;
     }
 
-    /// Our feed function for IMU measurements, will append to our historical vector
+    /// Our feed function for IMU measurements, will append to our historical vector (kept sorted by time)
     void feed_imu(double timestamp, Eigen::Matrix<double,3,1> wm, Eigen::Matrix<double,3,1> am);
 
+    /// Reserves space for the number of IMU measurements we expect to be fed (e.g. the number of messages in the bag)
+    void reserve(size_t num_imu) {
+        imu_chunks.reserve((num_imu+CHUNK_SIZE-1)/CHUNK_SIZE);
+    }
+
+    /// Number of IMU measurements we have
+    size_t size() const {
+        return imu_size;
+    }
+
     /// This will propgate the preintegration class between the two requested timesteps
-    bool propagate(double time0, double time1, Eigen::Matrix<double,3,1> bg_lin, Eigen::Matrix<double,3,1> ba_lin, CpiV1& integration);
+    bool propagate(double time0, double time1, const Eigen::Matrix<double,3,1>& bg_lin, const Eigen::Matrix<double,3,1>& ba_lin, CpiV1& integration);
 
     /// Checks if we have bounding IMU poses around a given timestamp
     bool has_bounding_imu(double timestamp);
 
+    /**
+     * @brief Removes IMU measurements that are no longer needed to propagate from the given time.
+     *
+     * We keep the newest measurement before the timestamp, since it is needed to interpolate at the timestamp itself.
+     * This should not be called while other threads are propagating.
+     *
+     * @param timestamp Oldest time we will want to propagate from in the future
+     */
+    void clean_older_than(double timestamp);
+
 private:
 
+    /**
+     * @brief Finds the index of the first IMU measurement that is not older than the given timestamp.
+     *
+     * This is a binary search over our time sorted history (i.e. the same as std::lower_bound).
+     * We start the search from the index of the last lookup and gallop forward from there.
+     * Thus if the requested times are monotonic (as they are when building the graph) each lookup only touches a few measurements.
+     *
+     * @param timestamp Time we want to find in our history
+     * @return Index into our IMU history (will be the size of the history if all are older)
+     */
+    size_t find_index(double timestamp) const;
+
 
     /**
      * Nice helper function that will linearly interpolate between two imu messages
      * This should be used instead of just "cutting" imu messages that bound the camera times
      * Give better time offset if we use this function....
      */
-    IMUDATA interpolate_data(IMUDATA imu_1, IMUDATA imu_2, double timestamp) {
+    IMUDATA interpolate_data(const IMUDATA& imu_1, const IMUDATA& imu_2, double timestamp) const {
         // time-distance lambda
         double lambda = (timestamp-imu_1.timestamp)/(imu_2.timestamp-imu_1.timestamp);
         //cout << "lambda - " << lambda << endl;
@@ -79,8 +150,69 @@ private:
         return data;
     }
 
-    // Our history of IMU messages (time, angular, linear)
-    std::vector<IMUDATA> imu_data;
+    /// Gets the IMU measurement at an index of our history (decoded if compact)
+    IMUDATA get_data(size_t idx) const {
+        size_t j = imu_start+idx;
+        const IMUCHUNK &chunk = imu_chunks.at(j/CHUNK_SIZE);
+        if(!compact)
+            return chunk.data.at(j%CHUNK_SIZE);
+        return decode(chunk, chunk.data_compact.at(j%CHUNK_SIZE));
+    }
+
+    /// Gets the time of the IMU measurement at an index of our history
+    double get_timestamp(size_t idx) const {
+        size_t j = imu_start+idx;
+        const IMUCHUNK &chunk = imu_chunks.at(j/CHUNK_SIZE);
+        if(!compact)
+            return chunk.data.at(j%CHUNK_SIZE).timestamp;
+        return chunk.time_base+(double)chunk.data_compact.at(j%CHUNK_SIZE).dt;
+    }
+
+    /// Converts a measurement to its single precision version in the given chunk
+    static IMUCOMPACT encode(const IMUCHUNK &chunk, const IMUDATA &data) {
+        IMUCOMPACT data_compact;
+        data_compact.dt = (float)(data.timestamp-chunk.time_base);
+        for(int k=0; k<3; k++) {
+            data_compact.wm[k] = (float)data.wm(k);
+            data_compact.am[k] = (float)data.am(k);
+        }
+        return data_compact;
+    }
+
+    /// Converts a single precision measurement of the given chunk back to a full measurement
+    static IMUDATA decode(const IMUCHUNK &chunk, const IMUCOMPACT &data_compact) {
+        IMUDATA data;
+        data.timestamp = chunk.time_base+(double)data_compact.dt;
+        data.wm << (double)data_compact.wm[0], (double)data_compact.wm[1], (double)data_compact.wm[2];
+        data.am << (double)data_compact.am[0], (double)data_compact.am[1], (double)data_compact.am[2];
+        return data;
+    }
+
+    /// Appends a new chunk to our history, whose times are relative to the given time
+    void add_chunk(double time_base);
+
+    /**
+     * @brief Inserts a measurement into a chunk, and returns the newest measurement of that chunk if it is now over capacity
+     * @param chunk Chunk we will insert into
+     * @param k Index in the chunk we will insert at
+     * @param data Measurement we will insert
+     * @param overflow Newest measurement that no longer fits into this chunk
+     * @return True if the chunk was full and we have an overflow measurement
+     */
+    bool insert_into_chunk(IMUCHUNK &chunk, size_t k, const IMUDATA &data, IMUDATA &overflow);
+
+    // Our history of IMU messages (time, angular, linear) in fixed size chunks
+    // The first imu_start measurements of the first chunk have been cleaned and are no longer used
+    std::vector<IMUCHUNK> imu_chunks;
+    size_t imu_start = 0;
+    size_t imu_size = 0;
+
+    // If we store the measurements in single precision
+    bool compact = false;
+
+    // Index of our last lookup into the history
+    // This is only a hint to start searching from, so it is fine if threads race on it
+    mutable std::atomic<size_t> cursor;
 
     // Our noises
     double sigma_w; // gyro white noise
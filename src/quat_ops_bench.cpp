@@ -0,0 +1,225 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Eigen>
+
+#include "utils/colors.h"
+#include "utils/quat_ops.h"
+
+
+/**
+ * @brief Timing and accuracy of one batched kernel compared to its scalar version
+ */
+struct KERNELRUN {
+
+    /// Name of the kernel
+    std::string name;
+
+    /// Average time per element of the scalar and batched versions (ns)
+    double time_scalar = 0.0;
+    double time_batch = 0.0;
+
+    /// Largest absolute difference between the scalar and batched results
+    double max_error = 0.0;
+
+};
+
+
+/// Prints the usage of this program
+static void print_usage(const char *name) {
+    printf("usage: %s [options]\n", name);
+    printf("    --num <int>      number of elements in each batch (default: 100000)\n");
+    printf("    --repeat <int>   number of times we time each kernel, the fastest is reported (default: 20)\n");
+    printf("    --seed <int>     seed of the random inputs (default: 0)\n");
+    printf("    --tol <double>   largest error to the scalar versions before we fail (default: 1e-12)\n");
+}
+
+
+/**
+ * @brief Times a kernel over the whole batch, and returns the fastest time per element (ns)
+ * @param func Kernel that processes the whole batch
+ * @param num Number of elements in the batch
+ * @param repeat Number of times we will time it
+ */
+static double time_kernel(const std::function<void()> &func, size_t num, int repeat) {
+    double best = INFINITY;
+    for(int r=0; r<repeat; r++) {
+        auto rT1 = std::chrono::steady_clock::now();
+        func();
+        auto rT2 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration_cast<std::chrono::duration<double,std::nano>>(rT2-rT1).count());
+    }
+    return best/(double)num;
+}
+
+
+/// Largest absolute difference between two arrays
+static double max_difference(const std::vector<double> &a, const std::vector<double> &b) {
+    double error = 0.0;
+    for(size_t i=0; i<a.size(); i++) {
+        error = std::max(error, std::abs(a.at(i)-b.at(i)));
+    }
+    return error;
+}
+
+
+int main(int argc, char** argv)
+{
+
+    // Our benchmark settings
+    size_t num = 100000;
+    int repeat = 20;
+    int seed = 0;
+    double tol = 1e-12;
+
+    // Parse our command line options
+    for(int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if(i+1 >= argc) {
+            printf(RED "missing value for %s\n" RESET, arg.c_str());
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+        std::string value = argv[++i];
+        if(arg == "--num") num = (size_t)std::stoul(value);
+        else if(arg == "--repeat") repeat = std::max(1, std::stoi(value));
+        else if(arg == "--seed") seed = std::stoi(value);
+        else if(arg == "--tol") tol = std::stod(value);
+        else {
+            printf(RED "unknown option %s\n" RESET, arg.c_str());
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // Random rotation vectors, which include some at and near zero so we check the small angle cases
+    // From these we get our quaternions and rotation matrices using the scalar versions
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> dist(-M_PI, M_PI);
+    std::vector<double> w(3*num), w2(3*num), q(4*num), p(4*num), R(9*num), v(3*num);
+    for(size_t k=0; k<num; k++) {
+        Eigen::Vector3d w_k(dist(gen), dist(gen), dist(gen));
+        if(k%100 == 0) w_k.setZero();
+        else if(k%100 == 1) w_k *= 1e-13;
+        else if(k%100 == 2) w_k *= 1e-7;
+        Eigen::Map<Eigen::Vector3d>(&w.at(3*k)) = w_k;
+        Eigen::Map<Eigen::Vector3d>(&w2.at(3*k)) = Eigen::Vector3d(dist(gen), dist(gen), dist(gen));
+        Eigen::Map<Eigen::Vector3d>(&v.at(3*k)) = Eigen::Vector3d(dist(gen), dist(gen), dist(gen));
+        Eigen::Map<Eigen::Matrix3d>(&R.at(9*k)) = exp_so3(w_k);
+        Eigen::Map<Eigen::Vector4d>(&q.at(4*k)) = rot_2_quat(exp_so3(w_k));
+        Eigen::Map<Eigen::Vector4d>(&p.at(4*k)) = rot_2_quat(exp_so3(Eigen::Map<Eigen::Vector3d>(&w2.at(3*k))));
+    }
+    Eigen::Vector4d p_fixed = Eigen::Map<Eigen::Vector4d>(&p.at(0));
+    Eigen::Matrix3d R_fixed = Eigen::Map<Eigen::Matrix3d>(&R.at(9*3));
+
+    // Run each kernel, where each scalar version writes into the same layout as the batched ones
+    std::vector<KERNELRUN> runs;
+    std::vector<double> out_scalar, out_batch;
+    auto run_kernel = [&](const std::string &name, size_t size, const std::function<void()> &scalar,
+                          const std::function<void()> &batch) {
+        KERNELRUN run;
+        run.name = name;
+        out_scalar.assign(size*num, 0.0);
+        out_batch.assign(size*num, 0.0);
+        run.time_scalar = time_kernel(scalar, num, repeat);
+        run.time_batch = time_kernel(batch, num, repeat);
+        run.max_error = max_difference(out_scalar, out_batch);
+        runs.push_back(run);
+    };
+    run_kernel("quat_multiply", 4, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Vector4d>(&out_scalar.at(4*k)) = quat_multiply(Eigen::Map<Eigen::Vector4d>(&q.at(4*k)), Eigen::Map<Eigen::Vector4d>(&p.at(4*k)));
+    }, [&]() {
+        quat_multiply_batch(q.data(), p.data(), out_batch.data(), num);
+    });
+    run_kernel("quat_multiply (fixed p)", 4, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Vector4d>(&out_scalar.at(4*k)) = quat_multiply(Eigen::Map<Eigen::Vector4d>(&q.at(4*k)), p_fixed);
+    }, [&]() {
+        quat_multiply_batch(q.data(), p_fixed, out_batch.data(), num);
+    });
+    run_kernel("quat_2_Rot", 9, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Matrix3d>(&out_scalar.at(9*k)) = quat_2_Rot(Eigen::Map<Eigen::Vector4d>(&q.at(4*k)));
+    }, [&]() {
+        quat_2_Rot_batch(q.data(), out_batch.data(), num);
+    });
+    run_kernel("rot_2_quat", 4, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Vector4d>(&out_scalar.at(4*k)) = rot_2_quat(Eigen::Map<Eigen::Matrix3d>(&R.at(9*k)));
+    }, [&]() {
+        rot_2_quat_batch(R.data(), out_batch.data(), num);
+    });
+    run_kernel("exp_so3", 9, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Matrix3d>(&out_scalar.at(9*k)) = exp_so3(Eigen::Map<Eigen::Vector3d>(&w.at(3*k)));
+    }, [&]() {
+        exp_so3_batch(w.data(), out_batch.data(), num);
+    });
+    run_kernel("log_so3", 3, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Vector3d>(&out_scalar.at(3*k)) = log_so3(Eigen::Map<Eigen::Matrix3d>(&R.at(9*k)));
+    }, [&]() {
+        log_so3_batch(R.data(), out_batch.data(), num);
+    });
+    run_kernel("Jr_so3", 9, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Matrix3d>(&out_scalar.at(9*k)) = Jr_so3(Eigen::Map<Eigen::Vector3d>(&w.at(3*k)));
+    }, [&]() {
+        Jr_so3_batch(w.data(), out_batch.data(), num);
+    });
+    run_kernel("rotate", 3, [&]() {
+        for(size_t k=0; k<num; k++)
+            Eigen::Map<Eigen::Vector3d>(&out_scalar.at(3*k)) = R_fixed*Eigen::Map<Eigen::Vector3d>(&v.at(3*k));
+    }, [&]() {
+        rotate_batch(R_fixed, v.data(), out_batch.data(), num);
+    });
+
+    // Print a summary table, and fail if any batched version does not match its scalar version
+    bool success = true;
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "Batched kernels (%d elements, ns per element)\n", (int)num);
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "%-25s %8s %8s %8s %10s\n" RESET, "kernel", "scalar", "batch", "speedup", "max_error");
+    for(const auto &run : runs) {
+        bool valid = (run.max_error <= tol);
+        success = success && valid;
+        printf("%s%-25s %8.2f %8.2f %7.2fx %10.2e\n" RESET, valid? REDPURPLE : RED, run.name.c_str(), run.time_scalar,
+               run.time_batch, run.time_scalar/std::max(run.time_batch,1e-9), run.max_error);
+    }
+    if(!success) {
+        printf(RED "[BENCH]: batched kernels do not match their scalar versions (tol = %.2e)\n" RESET, tol);
+        return EXIT_FAILURE;
+    }
+
+    // Done!
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,342 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <Eigen/Eigen>
+#include <boost/filesystem.hpp>
+
+#include <ros/ros.h>
+
+
+#include "meas/Propagator.h"
+#include "meas/Interpolator.h"
+#include "solver/ViconGraphSolver.h"
+#include "sim/Simulator.h"
+#include "utils/parse_ros.h"
+#include "utils/stats.h"
+
+
+/**
+ * @brief A single Monte-Carlo run: one vicon noise level and one simulation seed
+ */
+struct MCRUN {
+
+    /// Vicon orientation noise sigma (rad)
+    double sigma_ori = 0.0;
+
+    /// Vicon position noise sigma (meters)
+    double sigma_pos = 0.0;
+
+    /// Seed of the simulator
+    int seed = 0;
+
+    /// If this run has been solved
+    bool done = false;
+
+    /// Orientation (deg) and position (m) trajectory errors
+    Stats err_ori, err_pos;
+
+    /// Absolute calibration errors of the converged solution (sec, deg, m)
+    double err_toff = 0.0;
+    double err_R_BtoI = 0.0;
+    double err_p_BinI = 0.0;
+
+    /// How long this run took to simulate and solve (sec)
+    double time_total = 0.0;
+
+};
+
+
+/**
+ * @brief Simulates and solves a single Monte-Carlo run
+ * @param options Options of the solver
+ * @param params Base simulation parameters (seed and vicon noise will be overwritten)
+ * @param spline Shared trajectory spline of the params.sim_traj_path trajectory
+ * @param sigma_w Gyroscope white noise (rad/s/sqrt(hz))
+ * @param sigma_wb Gyroscope random walk (rad/s^2/sqrt(hz))
+ * @param sigma_a Accelerometer white noise (m/s^2/sqrt(hz))
+ * @param sigma_ab Accelerometer random walk (m/s^3/sqrt(hz))
+ * @param path_save Folder to save the estimated trajectory into, will not save if empty
+ * @param run Run we want to evaluate, will have its statistics filled
+ */
+void solve_run(const SolverOptions &options, SimulatorParams params, std::shared_ptr<const BsplineSE3> spline,
+               double sigma_w, double sigma_wb, double sigma_a, double sigma_ab,
+               const std::string &path_save, MCRUN &run) {
+
+    // Start timing
+    auto rT1 = std::chrono::high_resolution_clock::now();
+
+    // Set this run's noise and seed
+    // NOTE: each simulator has its own random number generators, so runs are independent of each other
+    params.seed = run.seed;
+    params.sigma_vicon_pose << run.sigma_ori, run.sigma_ori, run.sigma_ori, run.sigma_pos, run.sigma_pos, run.sigma_pos;
+    Eigen::Matrix<double,3,3> R_q = std::pow(run.sigma_ori,2)*Eigen::Matrix<double,3,3>::Identity();
+    Eigen::Matrix<double,3,3> R_p = std::pow(run.sigma_pos,2)*Eigen::Matrix<double,3,3>::Identity();
+
+    // Our simulator and data storage objects
+    std::shared_ptr<Simulator> sim = std::make_shared<Simulator>(params, spline);
+    std::shared_ptr<Propagator> propagator = std::make_shared<Propagator>(sigma_w,sigma_wb,sigma_a,sigma_ab);
+    std::shared_ptr<Interpolator> interpolator = std::make_shared<Interpolator>();
+    std::vector<double> timestamp_cameras;
+
+    // Simulate all our measurements
+    while(sim->ok() && ros::ok()) {
+        double time_imu;
+        Eigen::Vector3d wm, am;
+        if (sim->get_next_imu(time_imu, wm, am)) {
+            propagator->feed_imu(time_imu,wm,am);
+        }
+        double time_cam;
+        if (sim->get_next_cam(time_cam)) {
+            timestamp_cameras.push_back(time_cam);
+        }
+        double time_vicon;
+        Eigen::Vector4d q_VtoB;
+        Eigen::Vector3d p_BinV;
+        if (sim->get_next_vicon(time_vicon, q_VtoB, p_BinV)) {
+            interpolator->feed_pose(time_vicon,q_VtoB,p_BinV,R_q,R_p);
+        }
+    }
+    if(!ros::ok())
+        return;
+
+    // Create the graph problem, and solve it
+    // If this run can not be solved (the solver has already said why), then it is left as not done and the others continue
+    std::unique_ptr<ViconGraphSolver> solver;
+    try {
+        solver.reset(new ViconGraphSolver(options,propagator,interpolator,timestamp_cameras));
+        solver->set_cancel_callback([]() { return !ros::ok(); });
+        solver->build_and_solve();
+    } catch (const std::exception &) {
+        return;
+    }
+    if(!ros::ok())
+        return;
+
+    // Save the estimated trajectory if we have a folder
+    if(!path_save.empty()) {
+        char run_name[100];
+        std::snprintf(run_name, sizeof(run_name), "ori%.3f_pos%.3f/simulation/%02d", run.sigma_ori, run.sigma_pos, run.seed);
+        solver->write_to_file(path_save+"/"+run_name+"_states.csv", path_save+"/"+run_name+"_info.txt");
+    }
+
+    // Now compute the error compared to our true states
+    std::vector<double> times;
+    std::vector<Eigen::Matrix<double,7,1>> poses;
+    solver->get_imu_poses(times, poses);
+    std::vector<Eigen::Matrix<double,17,1>> gt_states;
+    sim->get_states_in_vicon(times, gt_states);
+    for(size_t i=0; i<times.size(); i++) {
+        const Eigen::Matrix<double,17,1> &gt_state = gt_states.at(i);
+        Eigen::Matrix<double,7,1> est_state = poses.at(i);
+        double ori = 2.0*(quat_multiply(
+                gt_state.block(1,0,4,1),
+                Inv(est_state.block(0,0,4,1))
+        )).block(0,0,3,1).norm();
+        double pose = (est_state.block(4,0,3,1)-gt_state.block(5,0,3,1)).norm();
+        run.err_ori.timestamps.push_back(times.at(i));
+        run.err_ori.values.push_back(180.0/M_PI*ori);
+        run.err_pos.timestamps.push_back(times.at(i));
+        run.err_pos.values.push_back(pose);
+    }
+    run.err_ori.calculate();
+    run.err_pos.calculate();
+
+    // Error of our converged calibration
+    double toff;
+    Eigen::Matrix3d R_BtoI, R_GtoV;
+    Eigen::Vector3d p_BinI;
+    solver->get_calibration(toff, R_BtoI, p_BinI, R_GtoV);
+    run.err_toff = std::abs(toff-sim->get_params().viconimu_dt);
+    run.err_R_BtoI = 180.0/M_PI*log_so3(sim->get_params().R_BtoI*R_BtoI.transpose()).norm();
+    run.err_p_BinI = (p_BinI-sim->get_params().p_BinI).norm();
+
+    // Done!
+    auto rT2 = std::chrono::high_resolution_clock::now();
+    run.time_total = std::chrono::duration_cast<std::chrono::duration<double>>(rT2-rT1).count();
+    run.done = true;
+
+}
+
+
+int main(int argc, char** argv)
+{
+
+    // Start up
+    ros::init(argc, argv, "run_monte_carlo");
+    ros::NodeHandle nh("~");
+
+    // Monte-Carlo settings
+    int seed_start, num_seeds, num_threads;
+    std::string path_summary, path_save;
+    std::vector<double> noises;
+    std::vector<double> noises_default = {0.001,0.005,0.01,0.05,0.10};
+    nh.param<std::vector<double>>("mc_noises", noises, noises_default);
+    nh.param<int>("mc_seed_start", seed_start, 10);
+    nh.param<int>("mc_num_seeds", num_seeds, 20);
+    nh.param<int>("mc_num_threads", num_threads, 0);
+    nh.param<std::string>("mc_path_summary", path_summary, "/tmp/vicon2gt_monte_carlo.txt");
+    nh.param<std::string>("mc_path_save", path_save, "");
+    if(noises.empty() || num_seeds < 1) {
+        ROS_ERROR("need at least one noise value and one seed to run (%d noises, %d seeds)", (int)noises.size(), num_seeds);
+        std::exit(EXIT_FAILURE);
+    }
+    if(num_threads < 1) {
+        num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    ROS_INFO("monte carlo information...");
+    ROS_INFO("    - number noises: %d (%d ori-pos pairs)", (int)noises.size(), (int)(noises.size()*noises.size()));
+    ROS_INFO("    - seeds: %d to %d", seed_start, seed_start+num_seeds-1);
+    ROS_INFO("    - number threads: %d", num_threads);
+    ROS_INFO("    - summary path: %s", path_summary.c_str());
+    ROS_INFO("    - save path: %s", path_save.c_str());
+
+    // Our simulator params
+    SimulatorParams params;
+    nh.param<std::string>("sim_traj_path", params.sim_traj_path, params.sim_traj_path);
+    nh.param<double>("sim_freq_imu", params.sim_freq_imu, params.sim_freq_imu);
+    nh.param<double>("sim_freq_cam", params.sim_freq_cam, params.sim_freq_cam);
+    nh.param<double>("sim_freq_vicon", params.sim_freq_vicon, params.sim_freq_vicon);
+    nh.param<double>("gravity_magnitude", params.gravity_magnitude, 9.81);
+
+    // Each run would print all its simulator parameters, so instead we print the ones they share once
+    // The runs only change the seed and vicon noise (and thus their random calibration)
+    params.print_params = false;
+    ROS_INFO("simulation information...");
+    ROS_INFO("    - traj path: %s", params.sim_traj_path.c_str());
+    ROS_INFO("    - imu, cam, vicon freq: %.2f, %.2f, %.2f", params.sim_freq_imu, params.sim_freq_cam, params.sim_freq_vicon);
+    ROS_INFO("    - gravity: %.3f", params.gravity_magnitude);
+
+    // Our IMU noise values
+    double sigma_w,sigma_wb,sigma_a,sigma_ab;
+    nh.param<double>("gyroscope_noise_density", sigma_w, 1.6968e-04);
+    nh.param<double>("accelerometer_noise_density", sigma_a, 2.0000e-3);
+    nh.param<double>("gyroscope_random_walk", sigma_wb, 1.9393e-05);
+    nh.param<double>("accelerometer_random_walk", sigma_ab, 3.0000e-03);
+
+    // Our solver options, each run has its own solver which uses these
+    SolverOptions options = load_solver_options(nh);
+
+    // Fit our trajectory spline once, every run will only read from it
+    std::shared_ptr<const BsplineSE3> spline = Simulator::load_spline(params.sim_traj_path);
+
+    // All pairwise combinations of orientation and position noises for each seed
+    std::vector<MCRUN> runs;
+    for(size_t h=0; h<noises.size(); h++) {
+        for(size_t i=0; i<noises.size(); i++) {
+            for(int j=seed_start; j<seed_start+num_seeds; j++) {
+                MCRUN run;
+                run.sigma_ori = noises.at(h);
+                run.sigma_pos = noises.at(i);
+                run.seed = j;
+                runs.push_back(run);
+            }
+        }
+    }
+
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Each worker will take the next run that has not been solved yet
+    std::atomic<size_t> next_run(0);
+    std::atomic<size_t> num_done(0);
+    std::mutex mtx_print;
+    auto worker = [&]() {
+        while(ros::ok()) {
+            size_t idx = next_run++;
+            if(idx >= runs.size())
+                break;
+            MCRUN &run = runs.at(idx);
+            solve_run(options, params, spline, sigma_w, sigma_wb, sigma_a, sigma_ab, path_save, run);
+            if(!run.done)
+                continue;
+            std::lock_guard<std::mutex> lck(mtx_print);
+            printf(REDPURPLE "[MC]: ori%.3f_pos%.3f - run %d took %.2f seconds (%d of %d) | rmse_ori = %.5f | rmse_pos = %.5f\n" RESET,
+                   run.sigma_ori, run.sigma_pos, run.seed, run.time_total, (int)(++num_done), (int)runs.size(),
+                   run.err_ori.rmse, run.err_pos.rmse);
+        }
+    };
+    std::vector<std::thread> threads;
+    for(int i=0; i<num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    //===================================================================================
+    //===================================================================================
+    //===================================================================================
+
+    // Open the summary file
+    ROS_INFO("saving monte carlo summary to file");
+    if (boost::filesystem::exists(path_summary)) {
+        boost::filesystem::remove(path_summary);
+        ROS_INFO("    - old summary file found, deleted...");
+    }
+    boost::filesystem::path p1(path_summary);
+    if(!p1.parent_path().empty())
+        boost::filesystem::create_directories(p1.parent_path());
+    std::ofstream of_summary(path_summary, std::ofstream::out);
+    if(!of_summary.is_open()) {
+        ROS_ERROR("unable to open the summary file %s", path_summary.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Write each run, and average each noise pair over its seeds
+    of_summary << "# sigma_ori(rad) sigma_pos(m) seed rmse_ori(deg) mean_ori(deg) 99_ori(deg) rmse_pos(m) mean_pos(m) 99_pos(m) "
+               << "err_toff(s) err_R_BtoI(deg) err_p_BinI(m) time(s)" << std::endl;
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "Monte-Carlo Average Trajectory Errors (deg,m)\n");
+    printf(REDPURPLE "======================================\n");
+    for(size_t i=0; i<runs.size(); i+=(size_t)num_seeds) {
+        Stats rmse_ori, rmse_pos;
+        for(size_t j=i; j<i+(size_t)num_seeds && j<runs.size(); j++) {
+            const MCRUN &run = runs.at(j);
+            if(!run.done)
+                continue;
+            of_summary << std::setprecision(6) << run.sigma_ori << " " << run.sigma_pos << " " << run.seed << " "
+                       << run.err_ori.rmse << " " << run.err_ori.mean << " " << run.err_ori.ninetynine << " "
+                       << run.err_pos.rmse << " " << run.err_pos.mean << " " << run.err_pos.ninetynine << " "
+                       << run.err_toff << " " << run.err_R_BtoI << " " << run.err_p_BinI << " " << run.time_total << std::endl;
+            rmse_ori.values.push_back(run.err_ori.rmse);
+            rmse_pos.values.push_back(run.err_pos.rmse);
+        }
+        rmse_ori.calculate();
+        rmse_pos.calculate();
+        printf(REDPURPLE "ori%.3f_pos%.3f: rmse_ori = %.5f | rmse_pos = %.5f (%d runs)\n",
+               runs.at(i).sigma_ori, runs.at(i).sigma_pos, rmse_ori.mean, rmse_pos.mean, (int)rmse_ori.values.size());
+    }
+    printf(RESET "\n");
+    of_summary.close();
+
+    // Done!
+    return EXIT_SUCCESS;
+
+}
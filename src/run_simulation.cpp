@@ -19,6 +19,7 @@
 
 
 #include <cmath>
+#include <future>
 #include <memory>
 #include <vector>
 #include <unistd.h>
@@ -27,13 +28,16 @@
 #include <ros/ros.h>
 #include <rosbag/bag.h>
 #include <sensor_msgs/Image.h>
+#include <nav_msgs/Path.h>
 #include <geometry_msgs/PoseStamped.h>
 
 
 #include "meas/Propagator.h"
 #include "meas/Interpolator.h"
 #include "solver/ViconGraphSolver.h"
+#include "solver/ViconGraphVisualizer.h"
 #include "sim/Simulator.h"
+#include "utils/parse_ros.h"
 #include "utils/stats.h"
 
 
@@ -150,20 +154,34 @@ int main(int argc, char** argv)
     ROS_INFO("    - number cam   = %d",ct_cam);
     ROS_INFO("    - number vicon = %d",ct_vic);
 
-    // Create the graph problem, and solve it
-    ViconGraphSolver solver(nh,propagator,interpolator,timestamp_cameras);
-    solver.build_and_solve();
+    // Setup our ROS publishers (before solving so subscribers have time to connect)
+    ViconGraphVisualizer visualizer(nh);
+
+    // Create the graph problem, and solve it (if we can not, the solver has already said why)
+    std::unique_ptr<ViconGraphSolver> solver;
+    try {
+        solver.reset(new ViconGraphSolver(load_solver_options(nh),propagator,interpolator,timestamp_cameras));
+        solver->set_cancel_callback([]() { return !ros::ok(); });
+        solver->build_and_solve();
+    } catch (const std::exception &) {
+        ros::shutdown();
+        return EXIT_FAILURE;
+    }
 
-    // Visualize onto ROS
-    solver.visualize();
+    // Save the generated trajectory while we visualize onto ROS
+    std::future<void> writing;
+    if(save2file) {
+        writing = solver->write_to_file_async(path_states,path_info);
+    }
+    visualizer.visualize(*solver);
+    if(writing.valid()) {
+        writing.get();
+    }
 
     // Finally, save to file all the information
     std::ofstream of_state;
     if(save2file) {
 
-        // save generated trajectory
-        solver.write_to_file(path_states,path_info);
-
         // Open the groundtruth trajectory file
         ROS_INFO("saving *groundtruth* states to file");
         if (boost::filesystem::exists(path_states_gt)) {
@@ -186,18 +204,19 @@ int main(int argc, char** argv)
     // Get the final optimized poses
     std::vector<double> times;
     std::vector<Eigen::Matrix<double,7,1>> poses;
-    solver.get_imu_poses(times, poses);
+    solver->get_imu_poses(times, poses);
 
     // Now compute the error compared to our true states
     std::vector<geometry_msgs::PoseStamped> poses_gtimu;
     Stats err_ori, err_pos;
+    std::vector<Eigen::Matrix<double,17,1>> gt_states;
+    sim->get_states_in_vicon(times, gt_states);
     for(size_t i=0; i<times.size(); i++) {
 
         // get the states
         // GT: [time(sec),q_VtoI,p_IinV,v_IinV,b_gyro,b_accel]
         // EST: [q_VtoI,p_IinV]
-        Eigen::Matrix<double,17,1> gt_state;
-        sim->get_state_in_vicon(times.at(i), gt_state);
+        const Eigen::Matrix<double,17,1> &gt_state = gt_states.at(i);
         Eigen::Matrix<double,7,1> est_state = poses.at(i);
 
         // compute error
@@ -290,7 +309,7 @@ int main(int argc, char** argv)
     double toff;
     Eigen::Matrix3d R_BtoI, R_GtoV;
     Eigen::Vector3d p_BinI;
-    solver.get_calibration(toff, R_BtoI, p_BinI, R_GtoV);
+    solver->get_calibration(toff, R_BtoI, p_BinI, R_GtoV);
     Eigen::Vector4d q_BtoI = rot_2_quat(R_BtoI);
     Eigen::Vector4d gt_q_BtoI = rot_2_quat(sim->get_params().R_BtoI);
 
@@ -20,7 +20,10 @@
 #define BSPLINESE3_H
 
 
+#include <map>
+#include <vector>
 #include <Eigen/Eigen>
+#include <Eigen/StdVector>
 
 #include "utils/quat_ops.h"
 #include "utils/colors.h"
@@ -94,11 +97,26 @@
  * Note that one needs to ensure that they use the SE(3) matrix expodential, logorithm, and hat operation for all above equations.
  * The indexes correspond to the the two poses that are older and two poses that are newer then the current time we want to get (i.e. i-1 and i are less than s, while i+1 and i+2 are both greater than time s).
  * Some additional derivations are available in [these notes](http://udel.edu/~pgeneva/downloads/notes/2018_notes_mueffler2017arxiv.pdf).
+ *
+ * Our control points are stored in contiguous arrays along with the log of each segment \f${}^{i-1}_{i}\mathbf{\Omega}\f$, which are computed once.
+ * Since control points are uniformly spaced, finding the ones bounding a time is a constant time lookup.
+ * All queries are const and do not keep any state, thus one spline can be queried from many threads at the same time.
  */
 class BsplineSE3 {
 
 public:
 
+    /// A single state on the spline (only the values up to the order we asked for are set)
+    struct SPLINESTATE {
+        bool valid = false;
+        Eigen::Matrix3d R_GtoI = Eigen::Matrix3d::Identity();
+        Eigen::Vector3d p_IinG = Eigen::Vector3d::Zero();
+        Eigen::Vector3d w_IinI = Eigen::Vector3d::Zero();
+        Eigen::Vector3d v_IinG = Eigen::Vector3d::Zero();
+        Eigen::Vector3d alpha_IinI = Eigen::Vector3d::Zero();
+        Eigen::Vector3d a_IinG = Eigen::Vector3d::Zero();
+    };
+
 
     /**
      * @brief Default constructor
@@ -124,7 +142,7 @@ public:
      * @param p_IinG Position of the pose in the global
      * @return False if we can't find it
      */
-    bool get_pose(double timestamp, Eigen::Matrix3d &R_GtoI, Eigen::Vector3d &p_IinG);
+    bool get_pose(double timestamp, Eigen::Matrix3d &R_GtoI, Eigen::Vector3d &p_IinG) const;
 
 
     /**
@@ -136,7 +154,7 @@ public:
      * @param v_IinG Linear velocity in the global frame
      * @return False if we can't find it
      */
-    bool get_velocity(double timestamp, Eigen::Matrix3d &R_GtoI, Eigen::Vector3d &p_IinG, Eigen::Vector3d &w_IinI, Eigen::Vector3d &v_IinG);
+    bool get_velocity(double timestamp, Eigen::Matrix3d &R_GtoI, Eigen::Vector3d &p_IinG, Eigen::Vector3d &w_IinI, Eigen::Vector3d &v_IinG) const;
 
 
     /**
@@ -152,11 +170,24 @@ public:
      */
     bool get_acceleration(double timestamp, Eigen::Matrix3d &R_GtoI, Eigen::Vector3d &p_IinG,
                             Eigen::Vector3d &w_IinI, Eigen::Vector3d &v_IinG,
-                            Eigen::Vector3d &alpha_IinI, Eigen::Vector3d &a_IinG);
+                            Eigen::Vector3d &alpha_IinI, Eigen::Vector3d &a_IinG) const;
+
+
+    /**
+     * @brief Gets the state at many timestamps at once.
+     *
+     * If the timestamps are sorted, we sweep forward through our control points and each lookup is just a few comparisons.
+     * Unsorted timestamps are still supported (each is just looked up on its own).
+     *
+     * @param timestamps Desired times to get the states at
+     * @param states State at each time (valid is false if we can't find it)
+     * @param order Highest derivative we will compute (0 pose, 1 velocity, 2 acceleration)
+     */
+    void get_states(const std::vector<double> &timestamps, std::vector<SPLINESTATE> &states, int order = 2) const;
 
 
     /// Returns the simulation start time that we should start simulating from
-    double get_start_time() {
+    double get_start_time() const {
         return timestamp_start;
     }
 
@@ -173,8 +204,12 @@ protected:
     typedef std::map<double, Eigen::Matrix4d, std::less<double>,
             Eigen::aligned_allocator<std::pair<const double, Eigen::Matrix4d>>> AlignedEigenMat4d;
 
-    /// Our control SE3 control poses (R_ItoG, p_IinG)
-    AlignedEigenMat4d control_points;
+    /// Our control SE3 control poses (R_ItoG, p_IinG) and their timestamps, sorted in time
+    std::vector<double> control_times;
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> control_poses;
+
+    /// Log of the relative pose between each control point and the next, log(T_i^-1*T_{i+1})
+    std::vector<Eigen::Matrix<double,6,1>, Eigen::aligned_allocator<Eigen::Matrix<double,6,1>>> control_logs;
 
 
     /**
@@ -196,23 +231,28 @@ protected:
 
 
     /**
-     * @brief Will find two older poses and two newer poses for the current timestamp
+     * @brief Will find the segment of control points for the current timestamp
      *
-     * @param timestamp Desired timestamp we want to get four bounding poses of
-     * @param poses Map of poses and timestamps
-     * @param t0 Timestamp of the first pose
-     * @param pose0 SE(3) pose of the first pose
-     * @param t1 Timestamp of the second pose
-     * @param pose1 SE(3) pose of the second pose
-     * @param t2 Timestamp of the third pose
-     * @param pose2 SE(3) pose of the third pose
-     * @param t3 Timestamp of the fourth pose
-     * @param pose3 SE(3) pose of the fourth pose
-     * @return False if we are unable to find bounding poses
+     * This is the index of the newest control point that is not newer than the timestamp (i.e. i in our equations).
+     * We need one control point older than it, and two newer, to be able to interpolate.
+     * We start from the hint (e.g. our last segment) if it is valid, else we guess it from our uniform spacing.
+     *
+     * @param timestamp Desired timestamp we want to get the control points of
+     * @param idx Index of the control point (the one older than it and two newer are also used)
+     * @param hint Index to start our search from
+     * @return False if we are unable to find all four bounding control points
+     */
+    bool find_segment(double timestamp, size_t &idx, size_t hint) const;
+
+
+    /**
+     * @brief Evaluates the spline in a segment found by @ref find_segment
+     * @param idx Index of the segment
+     * @param timestamp Desired time to evaluate at
+     * @param order Highest derivative we will compute (0 pose, 1 velocity, 2 acceleration)
+     * @param state Our state at this time
      */
-    static bool find_bounding_control_points(const double timestamp, const AlignedEigenMat4d &poses,
-                                             double &t0, Eigen::Matrix4d &pose0, double &t1, Eigen::Matrix4d &pose1,
-                                             double &t2, Eigen::Matrix4d &pose2, double &t3, Eigen::Matrix4d &pose3);
+    void evaluate(size_t idx, double timestamp, int order, SPLINESTATE &state) const;
 
 };
 
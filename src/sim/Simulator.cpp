@@ -20,7 +20,11 @@
 
 
 
-Simulator::Simulator(const SimulatorParams& params_) {
+Simulator::Simulator(const SimulatorParams& params_) : Simulator(params_, nullptr) {}
+
+
+
+Simulator::Simulator(const SimulatorParams& params_, std::shared_ptr<const BsplineSE3> spline_) {
 
 
     //===============================================================
@@ -44,27 +48,31 @@ Simulator::Simulator(const SimulatorParams& params_) {
     //===============================================================
 
     // Nice startup message
-    printf(CYAN "=======================================\n");
-    printf(CYAN "VICON-INERTIAL SIMULATOR STARTING\n");
-    printf(CYAN "=======================================\n");
-    params.print_noise();
-    params.print_state();
-    params.print_simulation();
+    if(params.print_params) {
+        printf(CYAN "=======================================\n");
+        printf(CYAN "VICON-INERTIAL SIMULATOR STARTING\n");
+        printf(CYAN "=======================================\n");
+        params.print_noise();
+        params.print_state();
+        params.print_simulation();
+    }
 
-    // Load the groundtruth trajectory and its spline
-    load_data(params.sim_traj_path);
-    spline.feed_trajectory(traj_data);
+    // Load the groundtruth trajectory and its spline if we were not given one
+    spline = spline_;
+    if(spline == nullptr) {
+        spline = load_spline(params.sim_traj_path);
+    }
 
     // Set all our timestamps as starting from the minimum spline time
-    timestamp = spline.get_start_time();
-    timestamp_last_imu = spline.get_start_time();
-    timestamp_last_cam = spline.get_start_time();
-    timestamp_last_vicon = spline.get_start_time();
+    timestamp = spline->get_start_time();
+    timestamp_last_imu = spline->get_start_time();
+    timestamp_last_cam = spline->get_start_time();
+    timestamp_last_vicon = spline->get_start_time();
 
     // Get the pose at the current timestep
     Eigen::Matrix3d R_GtoI_init;
     Eigen::Vector3d p_IinG_init;
-    bool success_pose_init = spline.get_pose(timestamp, R_GtoI_init, p_IinG_init);
+    bool success_pose_init = spline->get_pose(timestamp, R_GtoI_init, p_IinG_init);
     if(!success_pose_init) {
         printf(RED "[SIM]: unable to find the first pose in the spline...\n" RESET);
         std::exit(EXIT_FAILURE);
@@ -99,30 +107,81 @@ Simulator::Simulator(const SimulatorParams& params_) {
 
 bool Simulator::get_state_in_vicon(double desired_time, Eigen::Matrix<double,17,1> &imustate) {
 
+    // Get the pose, velocity, and acceleration
+    BsplineSE3::SPLINESTATE pose;
+    pose.valid = spline->get_velocity(desired_time, pose.R_GtoI, pose.p_IinG, pose.w_IinI, pose.v_IinG);
+
+    // Finally lets create the current state
+    return compute_state_in_vicon(desired_time, pose, imustate);
+
+}
+
+
+
+
+size_t Simulator::get_states_in_vicon(const std::vector<double> &desired_times, std::vector<Eigen::Matrix<double,17,1>> &imustates) {
+
+    // Get the pose and velocity at all times in one sweep
+    std::vector<BsplineSE3::SPLINESTATE> poses;
+    spline->get_states(desired_times, poses, 1);
+
+    // Now create each state, this will move our bias cursor forward with us
+    size_t num_success = 0;
+    imustates.resize(desired_times.size());
+    for(size_t i=0; i<desired_times.size(); i++) {
+        if(compute_state_in_vicon(desired_times.at(i), poses.at(i), imustates.at(i)))
+            num_success++;
+    }
+    return num_success;
+
+}
+
+
+
+
+bool Simulator::find_bias_index(double desired_time, size_t &idx) {
+
+    // Our bias at idx needs to be older than us, and the next not older
+    auto bounds = [&](size_t i) {
+        return i+1 < hist_true_bias_time.size() && hist_true_bias_time.at(i) < desired_time && hist_true_bias_time.at(i+1) >= desired_time;
+    };
+
+    // Check the interval we last found and the one after it
+    // When queried in order, this is almost always the case
+    if(bounds(hist_true_bias_cursor)) {
+        idx = hist_true_bias_cursor;
+        return true;
+    }
+    if(bounds(hist_true_bias_cursor+1)) {
+        idx = ++hist_true_bias_cursor;
+        return true;
+    }
+
+    // Else find the first bias that is not older than us, the one before it is our bound
+    auto it = std::lower_bound(hist_true_bias_time.begin(), hist_true_bias_time.end(), desired_time);
+    if(it == hist_true_bias_time.begin() || it == hist_true_bias_time.end())
+        return false;
+    idx = (size_t)(it-hist_true_bias_time.begin())-1;
+    hist_true_bias_cursor = idx;
+    return true;
+
+}
+
+
+
+
+bool Simulator::compute_state_in_vicon(double desired_time, const BsplineSE3::SPLINESTATE &pose, Eigen::Matrix<double,17,1> &imustate) {
+
     // Set to default state
     imustate.setZero();
     imustate(4) = 1;
 
-    // Current state values
-    Eigen::Matrix3d R_GtoI;
-    Eigen::Vector3d p_IinG, w_IinI, v_IinG;
-
-    // Get the pose, velocity, and acceleration
-    bool success_vel = spline.get_velocity(desired_time, R_GtoI, p_IinG, w_IinI, v_IinG);
-
     // Find the bounding bias values
-    bool success_bias = false;
     size_t id_loc = 0;
-    for(size_t i=0; i<hist_true_bias_time.size()-1; i++) {
-        if(hist_true_bias_time.at(i) < desired_time && hist_true_bias_time.at(i+1) >= desired_time) {
-            id_loc = i;
-            success_bias = true;
-            break;
-        }
-    }
+    bool success_bias = find_bias_index(desired_time, id_loc);
 
     // If failed, then that means we don't have any more spline or bias
-    if(!success_vel || !success_bias) {
+    if(!pose.valid || !success_bias) {
         return false;
     }
 
@@ -133,9 +192,9 @@ bool Simulator::get_state_in_vicon(double desired_time, Eigen::Matrix<double,17,
 
     // Finally lets create the current state
     imustate(0,0) = desired_time;
-    imustate.block(1,0,4,1) = rot_2_quat(R_GtoI*params.R_GtoV.transpose());
-    imustate.block(5,0,3,1) = params.R_GtoV*p_IinG;
-    imustate.block(8,0,3,1) = params.R_GtoV*v_IinG;
+    imustate.block(1,0,4,1) = rot_2_quat(pose.R_GtoI*params.R_GtoV.transpose());
+    imustate.block(5,0,3,1) = params.R_GtoV*pose.p_IinG;
+    imustate.block(8,0,3,1) = params.R_GtoV*pose.v_IinG;
     imustate.block(11,0,3,1) = true_bg_interp;
     imustate.block(14,0,3,1) = true_ba_interp;
     return true;
@@ -164,8 +223,8 @@ bool Simulator::get_next_imu(double &time_imu, Eigen::Vector3d &wm, Eigen::Vecto
     // Get the pose, velocity, and acceleration
     // NOTE: we get the acceleration between our two IMU
     // NOTE: this is because we are using a constant measurement model for integration
-    //bool success_accel = spline.get_acceleration(timestamp+0.5/freq_imu, R_GtoI, p_IinG, w_IinI, v_IinG, alpha_IinI, a_IinG);
-    bool success_accel = spline.get_acceleration(timestamp, R_GtoI, p_IinG, w_IinI, v_IinG, alpha_IinI, a_IinG);
+    //bool success_accel = spline->get_acceleration(timestamp+0.5/freq_imu, R_GtoI, p_IinG, w_IinI, v_IinG, alpha_IinI, a_IinG);
+    bool success_accel = spline->get_acceleration(timestamp, R_GtoI, p_IinG, w_IinI, v_IinG, alpha_IinI, a_IinG);
 
     // If failed, then that means we don't have any more spline
     // Thus we should stop the simulation
@@ -241,7 +300,7 @@ bool Simulator::get_next_vicon(double &time_vicon, Eigen::Vector4d &q_VtoB, Eige
     // Get the pose at the current timestep
     Eigen::Matrix3d R_GtoI;
     Eigen::Vector3d p_IinG;
-    bool success_pose = spline.get_pose(timestamp, R_GtoI, p_IinG);
+    bool success_pose = spline->get_pose(timestamp, R_GtoI, p_IinG);
 
     // We have finished generating measurements
     if(!success_pose) {
@@ -279,7 +338,17 @@ bool Simulator::get_next_vicon(double &time_vicon, Eigen::Vector4d &q_VtoB, Eige
 
 
 
-void Simulator::load_data(std::string path_traj) {
+std::shared_ptr<BsplineSE3> Simulator::load_spline(const std::string &path_traj) {
+    std::vector<Eigen::VectorXd> traj_data;
+    load_data(path_traj, traj_data);
+    std::shared_ptr<BsplineSE3> spline = std::make_shared<BsplineSE3>();
+    spline->feed_trajectory(traj_data);
+    return spline;
+}
+
+
+
+void Simulator::load_data(const std::string &path_traj, std::vector<Eigen::VectorXd> &traj_data) {
 
     // Try to open our groundtruth file
     std::ifstream file;
@@ -20,7 +20,9 @@
 #define SIMULATOR_H
 
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <random>
 #include <string>
@@ -55,6 +57,24 @@ public:
      */
     Simulator(const SimulatorParams& params_);
 
+    /**
+     * @brief Constructor which uses an already fitted trajectory spline.
+     *
+     * The spline is only ever read from, so it can be shared between many simulators (e.g. a Monte-Carlo run over seeds).
+     * Each simulator still has its own random number generators seeded from its parameters.
+     *
+     * @param params_ SimulationParams parameters. Should have already been loaded from cmd.
+     * @param spline_ B-spline of the params_.sim_traj_path trajectory (see @ref load_spline()), if null it will be loaded
+     */
+    Simulator(const SimulatorParams& params_, std::shared_ptr<const BsplineSE3> spline_);
+
+    /**
+     * @brief Loads a trajectory file and fits our SE(3) b-spline to it.
+     * @param path_traj Path to the trajectory file that we want to read in.
+     * @return Spline of the trajectory
+     */
+    static std::shared_ptr<BsplineSE3> load_spline(const std::string &path_traj);
+
     /**
      * @brief Returns if we are actively simulating
      * @return True if we still have simulation data
@@ -78,6 +98,19 @@ public:
      */
     bool get_state_in_vicon(double desired_time, Eigen::Matrix<double,17,1> &imustate);
 
+    /**
+     * @brief Get the simulation states at many timesteps at once
+     *
+     * This evaluates the spline in one sweep and walks forward through our bias history.
+     * Thus if the times are sorted (e.g. our estimated states) this is linear in the number of states.
+     * Times we do not have a state at are left as the default state (same as @ref get_state_in_vicon()).
+     *
+     * @param desired_times Timestamps we want to get the states at
+     * @param imustates State at each time in the MSCKF ordering: [time(sec),q_VtoI,p_IinV,v_IinV,b_gyro,b_accel]
+     * @return Number of times we have a state at
+     */
+    size_t get_states_in_vicon(const std::vector<double> &desired_times, std::vector<Eigen::Matrix<double,17,1>> &imustates);
+
     /**
      * @brief Gets the next IMU reading if we have one.
      * @param time_imu Time that this measurement occurred at
@@ -110,8 +143,29 @@ protected:
     /**
      * @brief This will load the trajectory into memory.
      * @param path_traj Path to the trajectory file that we want to read in.
+     * @param traj_data Our loaded trajectory data (timestamp(s), q_GtoI, p_IinG)
      */
-    void load_data(std::string path_traj);
+    static void load_data(const std::string &path_traj, std::vector<Eigen::VectorXd> &traj_data);
+
+    /**
+     * @brief Will find the two true biases that bound a timestamp in our history
+     *
+     * This first checks the interval our last lookup was in (and the one after it), else binary searches the history.
+     *
+     * @param desired_time Timestamp we want to get the biases at
+     * @param idx Index of the bias right before the timestamp (the next one is right after or at it)
+     * @return False if we do not have biases that bound this time
+     */
+    bool find_bias_index(double desired_time, size_t &idx);
+
+    /**
+     * @brief Creates our state in the vicon frame from the spline state at this time
+     * @param desired_time Timestamp of the state
+     * @param pose Spline pose and velocity at this time
+     * @param imustate State in the MSCKF ordering: [time(sec),q_VtoI,p_IinV,v_IinV,b_gyro,b_accel]
+     * @return True if we have a state
+     */
+    bool compute_state_in_vicon(double desired_time, const BsplineSE3::SPLINESTATE &pose, Eigen::Matrix<double,17,1> &imustate);
 
     //===================================================================
     // Configuration variables
@@ -124,11 +178,8 @@ protected:
     // State related variables
     //===================================================================
 
-    /// Our loaded trajectory data (timestamp(s), q_GtoI, p_IinG)
-    std::vector<Eigen::VectorXd> traj_data;
-
-    /// Our b-spline trajectory
-    BsplineSE3 spline;
+    /// Our b-spline trajectory (can be shared with other simulators)
+    std::shared_ptr<const BsplineSE3> spline;
 
     /// Mersenne twister PRNG for measurements (IMU)
     std::mt19937 gen_meas_imu;
@@ -164,11 +215,14 @@ protected:
     /// Our running gyroscope bias
     Eigen::Vector3d true_bias_gyro = Eigen::Vector3d::Zero();
 
-    // Our history of true biases
+    // Our history of true biases (sorted in time as we append one for every IMU reading)
     std::vector<double> hist_true_bias_time;
     std::vector<Eigen::Vector3d> hist_true_bias_accel;
     std::vector<Eigen::Vector3d> hist_true_bias_gyro;
 
+    /// Index in our bias history of our last lookup
+    size_t hist_true_bias_cursor = 0;
+
 
 };
 
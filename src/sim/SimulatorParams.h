@@ -119,6 +119,9 @@ struct SimulatorParams {
     /// This should be incremented for each run in the Monte-Carlo simulation to generate the same true measurements, but different noise values.
     int seed = 0;
 
+    /// If the simulator should print all its parameters when created (e.g. only once for the many runs of a Monte-Carlo)
+    bool print_params = true;
+
     /**
      * @brief This function will print out all simulated parameters loaded.
      * This allows for visual checking that everything was loaded properly from ROS/CMD parsers.
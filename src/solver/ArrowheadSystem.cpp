@@ -0,0 +1,170 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ArrowheadSystem.h"
+
+
+
+ArrowheadSystem::ArrowheadSystem(size_t num_states, int dim_state, int dim_calib) : dim_s(dim_state), dim_c(dim_calib) {
+    H_diag.resize(num_states, MATRIX::Zero(dim_s,dim_s));
+    H_next.resize((num_states>0)? num_states-1 : 0, MATRIX::Zero(dim_s,dim_s));
+    H_calib.resize(num_states, MATRIX::Zero(dim_s,dim_c));
+    H_cc_ = MATRIX::Zero(dim_c,dim_c);
+    g_state.resize(num_states, Eigen::VectorXd::Zero(dim_s));
+    g_calib = Eigen::VectorXd::Zero(dim_c);
+}
+
+
+void ArrowheadSystem::set_zero() {
+    for(auto &H : H_diag) H.setZero();
+    for(auto &H : H_next) H.setZero();
+    for(auto &H : H_calib) H.setZero();
+    for(auto &g : g_state) g.setZero();
+    H_cc_.setZero();
+    g_calib.setZero();
+}
+
+
+bool ArrowheadSystem::solve(double lambda, std::vector<Eigen::VectorXd> &dx_states, Eigen::VectorXd &dx_calib) const {
+
+    // Reduced system we are left with after eliminating all states
+    size_t N = num_states();
+    MATRIX S_cc = H_cc_ + lambda*MATRIX::Identity(dim_c,dim_c);
+    Eigen::VectorXd r_c = g_calib;
+
+    // Eliminate each state in time, the next state and calibration get updated with the schur complement of the current
+    // We save the factorization of each, along with its reduced calibration coupling and gradient for back substitution
+    std::vector<Eigen::LLT<MATRIX>> llts(N);
+    std::vector<MATRIX> W(N);
+    std::vector<Eigen::VectorXd> r(N);
+    MATRIX S_next;
+    for(size_t k=0; k<N; k++) {
+
+        // Our diagonal, which has all of the states before it eliminated already
+        MATRIX S = (k==0)? H_diag.at(k) : S_next;
+        S.diagonal().array() += lambda;
+        if(k==0) {
+            W.at(k) = H_calib.at(k);
+            r.at(k) = g_state.at(k);
+        }
+        llts.at(k).compute(S);
+        if(llts.at(k).info() != Eigen::Success)
+            return false;
+
+        // Reduce the calibration onto the states which are left
+        MATRIX SinvW = llts.at(k).solve(W.at(k));
+        Eigen::VectorXd Sinvr = llts.at(k).solve(r.at(k));
+        S_cc.noalias() -= W.at(k).transpose()*SinvW;
+        r_c.noalias() -= W.at(k).transpose()*Sinvr;
+
+        // Finally reduce the next state in the chain
+        if(k+1 < N) {
+            const MATRIX &U = H_next.at(k);
+            MATRIX SinvU = llts.at(k).solve(U);
+            S_next = H_diag.at(k+1) - U.transpose()*SinvU;
+            W.at(k+1) = H_calib.at(k+1) - U.transpose()*SinvW;
+            r.at(k+1) = g_state.at(k+1) - U.transpose()*Sinvr;
+        }
+
+    }
+
+    // Solve the small calibration system
+    if(dim_c > 0) {
+        Eigen::LLT<MATRIX> llt_c(S_cc);
+        if(llt_c.info() != Eigen::Success)
+            return false;
+        dx_calib = llt_c.solve(r_c);
+    } else {
+        dx_calib = Eigen::VectorXd::Zero(0);
+    }
+
+    // Back substitute, newest to oldest state
+    dx_states.resize(N);
+    for(size_t i=N; i>0; i--) {
+        size_t k = i-1;
+        Eigen::VectorXd rhs = r.at(k) - W.at(k)*dx_calib;
+        if(k+1 < N)
+            rhs.noalias() -= H_next.at(k)*dx_states.at(k+1);
+        dx_states.at(k) = llts.at(k).solve(rhs);
+    }
+    return true;
+
+}
+
+
+bool ArrowheadSystem::marginal_covariances(MATRIX &P_cc, const std::function<void(size_t,const MATRIX&)> &callback) const {
+
+    // Reduced calibration system we are left with after eliminating all states
+    size_t N = num_states();
+    MATRIX S_cc = H_cc_;
+
+    // Eliminate each state newest to oldest, the state before it and calibration get updated with the schur complement of the current
+    // For each we save its conditional: x_k = mean - G_k*x_{k-1} - F_k*x_c, with covariance S_k^-1
+    std::vector<MATRIX> S_inv(N), G(N), F(N);
+    MATRIX S_prev, W_prev;
+    for(size_t i=N; i>0; i--) {
+        size_t k = i-1;
+
+        // Our diagonal and calibration coupling, which have all states after it eliminated already
+        const MATRIX &S = (k+1==N)? H_diag.at(k) : S_prev;
+        const MATRIX &W = (k+1==N)? H_calib.at(k) : W_prev;
+        Eigen::LLT<MATRIX> llt(S);
+        if(llt.info() != Eigen::Success)
+            return false;
+        S_inv.at(k) = llt.solve(MATRIX::Identity(dim_s,dim_s));
+        F.at(k) = S_inv.at(k)*W;
+        S_cc.noalias() -= W.transpose()*F.at(k);
+
+        // Finally reduce the state before it in the chain
+        if(k > 0) {
+            const MATRIX &U = H_next.at(k-1);
+            G.at(k) = S_inv.at(k)*U.transpose();
+            S_prev = H_diag.at(k-1) - U*G.at(k);
+            W_prev = H_calib.at(k-1) - U*F.at(k);
+        }
+
+    }
+
+    // Covariance of the calibration
+    if(dim_c > 0) {
+        Eigen::LLT<MATRIX> llt_c(S_cc);
+        if(llt_c.info() != Eigen::Success)
+            return false;
+        P_cc = llt_c.solve(MATRIX::Identity(dim_c,dim_c));
+    } else {
+        P_cc = MATRIX::Zero(0,0);
+    }
+
+    // Recover each state oldest to newest, we only need to keep the covariances of the one before it
+    MATRIX P_kk, P_kc;
+    for(size_t k=0; k<N; k++) {
+        MATRIX FP = F.at(k)*P_cc;
+        if(k == 0) {
+            P_kc = -FP;
+            P_kk = S_inv.at(k) + FP*F.at(k).transpose();
+        } else {
+            MATRIX GP = G.at(k)*P_kk + F.at(k)*P_kc.transpose();
+            MATRIX P_kc_new = -G.at(k)*P_kc - FP;
+            P_kk = S_inv.at(k) + GP*G.at(k).transpose() + (G.at(k)*P_kc + FP)*F.at(k).transpose();
+            P_kc = P_kc_new;
+        }
+        callback(k, P_kk);
+    }
+    return true;
+
+}
@@ -0,0 +1,126 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ARROWHEADSYSTEM_H
+#define ARROWHEADSYSTEM_H
+
+
+#include <vector>
+#include <functional>
+#include <Eigen/Eigen>
+#include <Eigen/StdVector>
+
+
+/**
+ * @brief Normal equations of a chain of states which all connect to a small set of global variables.
+ *
+ * Our graph is a chain of imu states, where each state is only connected to the one before and after it.
+ * But every state also connects to the global calibration, thus the hessian has an "arrowhead" structure:
+ * a block tridiagonal part for the states, and a dense border of the calibration on the bottom and right.
+ *
+ * We solve this by eliminating the states in time (a block Cholesky of the tridiagonal part), which reduces the system onto the calibration
+ * (the Schur complement). After solving the small calibration system, we back substitute to recover each state.
+ * The cost is linear in the number of states, and no fill-in happens between states and the calibration.
+ *
+ * This has no dependency on GTSAM, the caller fills in the blocks from its linearized factors.
+ */
+class ArrowheadSystem {
+
+public:
+
+    /// Dense dynamic matrix type we store our blocks in
+    typedef Eigen::MatrixXd MATRIX;
+
+    /**
+     * @brief Default constructor
+     * @param num_states Number of states in our chain
+     * @param dim_state Dimension of each state
+     * @param dim_calib Dimension of all global variables together
+     */
+    ArrowheadSystem(size_t num_states, int dim_state, int dim_calib);
+
+    /// Sets all our blocks to zero (keeps the sizes)
+    void set_zero();
+
+    /// Hessian block between state k and itself
+    MATRIX &H_ss(size_t k) { return H_diag.at(k); }
+
+    /// Hessian block between state k and the state after it (k+1)
+    MATRIX &H_sn(size_t k) { return H_next.at(k); }
+
+    /// Hessian block between state k and the calibration
+    MATRIX &H_sc(size_t k) { return H_calib.at(k); }
+
+    /// Hessian block of the calibration
+    MATRIX &H_cc() { return H_cc_; }
+
+    /// Gradient (right hand side) of state k
+    Eigen::VectorXd &g_s(size_t k) { return g_state.at(k); }
+
+    /// Gradient (right hand side) of the calibration
+    Eigen::VectorXd &g_c() { return g_calib; }
+
+    /**
+     * @brief Solves (H + lambda*I) dx = g
+     * @param lambda Damping added to the diagonal (e.g. Levenberg-Marquardt)
+     * @param dx_states Solution of each state
+     * @param dx_calib Solution of the calibration
+     * @return False if the damped system is not positive definite
+     */
+    bool solve(double lambda, std::vector<Eigen::VectorXd> &dx_states, Eigen::VectorXd &dx_calib) const;
+
+    /**
+     * @brief Recovers the marginal covariance of each state and of the calibration, without ever forming the inverse of H.
+     *
+     * We eliminate the states newest to oldest, thus each state is conditioned on the one before it and the calibration.
+     * The covariance of the calibration is the inverse of its Schur complement, and then each state's covariance (and its
+     * cross-covariance with the calibration) follows from the one before it, oldest to newest.
+     * Only these blocks are ever computed, so this is linear in the number of states, and each is given to the callback as soon as it is known.
+     *
+     * @param P_cc Covariance of the calibration
+     * @param callback Given the index and covariance of each state, in order
+     * @return False if H is not positive definite (in which case the callback might have been called for some states)
+     */
+    bool marginal_covariances(MATRIX &P_cc, const std::function<void(size_t,const MATRIX&)> &callback) const;
+
+    /// Number of states in our chain
+    size_t num_states() const { return H_diag.size(); }
+
+    /// Dimension of each state
+    int dim_state() const { return dim_s; }
+
+    /// Dimension of the calibration
+    int dim_calib() const { return dim_c; }
+
+private:
+
+    /// Dimension of each state and the calibration
+    int dim_s, dim_c;
+
+    /// Our hessian blocks (H_next has one less than the number of states)
+    std::vector<MATRIX> H_diag, H_next, H_calib;
+    MATRIX H_cc_;
+
+    /// Our gradient blocks
+    std::vector<Eigen::VectorXd> g_state;
+    Eigen::VectorXd g_calib;
+
+};
+
+
+#endif //ARROWHEADSYSTEM_H
@@ -0,0 +1,186 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SOLVEROPTIONS_H
+#define SOLVEROPTIONS_H
+
+#include <iostream>
+#include <string>
+#include <Eigen/Eigen>
+
+
+/**
+ * @brief Struct which stores all options needed by the @ref ViconGraphSolver.
+ *
+ * This has no dependency on ROS, thus the solver can be used headless (e.g. many solves in one process).
+ * The ROS nodes load these from their node handler using load_solver_options() in utils/parse_ros.h.
+ */
+struct SolverOptions {
+
+    // INITIAL GUESSES =========================
+
+    /// Rotation from the gravity aligned frame to the vicon frame
+    Eigen::Matrix3d init_R_GtoV = Eigen::Matrix3d::Identity();
+
+    /// Rotation from the vicon marker body frame to the IMU
+    Eigen::Matrix3d init_R_BtoI = Eigen::Matrix3d::Identity();
+
+    /// Position of the vicon marker body frame in the IMU
+    Eigen::Vector3d init_p_BinI = Eigen::Vector3d::Zero();
+
+    /// Time offset between the IMU and vicon (t_imu = t_vicon + toff)
+    double init_toff_imu_to_vicon = 0.0;
+
+    /// Gravity magnitude in the global frame (we do not optimize this)
+    double gravity_magnitude = 9.81;
+
+    /// Largest gap between two vicon poses that we will interpolate over (sec), zero will interpolate over any gap
+    /// Camera times that do not have vicon without gaps for a second on either side are not estimated
+    double vicon_max_dt = 0.0;
+
+    /// States file of a previous solve (csv or .bin) to initialize our states from, instead of the vicon poses (empty to disable)
+    /// These are interpolated onto our camera times, any time it does not cover is still initialized from vicon (see @ref WarmStart)
+    /// This needs @ref warm_start_info of the same solve, since its R_GtoV is what rotates these states into the vicon frame
+    std::string warm_start_states = "";
+
+    /// Info file of a previous solve, whose calibration will replace all of the initial guesses above (empty to disable)
+    std::string warm_start_info = "";
+
+    // ESTIMATION ==============================
+
+    /// If we want to estimate the time offset between VICON and IMU
+    bool estimate_toff_vicon_to_imu = true;
+
+    /// If we want to estimate the orientation between VICON and IMU
+    bool estimate_ori_vicon_to_imu = true;
+
+    /// If we want to estimate the position between VICON and IMU
+    bool estimate_pos_vicon_to_imu = true;
+
+    /// If we want to estimate the gravity direction in the vicon frame, else it is fixed to init_R_GtoV
+    bool estimate_gravity = true;
+
+    // SOLVER ==================================
+
+    /// Number of times we will loop, relinearize the measurements, and re-solve
+    int num_loop_relin = 0;
+
+    /// If we should only re-preintegrate imu factors whose bias has changed more than our thresholds
+    bool relin_incremental = true;
+
+    /// Gyroscope (rad/s) and accelerometer (m/s^2) bias change needed to re-preintegrate an imu factor
+    double relin_thresh_bg = 1e-4;
+    double relin_thresh_ba = 1e-3;
+
+    /// How much camera time each update of a streaming solve adds (sec), see @ref ViconGraphSolver::stream_update()
+    double stream_window = 5.0;
+
+    /// How far behind our newest camera time a streaming solve keeps smoothing states, before they are marginalized and written (sec)
+    double stream_lag = 10.0;
+
+    /// Size of each chunk and how many camera times they overlap (zero will solve it all at once)
+    int chunk_size = 0;
+    int chunk_overlap = 200;
+
+    /// Number of threads we will use to build the graph (zero will use all cores)
+    int num_threads = 0;
+
+    /**
+     * @brief Minimum time between the states we estimate (sec), zero will estimate a state at every camera time
+     *
+     * We only estimate states at keyframe camera times which are at least this far apart, with imu factors over the longer intervals between them.
+     * After the solve, all other camera times are recovered by propagating the imu forward from the keyframe before it.
+     * This is not supported when streaming, since it removes the older imu measurements we would need.
+     */
+    double keyframe_dt = 0.0;
+
+    // OPTIMIZER ===============================
+
+    /// Non-linear optimizer we will use for batch solves (levenberg, dogleg, schur)
+    /// The schur optimizer is our own Levenberg-Marquardt which eliminates the states onto the calibration (see @ref ArrowheadSystem)
+    std::string optimizer = "levenberg";
+
+    /// Linear solver of each iteration (multifrontal_cholesky, multifrontal_qr, sequential_cholesky, sequential_qr)
+    std::string linear_solver = "multifrontal_cholesky";
+
+    /**
+     * @brief Variable elimination ordering (colamd, chain, metis), colamd is the default of GTSAM
+     *
+     * The chain ordering eliminates the states in time and the calibration variables last.
+     * Since every factor touches the calibration, it is a dense separator that we want to eliminate once at the end.
+     * This keeps each elimination step the same size, thus it is linear in the trajectory length.
+     * Use vicon2gt_bench to compare them on your datasets before changing this.
+     */
+    std::string ordering = "colamd";
+
+    /// Max number of iterations, and the relative and absolute decrease in error at which we have converged
+    /// The default tolerances only stop early once the error no longer decreases (e.g. 1e-9 stops once the decrease is small)
+    int max_iterations = 20;
+    double relative_error_tol = 1e-30;
+    double absolute_error_tol = 1e-30;
+
+    // OUTPUT ==================================
+
+    /// Format we will save the states in (csv, binary, both)
+    /// The binary file is columnar with the same columns as the csv, and is saved next to it with a .bin extension (see @ref StateWriter)
+    std::string state_format = "csv";
+
+    /// If we should save the marginal covariance of each state (its diagonal), and the full covariance of the estimated calibration
+    /// These are recovered from the normal equations of the final batch solve (see @ref ArrowheadSystem::marginal_covariances())
+    bool save_covariance = false;
+
+    /**
+     * @brief This function will print out all solver options loaded.
+     * This allows for visual checking that everything was loaded properly from ROS/CMD parsers.
+     */
+    void print() const {
+        std::cout << "init_R_GtoV:" << std::endl << init_R_GtoV << std::endl;
+        std::cout << "init_R_BtoI:" << std::endl << init_R_BtoI << std::endl;
+        std::cout << "init_p_BinI:" << std::endl << init_p_BinI.transpose() << std::endl;
+        std::cout << "init_toff_imu_to_vicon:" << std::endl << init_toff_imu_to_vicon << std::endl;
+        std::cout << "vicon_max_dt: " << vicon_max_dt << std::endl;
+        std::cout << "warm_start_states: " << warm_start_states << std::endl;
+        std::cout << "warm_start_info: " << warm_start_info << std::endl;
+        std::cout << "estimate_toff_vicon_to_imu: " << (int)estimate_toff_vicon_to_imu << std::endl;
+        std::cout << "estimate_ori_vicon_to_imu: " << (int)estimate_ori_vicon_to_imu << std::endl;
+        std::cout << "estimate_pos_vicon_to_imu: " << (int)estimate_pos_vicon_to_imu << std::endl;
+        std::cout << "estimate_gravity: " << (int)estimate_gravity << std::endl;
+        std::cout << "num_loop_relin: " << num_loop_relin << std::endl;
+        std::cout << "relin_incremental: " << (int)relin_incremental << std::endl;
+        std::cout << "relin_thresh_bg: " << relin_thresh_bg << std::endl;
+        std::cout << "relin_thresh_ba: " << relin_thresh_ba << std::endl;
+        std::cout << "stream_window: " << stream_window << std::endl;
+        std::cout << "stream_lag: " << stream_lag << std::endl;
+        std::cout << "chunk_size: " << chunk_size << std::endl;
+        std::cout << "chunk_overlap: " << chunk_overlap << std::endl;
+        std::cout << "num_threads: " << num_threads << std::endl;
+        std::cout << "keyframe_dt: " << keyframe_dt << std::endl;
+        std::cout << "optimizer: " << optimizer << std::endl;
+        std::cout << "linear_solver: " << linear_solver << std::endl;
+        std::cout << "ordering: " << ordering << std::endl;
+        std::cout << "max_iterations: " << max_iterations << std::endl;
+        std::cout << "relative_error_tol: " << relative_error_tol << std::endl;
+        std::cout << "absolute_error_tol: " << absolute_error_tol << std::endl;
+        std::cout << "state_format: " << state_format << std::endl;
+        std::cout << "save_covariance: " << (int)save_covariance << std::endl;
+    }
+
+};
+
+
+#endif //SOLVEROPTIONS_H
@@ -0,0 +1,208 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "StateWriter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "utils/profiler.h"
+
+
+/**
+ * @brief Formats a state as a csv line (ending in a newline) at the end of the buffer
+ * We use the same formatting as we had with std::setprecision (i.e. printf %g)
+ */
+static void append_row(const StateWriter::STATEROW &row, std::string &buffer) {
+    char line[512];
+    int len = std::snprintf(line, sizeof(line), "%.20g", std::floor(1e9*row.timestamp));
+    for(int j=0; j<16; j++) {
+        len += std::snprintf(line+len, sizeof(line)-len, ",%g", row.data(j));
+    }
+    buffer.append(line, len);
+    buffer.push_back('\n');
+}
+
+
+bool StateWriter::write_csv(const std::string &path, const std::vector<STATEROW> &rows, int num_threads) {
+
+    // Start timing
+    ProfileScope scope("write_csv");
+
+    // Format blocks of rows into their own buffer in parallel
+    size_t num_blocks = (size_t)std::max(1, std::min(num_threads, (int)(rows.size()/1000)+1));
+    size_t block_size = (rows.size()+num_blocks-1)/num_blocks;
+    std::vector<std::string> buffers(num_blocks);
+    auto format_block = [&](size_t b) {
+        std::string &buffer = buffers.at(b);
+        size_t idx_start = b*block_size;
+        size_t idx_end = std::min(rows.size(), idx_start+block_size);
+        buffer.reserve(200*(idx_end-idx_start));
+        for(size_t i=idx_start; i<idx_end; i++) {
+            append_row(rows.at(i), buffer);
+        }
+    };
+    std::vector<std::thread> workers;
+    for(size_t b=1; b<num_blocks; b++) {
+        workers.emplace_back(format_block, b);
+    }
+    format_block(0);
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+    // Finally write all buffers in order
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if(file == nullptr)
+        return false;
+    bool success = (std::fprintf(file, "%s\n", header()) > 0);
+    for(const auto &buffer : buffers) {
+        success = success && (std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size());
+    }
+    success = (std::fclose(file) == 0) && success;
+    return success;
+
+}
+
+
+bool StateWriter::append_csv(const std::string &path, const std::vector<STATEROW> &rows) {
+
+    // Format all rows, with our header first if this is a new file
+    std::ifstream existing(path);
+    bool has_header = existing.good() && existing.peek() != std::ifstream::traits_type::eof();
+    existing.close();
+    std::string buffer;
+    buffer.reserve(200*rows.size()+100);
+    if(!has_header) {
+        buffer.append(header());
+        buffer.push_back('\n');
+    }
+    for(const auto &row : rows) {
+        append_row(row, buffer);
+    }
+
+    // Write them to the end of the file in one go
+    FILE *file = std::fopen(path.c_str(), "ab");
+    if(file == nullptr)
+        return false;
+    bool success = (std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size());
+    success = (std::fclose(file) == 0) && success;
+    return success;
+
+}
+
+
+bool StateWriter::write_binary(const std::string &path, const std::vector<STATEROW> &rows) {
+
+    // Start timing
+    ProfileScope scope("write_binary");
+
+    // Convert into our columns
+    uint64_t num_rows = rows.size();
+    std::vector<int64_t> column_time(rows.size());
+    std::vector<double> columns(16*rows.size());
+    for(size_t i=0; i<rows.size(); i++) {
+        column_time.at(i) = (int64_t)std::floor(1e9*rows.at(i).timestamp);
+        for(size_t j=0; j<16; j++) {
+            columns.at(j*rows.size()+i) = rows.at(i).data(j);
+        }
+    }
+
+    // Write our header and then the columns
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if(file == nullptr)
+        return false;
+    bool success = (std::fprintf(file, "%s\n", header()) > 0);
+    success = success && (std::fwrite(&num_rows, sizeof(num_rows), 1, file) == 1);
+    success = success && (std::fwrite(column_time.data(), sizeof(int64_t), column_time.size(), file) == column_time.size());
+    success = success && (std::fwrite(columns.data(), sizeof(double), columns.size(), file) == columns.size());
+    success = (std::fclose(file) == 0) && success;
+    return success;
+
+}
+
+
+bool StateWriter::read(const std::string &path, std::vector<STATEROW> &rows) {
+
+    // Start timing
+    ProfileScope scope("read_states");
+    rows.clear();
+
+    // Binary files have our header, the number of rows, and then each column
+    size_t len = path.size();
+    if(len >= 4 && path.compare(len-4, 4, ".bin") == 0) {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if(file == nullptr)
+            return false;
+        char line[512];
+        uint64_t num_rows = 0;
+        bool success = (std::fgets(line, sizeof(line), file) != nullptr) && (std::strncmp(line, header(), std::strlen(header())) == 0);
+        success = success && (std::fread(&num_rows, sizeof(num_rows), 1, file) == 1);
+        // A corrupt count could be anything, so check all of its columns are in the rest of the file before we allocate them
+        long pos = success? std::ftell(file) : -1;
+        success = success && (pos >= 0) && (std::fseek(file, 0, SEEK_END) == 0);
+        long end = success? std::ftell(file) : -1;
+        success = success && (end >= pos) && (std::fseek(file, pos, SEEK_SET) == 0);
+        success = success && (num_rows <= (uint64_t)(end-pos)/(17*sizeof(double)));
+        std::vector<int64_t> column_time(success? num_rows : 0);
+        std::vector<double> columns(16*column_time.size());
+        success = success && (std::fread(column_time.data(), sizeof(int64_t), column_time.size(), file) == column_time.size());
+        success = success && (std::fread(columns.data(), sizeof(double), columns.size(), file) == columns.size());
+        std::fclose(file);
+        if(!success)
+            return false;
+        rows.resize(column_time.size());
+        for(size_t i=0; i<rows.size(); i++) {
+            rows.at(i).timestamp = 1e-9*(double)column_time.at(i);
+            for(size_t j=0; j<16; j++) {
+                rows.at(i).data(j) = columns.at(j*rows.size()+i);
+            }
+        }
+        return true;
+    }
+
+    // Else read each line of the csv, skipping our header (or any other comments)
+    std::ifstream file(path);
+    if(!file.is_open())
+        return false;
+    std::string line;
+    while(std::getline(file, line)) {
+        if(line.empty() || line.at(0) == '#')
+            continue;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream ss(line);
+        double time_ns;
+        STATEROW row;
+        ss >> time_ns;
+        for(int j=0; j<16; j++) {
+            ss >> row.data(j);
+        }
+        if(ss.fail())
+            return false;
+        row.timestamp = 1e-9*time_ns;
+        rows.push_back(row);
+    }
+    return true;
+
+}
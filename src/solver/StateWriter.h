@@ -0,0 +1,94 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef STATEWRITER_H
+#define STATEWRITER_H
+
+#include <string>
+#include <vector>
+#include <Eigen/Eigen>
+
+
+/**
+ * @brief Writes our estimated states in the eth format to file (and reads them back, e.g. to warm start a solve).
+ *
+ * The rows are gathered from the solver beforehand, thus writing does not touch the solver and can be done on another thread.
+ * Each row is `(time(ns),px,py,pz,qw,qx,qy,qz,vx,vy,vz,bwx,bwy,bwz,bax,bay,baz)` in the gravity aligned frame.
+ *
+ * The CSV is formatted in parallel blocks into large buffers which are then written in order with a single write each.
+ * The binary file has the same columns, but is stored column by column so each can be loaded directly (e.g. with numpy):
+ * - the csv header line (ending in a newline) which names the columns
+ * - number of rows as uint64
+ * - time column as int64 nanoseconds
+ * - the 16 remaining columns, each as contiguous float64 values
+ *
+ * All values are little-endian (i.e. native on the platforms we build on).
+ */
+class StateWriter {
+
+public:
+
+    /// A single state to write in the eth format
+    struct STATEROW {
+        double timestamp;
+        Eigen::Matrix<double,16,1,Eigen::DontAlign> data; ///< px,py,pz,qw,qx,qy,qz,vx,vy,vz,bwx,bwy,bwz,bax,bay,baz
+    };
+
+    /// Header of both our csv and binary files
+    static const char *header() {
+        return "#time(ns),px,py,pz,qw,qx,qy,qz,vx,vy,vz,bwx,bwy,bwz,bax,bay,baz";
+    }
+
+    /**
+     * @brief Writes the states to a csv file (overwrites it)
+     * @param path File we will write into
+     * @param rows States to write
+     * @param num_threads Number of threads we will format the rows with
+     * @return False if we could not write the file
+     */
+    static bool write_csv(const std::string &path, const std::vector<STATEROW> &rows, int num_threads);
+
+    /**
+     * @brief Appends the states to a csv file, which is created with our header if it does not exist yet
+     * This is used to write states as they are finalized (e.g. by a streaming solve) instead of all at once.
+     * @param path File we will append to
+     * @param rows States to write
+     * @return False if we could not write the file
+     */
+    static bool append_csv(const std::string &path, const std::vector<STATEROW> &rows);
+
+    /**
+     * @brief Writes the states to a columnar binary file (overwrites it)
+     * @param path File we will write into
+     * @param rows States to write
+     * @return False if we could not write the file
+     */
+    static bool write_binary(const std::string &path, const std::vector<STATEROW> &rows);
+
+    /**
+     * @brief Reads states from a file we have written (binary if it has a .bin extension, otherwise csv)
+     * @param path File we will read
+     * @param rows States in the file (in the same order)
+     * @return False if we could not read the file, or it is not in our format
+     */
+    static bool read(const std::string &path, std::vector<STATEROW> &rows);
+
+};
+
+
+#endif //STATEWRITER_H
@@ -19,82 +19,114 @@
 #include "ViconGraphSolver.h"
 
 
+/**
+ * @brief Prints an error and throws it, so the caller can decide if it is fatal (e.g. a batch only fails that one bag)
+ * @param msg Reason we are unable to solve
+ */
+static void throw_error(const std::string &msg) {
+    printf(RED "[VICON-GRAPH]: %s\n" RESET, msg.c_str());
+    throw std::runtime_error(msg);
+}
+
 
-ViconGraphSolver::ViconGraphSolver(ros::NodeHandle& nh, std::shared_ptr<Propagator> propagator,
+
+ViconGraphSolver::ViconGraphSolver(const SolverOptions &options, std::shared_ptr<Propagator> propagator,
                                    std::shared_ptr<Interpolator> interpolator, std::vector<double> timestamp_cameras) {
 
     // save measurement data
-    this->nh = nh;
+    this->options = options;
     this->propagator = propagator;
     this->interpolator = interpolator;
     this->timestamp_cameras = timestamp_cameras;
 
     // Initalize our graphs
-    this->graph = new gtsam::NonlinearFactorGraph();
+    this->graph.reset(new gtsam::NonlinearFactorGraph());
     this->config = std::make_shared<GtsamConfig>();
 
-    // Load gravity rotation into vicon frame
-    std::vector<double> R_GtoV;
-    std::vector<double> R_GtoV_default = {1.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,1.0};
-    nh.param<std::vector<double>>("R_GtoV", R_GtoV, R_GtoV_default);
-    init_R_GtoV << R_GtoV.at(0),R_GtoV.at(1),R_GtoV.at(2),
-            R_GtoV.at(3),R_GtoV.at(4),R_GtoV.at(5),
-            R_GtoV.at(6),R_GtoV.at(7),R_GtoV.at(8);
-
-    // Load gravity magnitude
-    nh.param<double>("gravity_magnitude", gravity_magnitude, 9.81);
-
-    // Load transform between vicon body frame to the IMU
-    std::vector<double> R_BtoI;
-    std::vector<double> R_BtoI_default = {1.0,0.0,0.0,0.0,1.0,0.0,0.0,0.0,1.0};
-    nh.param<std::vector<double>>("R_BtoI", R_BtoI, R_BtoI_default);
-    init_R_BtoI << R_BtoI.at(0),R_BtoI.at(1),R_BtoI.at(2),
-        R_BtoI.at(3),R_BtoI.at(4),R_BtoI.at(5),
-        R_BtoI.at(6),R_BtoI.at(7),R_BtoI.at(8);
-
-    std::vector<double> p_BinI;
-    std::vector<double> p_BinI_default = {0.0,0.0,0.0};
-    nh.param<std::vector<double>>("p_BinI", p_BinI, p_BinI_default);
-    init_p_BinI << p_BinI.at(0),p_BinI.at(1),p_BinI.at(2);
-
-    // Time offset between imu and vicon
-    nh.param<double>("toff_imu_to_vicon", init_toff_imu_to_vicon, 0.0);
-
-    // Debug print to console
-    cout << "init_R_GtoV:" << endl << init_R_GtoV << endl;
-    cout << "init_R_BtoI:" << endl << init_R_BtoI << endl;
-    cout << "init_p_BinI:" << endl << init_p_BinI.transpose() << endl;
-    cout << "init_toff_imu_to_vicon:" << endl << init_toff_imu_to_vicon << endl;
-
-    // ================================================================================================
-    // ================================================================================================
-    // ================================================================================================
-
-    // See if we should estimate time offset
-    nh.param<bool>("estimate_toff_vicon_to_imu", config->estimate_vicon_imu_toff, config->estimate_vicon_imu_toff);
-    nh.param<bool>("estimate_ori_vicon_to_imu", config->estimate_vicon_imu_ori, config->estimate_vicon_imu_ori);
-    nh.param<bool>("estimate_pos_vicon_to_imu", config->estimate_vicon_imu_pos, config->estimate_vicon_imu_pos);
-
-    // Number of times we relinearize
-    nh.param<int>("num_loop_relin", num_loop_relin, 0);
+    // See if we should estimate calibration
+    config->estimate_vicon_imu_toff = options.estimate_toff_vicon_to_imu;
+    config->estimate_vicon_imu_ori = options.estimate_ori_vicon_to_imu;
+    config->estimate_vicon_imu_pos = options.estimate_pos_vicon_to_imu;
+    config->estimate_gravity = options.estimate_gravity;
+
+    // Number of threads we will use to build the graph (zero will use all cores)
+    if(this->options.num_threads <= 0)
+        this->options.num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    // Ensure we know how to optimize
+    if(this->options.optimizer != "levenberg" && this->options.optimizer != "dogleg" && this->options.optimizer != "schur") {
+        throw_error("unknown optimizer "+this->options.optimizer+" (levenberg, dogleg, schur)");
+    }
+    if(this->options.linear_solver != "multifrontal_cholesky" && this->options.linear_solver != "multifrontal_qr"
+       && this->options.linear_solver != "sequential_cholesky" && this->options.linear_solver != "sequential_qr") {
+        throw_error("unknown linear solver "+this->options.linear_solver+" (multifrontal_cholesky, multifrontal_qr, sequential_cholesky, sequential_qr)");
+    }
+    if(this->options.ordering != "colamd" && this->options.ordering != "chain" && this->options.ordering != "metis") {
+        throw_error("unknown ordering "+this->options.ordering+" (colamd, chain, metis)");
+    }
+    if(this->options.state_format != "csv" && this->options.state_format != "binary" && this->options.state_format != "both") {
+        throw_error("unknown state format "+this->options.state_format+" (csv, binary, both)");
+    }
+
+    // Replace our initial calibration with the one from a previous solve
+    // If we do not estimate gravity, then we keep the one we were given (e.g. from another body in the same vicon frame)
+    if(!this->options.warm_start_states.empty() && this->options.warm_start_info.empty()) {
+        throw_error("warm start states "+this->options.warm_start_states+" also need the warm start info of the same solve");
+    }
+    Eigen::Matrix3d R_GtoV_warm = this->options.init_R_GtoV;
+    if(!this->options.warm_start_info.empty()) {
+        if(!WarmStart::load_calibration(this->options.warm_start_info, this->options.init_R_BtoI, this->options.init_p_BinI,
+                                        R_GtoV_warm, this->options.init_toff_imu_to_vicon)) {
+            throw_error("unable to load the warm start calibration from "+this->options.warm_start_info);
+        }
+        if(this->options.estimate_gravity)
+            this->options.init_R_GtoV = R_GtoV_warm;
+        printf("[VICON-GRAPH]: loaded warm start calibration from %s\n", this->options.warm_start_info.c_str());
+    }
+
+    // Load the states of a previous solve, which are in the gravity aligned frame of that solve
+    if(!this->options.warm_start_states.empty()) {
+        auto states = std::make_shared<WarmStart>();
+        if(!states->load_states(this->options.warm_start_states)) {
+            throw_error("unable to load the warm start states from "+this->options.warm_start_states);
+        }
+        states->R_GtoV = R_GtoV_warm;
+        printf("[VICON-GRAPH]: loaded %d warm start states from %s\n", (int)states->size(), this->options.warm_start_states.c_str());
+        this->warm_start = states;
+    }
+
+    // Find where we have vicon once, so each camera time only needs to look it up
+    this->vicon_coverage = this->interpolator->get_coverage(this->options.vicon_max_dt);
+    printf("[VICON-GRAPH]: vicon has %d intervals of coverage\n", (int)this->vicon_coverage.size());
 
     // Nice debug print
-    cout << "estimate_toff_vicon_to_imu: " << (int)config->estimate_vicon_imu_toff << endl;
-    cout << "estimate_ori_vicon_to_imu: " << (int)config->estimate_vicon_imu_ori << endl;
-    cout << "estimate_pos_vicon_to_imu: " << (int)config->estimate_vicon_imu_pos << endl;
-    cout << "num_loop_relin: " << num_loop_relin << endl;
+    this->options.print();
+
+}
+
+
 
-    // ================================================================================================
-    // ================================================================================================
-    // ================================================================================================
+ViconGraphSolver::ViconGraphSolver(const ViconGraphSolver &parent, const std::vector<size_t> &indices) {
 
-    // Frequency we will publish the raw vicon poses at
-    nh.param<double>("freq_pub_raw_vicon", vicon_raw_pub_freq, 10.0);
+    // Copy over our measurement data and settings
+    this->options = parent.options;
+    this->options.chunk_size = 0;
+    this->options.keyframe_dt = 0.0;
+    this->cancel_callback = parent.cancel_callback;
+    this->warm_start = parent.warm_start;
+    this->propagator = parent.propagator;
+    this->interpolator = parent.interpolator;
+    this->vicon_coverage = parent.vicon_coverage;
+
+    // Use the same state IDs as our parent, so our states can be copied back into it
+    for(const auto &i : indices) {
+        this->timestamp_cameras.push_back(parent.timestamp_cameras.at(i));
+        this->state_ids.push_back(parent.state_ids.at(i));
+    }
 
-    // Setup our ROS publishers
-    pub_pathimu = nh.advertise<nav_msgs::Path>("/vicon2gt/optimized", 2);
-    pub_pathvicon = nh.advertise<nav_msgs::Path>("/vicon2gt/vicon", 2);
-    pub_vicon_raw = nh.advertise<geometry_msgs::PoseArray>("/vicon2gt/vicon_raw", 2);
+    // Our own graph and config, so we can change what we estimate
+    this->graph.reset(new gtsam::NonlinearFactorGraph());
+    this->config = std::make_shared<GtsamConfig>(*parent.config);
 
 }
 
@@ -104,66 +136,68 @@ void ViconGraphSolver::build_and_solve() {
 
     // Ensure we have enough measurements
     if(timestamp_cameras.empty()) {
-        ROS_ERROR("[VICON-GRAPH]: Camera timestamp vector empty!!!!");
-        ROS_ERROR("[VICON-GRAPH]: Make sure your camera topic is correct...");
-        ROS_ERROR("%s on line %d",__FILE__,__LINE__);
-        std::exit(EXIT_FAILURE);
+        throw_error("camera timestamp vector empty, make sure your camera topic is correct");
+    }
+
+    // Clear old states, and give each camera time its state ID
+    // These IDs never change, even if we remove camera times after
+    values.clear();
+    solve_stats = SOLVESTATS();
+    state_ids.resize(timestamp_cameras.size());
+    for(size_t i=0; i<timestamp_cameras.size(); i++) {
+        state_ids.at(i) = i;
     }
 
     // Delete all camera measurements that occur before our IMU readings
-    ROS_INFO("cleaning camera timestamps");
-    auto it0 = timestamp_cameras.begin();
-    while(it0 != timestamp_cameras.end()) {
-        if(!propagator->has_bounding_imu(*it0)) {
-            ROS_INFO_THROTTLE(0.1,"    - deleted cam time %.9f [throttled]",*it0);
-            it0 = timestamp_cameras.erase(it0);
-        } else {
-            it0++;
+    printf("cleaning camera timestamps\n");
+    remove_cameras_if([&](size_t i) {
+        if(!propagator->has_bounding_imu(timestamp_cameras.at(i))) {
+            if(print_throttled()) printf("    - deleted cam time %.9f [throttled]\n",timestamp_cameras.at(i));
+            return true;
         }
-    }
+        return false;
+    });
 
     // Ensure we have enough measurements after removing invalid
     if(timestamp_cameras.empty()) {
-        ROS_ERROR("[VICON-GRAPH]: All camera timestamps where out of the range of the IMU measurements.");
-        ROS_ERROR("[VICON-GRAPH]: Make sure your camera and imu topics are correct...");
-        ROS_ERROR("%s on line %d",__FILE__,__LINE__);
-        std::exit(EXIT_FAILURE);
+        throw_error("all camera timestamps were out of the range of the imu measurements, make sure your camera and imu topics are correct");
     }
 
-    // Clear old states
-    map_states.clear();
-    values.clear();
-
-    // Create map of the state timestamps to their IDs
-    for(size_t i=0; i<timestamp_cameras.size(); i++) {
-        map_states.insert({timestamp_cameras.at(i),i});
+    // If we only estimate keyframes, then remove all other camera times (they are recovered after the solve)
+    // We always keep the first and last so we cover the whole trajectory
+    std::vector<double> timestamp_all;
+    std::vector<size_t> state_ids_all;
+    if(options.keyframe_dt > 0) {
+        timestamp_all = timestamp_cameras;
+        state_ids_all = state_ids;
+        double time_keyframe = -INFINITY;
+        remove_cameras_if([&](size_t i) {
+            if(i+1 < timestamp_all.size() && timestamp_all.at(i)-time_keyframe < options.keyframe_dt)
+                return true;
+            time_keyframe = timestamp_all.at(i);
+            return false;
+        });
+        printf("[KEYFRAME]: estimating %d keyframes of %d camera times\n", (int)timestamp_cameras.size(), (int)timestamp_all.size());
     }
 
-    // Loop a specified number of times, and keep solving the problem
-    // One would want this if you want to relinearize the bias estimates in CPI
-    for(int i=0; i<=num_loop_relin; i++) {
-
-        // Build the problem
-        build_problem(i==0);
-
-        // optimize the graph.
-        optimize_problem();
-
-        // move values forward in time
-        values = values_result;
-
-        // Now print timing statistics
-        ROS_INFO("\u001b[34m[TIME]: %.4f to build\u001b[0m",(rT2-rT1).total_microseconds() * 1e-6);
-        ROS_INFO("\u001b[34m[TIME]: %.4f to optimize\u001b[0m",(rT3-rT2).total_microseconds() * 1e-6);
-        ROS_INFO("\u001b[34m[TIME]: %.4f total (loop %d)\u001b[0m",(rT3-rT1).total_microseconds() * 1e-6,i);
+    // If we have a lot of states, then we solve them in smaller chunks
+    // Otherwise we will solve everything in one large batch problem
+    if(options.chunk_size > 0 && (int)timestamp_cameras.size() > options.chunk_size) {
+        solve_chunked();
+    } else {
+        solve_batch();
+    }
 
+    // Recover the camera times between our keyframes
+    if(options.keyframe_dt > 0 && !timestamp_cameras.empty()) {
+        densify_states(timestamp_all, state_ids_all);
     }
 
 
     // Debug print results...
     cout << endl << "======================================" << endl;
-    cout << "state_0: " << endl << values_result.at<JPLNavState>(X(map_states[timestamp_cameras.at(0)])) << endl;
-    cout << "state_N: " << endl << values_result.at<JPLNavState>(X(map_states[timestamp_cameras.at(timestamp_cameras.size()-1)])) << endl;
+    cout << "state_0: " << endl << values_result.at<JPLNavState>(key_state(0)) << endl;
+    cout << "state_N: " << endl << values_result.at<JPLNavState>(key_state(timestamp_cameras.size()-1)) << endl;
     cout << "R_BtoI: " << endl << quat_2_Rot(values_result.at<JPLQuaternion>(C(0)).q()) << endl << endl;
     cout << "p_BinI: " << endl << values_result.at<Vector3>(C(1)) << endl << endl;
     cout << "R_GtoV: " << endl << values_result.at<RotationXY>(G(0)).rot() << endl << endl;
@@ -176,18 +210,38 @@ void ViconGraphSolver::build_and_solve() {
 
 
 void ViconGraphSolver::write_to_file(std::string csvfilepath, std::string infofilepath) {
+    write_to_file_async(csvfilepath, infofilepath).get();
+}
+
+
+std::future<void> ViconGraphSolver::write_to_file_async(std::string csvfilepath, std::string infofilepath) {
 
     // Debug info
-    ROS_INFO("saving states and info to file");
+    printf("saving states and info to file\n");
+
+    // The binary file is saved next to the csv
+    bool save_csv = (options.state_format != "binary");
+    bool save_binary = (options.state_format != "csv");
+    std::string binfilepath = boost::filesystem::path(csvfilepath).replace_extension(".bin").string();
+    boost::filesystem::path path_csv(csvfilepath);
+    std::string covfilepath = (path_csv.parent_path()/(path_csv.stem().string()+"_cov.csv")).string();
 
     // If the file exists, then delete it
-    if (boost::filesystem::exists(csvfilepath)) {
+    if (save_csv && boost::filesystem::exists(csvfilepath)) {
         boost::filesystem::remove(csvfilepath);
-        ROS_INFO("    - old state file found, deleted...");
+        printf("    - old state file found, deleted...\n");
+    }
+    if (save_binary && boost::filesystem::exists(binfilepath)) {
+        boost::filesystem::remove(binfilepath);
+        printf("    - old binary state file found, deleted...\n");
+    }
+    if (options.save_covariance && boost::filesystem::exists(covfilepath)) {
+        boost::filesystem::remove(covfilepath);
+        printf("    - old covariance file found, deleted...\n");
     }
     if (boost::filesystem::exists(infofilepath)) {
         boost::filesystem::remove(infofilepath);
-        ROS_INFO("    - old info file found, deleted...");
+        printf("    - old info file found, deleted...\n");
     }
     // Create the directory that we will open the file in
     boost::filesystem::path p1(csvfilepath);
@@ -195,158 +249,127 @@ void ViconGraphSolver::write_to_file(std::string csvfilepath, std::string infofi
     boost::filesystem::path p2(infofilepath);
     boost::filesystem::create_directories(p2.parent_path());
 
-    // Open our state file!
-    std::ofstream of_state;
-    of_state.open(csvfilepath, std::ofstream::out | std::ofstream::app);
-    of_state << "#time(ns),px,py,pz,qw,qx,qy,qz,vx,vy,vz,bwx,bwy,bwz,bax,bay,baz" << std::endl;
-
-    // Loop through all states, and
+    // Loop through all states, and get them rotated into gravity aligned frame
+    // We gather these now so the writing does not need to touch the solver
     Eigen::Matrix3d R_GtoV = values_result.at<RotationXY>(G(0)).rot();
-    Eigen::Vector4d q_GtoV = rot_2_quat(R_GtoV);
-    for(size_t i=0; i<timestamp_cameras.size(); i++) {
-        // get this state at this timestep rotated into gravity aligned frame
-        JPLNavState state = values_result.at<JPLNavState>(X(map_states[timestamp_cameras.at(i)]));
-        Eigen::Vector4d q_GtoIi = quat_multiply(state.q(),q_GtoV);
-        Eigen::Vector3d p_IiinG = R_GtoV.transpose()*state.p();
-        Eigen::Vector3d v_IiinG = R_GtoV.transpose()*state.v();
-        // export to file (time(ns),px,py,pz,qw,qx,qy,qz,vx,vy,vz,bwx,bwy,bwz,bax,bay,baz)
-        of_state << std::setprecision(20) << std::floor(1e9*timestamp_cameras.at(i)) << ","
-                 << std::setprecision(6)
-                 << p_IiinG(0) << ","<< p_IiinG(1) << ","<< p_IiinG(2) << ","
-                 << q_GtoIi(3) << "," << q_GtoIi(0) << "," << q_GtoIi(1) << "," << q_GtoIi(2) << ","
-                 << v_IiinG(0) << ","<< v_IiinG(1) << ","<< v_IiinG(2) << ","
-                 << state.bg()(0) << "," << state.bg()(1) << "," << state.bg()(2) << ","
-                 << state.ba()(0) << "," << state.ba()(1) << "," << state.ba()(2) << std::endl;
-    }
-    of_state.close();
-
-    // Save calibration and the such to file
-    std::ofstream of_info;
-    of_info.open(infofilepath, std::ofstream::out | std::ofstream::app);
-    of_info << "R_BtoI: " << endl << quat_2_Rot(values_result.at<JPLQuaternion>(C(0)).q()) << endl << endl ;
-    of_info << "q_BtoI: " << endl << values_result.at<JPLQuaternion>(C(0)).q() << endl << endl;
-    of_info << "p_BinI: " << endl << values_result.at<Vector3>(C(1)) << endl << endl;
-    of_info << "R_GtoV: " << endl << values_result.at<RotationXY>(G(0)).rot() << endl << endl;
-    of_info << "R_GtoV (thetax, thetay): " << endl;
-    of_info << values_result.at<RotationXY>(G(0)).thetax() << " " << values_result.at<RotationXY>(G(0)).thetax() << endl << endl;
-    of_info << "gravity norm: " << endl << gravity_magnitude << endl << endl;
-    of_info << "t_off_vicon_to_imu: " << endl << values_result.at<Vector1>(T(0)) << endl << endl;
-    of_info.close();
+    auto rows = std::make_shared<std::vector<StateWriter::STATEROW>>();
+    get_state_rows(0, timestamp_cameras.size(), *rows);
+
+    // Save calibration and the such to our info
+    std::string info = get_info();
+
+    // If we want the covariance, build the normal equations at our final estimate
+    // This can only be done if we have the full batch graph (not if we solved in chunks or incrementally)
+    std::shared_ptr<ArrowheadSystem> system_cov;
+    std::string cov_order;
+    if(options.save_covariance) {
+        ProfileScope scope_cov("covariance_linearize");
+        SCHURLAYOUT layout = get_schur_layout(values_result);
+        system_cov = std::make_shared<ArrowheadSystem>(layout.keys_states.size(), (int)JPLNavState::dimension, layout.dim_calib);
+        if(layout.keys_states.size() != timestamp_cameras.size() || !fill_schur_system(*linearize_problem(values_result), layout, *system_cov)) {
+            printf(YELLOW "    - covariance can only be recovered from a batch solve of a chain of states, skipping...\n" RESET);
+            system_cov = nullptr;
+        }
+        for(const Key &key : layout.keys_calib) {
+            cov_order += DefaultKeyFormatter(key) + "(" + std::to_string(layout.block_calib.at(key).second) + ") ";
+        }
+    }
+
+    // Finally format and write everything on another thread
+    int num_threads = options.num_threads;
+    return std::async(std::launch::async, [=]() {
+        ProfileScope scope("write_to_file");
+        if(save_csv && !StateWriter::write_csv(csvfilepath, *rows, num_threads))
+            printf(RED "    - unable to write %s\n" RESET, csvfilepath.c_str());
+        if(save_binary && !StateWriter::write_binary(binfilepath, *rows))
+            printf(RED "    - unable to write %s\n" RESET, binfilepath.c_str());
+
+        // Recover the covariances, each state is written as soon as we have it
+        // Position and velocity are rotated into the gravity aligned frame like our states, orientation error is in the IMU frame
+        std::stringstream ss_cov;
+        if(system_cov != nullptr) {
+            ProfileScope scope_cov("covariance_recover");
+            FILE *file = std::fopen(covfilepath.c_str(), "wb");
+            bool success = (file != nullptr) && (std::fprintf(file, "#time(ns),var_px,var_py,var_pz,var_thx,var_thy,var_thz,var_vx,var_vy,var_vz,var_bwx,var_bwy,var_bwz,var_bax,var_bay,var_baz\n") > 0);
+            ArrowheadSystem::MATRIX P_cc;
+            bool success_cov = system_cov->marginal_covariances(P_cc, [&](size_t k, const ArrowheadSystem::MATRIX &P_kk) {
+                if(!success)
+                    return;
+                Eigen::Matrix<double,15,1> var;
+                var << (R_GtoV.transpose()*P_kk.block(12,12,3,3)*R_GtoV).diagonal(), P_kk.block(0,0,3,3).diagonal(),
+                       (R_GtoV.transpose()*P_kk.block(6,6,3,3)*R_GtoV).diagonal(), P_kk.block(3,3,3,3).diagonal(), P_kk.block(9,9,3,3).diagonal();
+                success = (std::fprintf(file, "%.20g", std::floor(1e9*rows->at(k).timestamp)) > 0);
+                for(int j=0; j<15; j++) {
+                    success = success && (std::fprintf(file, ",%g", var(j)) > 0);
+                }
+                success = success && (std::fprintf(file, "\n") > 0);
+            });
+            if(file != nullptr)
+                success = (std::fclose(file) == 0) && success;
+            if(!success)
+                printf(RED "    - unable to write %s\n" RESET, covfilepath.c_str());
+            if(!success_cov)
+                printf(RED "    - normal equations are not positive definite, covariance is incomplete\n" RESET);
+            else
+                ss_cov << "calibration covariance " << cov_order << ": " << endl << P_cc << endl << endl;
+        }
+        std::ofstream of_info(infofilepath, std::ofstream::out | std::ofstream::trunc);
+        of_info << info << ss_cov.str();
+        of_info.close();
+        if(!of_info)
+            printf(RED "    - unable to write %s\n" RESET, infofilepath.c_str());
+    });
 
 }
 
 
-void ViconGraphSolver::visualize() {
+void ViconGraphSolver::write_info_to_file(std::string infofilepath) const {
 
-    // Tell the user we are publishing
-    ROS_INFO("Publishing: %s", pub_pathimu.getTopic().c_str());
-    ROS_INFO("Publishing: %s", pub_pathvicon.getTopic().c_str());
+    // Create the directory that we will open the file in, and overwrite it
+    boost::filesystem::create_directories(boost::filesystem::path(infofilepath).parent_path());
+    std::ofstream of_info(infofilepath, std::ofstream::out | std::ofstream::trunc);
+    of_info << get_info();
+    of_info.close();
+    if(!of_info)
+        printf(RED "    - unable to write %s\n" RESET, infofilepath.c_str());
 
-    // Append to our pose vector
-    std::vector<geometry_msgs::PoseStamped> poses_imu;
-    for(size_t i=0; i<timestamp_cameras.size(); i++) {
+}
 
-        // Get the optimized imu state
-        JPLNavState state = values_result.at<JPLNavState>(X(map_states[timestamp_cameras.at(i)]));
-
-        // Create the pose
-        geometry_msgs::PoseStamped posetemp;
-        posetemp.header.stamp = ros::Time(timestamp_cameras.at(i));
-        posetemp.header.frame_id = "vicon";
-        posetemp.pose.orientation.x = state.q()(0);
-        posetemp.pose.orientation.y = state.q()(1);
-        posetemp.pose.orientation.z = state.q()(2);
-        posetemp.pose.orientation.w = state.q()(3);
-        posetemp.pose.position.x = state.p()(0);
-        posetemp.pose.position.y = state.p()(1);
-        posetemp.pose.position.z = state.p()(2);
-        poses_imu.push_back(posetemp);
-    }
-
-    // Create our path (imu)
-    // NOTE: We downsample the number of poses as needed to prevent rviz crashes
-    // NOTE: https://github.com/ros-visualization/rviz/issues/1107
-    nav_msgs::Path arrIMU;
-    arrIMU.header.stamp = ros::Time::now();
-    arrIMU.header.frame_id = "vicon";
-    for(size_t i=0; i<poses_imu.size(); i+=std::floor(poses_imu.size()/16384.0)+1) {
-        arrIMU.poses.push_back(poses_imu.at(i));
-    }
-    pub_pathimu.publish(arrIMU);
 
-    // Get vicon marker body to imu calibration
-    Eigen::Matrix3d R_BtoI = quat_2_Rot(values_result.at<JPLQuaternion>(C(0)).q());
-    Eigen::Vector3d p_BinI = values_result.at<Vector3>(C(1));
+void ViconGraphSolver::get_state_rows(size_t idx_start, size_t idx_end, std::vector<StateWriter::STATEROW> &rows) const {
 
-    // Append to our pose vector
-    std::vector<geometry_msgs::PoseStamped> poses_vicon;
-    for(size_t i=0; i<timestamp_cameras.size(); i++) {
+    // All states are rotated by the same gravity direction
+    Eigen::Matrix3d R_GtoV = values_result.at<RotationXY>(G(0)).rot();
+    Eigen::Vector4d q_GtoV = rot_2_quat(R_GtoV);
+    rows.reserve(rows.size()+idx_end-idx_start);
+    for(size_t i=idx_start; i<idx_end; i++) {
+        const JPLNavState &state = values_result.at<JPLNavState>(key_state(i));
+        Eigen::Vector4d q_GtoIi = quat_multiply(state.q(),q_GtoV);
+        Eigen::Vector3d p_IiinG = R_GtoV.transpose()*state.p();
+        Eigen::Vector3d v_IiinG = R_GtoV.transpose()*state.v();
+        StateWriter::STATEROW row;
+        row.timestamp = timestamp_cameras.at(i);
+        row.data << p_IiinG, q_GtoIi(3), q_GtoIi.block(0,0,3,1), v_IiinG, state.bg(), state.ba();
+        rows.push_back(row);
+    }
 
-        // Get the interpolated pose
-        Eigen::Matrix<double,4,1> q_VtoB;
-        Eigen::Matrix<double,3,1> p_BinV;
-        Eigen::Matrix<double,6,6> R_vicon;
-        double timestamp_inV = timestamp_cameras.at(i) - values.at<Vector1>(T(0))(0);
-        bool has_vicon = interpolator->get_pose(timestamp_inV, q_VtoB, p_BinV, R_vicon);
-        if(!has_vicon)
-            continue;
+}
 
-        // Transform into the IMU frame
-        Eigen::Vector4d q_VtoI = quat_multiply(rot_2_quat(R_BtoI),q_VtoB);
-        Eigen::Vector3d p_IinV = p_BinV - quat_2_Rot(q_VtoI).transpose()*p_BinI;
-
-        // Create the pose
-        geometry_msgs::PoseStamped posetemp;
-        posetemp.header.stamp = ros::Time(timestamp_cameras.at(i));
-        posetemp.header.frame_id = "vicon";
-        posetemp.pose.orientation.x = q_VtoI(0);
-        posetemp.pose.orientation.y = q_VtoI(1);
-        posetemp.pose.orientation.z = q_VtoI(2);
-        posetemp.pose.orientation.w = q_VtoI(3);
-        posetemp.pose.position.x = p_IinV(0);
-        posetemp.pose.position.y = p_IinV(1);
-        posetemp.pose.position.z = p_IinV(2);
-        poses_vicon.push_back(posetemp);
-
-    }
-
-    // Create our path (vicon)
-    // NOTE: We downsample the number of poses as needed to prevent rviz crashes
-    // NOTE: https://github.com/ros-visualization/rviz/issues/1107
-    nav_msgs::Path arrVICON;
-    arrVICON.header.stamp = ros::Time::now();
-    arrVICON.header.frame_id = "vicon";
-    for(size_t i=0; i<poses_vicon.size(); i+=std::floor(poses_imu.size()/16384.0)+1) {
-        arrVICON.poses.push_back(poses_vicon.at(i));
-    }
-    pub_pathvicon.publish(arrVICON);
-
-    // Pose array of the raw VICON poses which we get on our vicon topic
-    // NOTE: might be a lot to visualize if high frequency vicon system...
-    double last_pub_time = -1;
-    geometry_msgs::PoseArray pose_arr;
-    pose_arr.header.stamp = ros::Time::now();
-    pose_arr.header.frame_id = "vicon";
-    for(const auto &pose_data : interpolator->get_raw_poses()) {
-        if(last_pub_time != -1 && (last_pub_time+1.0/vicon_raw_pub_freq) > pose_data.timestamp)
-            continue;
-        geometry_msgs::Pose pose;
-        pose.orientation.x = pose_data.q(0);
-        pose.orientation.y = pose_data.q(1);
-        pose.orientation.z = pose_data.q(2);
-        pose.orientation.w = pose_data.q(3);
-        pose.position.x = pose_data.p(0);
-        pose.position.y = pose_data.p(1);
-        pose.position.z = pose_data.p(2);
-        pose_arr.poses.push_back(pose);
-        last_pub_time = pose_data.timestamp;
-    }
-    pub_vicon_raw.publish(pose_arr);
 
+std::string ViconGraphSolver::get_info() const {
+    std::stringstream ss_info;
+    ss_info << "R_BtoI: " << endl << quat_2_Rot(values_result.at<JPLQuaternion>(C(0)).q()) << endl << endl ;
+    ss_info << "q_BtoI: " << endl << values_result.at<JPLQuaternion>(C(0)).q() << endl << endl;
+    ss_info << "p_BinI: " << endl << values_result.at<Vector3>(C(1)) << endl << endl;
+    ss_info << "R_GtoV: " << endl << values_result.at<RotationXY>(G(0)).rot() << endl << endl;
+    ss_info << "R_GtoV (thetax, thetay): " << endl;
+    ss_info << values_result.at<RotationXY>(G(0)).thetax() << " " << values_result.at<RotationXY>(G(0)).thetay() << endl << endl;
+    ss_info << "gravity norm: " << endl << options.gravity_magnitude << endl << endl;
+    ss_info << "t_off_vicon_to_imu: " << endl << values_result.at<Vector1>(T(0)) << endl << endl;
+    return ss_info.str();
 }
 
 
-
 void ViconGraphSolver::get_imu_poses(std::vector<double> &times, std::vector<Eigen::Matrix<double,7,1>> &poses) {
 
     // Clear the old data
@@ -357,7 +380,7 @@ void ViconGraphSolver::get_imu_poses(std::vector<double> &times, std::vector<Eig
     for(size_t i=0; i<timestamp_cameras.size(); i++) {
 
         // get this state at this timestep
-        JPLNavState state = values_result.at<JPLNavState>(X(map_states[timestamp_cameras.at(i)]));
+        JPLNavState state = values_result.at<JPLNavState>(key_state(i));
 
         // append to our vectors
         Eigen::Matrix<double,7,1> pose;
@@ -388,25 +411,25 @@ void ViconGraphSolver::get_calibration(double &toff, Eigen::Matrix3d &R_BtoI, Ei
 void ViconGraphSolver::build_problem(bool init_states) {
 
     // Start timing
-    rT1 =  boost::posix_time::microsec_clock::local_time();
+    ProfileScope scope("build_problem");
 
     // Clear the old factors
-    ROS_INFO("[BUILD]: building the graph (might take a while)");
+    printf("[BUILD]: building the graph (might take a while)\n");
     graph->erase(graph->begin(), graph->end());
 
     // Create gravity and calibration nodes and insert them
     if(init_states) {
-        values.insert(C(0), JPLQuaternion(rot_2_quat(init_R_BtoI)));
-        values.insert(C(1), Vector3(init_p_BinI));
-        Eigen::Vector3d rpy = rot2rpy(init_R_GtoV);
+        values.insert(C(0), JPLQuaternion(rot_2_quat(options.init_R_BtoI)));
+        values.insert(C(1), Vector3(options.init_p_BinI));
+        Eigen::Vector3d rpy = rot2rpy(options.init_R_GtoV);
         values.insert(G(0), RotationXY(rpy(0),rpy(1)));
     }
-    ROS_INFO("[BUILD]: initial R_GtoV roll pitch %.4f, %.4f", values.at<RotationXY>(G(0)).thetax(), values.at<RotationXY>(G(0)).thetay());
+    printf("[BUILD]: initial R_GtoV roll pitch %.4f, %.4f\n", values.at<RotationXY>(G(0)).thetax(), values.at<RotationXY>(G(0)).thetay());
 
     // If estimating the timeoffset logic
     if(init_states) {
         Vector1 temp;
-        temp(0) = init_toff_imu_to_vicon;
+        temp(0) = options.init_toff_imu_to_vicon;
         values.insert(T(0), temp);
     }
     // Prior to make time offset stable
@@ -414,157 +437,1060 @@ void ViconGraphSolver::build_problem(bool init_states) {
     //sigma(0,0) = 0.02; // seconds
     //PriorFactor<Vector1> factor_timemag(T(0), values.at<Vector1>(T(0)), sigma);
     //graph->add(factor_timemag);
-    ROS_INFO("[BUILD]: current time offset is %.4f", values.at<Vector1>(T(0))(0));
+    printf("[BUILD]: current time offset is %.4f\n", values.at<Vector1>(T(0))(0));
 
-    // Loop through each camera time and construct the graph
-    auto it1 = timestamp_cameras.begin();
-    while(it1 != timestamp_cameras.end()) {
+    // Loop through each camera time and check that we can construct a vicon factor
+    // This is cheap compared to preintegration so we do it serially (also needs to remove invalid states)
+    // If we are told to stop, all camera times after are kept as is
+    size_t num_valid = 0;
+    bool cancelled = false;
+    remove_cameras_if([&](size_t i) {
 
         // If ros is wants us to stop, break out
-        if (!ros::ok())
-            break;
+        cancelled = cancelled || is_cancelled();
+        if (cancelled)
+            return false;
 
         // Current image time
-        double timestamp_inI = *it1;
-        double timestamp_inV = timestamp_inI - values.at<Vector1>(T(0))(0);
+        double timestamp_inI = timestamp_cameras.at(i);
 
-        // First get the vicon pose at the current time
+        // Skip if we don't have a valid vicon measurement for this pose
         Eigen::Matrix<double,4,1> q_VtoB;
         Eigen::Matrix<double,3,1> p_BinV;
-        Eigen::Matrix<double,6,6> R_vicon;
-        bool has_vicon1 = interpolator->get_pose(timestamp_inV - 1.0, q_VtoB, p_BinV, R_vicon);
-        bool has_vicon2 = interpolator->get_pose(timestamp_inV + 1.0, q_VtoB, p_BinV, R_vicon);
-        bool has_vicon3 = interpolator->get_pose(timestamp_inV, q_VtoB, p_BinV, R_vicon);
-
-        // Skip if we don't have a vicon measurement for this pose
-        if(!has_vicon1 || !has_vicon2 || !has_vicon3) {
-            ROS_INFO_THROTTLE(0.1, "    - skipping camera time %.9f (no vicon pose found) [throttled]", timestamp_inI);
-            if(values.find(X(map_states[timestamp_inI])) != values.end()) {
-                values.erase(X(map_states[timestamp_inI]));
+        if(!get_vicon_init(timestamp_inI, q_VtoB, p_BinV)) {
+            if(values.find(key_state(i)) != values.end()) {
+                values.erase(key_state(i));
             }
-            it1 = timestamp_cameras.erase(it1);
-            continue;
+            return true;
+        }
+
+        // Now initialize the current pose of the IMU
+        if(init_states) {
+            Eigen::Matrix<double,3,1> zero = Eigen::Matrix<double,3,1>::Zero();
+            values.insert(key_state(i), get_state_init(timestamp_inI, q_VtoB, p_BinV, zero, zero));
         }
 
-        // Check if we can do the inverse
-        if(std::isnan(R_vicon.norm()) || std::isnan(R_vicon.inverse().norm())) {
-            ROS_INFO_THROTTLE(0.1, "    - skipping camera time %.9f (R.norm = %.3f | Rinv.norm = %.3f) [throttled]", timestamp_inI, R_vicon.norm(), R_vicon.inverse().norm());
-            if(values.find(X(map_states[timestamp_inI])) != values.end()) {
-                values.erase(X(map_states[timestamp_inI]));
+        // Finally, move forward in time!
+        num_valid++;
+        return false;
+
+    });
+
+    // Now preintegrate between each state and the next
+    std::vector<size_t> intervals;
+    for(size_t i=1; i<num_valid; i++) {
+        intervals.push_back(i);
+    }
+    std::vector<gtsam::NonlinearFactor::shared_ptr> factors_imu;
+    std::vector<Bias3> factors_bg, factors_ba;
+    preintegrate_intervals(intervals, factors_imu, factors_bg, factors_ba);
+
+    // Finally add our factors to the graph, in the same order as if we had built them serially
+    // Each state gets a vicon measurement, and is connected to the previous with the imu factor
+    // We record where each imu factor is so we can replace it if its bias linearization point moves
+    imu_factors.clear();
+    for(size_t i=0; i<num_valid; i++) {
+        graph->push_back(create_vicon_factor(i));
+        if(i > 0 && factors_imu.at(i-1) != nullptr) {
+            graph->push_back(factors_imu.at(i-1));
+            IMUFACTOR info;
+            info.graph_id = graph->size()-1;
+            info.interval = i;
+            info.bg_lin = factors_bg.at(i-1);
+            info.ba_lin = factors_ba.at(i-1);
+            imu_factors.push_back(info);
+        }
+    }
+    solve_stats.time_build += scope.elapsed();
+
+}
+
+
+
+
+void ViconGraphSolver::solve_batch() {
+
+    // Loop a specified number of times, and keep solving the problem
+    // One would want this if you want to relinearize the bias estimates in CPI
+    for(int i=0; i<=options.num_loop_relin; i++) {
+
+        // Start timing
+        ProfileScope scope_loop("solve_batch_loop");
+        SOLVESTATS stats_loop = solve_stats;
+
+        // Build the problem the first time
+        // After that we only need to update the imu factors whose bias has moved
+        if(i==0 || !options.relin_incremental)
+            build_problem(i==0);
+        else
+            relinearize_problem();
+
+        // optimize the graph.
+        optimize_problem();
+
+        // move values forward in time
+        values = values_result;
+
+        // Now print timing statistics
+        printf(BLUE "[TIME]: %.4f to build\n" RESET,solve_stats.time_build-stats_loop.time_build);
+        printf(BLUE "[TIME]: %.4f to optimize\n" RESET,solve_stats.time_optimize-stats_loop.time_optimize);
+        printf(BLUE "[TIME]: %.4f total (loop %d)\n" RESET,scope_loop.elapsed(),i);
+
+    }
+
+}
+
+
+void ViconGraphSolver::solve_chunked() {
+
+    // Start timing
+    ProfileScope scope("solve_chunked");
+
+    // First estimate the calibration using a decimated set of camera times over the whole trajectory
+    // We still use all imu measurements, they are just preintegrated over longer intervals
+    std::vector<size_t> indices_calib;
+    size_t stride = (size_t)std::ceil((double)timestamp_cameras.size()/(double)options.chunk_size);
+    for(size_t i=0; i<timestamp_cameras.size(); i+=stride) {
+        indices_calib.push_back(i);
+    }
+    printf("[CHUNK]: estimating calibration with %d of %d states\n", (int)indices_calib.size(), (int)timestamp_cameras.size());
+    ViconGraphSolver solver_calib(*this, indices_calib);
+    solver_calib.solve_batch();
+    solve_stats.add(solver_calib.solve_stats);
+    if(is_cancelled())
+        return;
+
+    // Split our camera times into overlapping chunks
+    std::vector<std::pair<size_t,size_t>> chunks;
+    size_t overlap = (size_t)std::max(0, std::min(options.chunk_overlap, options.chunk_size/2));
+    for(size_t start=0; start<timestamp_cameras.size(); start+=(size_t)options.chunk_size-overlap) {
+        size_t end = std::min(start+(size_t)options.chunk_size, timestamp_cameras.size());
+        chunks.push_back({start,end});
+        if(end == timestamp_cameras.size())
+            break;
+    }
+
+    // Each chunk owns the states from the middle of its start overlap to the middle of its end overlap
+    // This is where the chunks will be stitched together, and is furthest from their ends (which are the least constrained)
+    std::vector<std::pair<double,double>> chunks_owned;
+    for(size_t c=0; c<chunks.size(); c++) {
+        double own_start = (c==0)? -INFINITY : timestamp_cameras.at((chunks.at(c).first+chunks.at(c-1).second)/2);
+        double own_end = (c+1==chunks.size())? INFINITY : timestamp_cameras.at((chunks.at(c+1).first+chunks.at(c).second)/2);
+        chunks_owned.push_back({own_start,own_end});
+    }
+
+    // Calibration that all chunks will use (they will not estimate it themselves)
+    double toff;
+    Eigen::Matrix3d R_BtoI, R_GtoV;
+    Eigen::Vector3d p_BinI;
+    solver_calib.get_calibration(toff, R_BtoI, p_BinI, R_GtoV);
+
+    // Now solve each chunk in parallel
+    // Only this many chunks will be in memory at once, so this also bounds our peak memory
+    std::mutex mtx;
+    std::atomic<size_t> next_chunk(0);
+    size_t num_workers = std::max(1, std::min(options.num_threads, (int)chunks.size()));
+    printf("[CHUNK]: solving %d chunks of %d states with %d threads\n", (int)chunks.size(), options.chunk_size, (int)num_workers);
+    values_result.clear();
+    auto solve_chunks = [&]() {
+        size_t c;
+        while((c=next_chunk++) < chunks.size()) {
+
+            // If ros is wants us to stop, break out
+            if (is_cancelled())
+                break;
+
+            // Create the solver for this chunk with the calibration fixed
+            ProfileScope scope_chunk("solve_chunk");
+            std::vector<size_t> indices_chunk;
+            for(size_t i=chunks.at(c).first; i<chunks.at(c).second; i++) {
+                indices_chunk.push_back(i);
             }
-            it1 = timestamp_cameras.erase(it1);
-            continue;
+            ViconGraphSolver solver_chunk(*this, indices_chunk);
+            solver_chunk.options.init_toff_imu_to_vicon = toff;
+            solver_chunk.options.init_R_BtoI = R_BtoI;
+            solver_chunk.options.init_p_BinI = p_BinI;
+            solver_chunk.options.init_R_GtoV = R_GtoV;
+            solver_chunk.config->estimate_vicon_imu_toff = false;
+            solver_chunk.config->estimate_vicon_imu_ori = false;
+            solver_chunk.config->estimate_vicon_imu_pos = false;
+            solver_chunk.config->estimate_gravity = false;
+            solver_chunk.options.num_threads = std::max(1, options.num_threads/(int)num_workers);
+            solver_chunk.solve_batch();
+
+            // Finally copy the states this chunk owns into our results
+            std::lock_guard<std::mutex> lck(mtx);
+            solve_stats.add(solver_chunk.solve_stats);
+            for(size_t i=0; i<solver_chunk.timestamp_cameras.size(); i++) {
+                double timestamp = solver_chunk.timestamp_cameras.at(i);
+                if(timestamp < chunks_owned.at(c).first || timestamp >= chunks_owned.at(c).second)
+                    continue;
+                Key key = solver_chunk.key_state(i);
+                values_result.insert(key, solver_chunk.values_result.at<JPLNavState>(key));
+            }
+            printf("[CHUNK]: chunk %d of %d done (%.3f to %.3f)\n", (int)c+1, (int)chunks.size(),
+                   timestamp_cameras.at(chunks.at(c).first), timestamp_cameras.at(chunks.at(c).second-1));
+
         }
+    };
+    std::vector<std::thread> workers;
+    for(size_t t=1; t<num_workers; t++) {
+        workers.emplace_back(solve_chunks);
+    }
+    solve_chunks();
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+    // Append our calibration, and remove any camera times that our chunks were not able to estimate
+    values_result.insert(C(0), solver_calib.values_result.at<JPLQuaternion>(C(0)));
+    values_result.insert(C(1), solver_calib.values_result.at<Vector3>(C(1)));
+    values_result.insert(G(0), solver_calib.values_result.at<RotationXY>(G(0)));
+    values_result.insert(T(0), solver_calib.values_result.at<Vector1>(T(0)));
+    remove_cameras_if([&](size_t i) {
+        return !values_result.exists(key_state(i));
+    });
+    values = values_result;
+    printf(BLUE "[TIME]: %.4f total (chunked)\n" RESET,scope.elapsed());
+
+}
+
+
+void ViconGraphSolver::stream_start(NonlinearFactorGraph &new_factors, Values &new_values) {
+
+    // Keyframes are recovered by propagating the imu between them, which we no longer have once the states leave our lag
+    if(options.keyframe_dt > 0) {
+        throw_error("keyframes are not supported when streaming, set keyframe_dt to zero");
+    }
+
+    // Setup our incremental solver, we start with no states
+    ISAM2Params isam_params;
+    isam_params.relinearizeThreshold = 0.01;
+    isam_params.relinearizeSkip = 1;
+    stream.isam.reset(new ISAM2(isam_params));
+    values.clear();
+    values_result.clear();
+    timestamp_cameras.clear();
+    state_ids.clear();
+    solve_stats = SOLVESTATS();
+
+    // Our estimated calibration nodes get inserted on the first update
+    // Since we might only have a few states in the first window, we add weak priors so the system is never indeterminant
+    // The calibration we do not estimate are constants of our factors, so they are never given to the solver
+    Vector1 toff;
+    toff(0) = options.init_toff_imu_to_vicon;
+    Eigen::Vector3d rpy = rot2rpy(options.init_R_GtoV);
+    Values &values_ori = (config->estimate_vicon_imu_ori)? new_values : stream.values_fixed;
+    Values &values_pos = (config->estimate_vicon_imu_pos)? new_values : stream.values_fixed;
+    Values &values_toff = (config->estimate_vicon_imu_toff)? new_values : stream.values_fixed;
+    Values &values_grav = (config->estimate_gravity)? new_values : stream.values_fixed;
+    values_ori.insert(C(0), JPLQuaternion(rot_2_quat(options.init_R_BtoI)));
+    values_pos.insert(C(1), Vector3(options.init_p_BinI));
+    values_grav.insert(G(0), RotationXY(rpy(0),rpy(1)));
+    values_toff.insert(T(0), toff);
+    auto noise_prior = [&](size_t dim) { return noiseModel::Isotropic::Sigma(dim,stream.sigma_prior); };
+    if(config->estimate_vicon_imu_ori) {
+        new_factors.add(PriorFactor<JPLQuaternion>(C(0), new_values.at<JPLQuaternion>(C(0)), noise_prior(3)));
+        stream.keys_prior.push_back(C(0));
+    }
+    if(config->estimate_vicon_imu_pos) {
+        new_factors.add(PriorFactor<Vector3>(C(1), new_values.at<Vector3>(C(1)), noise_prior(3)));
+        stream.keys_prior.push_back(C(1));
+    }
+    if(config->estimate_gravity) {
+        new_factors.add(PriorFactor<RotationXY>(G(0), new_values.at<RotationXY>(G(0)), noise_prior(2)));
+        stream.keys_prior.push_back(G(0));
+    }
+    if(config->estimate_vicon_imu_toff) {
+        new_factors.add(PriorFactor<Vector1>(T(0), toff, noise_prior(1)));
+        stream.keys_prior.push_back(T(0));
+    }
+    values.insert(new_values);
+    values.insert(stream.values_fixed);
+    values_result = values;
+
+}
+
+
+/**
+ * @brief Finds the keys of all cliques below this one which have the given key as a parent (the same as GTSAM's fixed lag smoother)
+ * These need to be re-eliminated with the key we marginalize, so it ends up in a leaf of the Bayes tree.
+ */
+static void mark_affected_keys(Key key, const ISAM2::sharedClique &clique, std::set<Key> &keys) {
+    auto conditional = clique->conditional();
+    if(std::find(conditional->beginParents(), conditional->endParents(), key) == conditional->endParents())
+        return;
+    for(Key frontal : conditional->frontals()) {
+        keys.insert(frontal);
+    }
+    for(const auto &child : clique->children) {
+        mark_affected_keys(key, child, keys);
+    }
+}
+
+
+void ViconGraphSolver::stream_update(const std::vector<double> &timestamps, std::vector<StateWriter::STATEROW> &rows) {
+
+    // Start timing
+    ProfileScope scope("stream_update");
+    NonlinearFactorGraph new_factors;
+    Values new_values;
+    if(stream.isam == nullptr)
+        stream_start(new_factors, new_values);
+
+    // Vicon poses have been fed since our last update, so find where we have vicon again
+    vicon_coverage = interpolator->get_coverage(options.vicon_max_dt);
+
+    // Add all new states, and their vicon measurements
+    // Each new state is initialized from vicon, with the current bias estimate of the state before it
+    size_t idx_first = timestamp_cameras.size();
+    for(double timestamp_inI : timestamps) {
+
+        // Skip if this is not after our newest state, or we don't have the imu or vicon around it
+        Eigen::Matrix<double,4,1> q_VtoB;
+        Eigen::Matrix<double,3,1> p_BinV;
+        if(!timestamp_cameras.empty() && timestamp_inI <= timestamp_cameras.back())
+            continue;
+        if(!propagator->has_bounding_imu(timestamp_inI) || !get_vicon_init(timestamp_inI, q_VtoB, p_BinV))
+            continue;
+        timestamp_cameras.push_back(timestamp_inI);
+        state_ids.push_back(stream.next_id++);
+        size_t idx = timestamp_cameras.size()-1;
 
         // Now initialize the current pose of the IMU
-        if(init_states) {
-            Eigen::Matrix<double,4,1> q_VtoI = quat_multiply(rot_2_quat(init_R_BtoI),q_VtoB);
-            Eigen::Matrix<double,3,1> bg = Eigen::Matrix<double,3,1>::Zero();
-            Eigen::Matrix<double,3,1> v_IinV = Eigen::Matrix<double,3,1>::Zero();
-            Eigen::Matrix<double,3,1> ba = Eigen::Matrix<double,3,1>::Zero();
-            Eigen::Matrix<double,3,1> p_IinV = p_BinV - quat_2_Rot(Inv(q_VtoB))*init_R_BtoI.transpose()*init_p_BinI;
-            JPLNavState imu_state(timestamp_inI, q_VtoI, bg, v_IinV, ba, p_IinV);
-            values.insert(X(map_states[timestamp_inI]), imu_state);
+        Eigen::Matrix<double,3,1> bg = Eigen::Matrix<double,3,1>::Zero();
+        Eigen::Matrix<double,3,1> ba = Eigen::Matrix<double,3,1>::Zero();
+        if(idx > 0) {
+            bg = values.at<JPLNavState>(key_state(idx-1)).bg();
+            ba = values.at<JPLNavState>(key_state(idx-1)).ba();
         }
+        JPLNavState imu_state = get_state_init(timestamp_inI, q_VtoB, p_BinV, bg, ba);
+        values.insert(key_state(idx), imu_state);
+        new_values.insert(key_state(idx), imu_state);
 
         // Add the vicon measurement to this pose
-        MeasBased_ViconPoseTimeoffsetFactor factor_vicon(
-                X(map_states[timestamp_inI]), C(0), C(1), T(0),
-                interpolator, config
-        );
-        graph->add(factor_vicon);
-
-        // Skip the first ever pose
-        if(it1 == timestamp_cameras.begin()) {
-            it1++;
-            continue;
+        new_factors.push_back(create_vicon_factor(idx));
+
+    }
+
+    // Preintegrate between each new state and the one before it (which might be from the last update)
+    std::vector<size_t> intervals;
+    for(size_t i=std::max(idx_first,(size_t)1); i<timestamp_cameras.size(); i++) {
+        intervals.push_back(i);
+    }
+    std::vector<gtsam::NonlinearFactor::shared_ptr> factors_imu;
+    std::vector<Bias3> factors_bg, factors_ba;
+    preintegrate_intervals(intervals, factors_imu, factors_bg, factors_ba);
+    for(size_t i=0; i<factors_imu.size(); i++) {
+        if(factors_imu.at(i) != nullptr)
+            new_factors.push_back(factors_imu.at(i));
+    }
+    solve_stats.time_build += scope.elapsed();
+
+    // Find the states which have left our lag, these need to already be in the smoother and we always keep our newest
+    // If we still have our calibration priors, then we keep all states until they have been removed
+    size_t num_new = timestamp_cameras.size()-idx_first;
+    size_t num_marg = 0;
+    FastList<Key> keys_marg;
+    if(stream.keys_prior.empty() && !timestamp_cameras.empty()) {
+        double time_marg = timestamp_cameras.back()-options.stream_lag;
+        while(num_marg < idx_first && num_marg+1 < timestamp_cameras.size() && timestamp_cameras.at(num_marg) < time_marg) {
+            keys_marg.push_back(key_state(num_marg));
+            num_marg++;
+        }
+    }
+
+    // Update our solver, and get the latest smoothed estimates
+    // If we will marginalize, then those states are eliminated first so they become leaves of the Bayes tree
+    if(new_values.empty() && keys_marg.empty())
+        return;
+    ProfileScope scope_update("isam2_update");
+    ISAM2Result result;
+    if(keys_marg.empty()) {
+        run_with_threads([&]() { result = stream.isam->update(new_factors, new_values); });
+    } else {
+        FastMap<Key,int> constrained_keys;
+        for(const Key &key : stream.isam->getLinearizationPoint().keys()) {
+            constrained_keys[key] = 1;
+        }
+        for(const Key &key : new_values.keys()) {
+            constrained_keys[key] = 1;
+        }
+        std::set<Key> keys_affected;
+        for(const Key &key : keys_marg) {
+            constrained_keys[key] = 0;
+            for(const auto &child : (*stream.isam)[key]->children) {
+                mark_affected_keys(key, child, keys_affected);
+            }
         }
+        FastList<Key> keys_reelim(keys_affected.begin(), keys_affected.end());
+        run_with_threads([&]() {
+            result = stream.isam->update(new_factors, new_values, FactorIndices(), constrained_keys, boost::none, keys_reelim);
+        });
+    }
+    if(stream.ids_prior.empty() && !stream.keys_prior.empty())
+        stream.ids_prior.assign(result.newFactorsIndices.begin(), result.newFactorsIndices.begin()+stream.keys_prior.size());
+    values = stream.isam->calculateEstimate();
+    values.insert(stream.values_fixed);
+    values_result = values;
+    solve_stats.num_iterations++;
+
+    // Our marginalized states are now final, so give them out and drop them from the solver
+    // Their vicon and imu factors are replaced by a linear marginal on the states and calibration that are left
+    if(!keys_marg.empty()) {
+        get_state_rows(0, num_marg, rows);
+        stream.isam->marginalizeLeaves(keys_marg);
+        for(const Key &key : keys_marg) {
+            values.erase(key);
+            values_result.erase(key);
+        }
+        timestamp_cameras.erase(timestamp_cameras.begin(), timestamp_cameras.begin()+(long)num_marg);
+        state_ids.erase(state_ids.begin(), state_ids.begin()+(long)num_marg);
+    }
 
-        // Now add preintegration between this state and the next
-        // We do a silly hack since inside of the propagator we create the preintegrator
-        // So we just randomly assign noises here which will be overwritten in the propagator
-        double time0 = *(it1-1);
-        double time1 = *(it1);
-
-        // Get the bias of the time0 state
-        Bias3 bg = values.at<JPLNavState>(X(map_states[time0])).bg();
-        Bias3 ba = values.at<JPLNavState>(X(map_states[time0])).ba();
-
-        // Get the preintegrator (will get recreated with correct noises in propagator)
-        CpiV1 preint(0,0,0,0,true);
-        bool has_imu = propagator->propagate(time0,time1,bg,ba,preint);
-        assert(has_imu);
-        assert(preint.DT==(time1-time0));
-
-        //cout << "dt = " << preint.DT << " | dt_times = " << time1-time0 << endl;
-        //cout << "q_k2tau = " << preint.q_k2tau.transpose() << endl;
-        //cout << "alpha_tau = " << preint.alpha_tau.transpose() << endl;
-        //cout << "beta_tau = " << preint.beta_tau.transpose() << endl;
-
-        // Check if we can do the inverse
-        if(std::isnan(preint.P_meas.norm()) || std::isnan(preint.P_meas.inverse().norm())) {
-            ROS_ERROR("R_imu is NAN | R.norm = %.3f | Rinv.norm = %.3f",preint.P_meas.norm(),preint.P_meas.inverse().norm());
-            ROS_ERROR("THIS SHOULD NEVER HAPPEN!@#!@#!@#!@#!#@");
+    // Once our states constrain the calibration far better than the weak priors, we remove them so they do not bias the result
+    if(!stream.keys_prior.empty() && timestamp_cameras.size() > 1) {
+        bool observable = true;
+        for(const Key &key : stream.keys_prior) {
+            observable = observable && (stream.isam->marginalCovariance(key).diagonal().maxCoeff() < std::pow(0.1*stream.sigma_prior,2));
         }
+        if(observable) {
+            run_with_threads([&]() { stream.isam->update(NonlinearFactorGraph(), Values(), stream.ids_prior); });
+            values = stream.isam->calculateEstimate();
+            values.insert(stream.values_fixed);
+            values_result = values;
+            stream.keys_prior.clear();
+            stream.ids_prior.clear();
+            printf("[STREAM]: calibration is observable, removed its priors\n");
+        }
+    }
+    solve_stats.time_optimize += scope_update.elapsed();
 
-        // Now create the IMU factor
-        ImuFactorCPIv1 factor_imu(
-                X(map_states[time0]),X(map_states[time1]),G(0),
-                preint.P_meas,preint.DT,gravity_magnitude,
-                preint.alpha_tau,preint.beta_tau,
-                preint.q_k2tau,
-                preint.b_a_lin,preint.b_w_lin,
-                preint.J_q,preint.J_b,preint.J_a,
-                preint.H_b,preint.H_a
-        );
-        graph->add(factor_imu);
+    // Future intervals will only start at our newest state, so older IMU data is no longer needed
+    if(!timestamp_cameras.empty()) {
+        propagator->clean_older_than(timestamp_cameras.back());
+    }
 
-        // Finally, move forward in time!
-        it1++;
+    // Debug print
+    if(!timestamp_cameras.empty()) {
+        printf(BLUE "[STREAM]: %.4f sec to add %d and marginalize %d states | %d states in lag (%.3f to %.3f) | toff %.4f\n" RESET,
+               scope.elapsed(), (int)num_new, (int)num_marg,
+               (int)timestamp_cameras.size(), timestamp_cameras.front(), timestamp_cameras.back(), values.at<Vector1>(T(0))(0));
+    }
+
+}
+
+
+void ViconGraphSolver::stream_finish(std::vector<StateWriter::STATEROW> &rows) {
+
+    // Warn if our result still has the weak priors in it
+    if(!stream.keys_prior.empty())
+        printf(YELLOW "[STREAM]: calibration was never observable enough to remove its priors, they are still in the result\n" RESET);
+
+    // All states left are as smoothed as they will be
+    if(stream.isam != nullptr)
+        get_state_rows(0, timestamp_cameras.size(), rows);
+
+}
+
+
+double ViconGraphSolver::stream_oldest_vicon() const {
+
+    // Our oldest vicon factor needs poses a second on either side of it (in the vicon clock)
+    if(timestamp_cameras.empty() || !values.exists(T(0)))
+        return -INFINITY;
+    return timestamp_cameras.front()-values.at<Vector1>(T(0))(0)-1.0;
+
+}
+
+
+void ViconGraphSolver::densify_states(const std::vector<double> &times_all, const std::vector<size_t> &ids_all) {
+
+    // Start timing
+    ProfileScope scope("densify_states");
+
+    // Get our estimated keyframes, and the gravity in the vicon frame
+    // We copy these before we spawn our threads so they only need to read from plain vectors
+    std::vector<double> times_keyframe = timestamp_cameras;
+    std::vector<JPLNavState, Eigen::aligned_allocator<JPLNavState>> states_keyframe;
+    for(size_t k=0; k<timestamp_cameras.size(); k++) {
+        states_keyframe.push_back(values_result.at<JPLNavState>(key_state(k)));
+    }
+    Eigen::Vector3d ez = {0,0,1};
+    Eigen::Vector3d grav_inV = values_result.at<RotationXY>(G(0)).rot()*options.gravity_magnitude*ez;
+    double toff = values_result.at<Vector1>(T(0))(0);
+
+    // Each camera time only depends on its keyframe and imu measurements, so we can do these in parallel
+    // Keyframes are kept as is, the rest are propagated from their nearest keyframe
+    std::vector<JPLNavState, Eigen::aligned_allocator<JPLNavState>> states(times_all.size());
+    std::vector<char> has_state(times_all.size(), 0);
+    std::atomic<size_t> next_time(0);
+    auto propagate_states = [&]() {
+        size_t i;
+        while((i=next_time++) < times_all.size()) {
+
+            // Same as in the solve, we only want times which have vicon around them
+            double timestamp = times_all.at(i);
+            if(!has_vicon_coverage(timestamp-toff))
+                continue;
+
+            // Find the nearest keyframe, which is either the one at or before this time, or the one after it
+            auto it = std::upper_bound(times_keyframe.begin(), times_keyframe.end(), timestamp);
+            if(it == times_keyframe.begin() && it == times_keyframe.end())
+                continue;
+            size_t k;
+            if(it == times_keyframe.end() || (it != times_keyframe.begin() && timestamp-*(it-1) <= *it-timestamp)) {
+                k = (size_t)(it-times_keyframe.begin())-1;
+            } else {
+                k = (size_t)(it-times_keyframe.begin());
+            }
+            const JPLNavState &state_k = states_keyframe.at(k);
+            if(times_keyframe.at(k) == timestamp) {
+                states.at(i) = state_k;
+                has_state.at(i) = 1;
+                continue;
+            }
+
+            // Preintegrate forward from the earlier of the two times, at the keyframe's biases, thus there is no bias correction
+            bool forward = (times_keyframe.at(k) < timestamp);
+            CpiV1 preint(0,0,0,0,true);
+            if(forward && !propagator->propagate(times_keyframe.at(k),timestamp,state_k.bg(),state_k.ba(),preint))
+                continue;
+            if(!forward && !propagator->propagate(timestamp,times_keyframe.at(k),state_k.bg(),state_k.ba(),preint))
+                continue;
+
+            // Now predict the state (this is the same model as our imu factor, with zero error)
+            // Going backward we solve that same model for the state at the start of the interval
+            Eigen::Matrix<double,4,1> q_VtoI;
+            Eigen::Matrix<double,3,1> v_IinV, p_IinV;
+            if(forward) {
+                Eigen::Matrix3d R_VtoK = quat_2_Rot(state_k.q());
+                q_VtoI = quat_multiply(preint.q_k2tau, state_k.q());
+                v_IinV = state_k.v() - grav_inV*preint.DT + R_VtoK.transpose()*preint.beta_tau;
+                p_IinV = state_k.p() + state_k.v()*preint.DT - 0.5*grav_inV*preint.DT*preint.DT + R_VtoK.transpose()*preint.alpha_tau;
+            } else {
+                q_VtoI = quat_multiply(Inv(preint.q_k2tau), state_k.q());
+                Eigen::Matrix3d R_VtoI = quat_2_Rot(q_VtoI);
+                v_IinV = state_k.v() + grav_inV*preint.DT - R_VtoI.transpose()*preint.beta_tau;
+                p_IinV = state_k.p() - v_IinV*preint.DT + 0.5*grav_inV*preint.DT*preint.DT - R_VtoI.transpose()*preint.alpha_tau;
+            }
+            states.at(i) = JPLNavState(timestamp, q_VtoI, state_k.bg(), v_IinV, state_k.ba(), p_IinV);
+            has_state.at(i) = 1;
+
+        }
+    };
+    size_t num_workers = std::max(1, std::min(options.num_threads, (int)(times_all.size()/1000)+1));
+    std::vector<std::thread> workers;
+    for(size_t t=1; t<num_workers; t++) {
+        workers.emplace_back(propagate_states);
+    }
+    propagate_states();
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+    // Finally add all the states we recovered, in time order
+    timestamp_cameras.clear();
+    state_ids.clear();
+    for(size_t i=0; i<times_all.size(); i++) {
+        if(!has_state.at(i))
+            continue;
+        timestamp_cameras.push_back(times_all.at(i));
+        state_ids.push_back(ids_all.at(i));
+        if(!values_result.exists(X(ids_all.at(i))))
+            values_result.insert(X(ids_all.at(i)), states.at(i));
+    }
+    values = values_result;
+    printf(BLUE "[KEYFRAME]: %.4f to recover %d states from %d keyframes\n" RESET, scope.elapsed(), (int)timestamp_cameras.size(), (int)times_keyframe.size());
+
+}
+
+
+bool ViconGraphSolver::get_vicon_init(double timestamp_inI, Eigen::Matrix<double,4,1> &q_VtoB, Eigen::Matrix<double,3,1> &p_BinV) {
+
+    // Current image time in the vicon clock
+    double timestamp_inV = timestamp_inI - values.at<Vector1>(T(0))(0);
+
+    // Skip if we don't have vicon around this time
+    if(!has_vicon_coverage(timestamp_inV)) {
+        if(print_throttled()) printf("    - skipping camera time %.9f (no vicon pose found) [throttled]\n", timestamp_inI);
+        return false;
+    }
+
+    // Now get the vicon pose at the current time, which we know is valid
+    Eigen::Matrix<double,6,6> R_vicon;
+    interpolator->get_pose(timestamp_inV, q_VtoB, p_BinV, R_vicon);
+    return true;
+
+}
+
+
+bool ViconGraphSolver::has_vicon_coverage(double timestamp_inV) const {
+
+    // The first interval that ends after the window start is the only one that can contain it
+    double time0 = timestamp_inV - 1.0;
+    double time1 = timestamp_inV + 1.0;
+    auto it = std::upper_bound(vicon_coverage.begin(), vicon_coverage.end(), time0,
+                               [](double t, const std::pair<double,double> &interval) { return t < interval.second; });
+    return (it != vicon_coverage.end() && it->first < time0 && it->second > time1);
+
+}
+
+
+JPLNavState ViconGraphSolver::get_state_init(double timestamp_inI, const Eigen::Matrix<double,4,1> &q_VtoB, const Eigen::Matrix<double,3,1> &p_BinV,
+                                             const Eigen::Matrix<double,3,1> &bg, const Eigen::Matrix<double,3,1> &ba) const {
+
+    // Use the previous solve if it has this time, which is in the gravity aligned frame of that solve
+    // Thus we rotate with its R_GtoV, not our own initial guess (which differs if we do not estimate gravity)
+    Eigen::Vector4d q_GtoI;
+    Eigen::Vector3d p_IinG, v_IinG, bg_prev, ba_prev;
+    if(warm_start != nullptr && warm_start->get_state(timestamp_inI, q_GtoI, p_IinG, v_IinG, bg_prev, ba_prev)) {
+        const Eigen::Matrix3d &R_GtoV = warm_start->R_GtoV;
+        Eigen::Matrix<double,4,1> q_VtoI = rot_2_quat(quat_2_Rot(q_GtoI)*R_GtoV.transpose());
+        return JPLNavState(timestamp_inI, q_VtoI, bg_prev, R_GtoV*v_IinG, ba_prev, R_GtoV*p_IinG);
+    }
+
+    // Else initialize from the vicon pose
+    Eigen::Matrix<double,4,1> q_VtoI = quat_multiply(rot_2_quat(options.init_R_BtoI),q_VtoB);
+    Eigen::Matrix<double,3,1> v_IinV = Eigen::Matrix<double,3,1>::Zero();
+    Eigen::Matrix<double,3,1> p_IinV = p_BinV - quat_2_Rot(Inv(q_VtoB))*options.init_R_BtoI.transpose()*options.init_p_BinI;
+    return JPLNavState(timestamp_inI, q_VtoI, bg, v_IinV, ba, p_IinV);
+
+}
+
+
+gtsam::NonlinearFactor::shared_ptr ViconGraphSolver::create_vicon_factor(size_t i) {
 
+    // If we estimate all calibration, then the factor is connected to all of them
+    if(config->estimate_vicon_imu_ori && config->estimate_vicon_imu_pos && config->estimate_vicon_imu_toff) {
+        return boost::make_shared<MeasBased_ViconPoseTimeoffsetFactor>(key_state(i), C(0), C(1), T(0), interpolator, config);
+    }
+
+    // Else the fixed ones are constants of the factor
+    return boost::make_shared<MeasBased_ViconPoseFixedCalibFactor>(
+            key_state(i), C(0), C(1), T(0),
+            values.at<JPLQuaternion>(C(0)), values.at<Vector3>(C(1)), values.at<Vector1>(T(0)),
+            interpolator, config
+    );
+
+}
+
+
+void ViconGraphSolver::relinearize_problem() {
+
+    // Start timing
+    ProfileScope scope("relinearize_problem");
+
+    // Find all imu factors whose starting state bias has moved away from the preintegration linearization point
+    // The rest can rely on the first-order bias correction inside of the factor (J_b, J_a, H_b, H_a)
+    // Vicon factors do not need to be rebuilt as they will interpolate with the current time offset estimate
+    std::vector<size_t> ids_relin, intervals;
+    for(size_t i=0; i<imu_factors.size(); i++) {
+        JPLNavState state0 = values.at<JPLNavState>(key_state(imu_factors.at(i).interval-1));
+        if((state0.bg()-imu_factors.at(i).bg_lin).norm() > options.relin_thresh_bg
+           || (state0.ba()-imu_factors.at(i).ba_lin).norm() > options.relin_thresh_ba) {
+            ids_relin.push_back(i);
+            intervals.push_back(imu_factors.at(i).interval);
+        }
     }
-    rT2 =  boost::posix_time::microsec_clock::local_time();
+    printf("[BUILD]: relinearizing %d of %d imu factors\n", (int)ids_relin.size(), (int)imu_factors.size());
+
+    // Re-preintegrate at the new bias, and swap them into the graph at the same location
+    std::vector<gtsam::NonlinearFactor::shared_ptr> factors_imu;
+    std::vector<Bias3> factors_bg, factors_ba;
+    preintegrate_intervals(intervals, factors_imu, factors_bg, factors_ba);
+    for(size_t i=0; i<ids_relin.size(); i++) {
+        if(factors_imu.at(i) == nullptr)
+            continue;
+        IMUFACTOR &info = imu_factors.at(ids_relin.at(i));
+        graph->replace(info.graph_id, factors_imu.at(i));
+        info.bg_lin = factors_bg.at(i);
+        info.ba_lin = factors_ba.at(i);
+    }
+    Profiler::count("imu_factors_relinearized", ids_relin.size());
+    solve_stats.time_build += scope.elapsed();
 
 }
 
 
+void ViconGraphSolver::preintegrate_intervals(const std::vector<size_t> &intervals,
+                                              std::vector<gtsam::NonlinearFactor::shared_ptr> &factors,
+                                              std::vector<Bias3> &bg_lin, std::vector<Bias3> &ba_lin) {
+
+    // Start timing
+    ProfileScope scope("preintegrate_intervals");
+
+    // Get the bias linearization point of each state we will preintegrate from
+    // We grab these before we spawn our threads so they only need to read from plain vectors
+    std::vector<size_t> ids0, ids1;
+    factors.clear();
+    factors.resize(intervals.size());
+    bg_lin.clear();
+    ba_lin.clear();
+    for(size_t k=0; k<intervals.size(); k++) {
+        size_t id0 = state_ids.at(intervals.at(k)-1);
+        ids0.push_back(id0);
+        ids1.push_back(state_ids.at(intervals.at(k)));
+        bg_lin.push_back(values.at<JPLNavState>(X(id0)).bg());
+        ba_lin.push_back(values.at<JPLNavState>(X(id0)).ba());
+    }
+    RotationXY rotxy = values.at<RotationXY>(G(0));
+
+    // Each interval only depends on its own imu measurements and bias, so we can do these in parallel
+    // Threads grab the next interval to process from a shared counter until all have been done
+    std::atomic<size_t> next_interval(0);
+    auto compute_preintegrations = [&]() {
+        ProfileScope scope_worker("preintegrate_worker");
+        size_t k;
+        while((k=next_interval++) < intervals.size()) {
+
+            // If ros is wants us to stop, break out
+            if (is_cancelled())
+                break;
+
+            // Now add preintegration between this state and the next
+            // We do a silly hack since inside of the propagator we create the preintegrator
+            // So we just randomly assign noises here which will be overwritten in the propagator
+            double time0 = timestamp_cameras.at(intervals.at(k)-1);
+            double time1 = timestamp_cameras.at(intervals.at(k));
+
+            // Get the preintegrator (will get recreated with correct noises in propagator)
+            CpiV1 preint(0,0,0,0,true);
+            bool has_imu = propagator->propagate(time0,time1,bg_lin.at(k),ba_lin.at(k),preint);
+            assert(has_imu);
+            assert(preint.DT==(time1-time0));
+
+            // Check if we can do the inverse
+            if(std::isnan(preint.P_meas.norm()) || std::isnan(preint.P_meas.inverse().norm())) {
+                printf(RED "R_imu is NAN | R.norm = %.3f | Rinv.norm = %.3f\n" RESET,preint.P_meas.norm(),preint.P_meas.inverse().norm());
+                printf(RED "THIS SHOULD NEVER HAPPEN!@#!@#!@#!@#!#@\n" RESET);
+            }
+
+            // Now create the IMU factor
+            // If we do not estimate gravity, then it is a constant of the factor and not connected to it
+            auto factor = boost::make_shared<ImuFactorCPIv1>(
+                    X(ids0.at(k)),X(ids1.at(k)),G(0),
+                    preint.P_meas,preint.DT,options.gravity_magnitude,
+                    preint.alpha_tau,preint.beta_tau,
+                    preint.q_k2tau,
+                    preint.b_a_lin,preint.b_w_lin,
+                    preint.J_q,preint.J_b,preint.J_a,
+                    preint.H_b,preint.H_a,config
+            );
+            if(config->estimate_gravity) factors.at(k) = factor;
+            else factors.at(k) = boost::make_shared<ImuFactorCPIv1FixedGravity>(factor, rotxy);
+
+        }
+    };
+    size_t num_workers = std::max(1, std::min(options.num_threads, (int)intervals.size()));
+    printf("[BUILD]: preintegrating %d intervals with %d threads\n", (int)intervals.size(), (int)num_workers);
+    std::vector<std::thread> workers;
+    for(size_t t=1; t<num_workers; t++) {
+        workers.emplace_back(compute_preintegrations);
+    }
+    compute_preintegrations();
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+}
 
 
 void ViconGraphSolver::optimize_problem() {
 
+    // Start timing
+    ProfileScope scope("optimize_problem");
+
     // Debug
-    ROS_INFO("[VICON-GRAPH]: graph factors - %d", (int) graph->nrFactors());
-    ROS_INFO("[VICON-GRAPH]: graph nodes - %d", (int) graph->keys().size());
-
-    // Setup the optimizer (levenberg)
-    LevenbergMarquardtParams opti_config;
-    opti_config.verbosity = NonlinearOptimizerParams::Verbosity::TERMINATION;
-    //config.verbosityLM = LevenbergMarquardtParams::VerbosityLM::SUMMARY;
-    //config.verbosityLM = LevenbergMarquardtParams::VerbosityLM::TERMINATION;
-    opti_config.absoluteErrorTol = 1e-30;
-    opti_config.relativeErrorTol = 1e-30;
-    opti_config.lambdaUpperBound = 1e20;
-    opti_config.maxIterations = 20;
-    LevenbergMarquardtOptimizer optimizer(*graph, values, opti_config);
-
-    // Setup optimizer (dogleg)
-    //DoglegParams params;
-    //params.verbosity = NonlinearOptimizerParams::Verbosity::TERMINATION;
-    //params.relativeErrorTol = 1e-10;
-    //params.absoluteErrorTol = 1e-10;
-    //DoglegOptimizer optimizer(*graph, values, params);
+    printf("[VICON-GRAPH]: graph factors - %d\n", (int) graph->nrFactors());
+    printf("[VICON-GRAPH]: graph nodes - %d\n", (int) graph->keys().size());
+
+    // Only optimize the variables in our graph
+    // Calibration that we do not estimate are constants of our factors, and are copied into the result after
+    Values values_init;
+    for(const Key &key : graph->keys()) {
+        values_init.insert(key, values.at(key));
+    }
+    values_result = values;
+
+    // Use our own solver which exploits the structure of our graph if we can
+    if(options.optimizer == "schur") {
+        int iterations = optimize_schur(values_init);
+        if(iterations >= 0) {
+            solve_stats.num_iterations += iterations;
+            solve_stats.time_optimize += scope.elapsed();
+            return;
+        }
+        printf(YELLOW "[VICON-GRAPH]: graph is not a chain of states, falling back to levenberg\n" RESET);
+    }
+
+    // Our linear solver
+    NonlinearOptimizerParams::LinearSolverType linear_solver = NonlinearOptimizerParams::MULTIFRONTAL_CHOLESKY;
+    if(options.linear_solver == "multifrontal_qr") linear_solver = NonlinearOptimizerParams::MULTIFRONTAL_QR;
+    else if(options.linear_solver == "sequential_cholesky") linear_solver = NonlinearOptimizerParams::SEQUENTIAL_CHOLESKY;
+    else if(options.linear_solver == "sequential_qr") linear_solver = NonlinearOptimizerParams::SEQUENTIAL_QR;
+
+    // Our elimination ordering
+    // For the chain we eliminate our states in time (their ids are in time order) and then all calibration variables
+    Ordering ordering;
+    if(options.ordering == "chain") {
+        KeyVector keys_calib;
+        for(const Key &key : graph->keys()) {
+            if(Symbol(key).chr() == 'x') ordering.push_back(key);
+            else keys_calib.push_back(key);
+        }
+        for(const Key &key : keys_calib) {
+            ordering.push_back(key);
+        }
+    }
+
+    // Settings that are shared between all optimizers
+    auto setup_params = [&](NonlinearOptimizerParams &params) {
+        params.verbosity = NonlinearOptimizerParams::Verbosity::TERMINATION;
+        params.absoluteErrorTol = options.absolute_error_tol;
+        params.relativeErrorTol = options.relative_error_tol;
+        params.maxIterations = options.max_iterations;
+        params.linearSolverType = linear_solver;
+        if(options.ordering == "chain") {
+            params.orderingType = Ordering::CUSTOM;
+            params.ordering = ordering;
+        } else if(options.ordering == "metis") params.orderingType = Ordering::METIS;
+        else params.orderingType = Ordering::COLAMD;
+    };
+
+    // Setup the optimizer (levenberg or dogleg)
+    std::shared_ptr<NonlinearOptimizer> optimizer;
+    LevenbergMarquardtOptimizer *optimizer_lm = nullptr;
+    DoglegOptimizer *optimizer_dl = nullptr;
+    if(options.optimizer == "dogleg") {
+        DoglegParams params;
+        setup_params(params);
+        optimizer_dl = new DoglegOptimizer(*graph, values_init, params);
+        optimizer.reset(optimizer_dl);
+    } else {
+        LevenbergMarquardtParams params;
+        setup_params(params);
+        //params.verbosityLM = LevenbergMarquardtParams::VerbosityLM::SUMMARY;
+        params.lambdaUpperBound = 1e20;
+        optimizer_lm = new LevenbergMarquardtOptimizer(*graph, values_init, params);
+        optimizer.reset(optimizer_lm);
+    }
+    printf("[VICON-GRAPH]: %s with %s (%s ordering)\n", options.optimizer.c_str(), options.linear_solver.c_str(), options.ordering.c_str());
 
     // Perform the optimization
-    ROS_INFO("[VICON-GRAPH]: begin optimization");
-    values_result = optimizer.optimize();
-    ROS_INFO("[VICON-GRAPH]: done optimization (%d iterations)!", (int) optimizer.iterations());
-    rT3 = boost::posix_time::microsec_clock::local_time();
+    // We step the optimizer ourselves (same as optimize()) so we can time and record each iteration
+    printf("[VICON-GRAPH]: begin optimization\n");
+    double error_new = optimizer->error();
+    double error_old = error_new;
+    printf("[VICON-GRAPH]: initial error %.6e\n", error_new);
+    while(options.max_iterations > 0 && error_new > 0.0) {
+        ProfileScope scope_iter("optimizer_iteration");
+        error_old = error_new;
+        run_with_threads([&]() { optimizer->iterate(); });
+        error_new = optimizer->error();
+        double lambda = (optimizer_lm != nullptr)? optimizer_lm->lambda() : optimizer_dl->getDelta();
+        scope_iter.add_arg("iteration", (double)optimizer->iterations());
+        scope_iter.add_arg("error", error_new);
+        scope_iter.add_arg((optimizer_lm != nullptr)? "lambda" : "delta", lambda);
+        printf("[VICON-GRAPH]: iteration %d | error %.6e | %s %.3e | %.4f sec\n", (int)optimizer->iterations(), error_new,
+               (optimizer_lm != nullptr)? "lambda" : "delta", lambda, scope_iter.elapsed());
+        if((int)optimizer->iterations() >= options.max_iterations || !std::isfinite(error_new)
+           || checkConvergence(options.relative_error_tol, options.absolute_error_tol, 0.0, error_old, error_new, NonlinearOptimizerParams::Verbosity::TERMINATION))
+            break;
+    }
+    values_result.update(optimizer->values());
+    printf("[VICON-GRAPH]: done optimization (%d iterations)!\n", (int) optimizer->iterations());
+    solve_stats.num_iterations += (int)optimizer->iterations();
+    solve_stats.time_optimize += scope.elapsed();
 
 }
 
 
+int ViconGraphSolver::optimize_schur(const Values &values_init) {
+
+    // Split our variables into the chain of states and the calibration
+    SCHURLAYOUT layout = get_schur_layout(values_init);
+    const KeyVector &keys_states = layout.keys_states;
+    const KeyVector &keys_calib = layout.keys_calib;
+    printf("[SCHUR]: %d states and %d calibration variables (%d dof)\n", (int)keys_states.size(), (int)keys_calib.size(), layout.dim_calib);
+    ArrowheadSystem system(keys_states.size(), (int)JPLNavState::dimension, layout.dim_calib);
+
+    // Levenberg-Marquardt settings (same as the gtsam defaults we used before)
+    double lambda = 1e-5;
+    double lambda_factor = 10.0;
+    double lambda_max = 1e20;
+
+    // Loop until we have converged
+    Values values_curr = values_init;
+    double error_new = graph->error(values_curr);
+    double error_old = error_new;
+    int iterations = 0;
+    printf("[VICON-GRAPH]: begin optimization\n");
+    printf("[VICON-GRAPH]: initial error %.6e\n", error_new);
+    while(iterations < options.max_iterations && error_new > 0.0 && !is_cancelled()) {
+
+        // Linearize and build our normal equations
+        // Our factors are whitened when linearized, thus H = A'*A and g = A'*b
+        ProfileScope scope_iter("optimizer_iteration");
+        GaussianFactorGraph::shared_ptr linear = linearize_problem(values_curr);
+        if(!fill_schur_system(*linear, layout, system))
+            return -1;
+
+        // Try steps until we decrease the error, increasing the damping each time we fail
+        error_old = error_new;
+        bool success = false;
+        while(!success && lambda < lambda_max) {
+            std::vector<Eigen::VectorXd> dx_states;
+            Eigen::VectorXd dx_calib;
+            if(system.solve(lambda, dx_states, dx_calib)) {
+                VectorValues delta;
+                for(size_t k=0; k<keys_states.size(); k++) {
+                    delta.insert(keys_states.at(k), dx_states.at(k));
+                }
+                for(const Key &key : keys_calib) {
+                    delta.insert(key, dx_calib.segment(layout.block_calib.at(key).first,layout.block_calib.at(key).second));
+                }
+                Values values_new = values_curr.retract(delta);
+                double error = graph->error(values_new);
+                if(error <= error_new) {
+                    values_curr = values_new;
+                    error_new = error;
+                    success = true;
+                    lambda /= lambda_factor;
+                    continue;
+                }
+            }
+            lambda *= lambda_factor;
+        }
+        iterations++;
+        scope_iter.add_arg("iteration", (double)iterations);
+        scope_iter.add_arg("error", error_new);
+        scope_iter.add_arg("lambda", lambda);
+        printf("[VICON-GRAPH]: iteration %d | error %.6e | lambda %.3e | %.4f sec\n", iterations, error_new, lambda, scope_iter.elapsed());
+
+        // Stop if we could not decrease the error, or the decrease is small enough
+        if(!success || checkConvergence(options.relative_error_tol, options.absolute_error_tol, 0.0, error_old, error_new, NonlinearOptimizerParams::Verbosity::TERMINATION))
+            break;
 
+    }
+    values_result.update(values_curr);
+    printf("[VICON-GRAPH]: done optimization (%d iterations)!\n", iterations);
+    return iterations;
+
+}
 
 
+ViconGraphSolver::SCHURLAYOUT ViconGraphSolver::get_schur_layout(const Values &values_lin) const {
+
+    // Our state ids are in time order, so sorted keys are also in time order
+    SCHURLAYOUT layout;
+    for(const Key &key : graph->keys()) {
+        if(Symbol(key).chr() == 'x') layout.keys_states.push_back(key);
+        else layout.keys_calib.push_back(key);
+    }
+    for(size_t k=0; k<layout.keys_states.size(); k++) {
+        layout.id_state.insert({layout.keys_states.at(k),k});
+    }
+    for(const Key &key : layout.keys_calib) {
+        int dim = (int)values_lin.at(key).dim();
+        layout.block_calib.insert({key,{layout.dim_calib,dim}});
+        layout.dim_calib += dim;
+    }
+    return layout;
+
+}
 
 
+bool ViconGraphSolver::fill_schur_system(const GaussianFactorGraph &linear, const SCHURLAYOUT &layout, ArrowheadSystem &system) const {
+
+    // Adds a hessian block between two variables into our system
+    // Returns false if the two are states that are not next to each other
+    auto add_block = [&](Key key_i, Key key_j, const Matrix &H_ij) {
+        auto it_si = layout.id_state.find(key_i);
+        auto it_sj = layout.id_state.find(key_j);
+        if(it_si != layout.id_state.end() && it_sj != layout.id_state.end()) {
+            size_t k_i = it_si->second;
+            size_t k_j = it_sj->second;
+            if(k_i == k_j) system.H_ss(k_i) += H_ij;
+            else if(k_i+1 == k_j) system.H_sn(k_i) += H_ij;
+            else if(k_j+1 == k_i) system.H_sn(k_j) += H_ij.transpose();
+            else return false;
+        } else if(it_si != layout.id_state.end()) {
+            const std::pair<int,int> &block_j = layout.block_calib.at(key_j);
+            system.H_sc(it_si->second).block(0,block_j.first,H_ij.rows(),block_j.second) += H_ij;
+        } else if(it_sj != layout.id_state.end()) {
+            const std::pair<int,int> &block_i = layout.block_calib.at(key_i);
+            system.H_sc(it_sj->second).block(0,block_i.first,H_ij.cols(),block_i.second) += H_ij.transpose();
+        } else {
+            const std::pair<int,int> &block_i = layout.block_calib.at(key_i);
+            const std::pair<int,int> &block_j = layout.block_calib.at(key_j);
+            system.H_cc().block(block_i.first,block_j.first,block_i.second,block_j.second) += H_ij;
+            if(key_i != key_j)
+                system.H_cc().block(block_j.first,block_i.first,block_j.second,block_i.second) += H_ij.transpose();
+        }
+        return true;
+    };
+
+    // Build our normal equations
+    // Our factors are whitened when linearized, thus H = A'*A and g = A'*b
+    system.set_zero();
+    for(const auto &factor : linear) {
+        auto jacobian = boost::dynamic_pointer_cast<JacobianFactor>(factor);
+        if(jacobian == nullptr)
+            return false;
+        const Vector &b = jacobian->getb();
+        for(auto it_i=jacobian->begin(); it_i!=jacobian->end(); it_i++) {
+            Matrix A_i = jacobian->getA(it_i);
+            auto it_si = layout.id_state.find(*it_i);
+            if(it_si != layout.id_state.end()) system.g_s(it_si->second) += A_i.transpose()*b;
+            else system.g_c().segment(layout.block_calib.at(*it_i).first,A_i.cols()) += A_i.transpose()*b;
+            for(auto it_j=it_i; it_j!=jacobian->end(); it_j++) {
+                if(!add_block(*it_i, *it_j, A_i.transpose()*jacobian->getA(it_j)))
+                    return false;
+            }
+        }
+    }
+    return true;
+
+}
+
+
+GaussianFactorGraph::shared_ptr ViconGraphSolver::linearize_problem(const Values &values_lin) {
+
+    // GTSAM will do this in parallel itself
+#if defined(ENABLE_TBB) && defined(GTSAM_USE_TBB)
+    GaussianFactorGraph::shared_ptr linear;
+    run_with_threads([&]() { linear = graph->linearize(values_lin); });
+    return linear;
+#else
+
+    // Else each thread grabs the next factor to linearize from a shared counter until all have been done
+    std::vector<GaussianFactor::shared_ptr> factors(graph->size());
+    std::atomic<size_t> next_factor(0);
+    auto linearize_factors = [&]() {
+        size_t i;
+        while((i=next_factor++) < factors.size()) {
+            if(graph->at(i) != nullptr)
+                factors.at(i) = graph->at(i)->linearize(values_lin);
+        }
+    };
+    size_t num_workers = std::max(1, std::min(options.num_threads, (int)(factors.size()/1000)+1));
+    std::vector<std::thread> workers;
+    for(size_t t=1; t<num_workers; t++) {
+        workers.emplace_back(linearize_factors);
+    }
+    linearize_factors();
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+    // Finally add them in the same order as our graph
+    GaussianFactorGraph::shared_ptr linear = boost::make_shared<GaussianFactorGraph>();
+    linear->reserve(factors.size());
+    for(const auto &factor : factors) {
+        linear->push_back(factor);
+    }
+    return linear;
+#endif
+
+}
@@ -21,13 +21,23 @@
 
 
 #include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <cmath>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <sstream>
+#include <stdexcept>
 #include <Eigen/Eigen>
-#include <ros/ros.h>
-#include <nav_msgs/Path.h>
-#include <geometry_msgs/PoseStamped.h>
-#include <geometry_msgs/PoseArray.h>
 
+#include <gtsam/config.h>
 #include <gtsam/nonlinear/Values.h>
 #include <gtsam/inference/Symbol.h>
 #include <gtsam/nonlinear/Marginals.h>
@@ -36,6 +46,9 @@
 #include <gtsam/nonlinear/DoglegOptimizer.h>
 #include <gtsam/nonlinear/ISAM2.h>
 #include <gtsam/slam/PriorFactor.h>
+#include <gtsam/linear/GaussianFactorGraph.h>
+#include <gtsam/linear/JacobianFactor.h>
+#include <gtsam/linear/VectorValues.h>
 
 #include "cpi/CpiV1.h"
 #include "gtsam/GtsamConfig.h"
@@ -43,14 +56,26 @@
 #include "gtsam/JPLQuaternion.h"
 #include "gtsam/RotationXY.h"
 #include "gtsam/MeasBased_ViconPoseTimeoffsetFactor.h"
+#include "gtsam/MeasBased_ViconPoseFixedCalibFactor.h"
 #include "gtsam/ImuFactorCPIv1.h"
+#include "gtsam/ImuFactorCPIv1FixedGravity.h"
 #include "meas/Propagator.h"
 #include "meas/Interpolator.h"
+#include "solver/ArrowheadSystem.h"
+#include "solver/SolverOptions.h"
+#include "solver/StateWriter.h"
+#include "solver/WarmStart.h"
+#include "utils/colors.h"
+#include "utils/profiler.h"
 #include "utils/quat_ops.h"
 
 
 #include <boost/filesystem.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/make_shared.hpp>
+
+#if defined(ENABLE_TBB) && defined(GTSAM_USE_TBB)
+#include <tbb/task_arena.h>
+#endif
 
 
 using namespace std;
@@ -64,6 +89,14 @@ using gtsam::symbol_shorthand::T; // T: time offset between vicon and imu sensor
 
 
 
+/**
+ * @brief Batch optimization of the IMU states given vicon poses and inertial measurements.
+ *
+ * This has no dependency on ROS, and all its settings are given through a @ref SolverOptions.
+ * Thus many solvers can be created and solved one after another, or in parallel, in a single process.
+ * The measurements can also be streamed in while they are recorded, which smooths states over a fixed lag (see stream_update()).
+ * See @ref ViconGraphVisualizer to publish the results onto ROS.
+ */
 class ViconGraphSolver
 {
 
@@ -71,18 +104,23 @@ public:
 
     /**
      * @brief Default constructor for the solver
-     * @param nh ROS node handler we will load parameters from
+     * @param options Options of what and how we will estimate
      * @param propagator Propagator with all IMU measurements inside
      * @param interpolator Interpolator with all vicon poses inside
      * @param timestamp_cameras Timestamps we are interested in estimating
+     *
+     * If our options have a warm start info file, its calibration replaces the initial guesses of the options (gravity only if we estimate it).
+     * Warm start states are rotated into the vicon frame with the R_GtoV of the warm start info, thus the states need their info file too.
+     * Throws a std::runtime_error if the options are invalid, or the warm start files are missing or can not be loaded.
      */
-    ViconGraphSolver(ros::NodeHandle& nh, std::shared_ptr<Propagator> propagator,
+    ViconGraphSolver(const SolverOptions &options, std::shared_ptr<Propagator> propagator,
                      std::shared_ptr<Interpolator> interpolator, std::vector<double> timestamp_cameras);
 
 
     /**
      * @brief This will build the graph and solve it.
      * This function will take a while, but handles the GTSAM optimization.
+     * Throws a std::runtime_error if none of our camera times are within the imu measurements.
      */
     void build_and_solve();
 
@@ -91,6 +129,8 @@ public:
      *
      * The CSV file will be in the eth format:
      * `(time(ns),px,py,pz,qw,qx,qy,qz,vx,vy,vz,bwx,bwy,bwz,bax,bay,baz)`
+     * Depending on our state format option we might also (or only) save the columnar binary version of it.
+     * If enabled, the marginal covariance of each state is saved next to it with a _cov.csv suffix and the calibration's in the info file.
      *
      * @param csvfilepath CSV export file we want to save
      * @param infofilepath Txt file we will save the found calibration parameters
@@ -98,9 +138,32 @@ public:
     void write_to_file(std::string csvfilepath, std::string infofilepath);
 
     /**
-     * @brief Will publish the trajectories onto ROS for visualization in RVIZ
+     * @brief Same as @ref write_to_file, but the formatting and writing are done on another thread.
+     *
+     * The states are gathered from the solver before we return, thus the solver can be used (e.g. visualized) while we write.
+     * The files are only complete once the returned future is ready.
+     *
+     * @param csvfilepath CSV export file we want to save
+     * @param infofilepath Txt file we will save the found calibration parameters
+     * @return Future which is ready once everything has been written
+     */
+    std::future<void> write_to_file_async(std::string csvfilepath, std::string infofilepath);
+
+    /**
+     * @brief Sets a function which will be polled during the solve, and if it returns true we will stop early.
+     * For example the ROS nodes use this to stop when ROS has been shutdown.
+     * @param callback Function that returns true if we should stop
+     */
+    void set_cancel_callback(const std::function<bool()> &callback) {
+        cancel_callback = callback;
+    }
+
+    /**
+     * @brief Returns the interpolator with all vicon poses inside
      */
-    void visualize();
+    std::shared_ptr<const Interpolator> get_interpolator() const {
+        return interpolator;
+    }
 
     /**
      * @brief Returns the current optimized poses which we estimated
@@ -118,9 +181,87 @@ public:
      */
     void get_calibration(double &toff, Eigen::Matrix3d &R_BtoI, Eigen::Vector3d &p_BinI, Eigen::Matrix3d &R_GtoV);
 
+    /**
+     * @brief Adds new camera times to our streaming solve, and gives back the states which have left our fixed lag.
+     *
+     * This is used instead of build_and_solve() while the measurements are still arriving (see estimate_vicon2gt_online.cpp).
+     * Each call adds the states of a window with their vicon factors and the imu factors that connect them, and updates ISAM2.
+     * States more than `stream_lag` seconds older than our newest are then marginalized, and are final from then on.
+     * Thus the solver only ever holds the states, imu and vicon measurements within the lag, and each state is out about one lag after its time.
+     *
+     * Since the first windows might not constrain the calibration, it has weak priors until its marginal covariance is well below them.
+     * Until they are removed we do not marginalize, so the priors are never folded into the marginals of the states we drop.
+     *
+     * The imu and vicon measurements need to already be fed a bit after these camera times, as each needs vicon a second on either side.
+     * Imu measurements older than our newest state are removed from the propagator, see @ref stream_oldest_vicon() for the interpolator.
+     * Throws a std::runtime_error if we are asked to only estimate keyframes, which needs the imu of the whole trajectory.
+     *
+     * @param timestamps New camera times (in the IMU clock) in time order, older ones than we have already been given are skipped
+     * @param rows States we have marginalized in this update, in the gravity aligned frame (appended to)
+     */
+    void stream_update(const std::vector<double> &timestamps, std::vector<StateWriter::STATEROW> &rows);
+
+    /**
+     * @brief Gives back the states still within our lag, used once all measurements have been added
+     * @param rows States that have not been marginalized, in the gravity aligned frame (appended to)
+     */
+    void stream_finish(std::vector<StateWriter::STATEROW> &rows);
+
+    /// Oldest vicon time (in the vicon clock) that the factors within our lag might still need, older poses can be removed
+    double stream_oldest_vicon() const;
+
+    /**
+     * @brief Saves the calibration we have found (the same as in the info file of @ref write_to_file)
+     * @param infofilepath Txt file we will save the found calibration parameters
+     */
+    void write_info_to_file(std::string infofilepath) const;
+
+    /// Timing (sec) and convergence statistics of a solve (summed over all relinearizations, chunks, and windows)
+    struct SOLVESTATS {
+        double time_build = 0.0;
+        double time_optimize = 0.0;
+        int num_iterations = 0;
+        void add(const SOLVESTATS &other) {
+            time_build += other.time_build;
+            time_optimize += other.time_optimize;
+            num_iterations += other.num_iterations;
+        }
+    };
+
+    /// Returns the statistics of our last call to build_and_solve()
+    SOLVESTATS get_solve_stats() const {
+        return solve_stats;
+    }
+
 
 protected:
 
+    /**
+     * @brief Creates a solver for a subset of the camera times of a parent solver.
+     *
+     * All measurement data and settings are shared with the parent, and states use the same IDs as the parent.
+     * The config is copied so the sub-solver can change what it estimates without affecting the parent.
+     *
+     * @param parent Solver we will copy our settings from
+     * @param indices Index of each camera time of the parent we are interested in estimating (in time order)
+     */
+    ViconGraphSolver(const ViconGraphSolver &parent, const std::vector<size_t> &indices);
+
+    /**
+     * @brief This will build and solve the whole problem in one batch optimization.
+     * We will relinearize the imu factors and re-solve `num_loop_relin` times.
+     */
+    void solve_batch();
+
+    /**
+     * @brief This will solve the problem in overlapping chunks of `chunk_size` camera times.
+     *
+     * We first estimate the calibration using a decimated set of camera times over the whole trajectory.
+     * Each chunk is then solved in parallel with our calibration fixed, and we stitch them together at the middle of their overlaps.
+     * Thus our peak memory depends on the chunk size, and not on the length of the trajectory.
+     */
+    void solve_chunked();
+
     /**
      * @brief This will build the graph problem and add all measurements and nodes to it
      * Given the first time, we init the states using the VICON, but in the future we keep them
@@ -129,37 +270,237 @@ protected:
      */
     void build_problem(bool init_states);
 
+    /**
+     * @brief Recovers the states of all camera times that were not keyframes, after the keyframes have been solved.
+     *
+     * Each is propagated from its nearest keyframe using the imu measurements and that keyframe's biases.
+     * This is forward from the keyframe before it, or backward from the one after it if that is closer, so there is no jump at the next keyframe.
+     * Like in the solve, camera times without vicon a second on either side (at our estimated time offset) are removed.
+     *
+     * @param times_all All camera times we want states at (in time order)
+     * @param ids_all State ID of each camera time
+     */
+    void densify_states(const std::vector<double> &times_all, const std::vector<size_t> &ids_all);
+
+    /**
+     * @brief Checks if we have a good vicon pose to init and constrain the state at a camera time
+     *
+     * The vicon needs to cover a second on either side of the camera time without any gaps, so our time offset has room to move.
+     * This is a cheap lookup in our coverage intervals, and we only interpolate the pose if it is covered.
+     *
+     * @param timestamp_inI Camera time in the IMU clock
+     * @param q_VtoB Interpolated vicon orientation
+     * @param p_BinV Interpolated vicon position
+     * @return False if this camera time should be removed
+     */
+    bool get_vicon_init(double timestamp_inI, Eigen::Matrix<double,4,1> &q_VtoB, Eigen::Matrix<double,3,1> &p_BinV);
+
+    /**
+     * @brief Checks if the vicon covers a second on either side of this time without any gaps
+     * @param timestamp_inV Camera time in the vicon clock
+     * @return True if this time is covered
+     */
+    bool has_vicon_coverage(double timestamp_inV) const;
+
+    /**
+     * @brief Sets up our ISAM2 smoother and the calibration nodes on the first streaming update
+     * @param new_factors Priors of the estimated calibration (appended to)
+     * @param new_values Estimated calibration nodes (appended to)
+     */
+    void stream_start(gtsam::NonlinearFactorGraph &new_factors, gtsam::Values &new_values);
+
+    /**
+     * @brief Gets our estimated states rotated into the gravity aligned frame, in the order they will be written
+     * We use the scalar quaternion functions (not the batched ones) so the csv stays byte-for-byte the same.
+     * @param idx_start Index of the first camera time we want
+     * @param idx_end One past the index of the last camera time we want
+     * @param rows States in the gravity aligned frame (appended to)
+     */
+    void get_state_rows(size_t idx_start, size_t idx_end, std::vector<StateWriter::STATEROW> &rows) const;
+
+    /// Text of our info file, our calibration and gravity (without any covariance)
+    std::string get_info() const;
+
+    /**
+     * @brief Initial guess of the state at a camera time
+     *
+     * If our warm start covers this time we use its interpolated state (rotated into the vicon frame with the R_GtoV of its solve).
+     * Otherwise we use the vicon pose and our initial calibration, with zero velocity and the given biases.
+     *
+     * @param timestamp_inI Camera time in the IMU clock
+     * @param q_VtoB Interpolated vicon orientation
+     * @param p_BinV Interpolated vicon position
+     * @param bg Gyroscope bias if we do not have a warm start
+     * @param ba Accelerometer bias if we do not have a warm start
+     * @return Initial state
+     */
+    JPLNavState get_state_init(double timestamp_inI, const Eigen::Matrix<double,4,1> &q_VtoB, const Eigen::Matrix<double,3,1> &p_BinV,
+                               const Eigen::Matrix<double,3,1> &bg, const Eigen::Matrix<double,3,1> &ba) const;
+
+    /**
+     * @brief Creates the vicon factor of a camera time
+     *
+     * If we estimate all of the vicon to imu calibration this is connected to all of them.
+     * Otherwise the fixed calibration (taken from our current values) are constants of the factor, and thus not in the linear system.
+     *
+     * @param i Index of the camera time
+     * @return Vicon factor of the state at this time
+     */
+    gtsam::NonlinearFactor::shared_ptr create_vicon_factor(size_t i);
+
+    /**
+     * @brief This will update the imu factors of an already built graph
+     * Only intervals whose starting bias has moved more than our thresholds are re-preintegrated.
+     * The rest are left as is, and rely on the first-order bias correction of the preintegration.
+     */
+    void relinearize_problem();
+
+    /**
+     * @brief Preintegrates the given camera intervals in parallel using the current bias estimates
+     * @param intervals Index of the camera time each interval ends at (starts at the one before)
+     * @param factors Created imu factors (nullptr if we stopped early)
+     * @param bg_lin Gyroscope bias each factor was linearized at
+     * @param ba_lin Accelerometer bias each factor was linearized at
+     */
+    void preintegrate_intervals(const std::vector<size_t> &intervals,
+                                std::vector<gtsam::NonlinearFactor::shared_ptr> &factors,
+                                std::vector<Bias3> &bg_lin, std::vector<Bias3> &ba_lin);
+
     /**
      * @brief This will optimize the graph.
-     * Uses Levenberg-Marquardt for the optimization.
+     * Uses Levenberg-Marquardt or Dogleg, with the linear solver and ordering of our options.
+     * We stop once the decrease in error is below our tolerances or we hit the max number of iterations.
      */
     void optimize_problem();
 
-    // Timing variables
-    boost::posix_time::ptime rT1, rT2, rT3, rT4, rT5, rT6, rT7;
+    /**
+     * @brief Levenberg-Marquardt where each step is solved with the Schur complement onto the calibration.
+     *
+     * Our states form a chain, and every factor also touches some of the global calibration (C, G, T).
+     * Thus we solve each damped step with an @ref ArrowheadSystem, which is linear in the trajectory length.
+     * The optimized values will be saved into values_result.
+     *
+     * @param values_init Values of only the variables in our graph to start from
+     * @return Number of iterations, or -1 if the graph does not have this structure (the caller should fall back to a generic optimizer)
+     */
+    int optimize_schur(const gtsam::Values &values_init);
 
-    // ROS node handler
-    ros::NodeHandle nh;
-    ros::Publisher pub_pathimu, pub_pathvicon, pub_vicon_raw;
-    double vicon_raw_pub_freq;
+    /**
+     * @brief Linearizes all factors of our graph in parallel.
+     *
+     * All of our factors can be evaluated at the same time (our interpolator and propagator are only queried).
+     * If GTSAM has TBB we use its own parallel linearization, otherwise our threads each linearize the next factor until all are done.
+     *
+     * @param values_lin Values to linearize at
+     * @return Linearized (whitened) factors in the same order as our graph
+     */
+    gtsam::GaussianFactorGraph::shared_ptr linearize_problem(const gtsam::Values &values_lin);
+
+    /// Variables of our graph split into the chain of states (in time order) and the calibration, and where each is in an @ref ArrowheadSystem
+    struct SCHURLAYOUT {
+        gtsam::KeyVector keys_states;
+        gtsam::KeyVector keys_calib;
+        std::map<gtsam::Key,size_t> id_state;
+        std::map<gtsam::Key,std::pair<int,int>> block_calib;
+        int dim_calib = 0;
+    };
+
+    /**
+     * @brief Splits the variables of our graph into the chain of states and the calibration
+     * @param values_lin Values of the variables (used to get the dimension of each calibration variable)
+     * @return Layout of our variables
+     */
+    SCHURLAYOUT get_schur_layout(const gtsam::Values &values_lin) const;
+
+    /**
+     * @brief Builds the normal equations of our linearized graph
+     * @param linear Linearized (whitened) factors of our graph
+     * @param layout Layout of our variables
+     * @param system System which we will fill (is set to zero first)
+     * @return False if the graph is not a chain of states that each connect to the calibration
+     */
+    bool fill_schur_system(const gtsam::GaussianFactorGraph &linear, const SCHURLAYOUT &layout, ArrowheadSystem &system) const;
+
+    /**
+     * @brief Runs a function with GTSAM limited to our number of threads.
+     *
+     * If GTSAM was built with TBB (and we have it enabled) then its linearization and multifrontal elimination are parallel.
+     * We run it in its own arena so we do not use more threads than we were asked to.
+     * Otherwise this just runs the function.
+     *
+     * @param func Function that calls into GTSAM
+     */
+    template<typename Func>
+    void run_with_threads(const Func &func) {
+#if defined(ENABLE_TBB) && defined(GTSAM_USE_TBB)
+        tbb::task_arena arena(options.num_threads);
+        arena.execute(func);
+#else
+        func();
+#endif
+    }
+
+    /// Key of the state at our i'th camera time
+    gtsam::Key key_state(size_t i) const {
+        return X(state_ids.at(i));
+    }
+
+    /**
+     * @brief Removes camera times (and their states ids) in a single pass, keeping the rest in order
+     * @param remove Function which is given the index of each camera time in order, and returns true if it should be removed
+     */
+    template<typename Func>
+    void remove_cameras_if(Func remove) {
+        size_t num_kept = 0;
+        for(size_t i=0; i<timestamp_cameras.size(); i++) {
+            if(remove(i))
+                continue;
+            timestamp_cameras.at(num_kept) = timestamp_cameras.at(i);
+            state_ids.at(num_kept) = state_ids.at(i);
+            num_kept++;
+        }
+        timestamp_cameras.resize(num_kept);
+        state_ids.resize(num_kept);
+    }
+
+    /// Returns true if we have been asked to stop
+    bool is_cancelled() const {
+        return cancel_callback && cancel_callback();
+    }
+
+    /// Returns true if enough time has passed since the last throttled print (10hz)
+    bool print_throttled() {
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_throttled_print < std::chrono::milliseconds(100))
+            return false;
+        last_throttled_print = now;
+        return true;
+    }
+
+    // Options of what and how we will estimate
+    SolverOptions options;
+
+    // Function that tells us if we should stop early (can be empty)
+    std::function<bool()> cancel_callback;
+
+    // Last time we printed a throttled message
+    std::chrono::steady_clock::time_point last_throttled_print;
+
+    // States of a previous solve we initialize from (can be null)
+    std::shared_ptr<const WarmStart> warm_start;
 
     // Measurement data from the rosbag
     std::shared_ptr<Propagator> propagator;
-    std::shared_ptr<Interpolator> interpolator;
+    std::shared_ptr<const Interpolator> interpolator;
     std::vector<double> timestamp_cameras;
 
-    // Initial estimates of our variables
-    Eigen::Matrix<double,3,3> init_R_GtoV;
-    Eigen::Matrix<double,3,3> init_R_BtoI;
-    Eigen::Matrix<double,3,1> init_p_BinI;
-    double init_toff_imu_to_vicon;
-
-    // We do not optimize the gravity magnitude
-    double gravity_magnitude;
+    // Time intervals that the interpolator has valid poses in (see Interpolator::get_coverage())
+    std::vector<std::pair<double,double>> vicon_coverage;
 
     // Master non-linear GTSAM graph, all created factors
     // Also have all nodes in the graph
-    gtsam::NonlinearFactorGraph* graph;
+    // We own the graph, thus solvers can not be copied (sub-solvers are created from a parent instead)
+    std::unique_ptr<gtsam::NonlinearFactorGraph> graph;
     gtsam::Values values;
 
     // Optimized values
@@ -168,11 +509,36 @@ protected:
     // Config for what we are optimizing
     std::shared_ptr<GtsamConfig> config;
 
-    // Map between state timestamp and their IDs
-    std::map<double,size_t> map_states;
-
-    // Number of times we will loop and relinearize the measurements
-    int num_loop_relin;
+    // ID of the state at each of our camera times (same size as timestamp_cameras)
+    // These are assigned once, thus stay the same when we remove camera times
+    std::vector<size_t> state_ids;
+
+    /// Location of an imu factor in our graph, and the bias it was preintegrated at
+    struct IMUFACTOR {
+        size_t graph_id;
+        size_t interval;
+        Bias3 bg_lin;
+        Bias3 ba_lin;
+    };
+
+    // All imu factors in the current graph
+    std::vector<IMUFACTOR> imu_factors;
+
+    // Statistics of our last solve
+    SOLVESTATS solve_stats;
+
+    /// Everything our streaming solve keeps between updates (see stream_update())
+    struct STREAM {
+        std::unique_ptr<gtsam::ISAM2> isam;
+        gtsam::Values values_fixed;
+        gtsam::KeyVector keys_prior;
+        gtsam::FactorIndices ids_prior;
+        double sigma_prior = 1.0;
+        size_t next_id = 0;
+    };
+
+    // State of our streaming solve (empty until the first update)
+    STREAM stream;
 
 };
 
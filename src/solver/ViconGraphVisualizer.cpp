@@ -0,0 +1,151 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ViconGraphVisualizer.h"
+
+
+
+ViconGraphVisualizer::ViconGraphVisualizer(ros::NodeHandle& nh) {
+
+    // Frequency we will publish the raw vicon poses at
+    this->nh = nh;
+    nh.param<double>("freq_pub_raw_vicon", vicon_raw_pub_freq, 10.0);
+
+    // Setup our ROS publishers
+    pub_pathimu = nh.advertise<nav_msgs::Path>("/vicon2gt/optimized", 2);
+    pub_pathvicon = nh.advertise<nav_msgs::Path>("/vicon2gt/vicon", 2);
+    pub_vicon_raw = nh.advertise<geometry_msgs::PoseArray>("/vicon2gt/vicon_raw", 2);
+
+}
+
+
+
+void ViconGraphVisualizer::visualize(ViconGraphSolver &solver) {
+
+    // Tell the user we are publishing
+    ROS_INFO("Publishing: %s", pub_pathimu.getTopic().c_str());
+    ROS_INFO("Publishing: %s", pub_pathvicon.getTopic().c_str());
+
+    // Get the optimized imu states
+    std::vector<double> times;
+    std::vector<Eigen::Matrix<double,7,1>> poses;
+    solver.get_imu_poses(times, poses);
+
+    // Append to our pose vector
+    std::vector<geometry_msgs::PoseStamped> poses_imu;
+    for(size_t i=0; i<times.size(); i++) {
+
+        // Create the pose
+        geometry_msgs::PoseStamped posetemp;
+        posetemp.header.stamp = ros::Time(times.at(i));
+        posetemp.header.frame_id = "vicon";
+        posetemp.pose.orientation.x = poses.at(i)(0);
+        posetemp.pose.orientation.y = poses.at(i)(1);
+        posetemp.pose.orientation.z = poses.at(i)(2);
+        posetemp.pose.orientation.w = poses.at(i)(3);
+        posetemp.pose.position.x = poses.at(i)(4);
+        posetemp.pose.position.y = poses.at(i)(5);
+        posetemp.pose.position.z = poses.at(i)(6);
+        poses_imu.push_back(posetemp);
+    }
+
+    // Create our path (imu)
+    // NOTE: We downsample the number of poses as needed to prevent rviz crashes
+    // NOTE: https://github.com/ros-visualization/rviz/issues/1107
+    nav_msgs::Path arrIMU;
+    arrIMU.header.stamp = ros::Time::now();
+    arrIMU.header.frame_id = "vicon";
+    for(size_t i=0; i<poses_imu.size(); i+=std::floor(poses_imu.size()/16384.0)+1) {
+        arrIMU.poses.push_back(poses_imu.at(i));
+    }
+    pub_pathimu.publish(arrIMU);
+
+    // Get vicon marker body to imu calibration
+    double toff;
+    Eigen::Matrix3d R_BtoI, R_GtoV;
+    Eigen::Vector3d p_BinI;
+    solver.get_calibration(toff, R_BtoI, p_BinI, R_GtoV);
+    std::shared_ptr<const Interpolator> interpolator = solver.get_interpolator();
+
+    // Append to our pose vector
+    std::vector<geometry_msgs::PoseStamped> poses_vicon;
+    for(size_t i=0; i<times.size(); i++) {
+
+        // Get the interpolated pose
+        Eigen::Matrix<double,4,1> q_VtoB;
+        Eigen::Matrix<double,3,1> p_BinV;
+        Eigen::Matrix<double,6,6> R_vicon;
+        double timestamp_inV = times.at(i) - toff;
+        bool has_vicon = interpolator->get_pose(timestamp_inV, q_VtoB, p_BinV, R_vicon);
+        if(!has_vicon)
+            continue;
+
+        // Transform into the IMU frame
+        Eigen::Vector4d q_VtoI = quat_multiply(rot_2_quat(R_BtoI),q_VtoB);
+        Eigen::Vector3d p_IinV = p_BinV - quat_2_Rot(q_VtoI).transpose()*p_BinI;
+
+        // Create the pose
+        geometry_msgs::PoseStamped posetemp;
+        posetemp.header.stamp = ros::Time(times.at(i));
+        posetemp.header.frame_id = "vicon";
+        posetemp.pose.orientation.x = q_VtoI(0);
+        posetemp.pose.orientation.y = q_VtoI(1);
+        posetemp.pose.orientation.z = q_VtoI(2);
+        posetemp.pose.orientation.w = q_VtoI(3);
+        posetemp.pose.position.x = p_IinV(0);
+        posetemp.pose.position.y = p_IinV(1);
+        posetemp.pose.position.z = p_IinV(2);
+        poses_vicon.push_back(posetemp);
+
+    }
+
+    // Create our path (vicon)
+    // NOTE: We downsample the number of poses as needed to prevent rviz crashes
+    // NOTE: https://github.com/ros-visualization/rviz/issues/1107
+    nav_msgs::Path arrVICON;
+    arrVICON.header.stamp = ros::Time::now();
+    arrVICON.header.frame_id = "vicon";
+    for(size_t i=0; i<poses_vicon.size(); i+=std::floor(poses_imu.size()/16384.0)+1) {
+        arrVICON.poses.push_back(poses_vicon.at(i));
+    }
+    pub_pathvicon.publish(arrVICON);
+
+    // Pose array of the raw VICON poses which we get on our vicon topic
+    // NOTE: might be a lot to visualize if high frequency vicon system...
+    double last_pub_time = -1;
+    geometry_msgs::PoseArray pose_arr;
+    pose_arr.header.stamp = ros::Time::now();
+    pose_arr.header.frame_id = "vicon";
+    POSEVIEW raw_poses = interpolator->get_raw_poses();
+    for(size_t i=0; i<raw_poses.size(); i++) {
+        if(last_pub_time != -1 && (last_pub_time+1.0/vicon_raw_pub_freq) > raw_poses.timestamps.at(i))
+            continue;
+        geometry_msgs::Pose pose;
+        pose.orientation.x = raw_poses.q.at(i)(0);
+        pose.orientation.y = raw_poses.q.at(i)(1);
+        pose.orientation.z = raw_poses.q.at(i)(2);
+        pose.orientation.w = raw_poses.q.at(i)(3);
+        pose.position.x = raw_poses.p.at(i)(0);
+        pose.position.y = raw_poses.p.at(i)(1);
+        pose.position.z = raw_poses.p.at(i)(2);
+        pose_arr.poses.push_back(pose);
+        last_pub_time = raw_poses.timestamps.at(i);
+    }
+    pub_vicon_raw.publish(pose_arr);
+
+}
@@ -0,0 +1,66 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef VICONGRAPHVISUALIZER_H
+#define VICONGRAPHVISUALIZER_H
+
+
+#include <vector>
+#include <cmath>
+#include <Eigen/Eigen>
+#include <ros/ros.h>
+#include <nav_msgs/Path.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PoseArray.h>
+
+#include "meas/Interpolator.h"
+#include "solver/ViconGraphSolver.h"
+#include "utils/quat_ops.h"
+
+
+/**
+ * @brief Thin ROS front-end which publishes the results of a @ref ViconGraphSolver for visualization in RVIZ
+ */
+class ViconGraphVisualizer
+{
+
+public:
+
+    /**
+     * @brief Default constructor, will advertise our publishers
+     * @param nh ROS node handler we will load parameters from
+     */
+    ViconGraphVisualizer(ros::NodeHandle& nh);
+
+    /**
+     * @brief Will publish the trajectories onto ROS for visualization in RVIZ
+     * @param solver Solver which has already been solved
+     */
+    void visualize(ViconGraphSolver &solver);
+
+protected:
+
+    // ROS node handler
+    ros::NodeHandle nh;
+    ros::Publisher pub_pathimu, pub_pathvicon, pub_vicon_raw;
+    double vicon_raw_pub_freq;
+
+};
+
+
+#endif /* VICONGRAPHVISUALIZER_H */
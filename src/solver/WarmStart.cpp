@@ -0,0 +1,107 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "WarmStart.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+
+bool WarmStart::load_states(const std::string &path) {
+
+    // Read the file and ensure our states are sorted in time
+    if(!StateWriter::read(path, rows))
+        return false;
+    std::stable_sort(rows.begin(), rows.end(), [](const StateWriter::STATEROW &a, const StateWriter::STATEROW &b) {
+        return a.timestamp < b.timestamp;
+    });
+    return !rows.empty();
+
+}
+
+
+bool WarmStart::load_calibration(const std::string &path, Eigen::Matrix3d &R_BtoI, Eigen::Vector3d &p_BinI, Eigen::Matrix3d &R_GtoV, double &toff) {
+
+    // Read the whole info file
+    std::ifstream file(path);
+    if(!file.is_open())
+        return false;
+    std::stringstream ss_file;
+    ss_file << file.rdbuf();
+    std::string info = ss_file.str();
+
+    // Each value is on the lines after its label
+    auto read_values = [&](const std::string &label, int num_values, Eigen::VectorXd &values) {
+        size_t pos = info.find(label);
+        if(pos == std::string::npos)
+            return false;
+        std::istringstream ss(info.substr(pos+label.size()));
+        values.resize(num_values);
+        for(int i=0; i<num_values; i++) {
+            ss >> values(i);
+        }
+        return !ss.fail();
+    };
+
+    // Our rotations are saved as matrices (row-major), but the quaternion is normalized so we use it
+    // Note that the thetay of R_GtoV was not saved correctly in older info files, so we use its matrix
+    Eigen::VectorXd q_BtoI, p, R, t;
+    if(!read_values("q_BtoI:", 4, q_BtoI) || !read_values("p_BinI:", 3, p) || !read_values("R_GtoV:", 9, R) || !read_values("t_off_vicon_to_imu:", 1, t))
+        return false;
+    R_BtoI = quat_2_Rot(q_BtoI/q_BtoI.norm());
+    p_BinI = p;
+    R_GtoV << R(0), R(1), R(2), R(3), R(4), R(5), R(6), R(7), R(8);
+    toff = t(0);
+    return true;
+
+}
+
+
+bool WarmStart::get_state(double timestamp, Eigen::Vector4d &q_GtoI, Eigen::Vector3d &p_IinG, Eigen::Vector3d &v_IinG,
+                          Eigen::Vector3d &bg, Eigen::Vector3d &ba) const {
+
+    // Find the two previous states that bound this time
+    auto it = std::lower_bound(rows.begin(), rows.end(), timestamp, [](const StateWriter::STATEROW &row, double t) {
+        return row.timestamp < t;
+    });
+    if(it == rows.end())
+        return false;
+    const StateWriter::STATEROW &row1 = *it;
+    const StateWriter::STATEROW &row0 = (it == rows.begin())? row1 : *(it-1);
+    if(row0.timestamp > timestamp || row1.timestamp-row0.timestamp > max_gap)
+        return false;
+
+    // Each row is [p,qw,qx,qy,qz,v,bg,ba] and our quaternions are JPL [qx,qy,qz,qw]
+    Eigen::Vector4d q0, q1;
+    q0 << row0.data(4), row0.data(5), row0.data(6), row0.data(3);
+    q1 << row1.data(4), row1.data(5), row1.data(6), row1.data(3);
+
+    // Linearly interpolate, with the orientation on the manifold
+    double lambda = (row1.timestamp > row0.timestamp)? (timestamp-row0.timestamp)/(row1.timestamp-row0.timestamp) : 0.0;
+    Eigen::Matrix3d R_GtoI0 = quat_2_Rot(q0/q0.norm());
+    Eigen::Matrix3d R_GtoI1 = quat_2_Rot(q1/q1.norm());
+    q_GtoI = rot_2_quat(exp_so3(lambda*log_so3(R_GtoI1*R_GtoI0.transpose()))*R_GtoI0);
+    Eigen::Matrix<double,16,1> data = (1-lambda)*row0.data + lambda*row1.data;
+    p_IinG = data.block(0,0,3,1);
+    v_IinG = data.block(7,0,3,1);
+    bg = data.block(10,0,3,1);
+    ba = data.block(13,0,3,1);
+    return true;
+
+}
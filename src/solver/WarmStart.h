@@ -0,0 +1,91 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef WARMSTART_H
+#define WARMSTART_H
+
+#include <string>
+#include <vector>
+#include <Eigen/Eigen>
+
+#include "solver/StateWriter.h"
+#include "utils/quat_ops.h"
+
+
+/**
+ * @brief States and calibration of a previous solve, which we can use as the initial guess of a new one.
+ *
+ * The states are loaded from a file saved by @ref StateWriter (csv or binary) and are in the gravity aligned frame.
+ * These are interpolated onto the new camera times, thus the new solve does not need to use the same times (or even all of them).
+ * The calibration is loaded from the info file that was saved next to the states.
+ */
+class WarmStart {
+
+public:
+
+    /// Largest gap (sec) between the two previous states we will interpolate between
+    double max_gap = 0.5;
+
+    /// Rotation from gravity aligned to vicon frame of the previous solve (what our states need to be rotated by into the vicon frame)
+    Eigen::Matrix3d R_GtoV = Eigen::Matrix3d::Identity();
+
+    /**
+     * @brief Loads the states of a previous solve
+     * @param path States file (binary if it has a .bin extension, otherwise csv)
+     * @return False if we could not read any states
+     */
+    bool load_states(const std::string &path);
+
+    /**
+     * @brief Loads the calibration from the info file of a previous solve
+     * @param path Info file that was saved with the states
+     * @param R_BtoI Rotation between vicon and IMU
+     * @param p_BinI Position between vicon and IMU
+     * @param R_GtoV Rotation from gravity aligned to vicon frame
+     * @param toff Time offset between vicon and IMU
+     * @return False if we could not read all of them
+     */
+    static bool load_calibration(const std::string &path, Eigen::Matrix3d &R_BtoI, Eigen::Vector3d &p_BinI, Eigen::Matrix3d &R_GtoV, double &toff);
+
+    /**
+     * @brief Interpolates the previous states at a time
+     * @param timestamp Time we want the state at (in the IMU clock)
+     * @param q_GtoI Rotation from gravity aligned to IMU frame
+     * @param p_IinG Position of the IMU in the gravity aligned frame
+     * @param v_IinG Velocity of the IMU in the gravity aligned frame
+     * @param bg Gyroscope bias
+     * @param ba Accelerometer bias
+     * @return False if we do not have previous states within @ref max_gap on both sides of this time
+     */
+    bool get_state(double timestamp, Eigen::Vector4d &q_GtoI, Eigen::Vector3d &p_IinG, Eigen::Vector3d &v_IinG,
+                   Eigen::Vector3d &bg, Eigen::Vector3d &ba) const;
+
+    /// Number of previous states we have
+    size_t size() const {
+        return rows.size();
+    }
+
+private:
+
+    /// Previous states sorted in time
+    std::vector<StateWriter::STATEROW> rows;
+
+};
+
+
+#endif //WARMSTART_H
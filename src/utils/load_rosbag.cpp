@@ -0,0 +1,312 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "load_rosbag.h"
+
+
+/**
+ * @brief Loads all IMU messages on a topic (opens its own bag so it can run in parallel with the other streams)
+ */
+static void load_imu_topic(const std::string &path_to_bag, const std::string &topic_imu, const ros::Time &time_init,
+                           const ros::Time &time_finish, MeasCache &cache) {
+    rosbag::Bag bag_imu;
+    bag_imu.open(path_to_bag, rosbag::bagmode::Read);
+    rosbag::View view_imu(bag_imu, rosbag::TopicQuery(topic_imu), time_init, time_finish);
+    cache.imu_times.reserve(view_imu.size());
+    cache.imu_wm.reserve(view_imu.size());
+    cache.imu_am.reserve(view_imu.size());
+    for (const rosbag::MessageInstance& m : view_imu) {
+        if (!ros::ok())
+            break;
+        sensor_msgs::Imu::ConstPtr s0 = m.instantiate<sensor_msgs::Imu>();
+        if (s0 == nullptr)
+            continue;
+        Eigen::Matrix<double,3,1> wm, am;
+        wm << s0->angular_velocity.x, s0->angular_velocity.y, s0->angular_velocity.z;
+        am << s0->linear_acceleration.x, s0->linear_acceleration.y, s0->linear_acceleration.z;
+        cache.imu_times.push_back(s0->header.stamp.toSec());
+        cache.imu_wm.push_back(wm);
+        cache.imu_am.push_back(am);
+    }
+    bag_imu.close();
+}
+
+
+/**
+ * @brief Loads all VICON messages on a topic (opens its own bag so it can run in parallel with the other streams)
+ */
+static void load_vicon_topic(const std::string &path_to_bag, const std::string &topic_vicon, const ros::Time &time_init,
+                             const ros::Time &time_finish, MeasCache &cache) {
+    rosbag::Bag bag_vicon;
+    bag_vicon.open(path_to_bag, rosbag::bagmode::Read);
+    rosbag::View view_vicon(bag_vicon, rosbag::TopicQuery(topic_vicon), time_init, time_finish);
+    cache.vicon_times.reserve(view_vicon.size());
+    cache.vicon_q.reserve(view_vicon.size());
+    cache.vicon_p.reserve(view_vicon.size());
+    cache.vicon_cov.reserve(view_vicon.size());
+    cache.vicon_has_cov.reserve(view_vicon.size());
+    for (const rosbag::MessageInstance& m : view_vicon) {
+
+        // If ros is wants us to stop, break out
+        if (!ros::ok())
+            break;
+
+        // Load orientation and position of the vicon
+        double timestamp;
+        Eigen::Matrix<double,4,1> q;
+        Eigen::Matrix<double,3,1> p;
+        Eigen::Matrix<double,6,6> pose_cov = Eigen::Matrix<double,6,6>::Zero();
+        bool has_cov = false;
+        if (!parse_vicon_message(m, timestamp, q, p, pose_cov, has_cov))
+            continue;
+
+        // Save it!
+        cache.vicon_times.push_back(timestamp);
+        cache.vicon_q.push_back(q);
+        cache.vicon_p.push_back(p);
+        cache.vicon_cov.push_back(pose_cov);
+        cache.vicon_has_cov.push_back((uint8_t)has_cov);
+
+    }
+    bag_vicon.close();
+}
+
+
+/**
+ * @brief Appends a topic to the list if it is not already in it, and returns its index in the list
+ */
+static size_t add_unique_topic(std::vector<std::string> &topics, const std::string &topic) {
+    auto it = std::find(topics.begin(), topics.end(), topic);
+    if(it != topics.end())
+        return (size_t)(it-topics.begin());
+    topics.push_back(topic);
+    return topics.size()-1;
+}
+
+
+
+bool load_rosbag(const std::string &path_to_bag, const std::string &topic_imu, const std::string &topic_cam, const std::string &topic_vicon,
+                 double bag_start, double bag_durr, MeasCache &cache) {
+
+    // This is just a single body, so we can move its measurements right into the cache
+    std::vector<MeasCache> caches;
+    if(!load_rosbag(path_to_bag, {BAGTOPICS{topic_imu, topic_cam, topic_vicon}}, bag_start, bag_durr, caches))
+        return false;
+    cache = std::move(caches.at(0));
+    return true;
+
+}
+
+
+
+bool load_rosbag(const std::string &path_to_bag, const std::vector<BAGTOPICS> &bodies,
+                 double bag_start, double bag_durr, std::vector<MeasCache> &caches) {
+
+    // Start timing
+    ProfileScope scope("load_rosbag");
+
+    // Load rosbag here, and find messages we can play
+    rosbag::Bag bag;
+    try {
+        bag.open(path_to_bag, rosbag::bagmode::Read);
+    } catch (const rosbag::BagException &e) {
+        ROS_ERROR("unable to open rosbag %s (%s)", path_to_bag.c_str(), e.what());
+        return false;
+    }
+
+    // We should load the bag as a view
+    // Here we go from beginning of the bag to the end of the bag
+    rosbag::View view_full;
+    rosbag::View view;
+
+    // Start a few seconds in from the full view time
+    // If we have a negative duration then use the full bag length
+    view_full.addQuery(bag);
+    ros::Time time_init = view_full.getBeginTime();
+    time_init += ros::Duration(bag_start);
+    ros::Time time_finish = (bag_durr < 0)? view_full.getEndTime() : time_init + ros::Duration(bag_durr);
+    ROS_INFO("loading rosbag into memory...");
+    ROS_INFO("    - time start = %.6f", time_init.toSec());
+    ROS_INFO("    - time end   = %.6f", time_finish.toSec());
+    ROS_INFO("    - duration   = %.2f (secs)", time_finish.toSec()-time_init.toSec());
+
+    // Find the unique topics we need, and which of them each body uses
+    // Bodies can share streams (e.g. a single camera), which we only want to read once
+    std::vector<std::string> topics_imu, topics_cam, topics_vicon;
+    std::vector<size_t> idx_imu, idx_cam, idx_vicon;
+    for(const BAGTOPICS &body : bodies) {
+        idx_imu.push_back(add_unique_topic(topics_imu, body.topic_imu));
+        idx_cam.push_back(add_unique_topic(topics_cam, body.topic_cam));
+        idx_vicon.push_back(add_unique_topic(topics_vicon, body.topic_vicon));
+    }
+
+    // Only query the topics that we will use
+    std::vector<std::string> topics_all;
+    for(const std::vector<std::string> *topics : {&topics_imu, &topics_cam, &topics_vicon}) {
+        topics_all.insert(topics_all.end(), topics->begin(), topics->end());
+    }
+    view.addQuery(bag, rosbag::TopicQuery(topics_all), time_init, time_finish);
+
+    // Check to make sure we have data to play
+    if (view.size() == 0) {
+        ROS_ERROR("No messages to play on specified topics.  Exiting.");
+        for(const BAGTOPICS &body : bodies) {
+            ROS_ERROR("IMU TOPIC: %s",body.topic_imu.c_str());
+            ROS_ERROR("CAM TOPIC: %s",body.topic_cam.c_str());
+            ROS_ERROR("VIC TOPIC: %s",body.topic_vicon.c_str());
+        }
+        return false;
+    }
+
+    // Start loading each IMU and VICON stream in the background
+    // If a stream fails to read (e.g. a corrupt chunk) we keep its exception, as it can not leave its thread
+    std::vector<MeasCache> streams_imu(topics_imu.size());
+    std::vector<MeasCache> streams_cam(topics_cam.size());
+    std::vector<MeasCache> streams_vicon(topics_vicon.size());
+    std::vector<std::exception_ptr> errors(topics_imu.size()+topics_vicon.size()+1);
+    std::vector<std::thread> threads;
+    for(size_t i=0; i<topics_imu.size(); i++) {
+        threads.emplace_back([&,i]() {
+            try {
+                load_imu_topic(path_to_bag, topics_imu.at(i), time_init, time_finish, streams_imu.at(i));
+            } catch (...) {
+                errors.at(i) = std::current_exception();
+            }
+        });
+    }
+    for(size_t i=0; i<topics_vicon.size(); i++) {
+        threads.emplace_back([&,i]() {
+            try {
+                load_vicon_topic(path_to_bag, topics_vicon.at(i), time_init, time_finish, streams_vicon.at(i));
+            } catch (...) {
+                errors.at(topics_imu.size()+i) = std::current_exception();
+            }
+        });
+    }
+
+    // Handle CAMERA messages
+    // We only need the time the message was recorded at, which is in the bag index
+    // Thus we never read or decode the actual images
+    try {
+        for(size_t i=0; i<topics_cam.size(); i++) {
+            rosbag::View view_cam(bag, rosbag::TopicQuery(topics_cam.at(i)), time_init, time_finish);
+            streams_cam.at(i).cam_times.reserve(view_cam.size());
+            for (const rosbag::MessageInstance& m : view_cam) {
+                if (!ros::ok())
+                    break;
+                streams_cam.at(i).cam_times.push_back(m.getTime().toSec());
+            }
+        }
+    } catch (...) {
+        errors.back() = std::current_exception();
+    }
+
+    // Wait for the other streams
+    for(auto &thread : threads) {
+        thread.join();
+    }
+    bag.close();
+
+    // If any stream failed, then we do not have all of the measurements
+    for(const std::exception_ptr &error : errors) {
+        if(error == nullptr)
+            continue;
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception &e) {
+            ROS_ERROR("unable to read rosbag %s (%s)", path_to_bag.c_str(), e.what());
+        } catch (...) {
+            ROS_ERROR("unable to read rosbag %s", path_to_bag.c_str());
+        }
+        return false;
+    }
+
+    // Finally give each body its streams
+    // The last body that uses a stream can take it, while all others need their own copy
+    caches.clear();
+    caches.resize(bodies.size());
+    for(size_t i=0; i<bodies.size(); i++) {
+        auto last_user = [&](const std::vector<size_t> &idx) {
+            return std::find(idx.begin()+(long)i+1, idx.end(), idx.at(i)) == idx.end();
+        };
+        MeasCache &cache = caches.at(i);
+        MeasCache &imu = streams_imu.at(idx_imu.at(i));
+        MeasCache &cam = streams_cam.at(idx_cam.at(i));
+        MeasCache &vicon = streams_vicon.at(idx_vicon.at(i));
+        if(last_user(idx_imu)) {
+            cache.imu_times = std::move(imu.imu_times);
+            cache.imu_wm = std::move(imu.imu_wm);
+            cache.imu_am = std::move(imu.imu_am);
+        } else {
+            cache.imu_times = imu.imu_times;
+            cache.imu_wm = imu.imu_wm;
+            cache.imu_am = imu.imu_am;
+        }
+        if(last_user(idx_cam)) {
+            cache.cam_times = std::move(cam.cam_times);
+        } else {
+            cache.cam_times = cam.cam_times;
+        }
+        if(last_user(idx_vicon)) {
+            cache.vicon_times = std::move(vicon.vicon_times);
+            cache.vicon_q = std::move(vicon.vicon_q);
+            cache.vicon_p = std::move(vicon.vicon_p);
+            cache.vicon_cov = std::move(vicon.vicon_cov);
+            cache.vicon_has_cov = std::move(vicon.vicon_has_cov);
+        } else {
+            cache.vicon_times = vicon.vicon_times;
+            cache.vicon_q = vicon.vicon_q;
+            cache.vicon_p = vicon.vicon_p;
+            cache.vicon_cov = vicon.vicon_cov;
+            cache.vicon_has_cov = vicon.vicon_has_cov;
+        }
+    }
+    return true;
+
+}
+
+
+
+bool get_rosbag_info(const std::string &path_to_bag, const std::string &topic_imu, const std::string &topic_cam, const std::string &topic_vicon,
+                     double bag_start, double bag_durr, size_t &num_imu, size_t &num_cam, size_t &num_vicon, double &duration) {
+
+    // Try to open the bag
+    rosbag::Bag bag;
+    try {
+        bag.open(path_to_bag, rosbag::bagmode::Read);
+    } catch (const rosbag::BagException &e) {
+        ROS_ERROR("unable to open rosbag %s (%s)", path_to_bag.c_str(), e.what());
+        return false;
+    }
+
+    // Get the same time range that we will load
+    rosbag::View view_full;
+    view_full.addQuery(bag);
+    ros::Time time_init = view_full.getBeginTime();
+    time_init += ros::Duration(bag_start);
+    ros::Time time_finish = (bag_durr < 0)? view_full.getEndTime() : time_init + ros::Duration(bag_durr);
+    duration = std::max(0.0, time_finish.toSec()-time_init.toSec());
+
+    // The size of each view only needs the bag index
+    num_imu = rosbag::View(bag, rosbag::TopicQuery(topic_imu), time_init, time_finish).size();
+    num_cam = rosbag::View(bag, rosbag::TopicQuery(topic_cam), time_init, time_finish).size();
+    num_vicon = rosbag::View(bag, rosbag::TopicQuery(topic_vicon), time_init, time_finish).size();
+    bag.close();
+    return true;
+
+}
@@ -0,0 +1,182 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LOAD_ROSBAG_H
+#define LOAD_ROSBAG_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <Eigen/Eigen>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/Imu.h>
+#include <nav_msgs/Odometry.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/TransformStamped.h>
+
+#include "meas/MeasCache.h"
+#include "utils/profiler.h"
+
+
+/**
+ * @brief Topics of a single body (IMU rigidly attached to a vicon marker body) that we will load from a rosbag
+ */
+struct BAGTOPICS {
+
+    /// IMU topic
+    std::string topic_imu;
+
+    /// Camera topic (we only use their timestamps)
+    std::string topic_cam;
+
+    /// Vicon topic (odometry, transform, or pose messages)
+    std::string topic_vicon;
+
+};
+
+
+/**
+ * @brief Checks if a type erased message is of the given type (the same check as rosbag::MessageInstance::isType())
+ */
+template<typename T, typename Message>
+bool is_message_type(const Message &m) {
+    std::string md5 = m.getMD5Sum();
+    return md5 == "*" || md5 == ros::message_traits::md5sum<T>();
+}
+
+
+/**
+ * @brief Reads the pose of a vicon message (odometry, transform, or pose messages)
+ *
+ * This works on any type erased message that can be instantiated (e.g. rosbag::MessageInstance or topic_tools::ShapeShifter).
+ * We check the message type first, so we only ever deserialize it once.
+ *
+ * @param m Message to read
+ * @param timestamp Time of the pose
+ * @param q Orientation of the pose (JPL quaternion)
+ * @param p Position of the pose
+ * @param pose_cov Covariance of the pose, only set if the message has one (order=x,y,z,rx,ry,rz)
+ * @param has_cov If the message has its own covariance
+ * @return False if this is a type we can not handle
+ */
+template<typename Message>
+bool parse_vicon_message(const Message &m, double &timestamp, Eigen::Matrix<double,4,1> &q, Eigen::Matrix<double,3,1> &p,
+                         Eigen::Matrix<double,6,6> &pose_cov, bool &has_cov) {
+
+    // Odometry messages (have their own covariance)
+    has_cov = false;
+    if (is_message_type<nav_msgs::Odometry>(m)) {
+        nav_msgs::Odometry::ConstPtr s2 = m.template instantiate<nav_msgs::Odometry>();
+        timestamp = s2->header.stamp.toSec();
+        q << s2->pose.pose.orientation.x,s2->pose.pose.orientation.y,s2->pose.pose.orientation.z,s2->pose.pose.orientation.w;
+        p << s2->pose.pose.position.x,s2->pose.pose.position.y,s2->pose.pose.position.z;
+        // load the covariance of the pose (order=x,y,z,rx,ry,rz) stored row-major
+        for(size_t c=0;c<6;c++) {
+            for(size_t r=0;r<6;r++) {
+                pose_cov(r,c) = s2->pose.covariance[6*c+r];
+            }
+        }
+        has_cov = true;
+        return true;
+    }
+
+    // Transform messages
+    if (is_message_type<geometry_msgs::TransformStamped>(m)) {
+        geometry_msgs::TransformStamped::ConstPtr s3 = m.template instantiate<geometry_msgs::TransformStamped>();
+        timestamp = s3->header.stamp.toSec();
+        q << s3->transform.rotation.x,s3->transform.rotation.y,s3->transform.rotation.z,s3->transform.rotation.w;
+        p << s3->transform.translation.x,s3->transform.translation.y,s3->transform.translation.z;
+        return true;
+    }
+
+    // Pose messages
+    if (is_message_type<geometry_msgs::PoseStamped>(m)) {
+        geometry_msgs::PoseStamped::ConstPtr s4 = m.template instantiate<geometry_msgs::PoseStamped>();
+        timestamp = s4->header.stamp.toSec();
+        q << s4->pose.orientation.x,s4->pose.orientation.y,s4->pose.orientation.z,s4->pose.orientation.w;
+        p << s4->pose.position.x,s4->pose.position.y,s4->pose.position.z;
+        return true;
+    }
+
+    // Else this is a type we can't handle
+    return false;
+
+}
+
+
+/**
+ * @brief Loads all measurements we need from the rosbag
+ *
+ * Each stream opens its own bag so they can read and decode in parallel.
+ * We only query the topics that we will use, so we never touch the data of any other topics in the bag.
+ * If the bag can not be opened or read (e.g. it is truncated or has a corrupt chunk), the error is printed and we return false.
+ *
+ * @param path_to_bag Path to the rosbag
+ * @param topic_imu IMU topic
+ * @param topic_cam Camera topic (we only use their timestamps)
+ * @param topic_vicon Vicon topic (odometry, transform, or pose messages)
+ * @param bag_start How many seconds into the bag we should start
+ * @param bag_durr How far after the start we should load (negative for the whole bag)
+ * @param cache Where we will store the raw measurements
+ * @return False if we have no messages to load, or the bag could not be read
+ */
+bool load_rosbag(const std::string &path_to_bag, const std::string &topic_imu, const std::string &topic_cam, const std::string &topic_vicon,
+                 double bag_start, double bag_durr, MeasCache &cache);
+
+
+/**
+ * @brief Loads the measurements of multiple bodies from the rosbag in a single pass
+ *
+ * Each unique topic is only read and decoded once, even if multiple bodies use it (e.g. a shared camera or IMU).
+ * Like the single body version, each IMU and vicon stream opens its own bag so all of them load in parallel.
+ *
+ * @param path_to_bag Path to the rosbag
+ * @param bodies Topics of each body
+ * @param bag_start How many seconds into the bag we should start
+ * @param bag_durr How far after the start we should load (negative for the whole bag)
+ * @param caches Where we will store the raw measurements of each body (will be resized to the number of bodies)
+ * @return False if we have no messages to load, or the bag could not be read
+ */
+bool load_rosbag(const std::string &path_to_bag, const std::vector<BAGTOPICS> &bodies,
+                 double bag_start, double bag_durr, std::vector<MeasCache> &caches);
+
+
+/**
+ * @brief Gets how many messages we will load from the rosbag without reading any of them (only uses the bag index)
+ * @param path_to_bag Path to the rosbag
+ * @param topic_imu IMU topic
+ * @param topic_cam Camera topic
+ * @param topic_vicon Vicon topic
+ * @param bag_start How many seconds into the bag we should start
+ * @param bag_durr How far after the start we should load (negative for the whole bag)
+ * @param num_imu Number of IMU messages
+ * @param num_cam Number of camera messages
+ * @param num_vicon Number of vicon messages
+ * @param duration Duration of the bag we will load (sec)
+ * @return False if we are unable to open the bag
+ */
+bool get_rosbag_info(const std::string &path_to_bag, const std::string &topic_imu, const std::string &topic_cam, const std::string &topic_vicon,
+                     double bag_start, double bag_durr, size_t &num_imu, size_t &num_cam, size_t &num_vicon, double &duration);
+
+
+#endif //LOAD_ROSBAG_H
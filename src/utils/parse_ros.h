@@ -0,0 +1,119 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PARSE_ROS_H
+#define PARSE_ROS_H
+
+#include <vector>
+#include <ros/ros.h>
+
+#include "solver/SolverOptions.h"
+
+
+/**
+ * @brief Loads the solver options from the ROS parameter server
+ * @param nh ROS node handler we will load parameters from
+ * @param defaults Options we start from (e.g. those of a parent namespace)
+ * @return Options, any parameters not set will be left at their defaults
+ */
+inline SolverOptions load_solver_options(ros::NodeHandle &nh, const SolverOptions &defaults = SolverOptions()) {
+
+    // Our options we will fill
+    SolverOptions options = defaults;
+
+    // Load gravity rotation into vicon frame
+    std::vector<double> R_GtoV;
+    Eigen::Matrix<double,3,3,Eigen::RowMajor> R_GtoV_rows = options.init_R_GtoV;
+    std::vector<double> R_GtoV_default(R_GtoV_rows.data(), R_GtoV_rows.data()+9);
+    nh.param<std::vector<double>>("R_GtoV", R_GtoV, R_GtoV_default);
+    options.init_R_GtoV << R_GtoV.at(0),R_GtoV.at(1),R_GtoV.at(2),
+            R_GtoV.at(3),R_GtoV.at(4),R_GtoV.at(5),
+            R_GtoV.at(6),R_GtoV.at(7),R_GtoV.at(8);
+
+    // Load gravity magnitude
+    nh.param<double>("gravity_magnitude", options.gravity_magnitude, options.gravity_magnitude);
+
+    // Load transform between vicon body frame to the IMU
+    std::vector<double> R_BtoI;
+    Eigen::Matrix<double,3,3,Eigen::RowMajor> R_BtoI_rows = options.init_R_BtoI;
+    std::vector<double> R_BtoI_default(R_BtoI_rows.data(), R_BtoI_rows.data()+9);
+    nh.param<std::vector<double>>("R_BtoI", R_BtoI, R_BtoI_default);
+    options.init_R_BtoI << R_BtoI.at(0),R_BtoI.at(1),R_BtoI.at(2),
+            R_BtoI.at(3),R_BtoI.at(4),R_BtoI.at(5),
+            R_BtoI.at(6),R_BtoI.at(7),R_BtoI.at(8);
+
+    std::vector<double> p_BinI;
+    std::vector<double> p_BinI_default(options.init_p_BinI.data(), options.init_p_BinI.data()+3);
+    nh.param<std::vector<double>>("p_BinI", p_BinI, p_BinI_default);
+    options.init_p_BinI << p_BinI.at(0),p_BinI.at(1),p_BinI.at(2);
+
+    // Time offset between imu and vicon
+    nh.param<double>("toff_imu_to_vicon", options.init_toff_imu_to_vicon, options.init_toff_imu_to_vicon);
+
+    // Largest gap in the vicon we will interpolate over
+    nh.param<double>("vicon_max_dt", options.vicon_max_dt, options.vicon_max_dt);
+
+    // Previous solve we can warm start from
+    nh.param<std::string>("warm_start_states", options.warm_start_states, options.warm_start_states);
+    nh.param<std::string>("warm_start_info", options.warm_start_info, options.warm_start_info);
+
+    // See if we should estimate calibration
+    nh.param<bool>("estimate_toff_vicon_to_imu", options.estimate_toff_vicon_to_imu, options.estimate_toff_vicon_to_imu);
+    nh.param<bool>("estimate_ori_vicon_to_imu", options.estimate_ori_vicon_to_imu, options.estimate_ori_vicon_to_imu);
+    nh.param<bool>("estimate_pos_vicon_to_imu", options.estimate_pos_vicon_to_imu, options.estimate_pos_vicon_to_imu);
+    nh.param<bool>("estimate_gravity", options.estimate_gravity, options.estimate_gravity);
+
+    // Number of times we relinearize
+    nh.param<int>("num_loop_relin", options.num_loop_relin, options.num_loop_relin);
+
+    // If we should only re-preintegrate imu factors whose bias has changed
+    nh.param<bool>("relin_incremental", options.relin_incremental, options.relin_incremental);
+    nh.param<double>("relin_thresh_bg", options.relin_thresh_bg, options.relin_thresh_bg);
+    nh.param<double>("relin_thresh_ba", options.relin_thresh_ba, options.relin_thresh_ba);
+
+    // How often and how far behind a streaming solve marginalizes its states
+    nh.param<double>("stream_window", options.stream_window, options.stream_window);
+    nh.param<double>("stream_lag", options.stream_lag, options.stream_lag);
+
+    // If we should split the problem into chunks of camera times (zero will solve it all at once)
+    nh.param<int>("chunk_size", options.chunk_size, options.chunk_size);
+    nh.param<int>("chunk_overlap", options.chunk_overlap, options.chunk_overlap);
+
+    // Number of threads we will use to build the graph (zero will use all cores)
+    nh.param<int>("num_threads", options.num_threads, options.num_threads);
+
+    // If we only estimate states at keyframes, and recover the rest after (zero will estimate all camera times)
+    nh.param<double>("keyframe_dt", options.keyframe_dt, options.keyframe_dt);
+
+    // How we will optimize the batch problem
+    nh.param<std::string>("optimizer", options.optimizer, options.optimizer);
+    nh.param<std::string>("linear_solver", options.linear_solver, options.linear_solver);
+    nh.param<std::string>("ordering", options.ordering, options.ordering);
+    nh.param<int>("max_iterations", options.max_iterations, options.max_iterations);
+    nh.param<double>("relative_error_tol", options.relative_error_tol, options.relative_error_tol);
+    nh.param<double>("absolute_error_tol", options.absolute_error_tol, options.absolute_error_tol);
+
+    // How we will save our states
+    nh.param<std::string>("state_format", options.state_format, options.state_format);
+    nh.param<bool>("save_covariance", options.save_covariance, options.save_covariance);
+    return options;
+
+}
+
+
+#endif //PARSE_ROS_H
@@ -0,0 +1,192 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "utils/colors.h"
+
+
+Profiler::STAT &Profiler::BUFFER::get_stat(const char *name) {
+    // Only a handful of names are used, so a linear search over pointers is faster than a map
+    for(auto &stat : stats) {
+        if(stat.name == name)
+            return stat;
+    }
+    stats.push_back({name, 0, 0, 0});
+    return stats.back();
+}
+
+
+Profiler::BUFFER &Profiler::get_buffer() {
+    thread_local std::shared_ptr<BUFFER> buffer;
+    if(buffer == nullptr) {
+        buffer = std::make_shared<BUFFER>();
+        std::lock_guard<std::mutex> lck(get_buffers_mutex());
+        buffer->tid = (uint32_t)get_buffers().size();
+        get_buffers().push_back(buffer);
+    }
+    return *buffer;
+}
+
+
+std::chrono::steady_clock::time_point Profiler::get_origin() {
+    static std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return origin;
+}
+
+
+void Profiler::record_event(const char *name, std::chrono::steady_clock::time_point start,
+                            std::chrono::steady_clock::time_point end, const std::string &args) {
+    std::chrono::steady_clock::time_point origin = get_origin();
+    EVENT event;
+    event.name = name;
+    event.ts_us = std::chrono::duration_cast<std::chrono::microseconds>(start-origin).count();
+    event.dur_us = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
+    event.args = args;
+    BUFFER &buffer = get_buffer();
+    std::lock_guard<std::mutex> lck(buffer.mtx);
+    buffer.events.push_back(std::move(event));
+}
+
+
+void Profiler::record_stat(const char *name, int64_t dur_ns) {
+    BUFFER &buffer = get_buffer();
+    std::lock_guard<std::mutex> lck(buffer.mtx);
+    STAT &stat = buffer.get_stat(name);
+    stat.count++;
+    stat.total_ns += dur_ns;
+    stat.max_ns = std::max(stat.max_ns, dur_ns);
+}
+
+
+void Profiler::count(const char *name, uint64_t amount) {
+    if(!is_enabled())
+        return;
+    BUFFER &buffer = get_buffer();
+    std::lock_guard<std::mutex> lck(buffer.mtx);
+    buffer.get_stat(name).count += amount;
+}
+
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lck(get_buffers_mutex());
+    for(auto &ptr : get_buffers()) {
+        BUFFER &buffer = *ptr;
+        std::lock_guard<std::mutex> lck_buffer(buffer.mtx);
+        buffer.events.clear();
+        buffer.stats.clear();
+    }
+}
+
+
+std::vector<Profiler::STAT> Profiler::get_stats() {
+
+    // Merge the same names from all threads together
+    // The same literal can have a different address in each translation unit, so we also compare the strings
+    std::vector<STAT> merged;
+    std::lock_guard<std::mutex> lck(get_buffers_mutex());
+    for(auto &ptr : get_buffers()) {
+        BUFFER &buffer = *ptr;
+        std::lock_guard<std::mutex> lck_buffer(buffer.mtx);
+        for(const auto &stat : buffer.stats) {
+            auto it = std::find_if(merged.begin(), merged.end(), [&](const STAT &s) {
+                return s.name == stat.name || std::string(s.name) == stat.name;
+            });
+            if(it == merged.end()) {
+                merged.push_back(stat);
+            } else {
+                it->count += stat.count;
+                it->total_ns += stat.total_ns;
+                it->max_ns = std::max(it->max_ns, stat.max_ns);
+            }
+        }
+    }
+
+    // Sort by the total time, so the most expensive are first
+    std::sort(merged.begin(), merged.end(), [](const STAT &a, const STAT &b) {
+        return a.total_ns > b.total_ns;
+    });
+    return merged;
+
+}
+
+
+void Profiler::print_summary() {
+    std::vector<STAT> stats = get_stats();
+    printf(BLUE "[PROFILE]: %-32s %12s %12s %12s %12s\n" RESET, "name", "count", "total (s)", "mean (ms)", "max (ms)");
+    for(const auto &stat : stats) {
+        double mean_ms = (stat.count > 0)? 1e-6*stat.total_ns/stat.count : 0.0;
+        printf(BLUE "[PROFILE]: %-32s %12llu %12.4f %12.5f %12.5f\n" RESET, stat.name, (unsigned long long)stat.count,
+               1e-9*stat.total_ns, mean_ms, 1e-6*stat.max_ns);
+    }
+}
+
+
+bool Profiler::write_trace(const std::string &path) {
+
+    // Create the directory that we will open the file in
+    boost::filesystem::path p1(path);
+    if(!p1.parent_path().empty())
+        boost::filesystem::create_directories(p1.parent_path());
+    std::ofstream of_trace(path, std::ofstream::out | std::ofstream::trunc);
+    if(!of_trace.is_open()) {
+        printf(RED "[PROFILE]: unable to open %s\n" RESET, path.c_str());
+        return false;
+    }
+
+    // Our timeline, one track per thread
+    of_trace << "{\"traceEvents\": [" << std::endl;
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> lck(get_buffers_mutex());
+        for(auto &ptr : get_buffers()) {
+            BUFFER &buffer = *ptr;
+            std::lock_guard<std::mutex> lck_buffer(buffer.mtx);
+            if(buffer.events.empty())
+                continue;
+            of_trace << (first? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer.tid
+                     << ", \"args\": {\"name\": \"thread " << buffer.tid << "\"}}";
+            first = false;
+            for(const auto &event : buffer.events) {
+                of_trace << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"vicon2gt\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer.tid
+                         << ", \"ts\": " << event.ts_us << ", \"dur\": " << event.dur_us
+                         << ", \"args\": {" << event.args << "}}";
+            }
+        }
+    }
+    of_trace << std::endl << "]," << std::endl;
+
+    // Finally our statistics of all threads
+    of_trace << "\"stats\": [" << std::endl;
+    std::vector<STAT> stats = get_stats();
+    for(size_t i=0; i<stats.size(); i++) {
+        of_trace << "{\"name\": \"" << stats.at(i).name << "\", \"count\": " << stats.at(i).count
+                 << ", \"total_ns\": " << stats.at(i).total_ns << ", \"max_ns\": " << stats.at(i).max_ns << "}"
+                 << ((i+1 < stats.size())? ",\n" : "\n");
+    }
+    of_trace << "]}" << std::endl;
+    of_trace.close();
+    printf("[PROFILE]: saved trace to %s\n", path.c_str());
+    return true;
+
+}
@@ -0,0 +1,207 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Lightweight process wide profiler with scoped timers and counters.
+ *
+ * Each thread records into its own buffer, so threads do not contend with each other.
+ * There are two kinds of records: stage level trace events (e.g. build, one iteration of the optimizer) which are saved into a timeline,
+ * and statistics (call count, total and max time) which are aggregated per name and are cheap enough for hot functions called millions of times.
+ * When disabled (the default) a statistics scope only costs a relaxed atomic load, and a trace scope a relaxed atomic load and one clock read,
+ * thus instrumentation can be left in release builds.
+ * The timeline can be saved as a Chrome trace (open with chrome://tracing or https://ui.perfetto.dev) along with the statistics.
+ *
+ * All names need to be string literals (or otherwise outlive the profiler) since we only store their pointers.
+ */
+class Profiler {
+
+public:
+
+    /// A single trace event in our timeline (microseconds since profiler start)
+    struct EVENT {
+        const char *name;
+        int64_t ts_us;
+        int64_t dur_us;
+        std::string args;
+    };
+
+    /// Aggregated statistics of a timer or counter
+    struct STAT {
+        const char *name;
+        uint64_t count;
+        int64_t total_ns;
+        int64_t max_ns;
+    };
+
+    /// Enable or disable recording (can be changed at any time)
+    static void set_enabled(bool enabled) {
+        get_origin();
+        enabled_flag().store(enabled, std::memory_order_relaxed);
+    }
+
+    /// If we are currently recording
+    static bool is_enabled() {
+        return enabled_flag().load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Record a trace event into this thread's timeline
+     * @param name Name of the event
+     * @param start When the event started
+     * @param end When the event finished
+     * @param args Optional json object members (e.g. "\"error\": 1.0") shown with this event
+     */
+    static void record_event(const char *name, std::chrono::steady_clock::time_point start,
+                             std::chrono::steady_clock::time_point end, const std::string &args = "");
+
+    /// Record a timed call into this thread's statistics
+    static void record_stat(const char *name, int64_t dur_ns);
+
+    /// Increments the counter of this name by the given amount (no timing)
+    static void count(const char *name, uint64_t amount = 1);
+
+    /// Clears all recorded events and statistics of all threads
+    static void reset();
+
+    /// Returns the statistics of all threads merged by name and sorted by total time
+    static std::vector<STAT> get_stats();
+
+    /// Prints the merged statistics to console
+    static void print_summary();
+
+    /**
+     * @brief Saves the timeline and the statistics as a Chrome trace json file
+     * This should be called once the threads which are being profiled have finished.
+     * @param path Json file we will save into (parent folders will be created)
+     * @return True if we were able to write the file
+     */
+    static bool write_trace(const std::string &path);
+
+private:
+
+    /// Recording of a single thread
+    struct BUFFER {
+        std::mutex mtx;
+        uint32_t tid = 0;
+        std::vector<EVENT> events;
+        std::vector<STAT> stats;
+        STAT &get_stat(const char *name);
+    };
+
+    /// Our global enabled flag
+    static std::atomic<bool> &enabled_flag() {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+
+    /// Buffer of the calling thread (created on first use)
+    static BUFFER &get_buffer();
+
+    /// All thread buffers ever created (kept alive after their threads exit so we can still save them)
+    static std::vector<std::shared_ptr<BUFFER>> &get_buffers() {
+        static std::vector<std::shared_ptr<BUFFER>> buffers;
+        return buffers;
+    }
+
+    /// Lock for adding to and reading our list of buffers
+    static std::mutex &get_buffers_mutex() {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    /// Time all our events are relative to
+    static std::chrono::steady_clock::time_point get_origin();
+
+};
+
+
+/**
+ * @brief Times the scope it lives in and records it to the @ref Profiler on destruction.
+ *
+ * A trace scope is saved into the timeline and statistics, and is meant for stages which happen a few times per solve.
+ * Its start time is always taken (one clock read even when profiling is disabled), thus elapsed() can be used for our own timing prints.
+ * A non-trace scope is only added to the statistics, and does nothing but the enabled check when profiling is disabled.
+ * Hot functions should thus always use non-trace scopes.
+ */
+class ProfileScope {
+
+public:
+
+    /**
+     * @brief Starts timing
+     * @param name_ Name of this scope (needs to be a string literal)
+     * @param trace_ If this scope should be added to the timeline
+     */
+    explicit ProfileScope(const char *name_, bool trace_ = true) : name(name_), trace(trace_) {
+        active = Profiler::is_enabled();
+        if(active || trace)
+            start = std::chrono::steady_clock::now();
+    }
+
+    /// Records our scope if we are profiling
+    ~ProfileScope() {
+        if(!active)
+            return;
+        auto end = std::chrono::steady_clock::now();
+        if(trace)
+            Profiler::record_event(name, start, end, args);
+        Profiler::record_stat(name, std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count());
+    }
+
+    /// Seconds since this scope started
+    double elapsed() const {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now()-start).count();
+    }
+
+    /// Append a number that will be shown with this trace event
+    void add_arg(const char *key, double value) {
+        if(!active || !trace)
+            return;
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "%s\"%s\": %.9g", args.empty()? "" : ", ", key, value);
+        args += buffer;
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope &operator=(const ProfileScope&) = delete;
+
+private:
+
+    const char *name;
+    bool trace;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    std::string args;
+
+};
+
+
+#endif //PROFILER_H
@@ -62,6 +62,9 @@
  */
 
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <Eigen/Eigen>
 
 
@@ -157,7 +160,7 @@ inline Eigen::Matrix<double, 3, 3> skew_x(const Eigen::Matrix<double, 3, 1> &w)
  */
 inline Eigen::Matrix<double, 3, 3> quat_2_Rot(const Eigen::Matrix<double, 4, 1> &q) {
     Eigen::Matrix<double, 3, 3> q_x = skew_x(q.block(0, 0, 3, 1));
-    Eigen::MatrixXd Rot = (2 * std::pow(q(3, 0), 2) - 1) * Eigen::MatrixXd::Identity(3, 3)
+    Eigen::Matrix<double, 3, 3> Rot = (2 * std::pow(q(3, 0), 2) - 1) * Eigen::Matrix<double, 3, 3>::Identity()
                           - 2 * q(3, 0) * q_x +
                           2 * q.block(0, 0, 3, 1) * (q.block(0, 0, 3, 1).transpose());
     return Rot;
@@ -189,7 +192,7 @@ inline Eigen::Matrix<double, 4, 1> quat_multiply(const Eigen::Matrix<double, 4,
     Eigen::Matrix<double, 4, 1> q_t;
     Eigen::Matrix<double, 4, 4> Qm;
     // create big L matrix
-    Qm.block(0, 0, 3, 3) = q(3, 0) * Eigen::MatrixXd::Identity(3, 3) - skew_x(q.block(0, 0, 3, 1));
+    Qm.block(0, 0, 3, 3) = q(3, 0) * Eigen::Matrix<double, 3, 3>::Identity() - skew_x(q.block(0, 0, 3, 1));
     Qm.block(0, 3, 3, 1) = q.block(0, 0, 3, 1);
     Qm.block(3, 0, 1, 3) = -q.block(0, 0, 3, 1).transpose();
     Qm(3, 3) = q(3, 0);
@@ -254,9 +257,9 @@ inline Eigen::Matrix<double, 3, 3> exp_so3(const Eigen::Matrix<double, 3, 1> &w)
     // compute so(3) rotation
     Eigen::Matrix<double, 3, 3> R;
     if (theta == 0) {
-        R = Eigen::MatrixXd::Identity(3, 3);
+        R = Eigen::Matrix<double, 3, 3>::Identity();
     } else {
-        R = Eigen::MatrixXd::Identity(3, 3) + A*w_x + B*w_x*w_x;
+        R = Eigen::Matrix<double, 3, 3>::Identity() + A*w_x + B*w_x*w_x;
     }
     return R;
 }
@@ -289,7 +292,7 @@ inline Eigen::Matrix<double, 3, 1> log_so3(const Eigen::Matrix<double, 3, 3> &R)
     // calculate the skew symetric matrix
     Eigen::Matrix<double, 3, 3> w_x = D*(R-R.transpose());
     // check if we are near the identity
-    if (R != Eigen::MatrixXd::Identity(3, 3)) {
+    if (R != Eigen::Matrix<double, 3, 3>::Identity()) {
         Eigen::Vector3d vec;
         vec << w_x(2, 1), w_x(0, 2), w_x(1, 0);
         return vec;
@@ -505,10 +508,10 @@ inline Eigen::Matrix<double, 4, 1> quatnorm(Eigen::Matrix<double, 4, 1> q_t) {
 inline Eigen::Matrix<double, 3, 3> Jl_so3(Eigen::Matrix<double, 3, 1> w) {
     double theta = w.norm();
     if (theta < 1e-12) {
-        return Eigen::MatrixXd::Identity(3, 3);
+        return Eigen::Matrix<double, 3, 3>::Identity();
     } else {
         Eigen::Matrix<double, 3, 1> a = w / theta;
-        Eigen::Matrix<double, 3, 3> J = sin(theta) / theta * Eigen::MatrixXd::Identity(3, 3) +
+        Eigen::Matrix<double, 3, 3> J = sin(theta) / theta * Eigen::Matrix<double, 3, 3>::Identity() +
                                         (1 - sin(theta) / theta) * a * a.transpose() +
                                         ((1 - cos(theta)) / theta) * skew_x(a);
         return J;
@@ -531,5 +534,211 @@ inline Eigen::Matrix<double, 3, 3> Jr_so3(Eigen::Matrix<double, 3, 1> w) {
 }
 
 
+//==========================================================================
+// BATCHED VERSIONS
+//==========================================================================
+//
+// These operate on contiguous arrays of n elements, with the same memory layout as a std::vector of the Eigen type.
+// For example a std::vector<Eigen::Vector4d> of quaternions can be passed as vec.data()->data() (Eigen matrices are column-major).
+// Each element is computed with plain branch-free arithmetic, so the compiler is able to vectorize over elements.
+// They give the same result as their scalar version to within floating point round off.
+
+
+/**
+ * @brief Batched version of quat_multiply() for n pairs of JPL quaternions
+ * @param[in] q First JPL quaternions (4*n)
+ * @param[in] p Second JPL quaternions (4*n)
+ * @param[out] q_t Resulting q*p quaternions (4*n), can be the same array as q or p
+ * @param[in] n Number of quaternions
+ */
+inline void quat_multiply_batch(const double *q, const double *p, double *q_t, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        const double *q_k = q + 4 * k;
+        const double *p_k = p + 4 * k;
+        double x = q_k[3] * p_k[0] + q_k[2] * p_k[1] - q_k[1] * p_k[2] + q_k[0] * p_k[3];
+        double y = -q_k[2] * p_k[0] + q_k[3] * p_k[1] + q_k[0] * p_k[2] + q_k[1] * p_k[3];
+        double z = q_k[1] * p_k[0] - q_k[0] * p_k[1] + q_k[3] * p_k[2] + q_k[2] * p_k[3];
+        double w = -q_k[0] * p_k[0] - q_k[1] * p_k[1] - q_k[2] * p_k[2] + q_k[3] * p_k[3];
+        // ensure unique by forcing q_4 to be >0, and normalize
+        double scale = ((w < 0) ? -1.0 : 1.0) / std::sqrt(x * x + y * y + z * z + w * w);
+        q_t[4 * k + 0] = scale * x;
+        q_t[4 * k + 1] = scale * y;
+        q_t[4 * k + 2] = scale * z;
+        q_t[4 * k + 3] = scale * w;
+    }
+}
+
+
+/**
+ * @brief Batched version of quat_multiply() where every quaternion is multiplied by the same second quaternion
+ * @param[in] q First JPL quaternions (4*n)
+ * @param[in] p Second JPL quaternion
+ * @param[out] q_t Resulting q*p quaternions (4*n), can be the same array as q
+ * @param[in] n Number of quaternions
+ */
+inline void quat_multiply_batch(const double *q, const Eigen::Matrix<double, 4, 1> &p, double *q_t, size_t n) {
+    const double p0 = p(0), p1 = p(1), p2 = p(2), p3 = p(3);
+    for (size_t k = 0; k < n; k++) {
+        const double *q_k = q + 4 * k;
+        double x = q_k[3] * p0 + q_k[2] * p1 - q_k[1] * p2 + q_k[0] * p3;
+        double y = -q_k[2] * p0 + q_k[3] * p1 + q_k[0] * p2 + q_k[1] * p3;
+        double z = q_k[1] * p0 - q_k[0] * p1 + q_k[3] * p2 + q_k[2] * p3;
+        double w = -q_k[0] * p0 - q_k[1] * p1 - q_k[2] * p2 + q_k[3] * p3;
+        double scale = ((w < 0) ? -1.0 : 1.0) / std::sqrt(x * x + y * y + z * z + w * w);
+        q_t[4 * k + 0] = scale * x;
+        q_t[4 * k + 1] = scale * y;
+        q_t[4 * k + 2] = scale * z;
+        q_t[4 * k + 3] = scale * w;
+    }
+}
+
+
+/**
+ * @brief Batched version of quat_2_Rot() for n JPL quaternions
+ * @param[in] q JPL quaternions (4*n)
+ * @param[out] R SO(3) rotation matrices (9*n, each column-major)
+ * @param[in] n Number of quaternions
+ */
+inline void quat_2_Rot_batch(const double *q, double *R, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        const double x = q[4 * k + 0], y = q[4 * k + 1], z = q[4 * k + 2], w = q[4 * k + 3];
+        const double c = 2 * w * w - 1;
+        double *R_k = R + 9 * k;
+        R_k[0] = c + 2 * x * x;
+        R_k[1] = -2 * w * z + 2 * y * x;
+        R_k[2] = 2 * w * y + 2 * z * x;
+        R_k[3] = 2 * w * z + 2 * x * y;
+        R_k[4] = c + 2 * y * y;
+        R_k[5] = -2 * w * x + 2 * z * y;
+        R_k[6] = -2 * w * y + 2 * x * z;
+        R_k[7] = 2 * w * x + 2 * y * z;
+        R_k[8] = c + 2 * z * z;
+    }
+}
+
+
+/**
+ * @brief Batched version of rot_2_quat() for n rotation matrices
+ *
+ * Each conversion needs to pick its largest diagonal element to divide by, thus this is the only batched version that branches.
+ *
+ * @param[in] R SO(3) rotation matrices (9*n, each column-major)
+ * @param[out] q JPL quaternions (4*n)
+ * @param[in] n Number of rotations
+ */
+inline void rot_2_quat_batch(const double *R, double *q, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        Eigen::Map<const Eigen::Matrix<double, 3, 3>> rot(R + 9 * k);
+        Eigen::Map<Eigen::Matrix<double, 4, 1>>(q + 4 * k) = rot_2_quat(rot);
+    }
+}
+
+
+/**
+ * @brief Batched version of exp_so3() for n rotation vectors
+ *
+ * This expands the square of the skew, using that \f$\lfloor\mathbf{v}\times\rfloor^2 = \mathbf{v}\mathbf{v}^\top-\theta^2\mathbf{I}\f$.
+ *
+ * @param[in] w Rotation vectors we will take the exponential of (3*n)
+ * @param[out] R SO(3) rotation matrices (9*n, each column-major)
+ * @param[in] n Number of rotation vectors
+ */
+inline void exp_so3_batch(const double *w, double *R, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        const double x = w[3 * k + 0], y = w[3 * k + 1], z = w[3 * k + 2];
+        const double theta2 = x * x + y * y + z * z;
+        const double theta = std::sqrt(theta2);
+        // Handle small angle values
+        const bool small = (theta < 1e-12);
+        const double A = small ? 1.0 : std::sin(theta) / theta;
+        const double B = small ? 0.5 : (1 - std::cos(theta)) / theta2;
+        const double d = 1 - B * theta2;
+        double *R_k = R + 9 * k;
+        R_k[0] = d + B * x * x;
+        R_k[1] = A * z + B * y * x;
+        R_k[2] = -A * y + B * z * x;
+        R_k[3] = -A * z + B * x * y;
+        R_k[4] = d + B * y * y;
+        R_k[5] = A * x + B * z * y;
+        R_k[6] = A * y + B * x * z;
+        R_k[7] = -A * x + B * y * z;
+        R_k[8] = d + B * z * z;
+    }
+}
+
+
+/**
+ * @brief Batched version of log_so3() for n rotation matrices
+ * @param[in] R SO(3) rotation matrices (9*n, each column-major)
+ * @param[out] w Rotation vectors [omegax, omegay, omegaz] (3*n)
+ * @param[in] n Number of rotations
+ */
+inline void log_so3_batch(const double *R, double *w, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        const double *R_k = R + 9 * k;
+        // magnitude of the skew elements (handle edge case where we sometimes have a>1...)
+        const double a = 0.5 * (R_k[0] + R_k[4] + R_k[8] - 1);
+        const double theta = std::acos(std::min(1.0, std::max(-1.0, a)));
+        // Handle small angle values
+        const double D = (theta < 1e-12) ? 0.5 : theta / (2 * std::sin(theta));
+        w[3 * k + 0] = D * (R_k[5] - R_k[7]);
+        w[3 * k + 1] = D * (R_k[6] - R_k[2]);
+        w[3 * k + 2] = D * (R_k[1] - R_k[3]);
+    }
+}
+
+
+/**
+ * @brief Batched version of Jr_so3() for n rotation vectors
+ * @param[in] w Axis-angles (3*n)
+ * @param[out] J Right Jacobians of SO(3) (9*n, each column-major)
+ * @param[in] n Number of axis-angles
+ */
+inline void Jr_so3_batch(const double *w, double *J, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        // The right Jacobian is the left Jacobian of the negative axis-angle
+        const double wx = -w[3 * k + 0], wy = -w[3 * k + 1], wz = -w[3 * k + 2];
+        const double theta = std::sqrt(wx * wx + wy * wy + wz * wz);
+        // Handle small angle values, which is just the identity
+        const bool small = (theta < 1e-12);
+        const double inv = small ? 0.0 : 1.0 / theta;
+        const double ax = wx * inv, ay = wy * inv, az = wz * inv;
+        const double s = small ? 1.0 : std::sin(theta) * inv;
+        const double c = small ? 0.0 : (1 - std::cos(theta)) * inv;
+        const double t = 1 - s;
+        double *J_k = J + 9 * k;
+        J_k[0] = s + t * ax * ax;
+        J_k[1] = t * ay * ax + c * az;
+        J_k[2] = t * az * ax - c * ay;
+        J_k[3] = t * ax * ay - c * az;
+        J_k[4] = s + t * ay * ay;
+        J_k[5] = t * az * ay + c * ax;
+        J_k[6] = t * ax * az + c * ay;
+        J_k[7] = t * ay * az - c * ax;
+        J_k[8] = s + t * az * az;
+    }
+}
+
+
+/**
+ * @brief Rotates n vectors by the same rotation (e.g. all exported states into the gravity frame)
+ * @param[in] R Rotation we will apply
+ * @param[in] v Vectors we will rotate (3*n)
+ * @param[out] Rv Rotated vectors (3*n), can be the same array as v
+ * @param[in] n Number of vectors
+ */
+inline void rotate_batch(const Eigen::Matrix<double, 3, 3> &R, const double *v, double *Rv, size_t n) {
+    const double r00 = R(0, 0), r01 = R(0, 1), r02 = R(0, 2);
+    const double r10 = R(1, 0), r11 = R(1, 1), r12 = R(1, 2);
+    const double r20 = R(2, 0), r21 = R(2, 1), r22 = R(2, 2);
+    for (size_t k = 0; k < n; k++) {
+        const double x = v[3 * k + 0], y = v[3 * k + 1], z = v[3 * k + 2];
+        Rv[3 * k + 0] = r00 * x + r01 * y + r02 * z;
+        Rv[3 * k + 1] = r10 * x + r11 * y + r12 * z;
+        Rv[3 * k + 2] = r20 * x + r21 * y + r22 * z;
+    }
+}
+
+
 
 #endif /* QUAT_OPS_H */
@@ -0,0 +1,397 @@
+/*
+ * The vicon2gt project
+ * Copyright (C) 2020 Patrick Geneva
+ * Copyright (C) 2020 Guoquan Huang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <Eigen/Eigen>
+#include <boost/filesystem.hpp>
+
+
+#include "meas/Propagator.h"
+#include "meas/Interpolator.h"
+#include "solver/ViconGraphSolver.h"
+#include "sim/Simulator.h"
+#include "utils/profiler.h"
+#include "utils/stats.h"
+
+
+/**
+ * @brief Benchmark results of a single trajectory
+ */
+struct BENCHRUN {
+
+    /// Name of the trajectory file (e.g. udel_gore.txt)
+    std::string name;
+
+    /// Number of simulated measurements
+    int num_imu = 0;
+    int num_cam = 0;
+    int num_vicon = 0;
+
+    /// Wall time of each stage (sec)
+    double time_spline = 0.0;
+    double time_simulate = 0.0;
+    double time_build = 0.0;
+    double time_optimize = 0.0;
+    double time_write = 0.0;
+    double time_total = 0.0;
+
+    /// Peak resident memory during this trajectory (MB)
+    double peak_rss_mb = 0.0;
+
+    /// Total number of non-linear optimizer iterations
+    int num_iterations = 0;
+
+    /// Build and optimize wall time when solved with our baseline number of threads (sec, zero if not run)
+    double time_build_baseline = 0.0;
+    double time_optimize_baseline = 0.0;
+
+    /// Final orientation (deg) and position (m) trajectory error
+    double rmse_ori = 0.0;
+    double rmse_pos = 0.0;
+
+};
+
+
+/// Seconds since the given time point
+static double seconds_since(const std::chrono::steady_clock::time_point &rT) {
+    return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now()-rT).count();
+}
+
+
+/**
+ * @brief Resets the peak resident memory of this process so each trajectory gets its own peak.
+ * This is only supported on linux (writing 5 to clear_refs resets VmHWM), else the peak is since process start.
+ */
+static void reset_peak_rss() {
+    std::ofstream file("/proc/self/clear_refs");
+    if(file.is_open())
+        file << "5";
+}
+
+
+/// Peak resident memory of this process (MB)
+static double get_peak_rss_mb() {
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while(std::getline(file, line)) {
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            return std::stod(line.substr(6))/1024.0;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0;
+}
+
+
+/// Prints the usage of this program
+static void print_usage(const char *name) {
+    printf("usage: %s [options]\n", name);
+    printf("    --data_dir <path>     folder with the trajectories to simulate (default: data)\n");
+    printf("    --datasets <a,b,...>  comma separated trajectory files in the folder (default: all *.txt)\n");
+    printf("    --output <path>       json file to write the results to (default: bench.json)\n");
+    printf("    --path_save <path>    folder that write_to_file will save into (default: temp folder)\n");
+    printf("    --freq_imu <hz>       simulated imu rate (default: 400)\n");
+    printf("    --freq_cam <hz>       simulated camera rate (default: 10)\n");
+    printf("    --freq_vicon <hz>     simulated vicon rate (default: 100)\n");
+    printf("    --seed <int>          simulation seed (default: 0)\n");
+    printf("    --num_threads <int>   solver threads, zero uses all cores (default: 0)\n");
+    printf("    --baseline_threads <int> also solve with this many threads and report the speedup, zero will not (default: 0)\n");
+    printf("    --optimizer <name>    levenberg, dogleg, or schur (default: levenberg)\n");
+    printf("    --linear_solver <name> multifrontal_cholesky, multifrontal_qr, sequential_cholesky, sequential_qr (default: multifrontal_cholesky)\n");
+    printf("    --ordering <name>     colamd, chain, or metis (default: colamd)\n");
+    printf("    --path_profile <path> chrome trace json of all stages, will not profile if empty (default: empty)\n");
+}
+
+
+int main(int argc, char** argv)
+{
+
+    // Our benchmark settings
+    std::string data_dir = "data";
+    std::string datasets_csv;
+    std::string path_output = "bench.json";
+    std::string path_save = (boost::filesystem::temp_directory_path()/"vicon2gt_bench").string();
+    std::string path_profile;
+    int baseline_threads = 0;
+    SimulatorParams params;
+    SolverOptions options;
+
+    // Parse our command line options
+    for(int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if(i+1 >= argc) {
+            printf(RED "missing value for %s\n" RESET, arg.c_str());
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+        std::string value = argv[++i];
+        if(arg == "--data_dir") data_dir = value;
+        else if(arg == "--datasets") datasets_csv = value;
+        else if(arg == "--output") path_output = value;
+        else if(arg == "--path_save") path_save = value;
+        else if(arg == "--freq_imu") params.sim_freq_imu = std::stod(value);
+        else if(arg == "--freq_cam") params.sim_freq_cam = std::stod(value);
+        else if(arg == "--freq_vicon") params.sim_freq_vicon = std::stod(value);
+        else if(arg == "--seed") params.seed = std::stoi(value);
+        else if(arg == "--num_threads") options.num_threads = std::stoi(value);
+        else if(arg == "--baseline_threads") baseline_threads = std::stoi(value);
+        else if(arg == "--optimizer") options.optimizer = value;
+        else if(arg == "--linear_solver") options.linear_solver = value;
+        else if(arg == "--ordering") options.ordering = value;
+        else if(arg == "--path_profile") path_profile = value;
+        else {
+            printf(RED "unknown option %s\n" RESET, arg.c_str());
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    options.gravity_magnitude = params.gravity_magnitude;
+    Profiler::set_enabled(!path_profile.empty());
+
+    // Get the trajectories we will benchmark (sorted so the output order is stable across runs)
+    std::vector<std::string> datasets;
+    if(!datasets_csv.empty()) {
+        std::stringstream ss(datasets_csv);
+        std::string name;
+        while(std::getline(ss, name, ','))
+            datasets.push_back(name);
+    } else if(boost::filesystem::is_directory(data_dir)) {
+        for(const auto &entry : boost::filesystem::directory_iterator(data_dir)) {
+            if(boost::filesystem::is_regular_file(entry.path()) && entry.path().extension() == ".txt")
+                datasets.push_back(entry.path().filename().string());
+        }
+        std::sort(datasets.begin(), datasets.end());
+    }
+    if(datasets.empty()) {
+        printf(RED "no trajectories found in %s\n" RESET, data_dir.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The vicon noise we will simulate and tell the solver about
+    Eigen::Matrix<double,3,3> R_q = Eigen::Matrix<double,3,3>::Zero();
+    Eigen::Matrix<double,3,3> R_p = Eigen::Matrix<double,3,3>::Zero();
+    R_q.diagonal() = params.sigma_vicon_pose.block(0,0,3,1).array().square();
+    R_p.diagonal() = params.sigma_vicon_pose.block(3,0,3,1).array().square();
+
+    // Benchmark each trajectory
+    std::vector<BENCHRUN> runs;
+    for(const auto &name : datasets) {
+
+        // Reset our peak memory so we only see this trajectory
+        printf(YELLOW "[BENCH]: %s\n" RESET, name.c_str());
+        reset_peak_rss();
+        BENCHRUN run;
+        run.name = name;
+        auto rT0 = std::chrono::steady_clock::now();
+
+        // Fit our trajectory spline
+        auto rT1 = std::chrono::steady_clock::now();
+        params.sim_traj_path = (boost::filesystem::path(data_dir)/name).string();
+        std::shared_ptr<BsplineSE3> spline = Simulator::load_spline(params.sim_traj_path);
+        run.time_spline = seconds_since(rT1);
+
+        // Simulate all our measurements
+        rT1 = std::chrono::steady_clock::now();
+        std::shared_ptr<Simulator> sim = std::make_shared<Simulator>(params, spline);
+        std::shared_ptr<Propagator> propagator = std::make_shared<Propagator>(params.sigma_w,params.sigma_wb,params.sigma_a,params.sigma_ab);
+        std::shared_ptr<Interpolator> interpolator = std::make_shared<Interpolator>();
+        std::vector<double> timestamp_cameras;
+        while(sim->ok()) {
+            double time_imu;
+            Eigen::Vector3d wm, am;
+            if (sim->get_next_imu(time_imu, wm, am)) {
+                propagator->feed_imu(time_imu,wm,am);
+                run.num_imu++;
+            }
+            double time_cam;
+            if (sim->get_next_cam(time_cam)) {
+                timestamp_cameras.push_back(time_cam);
+                run.num_cam++;
+            }
+            double time_vicon;
+            Eigen::Vector4d q_VtoB;
+            Eigen::Vector3d p_BinV;
+            if (sim->get_next_vicon(time_vicon, q_VtoB, p_BinV)) {
+                interpolator->feed_pose(time_vicon,q_VtoB,p_BinV,R_q,R_p);
+                run.num_vicon++;
+            }
+        }
+        run.time_simulate = seconds_since(rT1);
+
+        // Create the graph problem, and solve it (if we can not, the solver has already said why)
+        std::unique_ptr<ViconGraphSolver> solver;
+        try {
+            solver.reset(new ViconGraphSolver(options,propagator,interpolator,timestamp_cameras));
+            solver->build_and_solve();
+            ViconGraphSolver::SOLVESTATS stats = solver->get_solve_stats();
+            run.time_build = stats.time_build;
+            run.time_optimize = stats.time_optimize;
+            run.num_iterations = stats.num_iterations;
+
+            // Solve again with our baseline number of threads so we can see how much faster we are
+            if(baseline_threads > 0) {
+                SolverOptions options_baseline = options;
+                options_baseline.num_threads = baseline_threads;
+                ViconGraphSolver solver_baseline(options_baseline,propagator,interpolator,timestamp_cameras);
+                solver_baseline.build_and_solve();
+                ViconGraphSolver::SOLVESTATS stats_baseline = solver_baseline.get_solve_stats();
+                run.time_build_baseline = stats_baseline.time_build;
+                run.time_optimize_baseline = stats_baseline.time_optimize;
+            }
+        } catch (const std::exception &) {
+            printf(RED "[BENCH]: unable to solve %s\n" RESET, name.c_str());
+            std::exit(EXIT_FAILURE);
+        }
+
+        // Save the result to file
+        rT1 = std::chrono::steady_clock::now();
+        std::string path_run = (boost::filesystem::path(path_save)/boost::filesystem::path(name).stem()).string();
+        solver->write_to_file(path_run+"_states.csv", path_run+"_info.txt");
+        run.time_write = seconds_since(rT1);
+
+        // Finally compute the error compared to our true states
+        std::vector<double> times;
+        std::vector<Eigen::Matrix<double,7,1>> poses;
+        solver->get_imu_poses(times, poses);
+        Stats err_ori, err_pos;
+        std::vector<Eigen::Matrix<double,17,1>> gt_states;
+        sim->get_states_in_vicon(times, gt_states);
+        for(size_t i=0; i<times.size(); i++) {
+            const Eigen::Matrix<double,17,1> &gt_state = gt_states.at(i);
+            Eigen::Matrix<double,7,1> est_state = poses.at(i);
+            double ori = 2.0*(quat_multiply(
+                    gt_state.block(1,0,4,1),
+                    Inv(est_state.block(0,0,4,1))
+            )).block(0,0,3,1).norm();
+            double pose = (est_state.block(4,0,3,1)-gt_state.block(5,0,3,1)).norm();
+            err_ori.timestamps.push_back(times.at(i));
+            err_ori.values.push_back(180.0/M_PI*ori);
+            err_pos.timestamps.push_back(times.at(i));
+            err_pos.values.push_back(pose);
+        }
+        err_ori.calculate();
+        err_pos.calculate();
+        run.rmse_ori = err_ori.rmse;
+        run.rmse_pos = err_pos.rmse;
+        run.time_total = seconds_since(rT0);
+        run.peak_rss_mb = get_peak_rss_mb();
+        runs.push_back(run);
+
+    }
+
+    // Print a summary table
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "Benchmark (sec, MB, deg, m)\n");
+    printf(REDPURPLE "======================================\n");
+    printf(REDPURPLE "%-40s %8s %8s %8s %8s %8s %8s %5s %8s %8s\n" RESET,
+           "trajectory", "spline", "sim", "build", "optimize", "write", "rss", "iter", "rmse_ori", "rmse_pos");
+    for(const auto &run : runs) {
+        printf(REDPURPLE "%-40s %8.3f %8.3f %8.3f %8.3f %8.3f %8.1f %5d %8.5f %8.5f\n" RESET,
+               run.name.c_str(), run.time_spline, run.time_simulate, run.time_build, run.time_optimize,
+               run.time_write, run.peak_rss_mb, run.num_iterations, run.rmse_ori, run.rmse_pos);
+    }
+
+    // Print how much faster we are than our baseline
+    if(baseline_threads > 0) {
+        printf(REDPURPLE "======================================\n");
+        printf(REDPURPLE "Speedup over %d threads\n", baseline_threads);
+        printf(REDPURPLE "======================================\n");
+        printf(REDPURPLE "%-40s %8s %8s\n" RESET, "trajectory", "build", "optimize");
+        for(const auto &run : runs) {
+            printf(REDPURPLE "%-40s %7.2fx %7.2fx\n" RESET, run.name.c_str(),
+                   run.time_build_baseline/std::max(run.time_build,1e-9), run.time_optimize_baseline/std::max(run.time_optimize,1e-9));
+        }
+    }
+
+    // Write our results as json so they can be tracked across commits
+    boost::filesystem::path p1(path_output);
+    if(!p1.parent_path().empty())
+        boost::filesystem::create_directories(p1.parent_path());
+    std::ofstream of_json(path_output, std::ofstream::out | std::ofstream::trunc);
+    if(!of_json.is_open()) {
+        printf(RED "unable to open %s\n" RESET, path_output.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    of_json << std::setprecision(6) << std::fixed;
+    of_json << "{" << std::endl;
+    of_json << "  \"config\": {" << std::endl;
+    of_json << "    \"freq_imu\": " << params.sim_freq_imu << "," << std::endl;
+    of_json << "    \"freq_cam\": " << params.sim_freq_cam << "," << std::endl;
+    of_json << "    \"freq_vicon\": " << params.sim_freq_vicon << "," << std::endl;
+    of_json << "    \"seed\": " << params.seed << "," << std::endl;
+    of_json << "    \"num_threads\": " << options.num_threads << "," << std::endl;
+    of_json << "    \"baseline_threads\": " << baseline_threads << "," << std::endl;
+    of_json << "    \"optimizer\": \"" << options.optimizer << "\"," << std::endl;
+    of_json << "    \"linear_solver\": \"" << options.linear_solver << "\"," << std::endl;
+    of_json << "    \"ordering\": \"" << options.ordering << "\"" << std::endl;
+    of_json << "  }," << std::endl;
+    of_json << "  \"runs\": [" << std::endl;
+    for(size_t i=0; i<runs.size(); i++) {
+        const BENCHRUN &run = runs.at(i);
+        of_json << "    {" << std::endl;
+        of_json << "      \"name\": \"" << run.name << "\"," << std::endl;
+        of_json << "      \"num_imu\": " << run.num_imu << "," << std::endl;
+        of_json << "      \"num_cam\": " << run.num_cam << "," << std::endl;
+        of_json << "      \"num_vicon\": " << run.num_vicon << "," << std::endl;
+        of_json << "      \"time_spline\": " << run.time_spline << "," << std::endl;
+        of_json << "      \"time_simulate\": " << run.time_simulate << "," << std::endl;
+        of_json << "      \"time_build_problem\": " << run.time_build << "," << std::endl;
+        of_json << "      \"time_optimize_problem\": " << run.time_optimize << "," << std::endl;
+        of_json << "      \"time_write_to_file\": " << run.time_write << "," << std::endl;
+        of_json << "      \"time_total\": " << run.time_total << "," << std::endl;
+        of_json << "      \"peak_rss_mb\": " << run.peak_rss_mb << "," << std::endl;
+        of_json << "      \"num_iterations\": " << run.num_iterations << "," << std::endl;
+        if(baseline_threads > 0) {
+            of_json << "      \"time_build_baseline\": " << run.time_build_baseline << "," << std::endl;
+            of_json << "      \"time_optimize_baseline\": " << run.time_optimize_baseline << "," << std::endl;
+            of_json << "      \"speedup_build\": " << run.time_build_baseline/std::max(run.time_build,1e-9) << "," << std::endl;
+            of_json << "      \"speedup_optimize\": " << run.time_optimize_baseline/std::max(run.time_optimize,1e-9) << "," << std::endl;
+        }
+        of_json << "      \"rmse_ori\": " << run.rmse_ori << "," << std::endl;
+        of_json << "      \"rmse_pos\": " << run.rmse_pos << std::endl;
+        of_json << "    }" << ((i+1 < runs.size())? "," : "") << std::endl;
+    }
+    of_json << "  ]" << std::endl;
+    of_json << "}" << std::endl;
+    of_json.close();
+    printf("[BENCH]: results saved to %s\n", path_output.c_str());
+
+    // Save where our time went if profiling
+    if(!path_profile.empty()) {
+        Profiler::print_summary();
+        Profiler::write_trace(path_profile);
+    }
+
+    // Done!
+    return EXIT_SUCCESS;
+
+}